@@ -0,0 +1,269 @@
+/** The header file for the in driver alarm engine.
+ \file      alarm_engine.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef ALARM_ENGINE_H_
+#define ALARM_ENGINE_H_
+
+#include <boost/array.hpp>
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+namespace ursa
+{
+  const size_t max_alarm_rois = 8; //!< The most regions of interest the AlarmEngine will test.
+  const size_t alarm_window_slots = 8; //!< The number of slots an ROI window slides by.
+  const size_t alarm_event_capacity = 64; //!< The number of undelivered AlarmEvents kept. The oldest are dropped.
+
+  //! \brief The test that raised or cleared an alarm.
+  enum alarm_source
+  {
+    ALARM_GROSS = 0, //!< The gross count rate SPRT. Drives alarm output 0.
+    ALARM_ROI //!< A windowed region of interest test. Any active ROI drives alarm output 1.
+  };
+
+  //! \brief An inclusive range of channels tested by the AlarmEngine.
+  struct AlarmRoi
+  {
+    uint16_t low; //!< The first channel.
+    uint16_t high; //!< The last channel.
+  };
+
+  //! \brief The settings of an AlarmEngine. The defaults leave the engine disabled.
+  struct AlarmConfig
+  {
+    AlarmConfig();
+
+    bool enable; //!< Run the alarm tests on decoded events.
+    bool drive_outputs; //!< Switch the Ursa's alarm outputs as alarms are raised and cleared.
+    double learn_seconds; //!< The time used to learn the initial background. No alarms are raised while learning.
+    double background_seconds; //!< The time constant of the background average once learned.
+    double min_background; //!< The lowest gross background rate in counts per second.
+    double roi_min_background; //!< The lowest background rate of each ROI in counts per second, so a quiet ROI does not alarm on a count or two.
+    double rate_ratio; //!< The gross SPRT tests the background rate against this multiple of it.
+    double false_alarm; //!< The probability of a false alarm per SPRT decision.
+    double missed_alarm; //!< The probability of missing a source per SPRT decision.
+    std::vector<AlarmRoi> rois; //!< The regions of interest. Only the first max_alarm_rois are used.
+    double roi_window; //!< The length of the sliding ROI window in seconds.
+    double roi_sigma; //!< The number of standard deviations above background that raises an ROI alarm.
+  };
+
+  //! \brief A change of alarm state.
+  struct AlarmEvent
+  {
+    uint64_t time_ns; //!< The wall clock time of the decision in nanoseconds since the unix epoch.
+    uint8_t source; //!< An alarm_source.
+    int32_t roi; //!< The index of the ROI, or -1 for the gross test.
+    bool active; //!< True when the alarm was raised, false when it was cleared.
+    double rate; //!< The measured rate behind the decision in counts per second.
+    double background; //!< The background rate it was tested against in counts per second.
+    double statistic; //!< The SPRT log likelihood ratio, or the ROI excess in standard deviations.
+    uint64_t evidence_ns; //!< The span of data the decision was based on.
+    uint64_t read_ns; //!< The monotonic time the deciding bytes were read.
+    uint64_t arrival_ns; //!< The monotonic time the first byte of the deciding read had arrived by, as near as it is known.
+    uint64_t decision_ns; //!< The monotonic time of the decision.
+    uint64_t output_ns; //!< The monotonic time the alarm output was written, or 0 if the output did not change.
+  };
+
+  /** \brief Count rate and ROI alarm tests evaluated on the event stream.
+   *
+   * The Interface calls beginBatch() before decoding each read, addEvent() for each decoded event and
+   * endBatch() after.  A decision is made on the event that crosses a threshold, so the delay from the
+   * bytes arriving to the decision is one decode pass rather than a spectrum interval.
+   *
+   * The gross test is a Wald sequential probability ratio test of a Poisson rate, background against
+   * rate_ratio times background.  Each count adds ln(rate_ratio) and elapsed time subtracts
+   * (rate_ratio - 1) * background.  The test restarts after every decision.
+   *
+   * Each ROI keeps its counts over a sliding window and alarms when they are as unlikely under the
+   * expected background as a roi_sigma excess of a normal distribution.  It clears when they fall below
+   * half of that excess.
+   *
+   * Backgrounds are learned over learn_seconds then followed with an exponential average which is frozen
+   * while an alarm is active.
+   */
+  class AlarmEngine
+  {
+  private:
+    //! The state of one region of interest.
+    struct Roi
+    {
+      uint16_t low; //!< The first channel.
+      uint16_t high; //!< The last channel.
+      bool active; //!< True while the ROI is alarming.
+      uint32_t window; //!< The counts in the window.
+      boost::array<uint32_t, alarm_window_slots> slots; //!< The counts in each slot of the window.
+      uint32_t batch; //!< The counts in this batch.
+      uint64_t learn_counts; //!< The counts seen while learning.
+      double background; //!< The background rate in counts per second.
+      double expected; //!< The expected window counts for this batch.
+      double sigma; //!< The standard deviation of the expected window counts.
+      double trigger; //!< Window counts above this raise an alarm during this batch.
+      double release; //!< Window counts below this clear an alarm at the end of this batch.
+    };
+
+    AlarmConfig config_; //!< The current settings.
+    bool enabled_; //!< A copy of config_.enable checked on every event.
+    bool learning_; //!< True until the background is learned.
+    bool started_; //!< True once the first batch has set the clock.
+
+    double log_ratio_; //!< ln(rate_ratio), added per count.
+    double upper_; //!< The SPRT threshold to raise an alarm.
+    double lower_; //!< The SPRT threshold to accept background.
+    uint64_t slot_ns_; //!< The length of one window slot.
+    double roi_tail_; //!< The one sided normal tail probability of roi_sigma.
+
+    uint64_t batch_ns_; //!< The monotonic time of the current batch.
+    uint64_t arrival_ns_; //!< The monotonic time the first byte of the current batch had arrived by.
+    uint64_t batch_dt_; //!< The time since the previous batch.
+    uint64_t slot_start_ns_; //!< The start of the current window slot.
+    uint64_t window_start_ns_; //!< The time the ROI windows started filling.
+    uint64_t window_ns_; //!< The span of data in the ROI windows during this batch.
+    size_t slot_; //!< The current window slot.
+    uint32_t batch_counts_; //!< The gross counts in this batch.
+    uint64_t learn_counts_; //!< The gross counts seen while learning.
+    uint64_t learn_ns_; //!< The time spent learning.
+    double background_; //!< The gross background rate in counts per second.
+
+    bool gross_active_; //!< True while the gross test is alarming.
+    double llr_; //!< The gross SPRT log likelihood ratio.
+    uint64_t llr_start_ns_; //!< The time the gross SPRT last restarted.
+    uint64_t llr_counts_; //!< The counts since the gross SPRT last restarted.
+
+    size_t roi_count_; //!< The number of ROIs in use.
+    boost::array<Roi, max_alarm_rois> rois_; //!< The ROIs in use.
+    size_t rois_active_; //!< The number of ROIs alarming.
+
+    boost::array<AlarmEvent, alarm_event_capacity> events_; //!< A ring of undelivered events.
+    size_t event_head_; //!< The oldest undelivered event.
+    size_t event_count_; //!< The number of undelivered events.
+    boost::array<bool, alarm_event_capacity> output_pending_; //!< Events whose alarm output has not been written yet.
+    uint64_t events_dropped_; //!< Events overwritten before they were delivered.
+
+    void grossDecision(bool active); //!< \brief Raises or clears the gross alarm and restarts the SPRT.
+    void roiDecision(size_t index, bool active); //!< \brief Raises or clears an ROI alarm.
+    void clearAlarms(); //!< \brief Clears every active alarm with an event, so consumers and outputs see it end.
+    //! \brief Adds an event to the ring, dropping the oldest if full.
+    AlarmEvent &pushEvent(alarm_source source, int32_t roi, bool active);
+    void advanceWindow(); //!< \brief Slides the ROI windows to batch_ns_ and updates their thresholds.
+    void updateBackground(); //!< \brief Learns or follows the background from the batch just decoded.
+
+  public:
+    AlarmEngine(); //!< \brief AlarmEngine constructor. The engine starts disabled.
+
+    /** \brief Replaces the settings and starts learning the background again.
+     *
+     * Also used with the current settings when the detector settings change, since a background learned
+     * under the old gain, threshold or resolution no longer applies.
+     * @param config The new settings.
+     */
+    void configure(const AlarmConfig &config);
+    //! \brief Returns the current settings.
+    const AlarmConfig &config() const {
+      return (config_);
+    }
+    //! \brief Returns true when the tests are running.
+    bool enabled() const {
+      return (enabled_);
+    }
+    //! \brief Returns true while the background is being learned.
+    bool learning() const {
+      return (learning_);
+    }
+    //! \brief Returns the learned gross background in counts per second.
+    double background() const {
+      return (background_);
+    }
+    /** \brief Restarts the tests and clears any alarm while keeping the learned background.
+     *
+     * Called when acquisition starts so the time spent stopped is not counted.
+     */
+    void restart();
+
+    /** \brief Starts a decode pass.
+     * @param now_ns The monotonic time the data was read.
+     * @param arrival_ns The monotonic time the first byte of the data had arrived by, or 0 for now_ns.
+     */
+    void beginBatch(uint64_t now_ns, uint64_t arrival_ns = 0);
+    /** \brief Tests one decoded event.
+     * @param channel The event's channel.
+     * @param counts The number of counts the event adds to the channel.
+     */
+    void addEvent(uint16_t channel, uint32_t counts);
+    void endBatch(); //!< \brief Ends a decode pass and updates the backgrounds.
+
+    /** \brief Returns the state an alarm output should be in.
+     * @param line 0 for the gross alarm or 1 for the ROI alarms.
+     */
+    bool output(size_t line) const {
+      return (line == 0 ? gross_active_ : rois_active_ > 0);
+    }
+    /** \brief Records when an alarm output was written so events carry their latency.
+     * @param line The output that was written.
+     * @param now_ns The monotonic time the write finished.
+     */
+    void outputWritten(size_t line, uint64_t now_ns);
+    /** \brief Moves the undelivered events into a vector.
+     * @param events Events are appended to this vector.
+     * @return The number of events appended.
+     */
+    size_t takeEvents(std::vector<AlarmEvent> *events);
+    //! \brief Returns the number of events dropped because they were not taken in time.
+    uint64_t eventsDropped() const {
+      return (events_dropped_);
+    }
+  };
+
+  /** The hot path.  Gross counts always feed the SPRT; ROI counts are only tested against the
+   * threshold computed for this batch, so the per event cost is a few compares.
+   */
+  inline void AlarmEngine::addEvent(uint16_t channel, uint32_t counts) {
+    if (!enabled_)
+      return;
+    batch_counts_ += counts;
+    for (size_t i = 0; i < roi_count_; i++)
+    {
+      Roi &roi = rois_[i];
+      if (channel >= roi.low && channel <= roi.high)
+      {
+        roi.batch += counts;
+        roi.window += counts;
+        roi.slots[slot_] += counts;
+        if (!learning_ && !roi.active && roi.window > roi.trigger)
+          roiDecision(i, true);
+      }
+    }
+    if (learning_)
+      return;
+    llr_ += log_ratio_ * counts;
+    llr_counts_ += counts;
+    if (llr_ >= upper_)
+      grossDecision(true);
+  }
+}
+
+#endif /* ALARM_ENGINE_H_ */
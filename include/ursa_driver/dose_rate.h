@@ -0,0 +1,138 @@
+/** The header file for the dose rate accumulator.
+ \file      dose_rate.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#ifndef DOSE_RATE_H_
+#define DOSE_RATE_H_
+
+#include <ursa_driver/spectrum_ops.h>
+
+#include <boost/array.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+namespace ursa
+{
+  /** \brief The energy calibration and spectrum to dose function used to weight each channel.
+   *
+   * The calibration is measured at a reference gain and bit mode.  Channel energies scale inversely with
+   * the gain and by a factor of two for each bit fewer, so the weights follow setting changes without a
+   * new calibration.
+   */
+  struct DoseCalibration
+  {
+    double offset_kev; //!< The energy of channel 0.
+    double kev_per_channel; //!< The channel width at the reference gain and bit mode.
+    double reference_gain; //!< The gain the calibration was measured at.
+    int reference_bits; //!< The bit mode the calibration was measured at.
+    std::vector<double> energies; //!< The G(E) knots in keV, ascending.
+    std::vector<double> weights; //!< The dose per count at each knot, in nSv. Interpolated log-log between knots.
+
+    DoseCalibration(); //!< \brief DoseCalibration constructor. Without knots every weight is zero.
+    /** \brief Returns the channel width in keV at other acquisition settings.
+     * @param gain The gain. Must be positive.
+     * @param bits The bit mode.
+     */
+    double channelWidth(double gain, int bits) const;
+  };
+
+  //! \brief The cumulative dose of the counted events.
+  struct DoseCounts
+  {
+    uint64_t time_ns; //!< The read time of the last data counted, in nanoseconds since the unix epoch.
+    uint64_t counts; //!< The events weighted.
+    double dose; //!< The dose in nSv.
+    double variance; //!< The Poisson variance of the dose in nSv^2.
+    bool valid; //!< False if the gain is unknown, so nothing was weighted.
+  };
+
+  /** \brief Accumulates dose from the event stream with a per channel weight table.
+   *
+   * setResponse() evaluates G(E) at every channel's energy once, so add() is two multiply adds per event:
+   * the dose, and its variance, the sum of the squared weight for each count.  A channel's weight and
+   * squared weight are adjacent so they share a cache line.
+   *
+   * Only configure() clears the totals.  setResponse() rebuilds the table but keeps them, so the dose
+   * carries on across a gain or bit mode change with each event weighted for the settings it arrived at.
+   */
+  class DoseCounter
+  {
+  private:
+    DoseCalibration calibration_; //!< The calibration the table is built from.
+    boost::array<double, 2 * spectrum_bins> weights_; //!< Each channel's dose per count then its square, so an event reads one line.
+    bool valid_; //!< True when the table weights events, i.e. the gain is known and there are knots.
+    double gain_; //!< The gain the table was built for, or 0 if none.
+    int bits_; //!< The bit mode the table was built for.
+    uint64_t counts_; //!< The events counted while the table was valid.
+    double dose_; //!< The weighted sum of the counts.
+    double variance_; //!< The squared weighted sum of the counts.
+    uint64_t time_ns_; //!< The read time of the last data counted.
+
+    void build(); //!< \brief Evaluates G(E) for every channel at the current gain and bit mode.
+
+  public:
+    DoseCounter(); //!< \brief DoseCounter constructor. Every weight is zero until configured.
+
+    /** \brief Replaces the calibration, rebuilds the table and clears the totals.
+     * @param calibration The calibration.
+     * @return False if the knots are not ascending positive energies with one weight each. Nothing is changed.
+     */
+    bool configure(const DoseCalibration &calibration);
+    /** \brief Rebuilds the table for new acquisition settings if they differ from the last.
+     * @param gain The gain, or 0 if it is unknown. Unknown gains weight every event zero.
+     * @param bits The bit mode.
+     */
+    void setResponse(double gain, int bits);
+    //! \brief Returns false while every weight is zero, when add() need not be called.
+    bool valid() const {
+      return (valid_);
+    }
+
+    /** \brief Counts one event.
+     * @param channel The event's channel.
+     * @param counts The event's count.
+     */
+    void add(uint16_t channel, uint32_t counts) {
+      counts_ += counts;
+      const double *weight = &weights_[2 * channel];
+      dose_ += weight[0] * counts;
+      variance_ += weight[1] * counts;
+    }
+    /** \brief Records the read time of the data counted so far.
+     * @param time_ns The read time in nanoseconds since the unix epoch.
+     */
+    void mark(uint64_t time_ns) {
+      time_ns_ = time_ns;
+    }
+    /** \brief Copies out the totals.
+     * @param counts Filled with the cumulative dose.
+     */
+    void read(DoseCounts *counts) const;
+  };
+}
+
+#endif /* DOSE_RATE_H_ */
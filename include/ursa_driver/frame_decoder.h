@@ -0,0 +1,114 @@
+/** The header file for the decoder of the Ursa's acquisition stream.
+ \file      frame_decoder.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#ifndef FRAME_DECODER_H_
+#define FRAME_DECODER_H_
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace ursa
+{
+  const uint8_t frame_sync = 0xff; //!< The first byte of every frame in the acquisition stream.
+  const size_t frame_size = 3; //!< The bytes in one frame.
+
+  /** \brief Decodes the acquisition stream, the decoder behind Interface::processData().
+   *
+   * Each frame is the sync byte, then a 4 bit count and a 12 bit channel.  A frame whose top 6 bits after the
+   * sync are zero carries a 10 bit battery reading instead.  Bytes which do not start a frame are dropped
+   * up to the next sync byte.  Decoding stops with fewer than frame_size bytes left, which are the start
+   * of a frame that has not finished arriving.
+   *
+   * The handler is called inline for every frame so the per event work is the caller's own.  It provides:
+   *  - event(end, channel, counts) for each event, where end is the offset just past its frame;
+   *  - battery(reading) for each battery frame;
+   *  - dropped(bytes) after each run of dropped bytes.
+   * @param buffer The stream.
+   * @param length The bytes in buffer.
+   * @param handler Called for everything decoded.
+   * @return The bytes consumed.
+   */
+  template<typename Handler>
+  inline size_t decodeFrames(const uint8_t *buffer, size_t length,
+                             Handler &handler) {
+    size_t pos = 0;
+    while (length - pos >= frame_size)
+    {
+      if (buffer[pos] == frame_sync)
+      {
+        uint8_t char1 = buffer[pos + 1];      //the first byte is only for sync
+        uint8_t char2 = buffer[pos + 2];
+        pos += frame_size;
+
+        uint8_t count = char1 >> 2;
+        uint16_t energy = (char1 & 0x03) << 8 | char2;
+
+        if (count == 0)
+          handler.battery(energy);
+        else
+          handler.event(pos, energy, count >> 2);
+      }
+      else
+      {
+        uint32_t dropped = 0;
+        while (pos < length && buffer[pos] != frame_sync)
+        {
+          pos++;
+          dropped++;
+        }
+        handler.dropped(dropped);
+      }
+    }
+    return (pos);
+  }
+
+  /** \brief Finds a point where decoding the whole stream and decoding from that point agree.
+   *
+   * A frame whose two data bytes are not the sync byte, followed by a sync byte, is such a point: however
+   * decodeFrames() was aligned before it, it either decodes that frame or drops its data bytes, so it
+   * reaches the following sync byte exactly.  A stream can then be split at these points and the pieces
+   * decoded separately with the same result as decoding it whole, except that the bytes the whole decode
+   * would drop before a point are left over at the end of the piece before it.
+   * @param buffer The stream.
+   * @param length The bytes in buffer.
+   * @param from The offset to search from.
+   * @return The offset of the point, or length if there is none.
+   */
+  inline size_t findFrameBoundary(const uint8_t *buffer, size_t length,
+                                  size_t from) {
+    for (size_t pos = from; pos + frame_size < length; pos++)
+    {
+      if (buffer[pos] == frame_sync && buffer[pos + 1] != frame_sync
+          && buffer[pos + 2] != frame_sync
+          && buffer[pos + frame_size] == frame_sync)
+        return (pos + frame_size);
+    }
+    return (length);
+  }
+}
+
+#endif /* FRAME_DECODER_H_ */
@@ -0,0 +1,145 @@
+/** The header file for the list mode event buffer.
+ \file      list_mode.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef LIST_MODE_H_
+#define LIST_MODE_H_
+
+#include <boost/array.hpp>
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace ursa
+{
+  const size_t event_batch_capacity = 8192; //!< The most events a batch can hold.
+
+  //! \brief A batch of decoded events stored as parallel arrays.
+  struct EventBatch
+  {
+    uint32_t sequence; //!< The batch number since list mode was enabled.
+    uint32_t dropped; //!< Events dropped since the previous batch because the consumer fell behind.
+    uint64_t start_ns; //!< The arrival time of the first event in nanoseconds since the unix epoch.
+    size_t size; //!< The number of events in the batch.
+    boost::array<uint32_t, event_batch_capacity> offsets; //!< Each event's arrival time in nanoseconds after start_ns.
+    boost::array<uint16_t, event_batch_capacity> channels; //!< Each event's channel.
+    boost::array<uint8_t, event_batch_capacity> counts; //!< Each event's count.
+  };
+
+  /** \brief A double buffered list of decoded events.
+   *
+   * The decoder add()s events to the filling batch.  The batch is closed when it reaches the batch size,
+   * when its first event is older than the latency bound or when an offset would overflow.  A closed
+   * batch waits in the ready slot until the consumer take()s it.  If the ready slot is still full the
+   * filling batch keeps growing to event_batch_capacity, after which events are counted as dropped.  So
+   * are events whose offset would overflow while the batch can not be closed.
+   *
+   * Both batches are allocated with the buffer so the steady state does not allocate.
+   */
+  class ListModeBuffer
+  {
+  private:
+    EventBatch batches_[2]; //!< The filling and ready batches.
+    EventBatch *filling_; //!< The batch add() writes to.
+    EventBatch *ready_; //!< The closed batch waiting for take().
+    bool ready_full_; //!< True while ready_ holds a batch.
+    bool enabled_; //!< True when add() records events.
+    size_t batch_size_; //!< The events which close a batch.
+    uint64_t max_latency_ns_; //!< The age of the first event which closes a batch.
+    uint32_t sequence_; //!< The next batch number.
+    uint32_t dropped_; //!< Events dropped since the last closed batch.
+
+    void close(); //!< \brief Moves the filling batch to the ready slot if it is free.
+
+  public:
+    ListModeBuffer(); //!< \brief ListModeBuffer constructor. List mode starts disabled.
+
+    /** \brief Enables or disables list mode and empties both batches.
+     * @param enable Record events.
+     * @param batch_size The events per batch, at most event_batch_capacity.
+     * @param max_latency The longest an event waits before its batch is closed, in seconds.
+     */
+    void configure(bool enable, size_t batch_size, double max_latency);
+    //! \brief Returns true when events are being recorded.
+    bool enabled() const {
+      return (enabled_);
+    }
+
+    /** \brief Records one event.
+     * @param time_ns The event's arrival time in nanoseconds since the unix epoch.
+     * @param channel The event's channel.
+     * @param counts The event's count.
+     */
+    void add(uint64_t time_ns, uint16_t channel, uint8_t counts);
+    /** \brief Closes the filling batch if its first event is older than the latency bound.
+     * @param now_ns The current time in nanoseconds since the unix epoch.
+     */
+    void poll(uint64_t now_ns);
+    /** \brief Copies out the ready batch.  Only the used part of each array is copied.
+     * @param batch Filled with the batch.
+     * @return False if no batch was ready.
+     */
+    bool take(EventBatch *batch);
+  };
+
+  /** Events are appended to the parallel arrays.  Time going backwards between reads is clamped to the
+   * start of the batch.  An offset past 32 bits closes the batch; if the ready slot is full the event is
+   * dropped rather than stored with a truncated offset.
+   */
+  inline void ListModeBuffer::add(uint64_t time_ns, uint16_t channel,
+                                  uint8_t counts) {
+    if (!enabled_)
+      return;
+    EventBatch *batch = filling_;
+    if (batch->size == 0)
+      batch->start_ns = time_ns;
+    else if (time_ns > batch->start_ns
+        && time_ns - batch->start_ns > 0xffffffffULL)
+    {
+      close();
+      batch = filling_;
+      if (batch->size != 0)
+      {
+        dropped_++;
+        return;
+      }
+      batch->start_ns = time_ns;
+    }
+    if (batch->size == event_batch_capacity)
+    {
+      dropped_++;
+      return;
+    }
+    size_t index = batch->size++;
+    batch->offsets[index] = (
+        time_ns > batch->start_ns ? uint32_t(time_ns - batch->start_ns) : 0);
+    batch->channels[index] = channel;
+    batch->counts[index] = counts;
+    if (batch->size >= batch_size_)
+      close();
+  }
+}
+
+#endif /* LIST_MODE_H_ */
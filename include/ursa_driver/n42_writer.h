@@ -0,0 +1,101 @@
+/** The header file for the streaming ANSI N42.42 writer.
+ \file      n42_writer.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#ifndef N42_WRITER_H_
+#define N42_WRITER_H_
+
+#include <ursa_driver/spectrum_ops.h>
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace ursa
+{
+  //! \brief The instrument description written once at the top of an N42 file.
+  struct N42Header
+  {
+    int serial_number; //!< The Ursa's serial number from Interface::requestSerialNumber(), or -1 to leave it out.
+    std::string detector_kind; //!< The N42 RadDetectorKindCode of the detector head, e.g. "NaI".
+    std::string detector_description; //!< A free form description of the detector head. Empty leaves it out.
+    std::vector<double> coefficients; //!< The energy calibration polynomial in keV, constant term first. Empty leaves it out.
+    size_t channels; //!< The channels written for each spectrum, at most spectrum_bins.
+
+    N42Header(); //!< \brief N42Header constructor. An unknown detector with every channel and no calibration.
+  };
+
+  /** \brief Writes spectra to an ANSI N42.42-2011 file as they arrive.
+   *
+   * The instrument, detector and calibration are written by open() and each spectrum becomes one
+   * RadMeasurement, formatted into a buffer sized for the largest measurement and written in one call.
+   * Nothing else is kept, so memory does not grow with the length of the run.  The N42 schema puts the
+   * calibration before every measurement, so a file has one calibration; open a new file when it changes.
+   * Zero runs use the CountedZeroes compression, which keeps quiet one second spectra to a few hundred bytes.
+   */
+  class N42Writer
+  {
+  private:
+    std::ofstream file_; //!< The file being written.
+    size_t channels_; //!< The channels written for each spectrum.
+    bool calibrated_; //!< True if the header has an energy calibration for the spectra to reference.
+    std::vector<char> buffer_; //!< Scratch space for one measurement.
+    uint64_t measurements_; //!< The measurements written.
+
+  public:
+    N42Writer(); //!< \brief N42Writer constructor.
+    ~N42Writer(); //!< \brief Closes the file if it is open.
+
+    /** \brief Creates a new file, replacing any existing file, and writes the header.
+     * @param path The file to write.
+     * @param header The instrument description.
+     * @return False if the file could not be opened.
+     */
+    bool open(const std::string &path, const N42Header &header);
+    //! \brief Returns true when a file is open.
+    bool isOpen() const {
+      return (file_.is_open());
+    }
+    /** \brief Appends one spectrum as a foreground measurement.
+     * @param start_ns The start of the measurement in nanoseconds since the unix epoch.
+     * @param real_ns The real time of the measurement in nanoseconds.
+     * @param live_ns The live time of the measurement in nanoseconds.
+     * @param counts The counts in each channel.
+     * @return False if the file is not open or could not be written.
+     */
+    bool write(uint64_t start_ns, uint64_t real_ns, uint64_t live_ns,
+               const WideSpectrum &counts);
+    void flush(); //!< \brief Writes the buffered measurements to disk.
+    void close(); //!< \brief Writes the closing tags and closes the file. The file is not valid XML until then.
+    //! \brief Returns the measurements written to the open file.
+    uint64_t measurements() const {
+      return (measurements_);
+    }
+  };
+}
+
+#endif /* N42_WRITER_H_ */
@@ -0,0 +1,144 @@
+/** The header file for the nuclide identification template matcher.
+ \file      nuclide_id.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef NUCLIDE_ID_H_
+#define NUCLIDE_ID_H_
+
+#include <ursa_driver/spectrum_ops.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ursa
+{
+  /** \brief A library of nuclide response templates.
+   *
+   * Each template is normalized to sum to 1.  The weights are stored channel major, one row of
+   * stride() floats per channel with a column per template, so a single pass over a spectrum updates
+   * every template with accumulateRows().  Names and per template constants are kept in separate arrays.
+   *
+   * Templates are in channels, so they must match the gain and bit mode the spectra are taken with.
+   */
+  class NuclideLibrary
+  {
+  private:
+    std::vector<std::string> names_; //!< The name of each template.
+    std::vector<double> variance_; //!< The sum of squared deviations of each template's weights from their mean.
+    std::vector<float> weights_; //!< spectrum_bins rows of stride_ weights.
+    size_t stride_; //!< The row length, the template count rounded up to a multiple of 8.
+
+  public:
+    NuclideLibrary();
+
+    /** \brief Adds a template.
+     * @param name The nuclide name.
+     * @param response The response per channel from channel 0. Missing channels are zero.
+     * @return False if the response is empty, flat or has a negative weight.
+     */
+    bool add(const std::string &name, const std::vector<double> &response);
+    /** \brief Loads templates from a text file.
+     *
+     * Each line is a name followed by the response of each channel from channel 0, separated by white
+     * space.  Blank lines and lines starting with # are skipped.
+     * @param path The file to load.
+     * @return The number of templates added, or -1 if the file could not be read or a line was invalid.
+     */
+    int load(const std::string &path);
+    void clear(); //!< \brief Removes every template.
+
+    //! \brief Returns the number of templates.
+    size_t size() const {
+      return (names_.size());
+    }
+    //! \brief Returns the row length of the weight matrix.
+    size_t stride() const {
+      return (stride_);
+    }
+    //! \brief Returns a template's name.
+    const std::string &name(size_t index) const {
+      return (names_[index]);
+    }
+    //! \brief Returns the sum of squared deviations of a template's weights from their mean.
+    double variance(size_t index) const {
+      return (variance_[index]);
+    }
+    //! \brief Returns the weight matrix, spectrum_bins rows of stride() floats.
+    const float *weights() const {
+      return (weights_.empty() ? NULL : &weights_[0]);
+    }
+  };
+
+  //! \brief One ranked match of a spectrum against a template.
+  struct Identification
+  {
+    size_t index; //!< The template's index in the NuclideLibrary.
+    double score; //!< The Pearson correlation of the spectrum with the template, -1 to 1.
+    double counts; //!< The least squares counts attributed to the template above a flat baseline.
+  };
+
+  /** \brief Correlates successive cumulative spectra against a NuclideLibrary.
+   *
+   * The correlation needs the dot product of the spectrum with each template plus the sum and sum of
+   * squares of the spectrum.  All of these are linear in the counts, so update() only adds the channels
+   * that changed since the previous spectrum.  A cleared spectrum, or every full_update_interval updates
+   * to bound rounding, is recomputed in full.
+   */
+  class NuclideIdentifier
+  {
+  private:
+    const NuclideLibrary &library_; //!< The templates. Call reset() after changing them.
+    WideSpectrum previous_; //!< The spectrum of the last update.
+    std::vector<double> dots_; //!< The dot product of the spectrum with each template, padded to the stride.
+    double sum_; //!< The sum of the spectrum.
+    double sum_squares_; //!< The sum of squares of the spectrum.
+    uint32_t updates_; //!< Incremental updates since the last full pass.
+    std::vector<uint32_t> channels_; //!< Scratch, the channels to add.
+    std::vector<double> deltas_; //!< Scratch, the change in each channel to add.
+
+  public:
+    static const uint32_t full_update_interval = 1000; //!< The incremental updates between full passes.
+
+    /** \brief NuclideIdentifier constructor.
+     * @param library The templates, which must outlive the identifier.
+     */
+    explicit NuclideIdentifier(const NuclideLibrary &library);
+
+    void reset(); //!< \brief Forgets the previous spectrum so the next update() is a full pass.
+    /** \brief Brings the correlations up to date with a cumulative spectrum.
+     * @param spectrum The spectrum, e.g. from Interface::getWideSpectra().
+     * @return The number of channels that were added.
+     */
+    size_t update(const WideSpectrum &spectrum);
+    /** \brief Ranks the templates by correlation with the last spectrum.
+     * @param min_score Templates scoring below this or with no attributed counts are left out.
+     * @param results Filled with the matches, best first.
+     */
+    void rank(double min_score, std::vector<Identification> *results) const;
+  };
+}
+
+#endif /* NUCLIDE_ID_H_ */
@@ -0,0 +1,106 @@
+/** The header file for the region of interest counters.
+ \file      roi_counter.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#ifndef ROI_COUNTER_H_
+#define ROI_COUNTER_H_
+
+#include <ursa_driver/spectrum_ops.h>
+
+#include <boost/array.hpp>
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+namespace ursa
+{
+  const size_t max_rois = 64; //!< The most regions of interest a RoiCounter resolves.
+
+  //! \brief The cumulative counts in each region of interest.
+  struct RoiCounts
+  {
+    uint64_t time_ns; //!< The read time of the last data counted, in nanoseconds since the unix epoch.
+    uint64_t gross; //!< The counts in every channel.
+    size_t size; //!< The number of regions of interest.
+    boost::array<uint64_t, max_rois> counts; //!< The counts in each region of interest.
+  };
+
+  /** \brief Counts events into regions of interest with constant work per event.
+   *
+   * The region boundaries split the channels into segments which are each wholly inside or outside every
+   * region.  configure() resolves them into a channel to segment lookup table so add() is one load and one
+   * add however many regions there are, and regions may overlap.  Region counts are summed from their
+   * segments only when they are read.
+   *
+   * The counts only grow until the next configure(), so consumers take rates from the difference of two
+   * reads.
+   */
+  class RoiCounter
+  {
+  private:
+    boost::array<uint8_t, spectrum_bins> segment_; //!< The segment of each channel.
+    boost::array<uint64_t, 2 * max_rois + 1> segment_counts_; //!< The counts in each segment.
+    boost::array<uint8_t, max_rois> first_; //!< The first segment of each region.
+    boost::array<uint8_t, max_rois> end_; //!< One past the last segment of each region.
+    size_t size_; //!< The number of regions.
+    size_t segments_; //!< The number of segments.
+    uint64_t time_ns_; //!< The read time of the last data counted.
+
+  public:
+    RoiCounter(); //!< \brief RoiCounter constructor. There are no regions, only the gross counts.
+
+    /** \brief Replaces the regions of interest and clears the counts.
+     * @param rois The inclusive channel ranges, at most max_rois. Channels past the spectrum are ignored.
+     * @return False if there are too many regions or one has its high channel below its low. Nothing is changed.
+     */
+    bool configure(const std::vector<ChannelRange> &rois);
+    //! \brief Returns the number of regions of interest.
+    size_t size() const {
+      return (size_);
+    }
+
+    /** \brief Counts one event.
+     * @param channel The event's channel.
+     * @param counts The event's count.
+     */
+    void add(uint16_t channel, uint32_t counts) {
+      segment_counts_[segment_[channel]] += counts;
+    }
+    /** \brief Records the read time of the data counted so far.
+     * @param time_ns The read time in nanoseconds since the unix epoch.
+     */
+    void mark(uint64_t time_ns) {
+      time_ns_ = time_ns;
+    }
+    /** \brief Sums the counts in each region.
+     * @param counts Filled with the cumulative counts.
+     */
+    void read(RoiCounts *counts) const;
+  };
+}
+
+#endif /* ROI_COUNTER_H_ */
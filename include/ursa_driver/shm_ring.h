@@ -0,0 +1,238 @@
+/** The header file for the shared memory spectrum and event ring.
+ \file      shm_ring.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef SHM_RING_H_
+#define SHM_RING_H_
+
+#include <boost/atomic.hpp>
+#include <boost/static_assert.hpp>
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+namespace ursa
+{
+  const uint32_t shm_magic = 0x4d485355; //!< "USHM", the first word of a ring.
+  const uint32_t shm_version = 1; //!< Changed whenever the layout changes.
+  const size_t shm_spectrum_slots = 4; //!< The snapshots kept, so a zero copy reader has this many periods to finish.
+  const size_t shm_spectrum_bins = 4096; //!< The bins in a snapshot.
+
+  //! \brief One decoded event in the ring.
+  struct ShmEvent
+  {
+    uint64_t time_ns; //!< The arrival time in nanoseconds since the unix epoch.
+    uint16_t channel; //!< The event's channel.
+    uint8_t counts; //!< The event's count.
+    uint8_t reserved[5]; //!< Pads the event to 16 bytes.
+  };
+
+  /** \brief One spectrum snapshot guarded by a sequence lock.
+   *
+   * The sequence is odd while the writer is filling the slot and 2 * (n + 1) once snapshot n is complete.
+   */
+  struct ShmSpectrumSlot
+  {
+    boost::atomic<uint64_t> sequence; //!< The slot's sequence lock.
+    uint64_t time_ns; //!< The snapshot time in nanoseconds since the unix epoch.
+    uint32_t epoch; //!< The configuration epoch of the spectrum.
+    uint32_t reserved; //!< Padding.
+    uint64_t bins[shm_spectrum_bins]; //!< The cumulative 64 bit spectrum.
+  };
+
+  /** \brief The start of the shared memory object.  The event ring follows it.
+   *
+   * The counters are on their own cache lines so readers polling one do not slow the writer updating the other.
+   */
+  struct ShmHeader
+  {
+    uint32_t magic; //!< shm_magic.
+    uint32_t version; //!< shm_version.
+    uint32_t event_capacity; //!< The events the ring holds, a power of two.
+    uint32_t spectrum_slots; //!< shm_spectrum_slots.
+    boost::atomic<uint32_t> active; //!< 1 while the writer is attached, 0 once it has closed.
+    char pad0[64 - 5 * sizeof(uint32_t)];
+    boost::atomic<uint64_t> spectra; //!< The snapshots published. Snapshot n is in slot n % spectrum_slots.
+    char pad1[64 - sizeof(uint64_t)];
+    boost::atomic<uint64_t> events; //!< The events published. Event n is at index n % event_capacity.
+    char pad2[64 - sizeof(uint64_t)];
+    ShmSpectrumSlot slots[shm_spectrum_slots]; //!< The snapshots.
+  };
+
+  // The counters live in memory mapped by other processes so they must be plain lock free words.
+  BOOST_STATIC_ASSERT(sizeof(boost::atomic<uint64_t>) == sizeof(uint64_t));
+  BOOST_STATIC_ASSERT(sizeof(ShmEvent) == 16);
+
+  //! \brief Returns the size of a ring holding event_capacity events.
+  size_t shmSize(uint32_t event_capacity);
+
+  /** \brief Publishes spectrum snapshots and decoded events into a POSIX shared memory ring.
+   *
+   * There is one writer and any number of readers, none of which can block the writer.  A reader that
+   * falls behind loses the oldest data instead.
+   */
+  class ShmWriter
+  {
+  private:
+    std::string name_; //!< The shared memory object name.
+    ShmHeader *header_; //!< The mapping, or NULL when closed.
+    ShmEvent *events_; //!< The event ring after the header.
+    size_t size_; //!< The mapping size.
+    uint64_t mask_; //!< event_capacity - 1.
+    uint64_t next_event_; //!< The number of the next event.
+    uint64_t next_spectrum_; //!< The number of the next snapshot.
+
+  public:
+    ShmWriter(); //!< \brief ShmWriter constructor. The writer starts closed.
+    ~ShmWriter(); //!< \brief Closes the ring if it is open.
+
+    /** \brief Creates the shared memory object, replacing any left by a previous run.
+     * @param name The object name, e.g. "/ursa".
+     * @param event_capacity The events the ring holds. Rounded up to a power of two.
+     * @return False if the object could not be created.
+     */
+    bool open(const std::string &name, uint32_t event_capacity);
+    //! \brief Marks the ring inactive, unmaps and unlinks it. Readers keep their mapping.
+    void close();
+    //! \brief Returns true when a ring is open.
+    bool isOpen() const {
+      return (header_ != NULL);
+    }
+
+    /** \brief Starts a snapshot.  The caller fills the returned bins then calls commitSpectrum().
+     * @return The shm_spectrum_bins bins of the slot being written.
+     */
+    uint64_t *beginSpectrum();
+    /** \brief Completes the snapshot started by beginSpectrum().
+     * @param time_ns The snapshot time in nanoseconds since the unix epoch.
+     * @param epoch The configuration epoch of the spectrum.
+     */
+    void commitSpectrum(uint64_t time_ns, uint32_t epoch);
+
+    /** \brief Publishes one event.
+     * @param time_ns The event's arrival time in nanoseconds since the unix epoch.
+     * @param channel The event's channel.
+     * @param counts The event's count.
+     */
+    void addEvent(uint64_t time_ns, uint16_t channel, uint8_t counts);
+  };
+
+  /** The event is written then published with a release store.  The release fence after the store keeps
+   * the next event's writes after it, so a reader that reads the head after copying events knows every
+   * slot the writer may have started to overwrite, as beginSpectrum() does for snapshots.
+   */
+  inline void ShmWriter::addEvent(uint64_t time_ns, uint16_t channel,
+                                  uint8_t counts) {
+    ShmEvent &event = events_[next_event_ & mask_];
+    event.time_ns = time_ns;
+    event.channel = channel;
+    event.counts = counts;
+    header_->events.store(++next_event_, boost::memory_order_release);
+    boost::atomic_thread_fence(boost::memory_order_release);
+  }
+
+  /** \brief Reads a ring written by ShmWriter, without locks and without blocking the writer.
+   *
+   * Spectra can be copied out with readSpectrum() or read in place with latestSpectrum() and
+   * spectrumValid().  Events can be copied out with readEvents() or read in place with peekEvents()
+   * and consumeEvents().  Each reader keeps its own event cursor.
+   */
+  class ShmReader
+  {
+  private:
+    const ShmHeader *header_; //!< The mapping, or NULL when closed.
+    const ShmEvent *events_; //!< The event ring after the header.
+    size_t size_; //!< The mapping size.
+    uint64_t capacity_; //!< The events the ring holds.
+    uint64_t cursor_; //!< The number of the next event to read.
+
+    /** \brief Returns the oldest event that cannot be being overwritten.
+     * @param head The events published.
+     */
+    uint64_t oldestSafe(uint64_t head) const {
+      return (head >= capacity_ ? head - capacity_ + 1 : 0);
+    }
+
+  public:
+    ShmReader(); //!< \brief ShmReader constructor. The reader starts closed.
+    ~ShmReader(); //!< \brief Unmaps the ring if it is open.
+
+    /** \brief Maps a ring read only.  Reading starts with the next event published.
+     * @param name The object name given to ShmWriter::open().
+     * @return False if the object does not exist or is not a ring of this version.
+     */
+    bool open(const std::string &name);
+    void close(); //!< \brief Unmaps the ring.
+    //! \brief Returns true when a ring is mapped.
+    bool isOpen() const {
+      return (header_ != NULL);
+    }
+    //! \brief Returns false once the writer has closed the ring.
+    bool writerActive() const {
+      return (header_->active.load(boost::memory_order_acquire) != 0);
+    }
+
+    /** \brief Finds the latest complete snapshot for reading in place.
+     * @param sequence Filled with the slot sequence to pass to spectrumValid().
+     * @return The slot, or NULL if no snapshot has been published.
+     */
+    const ShmSpectrumSlot *latestSpectrum(uint64_t *sequence) const;
+    /** \brief Checks that a slot was not overwritten while it was read in place.
+     * @return False if the data read since latestSpectrum() may be torn.
+     */
+    bool spectrumValid(const ShmSpectrumSlot *slot, uint64_t sequence) const;
+    /** \brief Copies out the latest complete snapshot, retrying if the writer overtakes the copy.
+     * @param time_ns If not NULL, filled with the snapshot time.
+     * @param epoch If not NULL, filled with the configuration epoch.
+     * @param bins Filled with shm_spectrum_bins bins.
+     * @return The snapshot number, or 0 if none has been published.
+     */
+    uint64_t readSpectrum(uint64_t *time_ns, uint32_t *epoch, uint64_t *bins) const;
+
+    /** \brief Copies out the events published since the last call.
+     * @param events Filled with up to max events.
+     * @param max The most events to copy.
+     * @param dropped If not NULL, incremented by the events lost because the writer overtook this reader.
+     * @return The number of events copied.
+     */
+    size_t readEvents(ShmEvent *events, size_t max, uint64_t *dropped = NULL);
+    /** \brief Finds the contiguous run of unread events for reading in place.
+     *
+     * The run stops at the end of the ring, so two calls may be needed to reach the newest event.
+     * @param first Filled with the first unread event.
+     * @param dropped If not NULL, incremented by the events lost because the writer overtook this reader.
+     * @return The number of events in the run.
+     */
+    size_t peekEvents(const ShmEvent **first, uint64_t *dropped = NULL);
+    /** \brief Marks events returned by peekEvents() as read.
+     * @param count The events read.
+     * @return False if some of them may have been overwritten while they were read.
+     */
+    bool consumeEvents(size_t count);
+  };
+}
+
+#endif /* SHM_RING_H_ */
@@ -0,0 +1,202 @@
+/** The header file for the spectrum archive writer and reader.
+ \file      spectrum_archive.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef SPECTRUM_ARCHIVE_H_
+#define SPECTRUM_ARCHIVE_H_
+
+#include <ursa_driver/spectrum_ops.h>
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace ursa
+{
+  /** \brief The kinds of block in an archive file.
+   *
+   * An archive is a file header followed by blocks.  Chunk blocks hold a summed spectrum followed by the
+   * delta compressed records for one chunk of time (a minute by default).  Summary blocks hold only the
+   * summed spectrum for a longer period (an hour by default).  A closed archive ends with an index of every block.
+   */
+  enum archive_block
+  {
+    ARCHIVE_CHUNK = 1, //!< A chunk summary followed by its records.
+    ARCHIVE_SUMMARY = 2, //!< A coarse summary without records.
+    ARCHIVE_INDEX = 3 //!< The block index written by SpectrumArchiveWriter::close().
+  };
+
+  //! \brief The location and time span of one block, as stored in the index.
+  struct ArchiveBlockInfo
+  {
+    uint32_t kind; //!< An archive_block.
+    uint32_t records; //!< The number of records the block covers.
+    uint64_t start_ns; //!< The nominal start of the block. Records at or after this time are included.
+    uint64_t end_ns; //!< The nominal end of the block. Records before this time are included.
+    uint64_t offset; //!< The file offset of the block header.
+  };
+
+  /** \brief Writes spectra to an indexed archive file.
+   *
+   * Spectra are stored as interval counts.  Each record is a sparse list of (zero run, count) varints so
+   * a quiet second costs a few bytes instead of 16 KB.  Only the open chunk and the open summary are held
+   * in memory.
+   */
+  class SpectrumArchiveWriter
+  {
+  private:
+    std::ofstream file_; //!< The archive being written.
+    uint64_t chunk_ns_; //!< The length of a chunk.
+    uint64_t summary_ns_; //!< The length of a summary.
+
+    std::vector<ArchiveBlockInfo> index_; //!< Every block written so far.
+
+    bool chunk_open_; //!< True when the current chunk holds records.
+    uint64_t chunk_start_ns_; //!< The nominal start of the current chunk.
+    uint64_t last_ns_; //!< The time of the last record.
+    uint32_t chunk_records_; //!< The records in the current chunk.
+    std::vector<uint8_t> chunk_data_; //!< The encoded records of the current chunk.
+    WideSpectrum chunk_sum_; //!< The sum of the current chunk.
+
+    bool summary_open_; //!< True when the current summary holds records.
+    uint64_t summary_start_ns_; //!< The nominal start of the current summary.
+    uint32_t summary_records_; //!< The records in the current summary.
+    WideSpectrum summary_sum_; //!< The sum of the current summary.
+
+    bool have_previous_; //!< True once appendCumulative() has a previous spectrum to difference against.
+    WideSpectrum previous_; //!< The last cumulative spectrum.
+    Spectrum interval_; //!< Scratch space for appendCumulative().
+
+    void writeChunk(); //!< \brief Writes the current chunk and resets it.
+    void writeSummary(); //!< \brief Writes the current summary and resets it.
+    /** \brief Writes a block header and payload and records it in the index.
+     * @param info The block's index entry. The offset is filled in.
+     * @param summary The encoded summed spectrum.
+     * @param records The encoded records, may be empty.
+     */
+    void writeBlock(ArchiveBlockInfo info, const std::vector<uint8_t> &summary,
+                    const std::vector<uint8_t> &records);
+
+  public:
+    /** \brief SpectrumArchiveWriter constructor.
+     * @param chunk_seconds The length of a chunk and of the fine summaries.
+     * @param summary_seconds The length of the coarse summaries. Must be a multiple of chunk_seconds.
+     */
+    SpectrumArchiveWriter(uint32_t chunk_seconds = 60,
+                          uint32_t summary_seconds = 3600);
+    ~SpectrumArchiveWriter(); //!< \brief Closes the archive if it is open.
+
+    /** \brief Creates a new archive, replacing any existing file.
+     * @param path The file to write.
+     * @return False if the file could not be opened.
+     */
+    bool open(const std::string &path);
+    //! \brief Returns true when an archive is open.
+    bool isOpen() const {
+      return (file_.is_open());
+    }
+    /** \brief Adds one interval spectrum.
+     * @param time_ns The time of the spectrum in nanoseconds since the unix epoch. Must not go backwards.
+     * @param counts The counts received during the interval.
+     * @return False if the archive is not open or the time went backwards.
+     */
+    bool append(uint64_t time_ns, const Spectrum &counts);
+    /** \brief Adds the difference between a cumulative spectrum and the previous one.
+     *
+     * If any bin went down the spectrum was cleared and is stored as is.  The first call only sets the reference.
+     * @param time_ns The time of the spectrum in nanoseconds since the unix epoch.
+     * @param cumulative The cumulative spectrum, e.g. from Interface::getWideSpectra().
+     * @return False if the archive is not open or the time went backwards.
+     */
+    bool appendCumulative(uint64_t time_ns, const WideSpectrum &cumulative);
+    void flush(); //!< \brief Writes the open chunk so it survives a crash. Later records start a new chunk.
+    void close(); //!< \brief Writes the open chunk, the open summary and the index.
+  };
+
+  /** \brief Reads an archive written by SpectrumArchiveWriter.
+   *
+   * Queries only read the blocks that overlap the requested range.  Summaries that lie entirely inside the
+   * range are used instead of their chunks, and chunk summaries instead of their records.
+   */
+  class SpectrumArchiveReader
+  {
+  private:
+    std::ifstream file_; //!< The archive being read.
+    uint64_t chunk_ns_; //!< The length of a chunk.
+    uint64_t summary_ns_; //!< The length of a summary.
+    std::vector<ArchiveBlockInfo> index_; //!< Every block in the file.
+    std::vector<uint8_t> buffer_; //!< Scratch space for encoded blocks.
+    size_t next_block_; //!< The index entry next() reads after the current chunk.
+    uint64_t chunk_start_ns_; //!< The start of the chunk next() is reading.
+    std::vector<uint8_t> records_; //!< The encoded records of the chunk next() is reading.
+    size_t record_offset_; //!< The position of the next record in records_.
+
+    bool readIndex(); //!< \brief Reads the index from the end of a closed archive.
+    bool scanIndex(); //!< \brief Rebuilds the index from the block headers of an archive that was not closed.
+    /** \brief Reads and decodes the summed spectrum of a block.
+     * @return False on a read error.
+     */
+    bool addSummary(const ArchiveBlockInfo &info, WideSpectrum *sum);
+    /** \brief Reads and decodes the records of a chunk which fall in [start_ns, end_ns).
+     * @return False on a read error.
+     */
+    bool addRecords(const ArchiveBlockInfo &info, uint64_t start_ns,
+                    uint64_t end_ns, WideSpectrum *sum, uint64_t *records);
+
+  public:
+    SpectrumArchiveReader(); //!< \brief SpectrumArchiveReader constructor.
+
+    /** \brief Opens an archive and loads its index.
+     * @param path The archive to read.
+     * @return False if the file is not an archive.
+     */
+    bool open(const std::string &path);
+    //! \brief Returns the index of every block in the file.
+    const std::vector<ArchiveBlockInfo> &index() const {
+      return (index_);
+    }
+    /** \brief Sums every record with a time in [start_ns, end_ns).
+     * @param start_ns The start of the range in nanoseconds since the unix epoch.
+     * @param end_ns The end of the range in nanoseconds since the unix epoch.
+     * @param sum Filled with the summed spectrum.
+     * @param records If not NULL, filled with the number of records summed.
+     * @return False on a read error.
+     */
+    bool query(uint64_t start_ns, uint64_t end_ns, WideSpectrum *sum,
+               uint64_t *records = NULL);
+    /** \brief Reads the records one at a time in time order, starting from the first after open() or rewind().
+     *
+     * Only one chunk's encoded records are held, so reading a whole archive takes constant memory.
+     * @param time_ns Filled with the time of the record in nanoseconds since the unix epoch.
+     * @param counts Filled with the record's counts.
+     * @return False after the last record or on a read error.
+     */
+    bool next(uint64_t *time_ns, WideSpectrum *counts);
+    void rewind(); //!< \brief Makes next() start again from the first record.
+  };
+}
+
+#endif /* SPECTRUM_ARCHIVE_H_ */
@@ -0,0 +1,172 @@
+/** Spectrum types and vectorized kernels used by the ursa::Interface class.
+ \file      spectrum_ops.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef SPECTRUM_OPS_H_
+#define SPECTRUM_OPS_H_
+
+#include <boost/array.hpp>
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace ursa
+{
+  const size_t spectrum_bins = 4096; //!< The number of bins in an Ursa spectrum.
+
+  typedef boost::array<uint32_t, spectrum_bins> Spectrum; //!< The 32 bit spectrum published by the driver.
+  typedef boost::array<uint64_t, spectrum_bins> WideSpectrum; //!< A 64 bit spectrum for long dwells.
+
+  /** \brief Adds 32 bit counts into 64 bit totals, dst[i] += src[i].
+   *
+   * Uses AVX2 or SSE2 when the CPU supports it, otherwise a scalar loop.
+   * @param dst The 64 bit totals.
+   * @param src The 32 bit counts.
+   * @param n The number of elements.
+   */
+  void widenAccumulate(uint64_t *dst, const uint32_t *src, size_t n);
+
+  /** \brief Adds scaled rows of a float matrix into double accumulators.
+   *
+   * For each i, acc[t] += scale[i] * matrix[rows[i] * stride + t] for every t < stride.  This is the
+   * transposed sparse matrix vector product used to correlate a spectrum against many templates at once.
+   * Uses AVX2 or SSE2 when the CPU supports it, otherwise a scalar loop.
+   * @param acc The stride accumulators.
+   * @param matrix The row major matrix. Rows are stride floats long.
+   * @param stride The row length. A multiple of 8 keeps every row on the vector path.
+   * @param rows The rows to add.
+   * @param scale The factor for each row.
+   * @param n The number of rows to add.
+   */
+  void accumulateRows(double *acc, const float *matrix, size_t stride,
+                      const uint32_t *rows, const double *scale, size_t n);
+
+  //! \brief An inclusive range of channels.
+  struct ChannelRange
+  {
+    uint16_t low; //!< The first channel.
+    uint16_t high; //!< The last channel.
+  };
+
+  //! \brief A ratio of two ranges, given as indices into the ranges passed to roiSums().
+  struct RangeRatio
+  {
+    uint16_t numerator; //!< The range on top.
+    uint16_t denominator; //!< The range below.
+  };
+
+  /** \brief Returns the factor which scales a background to the live time of a measurement.
+   * @param live_time The live time of the measurement.
+   * @param background_live_time The live time of the background.
+   */
+  inline double liveTimeScale(double live_time, double background_live_time) {
+    return (background_live_time > 0 ? live_time / background_live_time : 0);
+  }
+
+  /** \brief Subtracts a scaled background, net[i] = gross[i] - scale * background[i].
+   *
+   * The Poisson variance of each net bin, gross[i] + scale^2 * background[i], is computed in the same pass.
+   * Uses AVX2 when the CPU supports it, otherwise a scalar loop.
+   * @param net The net counts.
+   * @param variance If not NULL, filled with the variance of each net bin.
+   * @param gross The measured spectrum.
+   * @param background The background spectrum.
+   * @param scale The background scale, usually liveTimeScale().
+   * @param n The number of bins.
+   */
+  void subtractBackground(double *net, double *variance, const uint32_t *gross,
+                          const uint32_t *background, double scale, size_t n);
+
+  /** \brief Sums spectra from several detectors, dst[i] = sum of sources[k][i].
+   *
+   * All sources are added in one pass so each output bin is written once.
+   * Uses AVX2 when the CPU supports it, otherwise a scalar loop.
+   * @param dst The 64 bit sum.
+   * @param sources The spectra to sum.
+   * @param count The number of sources.
+   * @param n The number of bins.
+   */
+  void sumSpectra(uint64_t *dst, const uint32_t *const *sources, size_t count,
+                  size_t n);
+
+  /** \brief Integrates many channel ranges in one sweep of the spectrum.
+   *
+   * The sweep sums blocks of 8 bins, then each range costs two block prefix lookups and at most 14 edge
+   * bins however wide it is.  Ranges may overlap.  The block sums use AVX2 when the CPU supports it.
+   * @param spectrum The spectrum.
+   * @param n The number of bins, at most spectrum_bins. Ranges are clipped to it.
+   * @param ranges The ranges to integrate.
+   * @param count The number of ranges.
+   * @param sums Filled with the counts in each range.
+   */
+  void roiSums(const uint32_t *spectrum, size_t n, const ChannelRange *ranges,
+               size_t count, uint64_t *sums);
+
+  /** \brief Integrates many channel ranges of a background subtracted spectrum.
+   *
+   * Both spectra are integrated with roiSums() and the background scaled, which is the same as
+   * integrating subtractBackground() without the per bin pass.  Ranges are integrated max_fused_ranges
+   * at a time.
+   * @param gross The measured spectrum.
+   * @param background The background spectrum.
+   * @param scale The background scale, usually liveTimeScale().
+   * @param n The number of bins, at most spectrum_bins.
+   * @param ranges The ranges to integrate.
+   * @param count The number of ranges.
+   * @param net Filled with the net counts in each range.
+   * @param variance If not NULL, filled with the variance of each net count.
+   */
+  void netRoiSums(const uint32_t *gross, const uint32_t *background,
+                  double scale, size_t n, const ChannelRange *ranges,
+                  size_t count, double *net, double *variance);
+
+  const size_t max_fused_ranges = 256; //!< The most ranges netRoiSums() integrates per pass over the spectra.
+
+  /** \brief Computes ratios of range counts with their propagated uncertainty.
+   * @param values The counts in each range, e.g. from netRoiSums().
+   * @param variances The variance of each count, or NULL to treat the counts as Poisson.
+   * @param ratios The ratios to compute.
+   * @param count The number of ratios.
+   * @param results Filled with each ratio, or 0 where the denominator is not positive.
+   * @param sigmas If not NULL, filled with the standard deviation of each ratio.
+   */
+  void rangeRatios(const double *values, const double *variances,
+                   const RangeRatio *ratios, size_t count, double *results,
+                   double *sigmas);
+
+  /** \brief Returns the instruction set used by the vectorized kernels.
+   * @return "avx2", "sse2" or "scalar".
+   */
+  const char *simdLevel();
+  /** \brief Caps the instruction set the vectorized kernels use, so the vector and scalar kernels can be compared.
+   *
+   * Not thread safe; call it while no kernel is running.
+   * @param level "avx2", "sse2" or "scalar". The kernels use the lower of it and what the CPU supports.
+   * @return False if the level is not one of those. Nothing is changed.
+   */
+  bool limitSimd(const char *level);
+}
+
+#endif /* SPECTRUM_OPS_H_ */
@@ -0,0 +1,86 @@
+/** Clock helpers shared by the ursa::Interface components.
+ \file      ursa_clock.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef URSA_CLOCK_H_
+#define URSA_CLOCK_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace ursa
+{
+  /** \brief Returns the monotonic clock in nanoseconds.
+   *
+   * Used for intervals and rate limiting. It is not affected by changes to the system time.
+   */
+  inline uint64_t monotonicNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+  }
+
+  /** \brief Returns the wall clock in nanoseconds since the unix epoch.
+   *
+   * Used for time stamping data that leaves the driver.
+   */
+  inline uint64_t wallNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+  }
+
+  /** \brief Returns the first wall clock boundary after a time.
+   *
+   * Boundaries are offset_ns plus whole periods since the unix epoch, so hosts with synchronized clocks
+   * share them.
+   * @param now_ns The time in nanoseconds since the unix epoch.
+   * @param period_ns The period between boundaries.
+   * @param offset_ns The offset of the boundaries into each period.
+   */
+  inline uint64_t nextWallBoundary(uint64_t now_ns, uint64_t period_ns,
+                                   uint64_t offset_ns) {
+    offset_ns %= period_ns;
+    uint64_t base = (now_ns < offset_ns ? 0 : now_ns - offset_ns);
+    return ((base / period_ns + 1) * period_ns + offset_ns);
+  }
+
+  /** \brief Sleeps until an absolute wall clock time.
+   *
+   * Sleeping to an absolute time does not add the time spent awake to each period the way a relative sleep
+   * does, so a loop which advances its deadline by a fixed period does not drift.
+   * @param time_ns The time to wake in nanoseconds since the unix epoch.
+   */
+  inline void sleepUntilWall(uint64_t time_ns) {
+    timespec ts;
+    ts.tv_sec = time_ns / 1000000000ULL;
+    ts.tv_nsec = time_ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+  }
+}
+
+#endif /* URSA_CLOCK_H_ */
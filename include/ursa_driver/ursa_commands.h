@@ -0,0 +1,231 @@
+/** The command table and encoder used by the ursa::Interface class.
+ \file      ursa_commands.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef URSA_COMMANDS_H_
+#define URSA_COMMANDS_H_
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace ursa
+{
+  /** \brief One encoded command ready to be written to the Ursa.
+   *
+   * The bytes live in a fixed buffer so building a command never touches the heap.
+   */
+  struct Command
+  {
+    static const size_t max_length = 8; //!< The longest command (or group of commands) that can be held.
+    uint8_t data[max_length]; //!< The wire bytes.
+    size_t size; //!< The number of valid bytes in Command::data.
+
+    Command() :
+        size(0) {
+    }
+    /** \brief Appends another command so both are sent in one write.
+     * @param other The command to append. It must fit in the remaining space.
+     */
+    void append(const Command &other) {
+      for (size_t i = 0; i < other.size && size < max_length; i++)
+        data[size++] = other.data[i];
+    }
+  };
+
+  /** \brief Argument layouts that follow an opcode.
+   *
+   * Each layout gives its length in bytes and an encode() which writes the arguments into place.
+   */
+  namespace layout
+  {
+    //! The opcode alone.
+    struct None
+    {
+      static const size_t length = 0;
+    };
+
+    //! A big endian unsigned 16 bit value. Used by V and P.
+    struct BigEndian16
+    {
+      static const size_t length = 2;
+      static void encode(uint8_t *out, uint16_t value) {
+        out[0] = (uint8_t) (value >> 8);
+        out[1] = (uint8_t) (value & 0xFF);
+      }
+    };
+
+    //! A single ASCII decimal digit. Used by I, S, M and X.
+    struct Digit
+    {
+      static const size_t length = 1;
+      static void encode(uint8_t *out, int value) {
+        out[0] = (uint8_t) ('0' + value);
+      }
+    };
+
+    //! Two 12 bit values packed into 3 bytes, high nibble first. Used by T for threshold and offset.
+    struct Packed12x2
+    {
+      static const size_t length = 3;
+      static void encode(uint8_t *out, uint16_t first, uint16_t second) {
+        out[0] = (uint8_t) ((first >> 4) & 0xFF);
+        out[1] = (uint8_t) (((first & 0x0F) << 4) | ((second >> 8) & 0x0F));
+        out[2] = (uint8_t) (second & 0xFF);
+      }
+    };
+
+    //! The coarse gain as an ASCII digit followed by F and the raw fine gain byte. Used by C.
+    struct GainPair
+    {
+      static const size_t length = 3;
+      static void encode(uint8_t *out, int coarse, uint8_t fine) {
+        out[0] = (uint8_t) ('0' + coarse);
+        out[1] = 'F';
+        out[2] = fine;
+      }
+    };
+
+    //! A six digit ASCII decimal number. Used for the serial number after #.
+    struct Decimal6
+    {
+      static const size_t length = 6;
+      static void encode(uint8_t *out, int value) {
+        for (int i = 5; i >= 0; i--)
+        {
+          out[i] = (uint8_t) ('0' + value % 10);
+          value /= 10;
+        }
+      }
+    };
+  }
+
+  /** \brief Describes one command as an opcode followed by a layout.
+   *
+   * The length is known at compile time and the encoded bytes are written straight into a Command.
+   * The opcode is optional for commands which are sent as a bare argument such as the serial number.
+   */
+  template<char Opcode, typename Layout = layout::None, bool HasOpcode = true>
+  struct CommandSpec
+  {
+    static const size_t opcode_length = (HasOpcode ? 1 : 0);
+    static const size_t length = opcode_length + Layout::length;
+
+    static Command encode() {
+      Command cmd;
+      start(&cmd);
+      return (cmd);
+    }
+    template<typename A>
+    static Command encode(A a) {
+      Command cmd;
+      start(&cmd);
+      Layout::encode(cmd.data + opcode_length, a);
+      return (cmd);
+    }
+    template<typename A, typename B>
+    static Command encode(A a, B b) {
+      Command cmd;
+      start(&cmd);
+      Layout::encode(cmd.data + opcode_length, a, b);
+      return (cmd);
+    }
+
+  private:
+    static void start(Command *cmd) {
+      if (HasOpcode)
+        cmd->data[0] = Opcode;
+      cmd->size = length;
+    }
+  };
+
+  //! \brief The command table.  Every command the driver sends is described here once.
+  namespace commands
+  {
+    typedef CommandSpec<'G'> StartAcquire;
+    typedef CommandSpec<'R'> StopAcquire;
+    typedef CommandSpec<'J'> StartGM;
+    typedef CommandSpec<'j'> StopGM;
+    typedef CommandSpec<'c'> RequestCounts;
+    typedef CommandSpec<'v'> StopVoltage;
+    typedef CommandSpec<'B'> RequestBatt;
+    typedef CommandSpec<'A'> StartASCII;
+    typedef CommandSpec<'N'> StopASCII;
+    typedef CommandSpec<'U'> CheckComms;
+    typedef CommandSpec<'@'> RequestSerialNumber;
+    typedef CommandSpec<'2'> RequestMaxHV;
+    typedef CommandSpec<'r'> LoadPrevSettings;
+    typedef CommandSpec<'d'> SetNoSave;
+    typedef CommandSpec<'p'> NoRamp;
+    typedef CommandSpec<'Z'> EnableAlarm0;
+    typedef CommandSpec<'z'> DisableAlarm0;
+    typedef CommandSpec<'W'> EnableAlarm1;
+    typedef CommandSpec<'w'> DisableAlarm1;
+    typedef CommandSpec<'V', layout::BigEndian16> SetVoltage;
+    typedef CommandSpec<'P', layout::BigEndian16> SetRamp;
+    typedef CommandSpec<'C', layout::GainPair> SetGain;
+    typedef CommandSpec<'T', layout::Packed12x2> SetThresholdOffset;
+    typedef CommandSpec<'I', layout::Digit> SetInput;
+    typedef CommandSpec<'S', layout::Digit> SetShapingTime;
+    typedef CommandSpec<'M', layout::Digit> SetBitMode;
+    typedef CommandSpec<'X', layout::Digit> SetSmudgeFactor;
+    typedef CommandSpec<'#'> SetSerialNumber;
+    typedef CommandSpec<0, layout::Decimal6, false> SerialNumberValue;
+
+    //! \brief The coarse and fine gain registers for a requested gain.
+    struct GainSetting
+    {
+      int coarse;    //!< The coarse gain index, 0 to 5.
+      uint8_t fine;  //!< The fine gain register. The fine gain is (fine + 1) / 256.
+    };
+
+    /** \brief Converts a voltage in volts to the 16 bit register value sent with V.
+     * @param voltage The high voltage between 0 and 2000.
+     */
+    uint16_t voltageRegister(int voltage);
+    /** \brief Converts a ramp time to the 16 bit register value sent with P.
+     * @param seconds The ramping time in seconds per 100 volts.
+     */
+    uint16_t rampRegister(int seconds);
+    /** \brief Finds the coarse and fine gain registers for a gain.
+     * @param gain The requested gain, which must be below 250.
+     * @param setting Filled with the register values.
+     * @return False if the gain is out of range.
+     */
+    bool gainSetting(double gain, GainSetting *setting);
+    /** \brief Returns the coarse gain multiplier for a coarse gain index.
+     * @param coarse The coarse gain index, 0 to 5.
+     */
+    int coarseGain(int coarse);
+
+    Command setVoltage(int voltage); //!< \brief Encodes V for a voltage in volts.
+    Command setRamp(int seconds); //!< \brief Encodes P for a ramp time in seconds per 100 volts.
+    Command setGain(const GainSetting &setting); //!< \brief Encodes C with the coarse and fine gain.
+    Command setThresholdOffset(int mVolts); //!< \brief Encodes T for a threshold in millivolts.
+    Command setBitMode(int bits); //!< \brief Encodes M for a number of bits between 8 and 12.
+  }
+
+}
+
+#endif /* URSA_COMMANDS_H_ */
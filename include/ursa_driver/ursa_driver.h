@@ -32,6 +32,8 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/array.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/thread/lock_guard.hpp>
 
@@ -40,16 +42,23 @@
 #include <iostream>
 #include <sstream>
 
-#include <serial/serial.h>
-
-namespace serial
-{
-  class Serial;
-}
+#include <ursa_driver/ursa_transport.h>
+#include <ursa_driver/ursa_commands.h>
+#include <ursa_driver/ursa_log.h>
+#include <ursa_driver/spectrum_ops.h>
+#include <ursa_driver/alarm_engine.h>
+#include <ursa_driver/list_mode.h>
+#include <ursa_driver/shm_ring.h>
+#include <ursa_driver/roi_counter.h>
+#include <ursa_driver/dose_rate.h>
+#include <ursa_driver/ursa_realtime.h>
+#include <ursa_driver/ursa_clock.h>
 
 //! The ursa namespace.
 namespace ursa
 {
+  const size_t rx_buffer_size = 16384; //!< The size of the receive buffer. At 115200 baud this is over a second of data.
+
   /** \brief An enum for the different input configurations.
    *
    *  Used in Interface::setInput().
@@ -79,6 +88,56 @@ namespace ursa
     TIME10uS       //!< 10 μS
   };
 
+  /** \brief Acquisition settings for Interface::reconfigure().
+   *
+   * Only the settings whose set_ flag is true are applied.  The Interface also keeps one of these
+   * recording the settings it last sent, where the flags mark the settings it knows.
+   */
+  struct AcquisitionSettings
+  {
+    AcquisitionSettings(); //!< \brief Marks every setting as not set.
+
+    bool set_gain; //!< Apply gain.
+    double gain; //!< The gain, see Interface::setGain().
+    bool set_threshold; //!< Apply threshold.
+    int threshold; //!< The threshold in millivolts, see Interface::setThresholdOffset().
+    bool set_shaping_time; //!< Apply shaping.
+    shaping_time shaping; //!< The shaping time, see Interface::setShapingTime().
+    bool set_input; //!< Apply input. Changing the input cycles the high voltage.
+    inputs input; //!< The input and polarity, see Interface::setInput().
+    bool set_bits; //!< Apply bits.
+    int bits; //!< The bits of resolution, see Interface::setBitMode().
+  };
+
+  //! \brief The outcome of Interface::reconfigure().
+  struct ReconfigureResult
+  {
+    bool success; //!< False if a requested setting was invalid. Nothing is changed then.
+    uint32_t epoch; //!< The configuration epoch after the call.
+    size_t applied; //!< The number of settings that differed and were sent.
+    uint64_t dead_ns; //!< The time acquisition was stopped for, from the stop command to the start command.
+  };
+
+  //! \brief One of the two spectrum buffers the Interface decodes into. See Interface::swapSpectra().
+  struct SpectrumBuffer
+  {
+    boost::array<uint32_t, 4096> pulses; //!< The pulses received in each bin since the last fold.
+    boost::array<uint64_t, 4096> totals; //!< The 64 bit totals that pulses is periodically folded into.
+    uint32_t interval_counts; //!< The sum of pulses. Used to fold before any bin can wrap.
+
+    void clear(); //!< \brief Zeroes both tiers.
+  };
+
+  //! \brief Describes the counts taken by Interface::swapSpectra().
+  struct SpectrumInterval
+  {
+    uint64_t sequence; //!< Counts from 1 with each interval taken. A gap means another consumer took the intervals between.
+    uint32_t epoch; //!< The configuration epoch when the interval was taken.
+    uint64_t start_ns; //!< When the interval started, at the previous swap or clear, in nanoseconds since the unix epoch.
+    uint64_t end_ns; //!< When the interval was taken, in nanoseconds since the unix epoch.
+    uint64_t counts; //!< The total counts in the interval.
+  };
+
   //! The interface class implements a link to the ursa hardware.
   class Interface
   {
@@ -88,64 +147,257 @@ namespace ursa
     int baud_; //!< The baud rate that Ursa communicates at. This is always 115200.
     bool connected_; //!< A boolean signaling if the Interface successfully connected.
     bool responsive_; //!< A boolean signaling if the Ursa has responded to the Interface.
+    boost::atomic<uint64_t> last_rx_ns_; //!< The monotonic time bytes were last received, of any kind. Written by the reader thread.
+    uint64_t silence_ns_; //!< The silence after which alive() probes the Ursa.
+    uint64_t probe_ns_; //!< The monotonic time of the outstanding probe, or 0.
     bool acquiring_;    //!< A boolean which marks when the ursa is acquiring.
     bool gmMode_;       //!< A boolean which reports if the ursa is in GM mode.
-    serial::Serial *serial_; //!< A serial object which controls comunication to the serial port.
-    std::stringstream tx_buffer_;   //!< A String buffer for output commands.
-    std::deque<uint8_t> rx_buffer_; //!< A Character buffer for incoming data.
+    Transport *transport_; //!< The transport which controls comunication to the serial port. Owned by the Interface.
+    boost::array<uint8_t, rx_buffer_size> rx_buffer_; //!< A Character buffer for incoming data. Bulk reads land here directly.
+    size_t rx_length_; //!< The number of bytes in rx_buffer_.
+    uint64_t rx_time_ns_; //!< The wall clock time of the last read, used to time events in list mode.
 
     float battV_; //!< The current Battery voltage. This is NOT the 12v input voltage.
 
     int ramp_;      //!< The ramp time in seconds per 100 volts.
     int voltage_;   //!< The currently set high voltage.
 
-    boost::mutex array_mutex_; //!< The locking mechanism for the spectrum array.
-    boost::array<uint32_t, 4096> pulses_; //!< An array of the pulses received in each bin. This consists of 4096 32 bit unsigned integers.
+    boost::mutex array_mutex_; //!< The locking mechanism for the spectrum array, and for the per event consumers below, which do no locking of their own.
+    boost::array<SpectrumBuffer, 2> spectra_; //!< The buffer being decoded into and the one the last swapSpectra() retired.
+    SpectrumBuffer *spectrum_; //!< The buffer processData() counts into. Only changed with array_mutex_ held.
+    boost::mutex swap_mutex_; //!< Serializes swapSpectra(), which empties the retired buffer without array_mutex_, and the clears.
+    boost::array<boost::array<uint64_t, 4096>, 2> past_; //!< The sum of the intervals swapSpectra() has retired, and its next value being built.
+    boost::array<uint64_t, 4096> *past_total_; //!< The entry of past_ the cumulative spectrum adds. Only changed with array_mutex_ held.
+    SpectrumBuffer *retiring_; //!< The buffer swapSpectra() retired until it is in past_total_, else NULL.
+    uint64_t interval_sequence_; //!< The intervals taken by swapSpectra().
+    uint64_t interval_start_ns_; //!< The wall time the current interval started, or 0 before the first acquisition.
+
+    Logger log_; //!< The asynchronous logger all driver messages are written through.
+
+    AlarmEngine alarm_; //!< The alarm tests run on each decoded event. Protected by array_mutex_.
+    boost::array<bool, 2> alarm_outputs_; //!< The last state written to each alarm output.
+
+    ListModeBuffer list_mode_; //!< The batches of decoded events for list mode. Protected by array_mutex_.
+
+    AcquisitionSettings settings_; //!< The settings last sent to the Ursa.
+    uint32_t epoch_; //!< The configuration epoch, incremented by every reconfigure() that changes a setting. Protected by array_mutex_.
+
+    ShmWriter shm_; //!< The shared memory ring for consumers outside ROS. Protected by array_mutex_.
+    uint64_t shm_period_ns_; //!< The time between spectrum snapshots in the ring.
+    uint64_t shm_last_ns_; //!< The monotonic time of the last snapshot.
+
+    RoiCounter rois_; //!< The region of interest counters updated by every decoded event. Protected by array_mutex_.
+    DoseCounter dose_; //!< The dose accumulated from every decoded event. Protected by array_mutex_.
+
+    boost::thread reader_; //!< The reader thread, when one has been started.
+    boost::atomic<bool> reader_stop_; //!< Set to end the reader thread.
+    RealtimeOptions reader_options_; //!< The options the reader thread was started with.
+    ReaderStats reader_stats_; //!< How promptly read() has been called. Protected by array_mutex_.
+    uint64_t last_read_ns_; //!< The monotonic time the last read() started, or 0.
+    uint64_t last_fetch_ns_; //!< The monotonic time read() last emptied the transport, or 0.
+    uint64_t ready_ns_; //!< The monotonic time the reader thread saw data waiting, or 0 when read() is polled.
+    uint64_t rx_arrival_ns_; //!< The monotonic time the first byte of the current read had arrived by.
 
     /**
      * \brief Private function which checks to see if Ursa will respond to communication.
+     *
+     * This stops acquiring, so while acquiring it returns alive() instead.
      * @return True: communication verified. False: failed to receive correct response.
      */
     bool checkComms();
 
-    void transmit(); //!< \brief Private utility function for flushing the transmit buffer down the line.
+    /** \brief Private utility function for writing an encoded command down the line.
+     * @param cmd The command built from the table in ursa_commands.h.
+     * @param settle Wait 100 ms after writing for the Ursa to act on the command.
+     */
+    void transmit(const Command &cmd, bool settle = true);
+    /** \brief Private utility function which reads a text response.
+     * @param size The most characters to read. The read waits for this many until the timeout.
+     * @return The characters read.
+     */
+    std::string readString(size_t size);
+    /** \brief Private utility function which reads raw bytes without allocating.
+     * @param buffer The destination.
+     * @param size The most bytes to read. The read waits for this many until the timeout.
+     * @return The number of bytes read.
+     */
+    size_t readBytes(uint8_t *buffer, size_t size);
+    //! \brief Takes each frame processData() decodes. Called with array_mutex_ held.
+    struct FrameHandler
+    {
+      Interface &ursa; //!< The interface decoding.
+      SpectrumBuffer &spectrum; //!< The buffer being decoded into.
+      uint64_t byte_ns; //!< The time one byte takes at the baud rate.
+
+      void event(size_t end, uint16_t channel, uint8_t counts); //!< \brief Counts an event into the spectrum and every event consumer.
+      void battery(uint16_t reading); //!< \brief Passes a battery reading to processBatt().
+      void dropped(uint32_t bytes); //!< \brief Counts bytes dropped while searching for a sync byte.
+    };
+
     void processData(); //!< \brief Private utility function which processes incoming data.
     void processBatt(uint16_t input); //!< \brief Private utility function which processes a battery voltage message if in acquire mode.
+    void foldSpectra(); //!< \brief Private utility function which adds the pulses into the totals of the decoded buffer and clears them.
+    /** \brief Private utility function which reads a range of the cumulative spectrum. Call with array_mutex_ held.
+     * @param first The first channel.
+     * @param channels The channels to read.
+     * @param bins Filled with the 64 bit counts.
+     */
+    void readCumulative(size_t first, size_t channels, uint64_t *bins);
+    void applyAlarmOutputs(); //!< \brief Private utility function which writes alarm outputs the AlarmEngine changed.
+    /** \brief Private utility function which stops acquiring and decodes the data still in flight.
+     *
+     * Faster than stopAcquire(), which waits a full read timeout for data.  Falls back to stopAcquire()
+     * if the Ursa does not go quiet.
+     */
+    void quiesce();
+    void publishSnapshot(); //!< \brief Private utility function which writes a spectrum snapshot to the shared memory ring when one is due.
+    void readerLoop(); //!< \brief Private utility function run by the reader thread. Reads whenever data is waiting.
+    void updateDoseResponse(); //!< \brief Private utility function which rebuilds the dose weights if the gain or bit mode changed.
+    /** \brief Private utility function which writes one alarm output without waiting for it to settle.
+     * @param line The alarm output, 0 or 1.
+     * @param enable The new state.
+     */
+    void writeAlarmOutput(size_t line, bool enable);
 
   public:
     /**
      * \brief Interface constructor.
      * @param port The port that the Ursa hardware is connected to.
      * @param baud Baud rate to communicate to the Ursa with.
+     * @param transport The transport to open the port with, or NULL for a serial port. The Interface takes ownership.
      */
-    Interface(const char *port, int baud);
+    Interface(const char *port, int baud, Transport *transport = NULL);
     ~Interface(); //!< \brief Interface destructor.
 
+    /** \brief Sets the destination of the driver's log messages.
+     * @param sink The new sink or NULL to write to std::cout. The Interface does not take ownership.
+     */
+    void setLogSink(LogSink *sink) {
+      log_.setSink(sink);
+    }
+    /** \brief Returns the counters describing the cost of logging.
+     * @return The Logger's LogStats.
+     */
+    LogStats getLogStats() const {
+      return (log_.stats());
+    }
+
     void read(); //!< \brief A utility function to flush the input buffer and process the data.
+    /**
+     * \brief Starts a thread which calls read() as soon as data is waiting, instead of on a timer.
+     *
+     * Start it after startAcquire().  The thread only reads, so commands which read a reply must not be sent
+     * while it runs; stopAcquire() and reconfigure() stop it themselves and reconfigure() restarts it.
+     * @param options The affinity, priority and memory locking of the thread.
+     * @return False if a setting could not be applied. The thread still runs without it.
+     */
+    bool startReader(const RealtimeOptions &options);
+    void stopReader(); //!< \brief Stops the reader thread, waiting at most one read timeout for it.
+    //! \brief Returns true while the reader thread runs.
+    bool readerRunning() {
+      return (reader_.joinable());
+    }
+    /** \brief Returns how promptly read() has been called since the last reset.
+     * @param reset Start the counters again after copying them.
+     * @return The counters.
+     */
+    ReaderStats getReaderStats(bool reset);
+    /** \brief Replaces the alarm settings.  The background is learned again.
+     * @param config The new settings. AlarmConfig::enable must be set for the tests to run.
+     */
+    void setAlarmConfig(const AlarmConfig &config);
+    /** \brief Moves the alarm events raised or cleared since the last call into a vector.
+     * @param events Events are appended to this vector.
+     */
+    void getAlarmEvents(std::vector<AlarmEvent> *events);
+    /** \brief Enables or disables list mode, in which every decoded event is also recorded in batches.
+     * @param enable Record events.
+     * @param batch_size The events per batch, at most event_batch_capacity.
+     * @param max_latency The longest an event waits before its batch is closed, in seconds.
+     */
+    void setListMode(bool enable, size_t batch_size, double max_latency);
+    /** \brief Copies out the next complete batch of events.
+     * @param batch Filled with the batch.
+     * @return False if no batch is ready.
+     */
+    bool getEvents(EventBatch *batch);
     /** \brief Access function which returns by reference a copy of the spectra data.
      * @param array The array to fill with spectra data.
+     * @param epoch If not NULL, filled with the configuration epoch the spectrum belongs to.
+     */
+    void getSpectra(boost::array<uint32_t, 4096>* array, uint32_t *epoch = NULL);
+    /** \brief Access function which returns by reference a copy of the spectra data as 64 bit counts.
+     *
+     * Unlike getSpectra() a bin can not wrap during a long dwell.
+     * @param array The array to fill with spectra data.
+     * @param epoch If not NULL, filled with the configuration epoch the spectrum belongs to.
+     */
+    void getWideSpectra(boost::array<uint64_t, 4096>* array,
+                        uint32_t *epoch = NULL);
+    /** \brief Copies part of the spectrum as 64 bit counts, optionally summed into coarser bins.
+     *
+     * The range is read under the same lock as getSpectra(), so it is as consistent, but only the
+     * channels in the range are touched.
+     * @param first The first channel.
+     * @param channels The channels to read. Clipped to the end of the spectrum.
+     * @param group The channels summed into each bin. The last bin holds what is left of the range.
+     * @param bins Filled with the sums. Must hold spectrumViewSize() bins.
+     * @param epoch If not NULL, filled with the configuration epoch the spectrum belongs to.
+     * @return The number of bins filled.
+     */
+    size_t getSpectrumView(size_t first, size_t channels, size_t group,
+                           uint64_t *bins, uint32_t *epoch = NULL);
+    /** \brief Returns the number of bins getSpectrumView() fills for a range.
+     * @param first The first channel.
+     * @param channels The channels to read.
+     * @param group The channels summed into each bin. Zero is taken as one.
      */
-    void getSpectra(boost::array<uint32_t, 4096>* array);
-    void clearSpectra(); //!< \brief A utility function to clear the internal Interface::pulses_ array.
+    static size_t spectrumViewSize(size_t first, size_t channels,
+                                   size_t group);
+    void clearSpectra(); //!< \brief A utility function to clear the spectrum. The next interval starts now.
+    /** \brief Takes the spectrum accumulated since the last swap or clear and starts a new interval.
+     *
+     * Unlike getWideSpectra() followed by clearSpectra() no event can fall between the two, and the decoder
+     * is only held up while two buffers are exchanged.  The cumulative spectrum read by getSpectra(),
+     * getWideSpectra(), getSpectrumView() and the shared memory ring keeps every interval taken, so only
+     * clearSpectra() or a clearing reconfigure() resets it.
+     * @param array Filled with the counts of the interval.
+     * @param interval If not NULL, filled with the interval's sequence number, times and total.
+     */
+    void swapSpectra(boost::array<uint64_t, 4096>* array,
+                     SpectrumInterval *interval = NULL);
 
-    void connect(); //!< \brief Opens the serial port and attempts to confirm communication to the Ursa.
+    void connect(); //!< \brief Opens the port and attempts to confirm communication to the Ursa.
     /** \brief A utility function to check the status of the connection to the Ursa.
-     * @return Returns true if Interface::connected_ and Interface::responsive_ are true.
+     * @return Returns true if Interface::connected_ is true and alive() reports the Ursa responsive.
      *
-     * The function will attempt to check responsiveness if Interface::responsive_ is false using
-     * the Interface::checkComms() function.
+     * Responsiveness comes from the data stream where possible, so this never stops an acquisition.
      */
     bool connected() {
       if (connected_)
-      {
-        if (responsive_)
-          return (true);
-        else
-          return (checkComms());
-      }
+        return (alive());
       else
         return (false);
     }
+    /** \brief Checks the Ursa is responsive, from the data stream where possible.
+     *
+     * Any bytes received within the silence timeout show the Ursa is alive: events, battery frames and
+     * GM count replies all count.  Only when the line has been silent that long is the Ursa probed.
+     * @return False once a probe has gone unanswered.
+     */
+    bool alive();
+    /** \brief Sets how long the line can be silent before alive() probes the Ursa.
+     * @param seconds The silence timeout in seconds.
+     */
+    void setSilenceTimeout(double seconds) {
+      silence_ns_ = uint64_t(seconds * 1e9);
+    }
+    //! \brief Returns the seconds since bytes were last received.
+    double silence() {
+      uint64_t now = monotonicNanos();
+      uint64_t last = last_rx_ns_;
+      return (now > last ? (now - last) / 1e9 : 0);
+    }
     //! \brief A utility function to check if the driver is acquiring.
     bool acquiring() {
       return (acquiring_);
@@ -178,7 +430,7 @@ namespace ursa
     void stopASCII(); //!< \brief Switches Ursa out of ASCII mode.
     /** \brief Requests the serial number of the connected Ursa.
      *
-     * @return The serial number as a int.
+     * @return The serial number as a int, or -1 if it could not be read.
      */
     int requestSerialNumber();
 
@@ -221,6 +473,65 @@ namespace ursa
      * @param enable Enable or disabel as a bool.
      */
     void setAlarm1(bool enable);
+
+    /**
+     * \brief Changes acquisition settings while acquiring, as one stop, apply, restart transaction.
+     * @param settings The settings to change.  Settings equal to those last sent are skipped.
+     * @param clear Clear the spectrum when the epoch changes so it only holds counts from the new settings.
+     * @return The new epoch, the settings applied and the dead time.
+     */
+    ReconfigureResult reconfigure(const AcquisitionSettings &settings,
+                                  bool clear);
+    /**
+     * \brief Publishes spectrum snapshots and decoded events into a POSIX shared memory ring. See ursa::ShmReader.
+     * @param name The shared memory object name, e.g. "/ursa". An empty name closes the ring.
+     * @param event_capacity The events the ring holds.
+     * @param snapshot_period The seconds between spectrum snapshots. Snapshots are taken by read().
+     * @return False if the ring could not be created.
+     */
+    bool setSharedMemory(const std::string &name, uint32_t event_capacity,
+                         double snapshot_period);
+    /**
+     * \brief Replaces the regions of interest counted as events are decoded, and clears their counts.
+     * @param rois The inclusive channel ranges, at most max_rois.
+     * @return False if the ranges are invalid. The previous regions are kept.
+     */
+    bool setRois(const std::vector<ChannelRange> &rois);
+    /**
+     * \brief Copies out the cumulative counts in each region of interest.
+     *
+     * The counts only grow until the next setRois(), clearSpectra() does not reset them.  Take rates from
+     * the difference between two calls over the difference of their times.
+     * @param counts Filled with the counts and the read time of the last data counted.
+     * @param epoch If not NULL, filled with the configuration epoch.
+     */
+    void getRoiCounts(RoiCounts *counts, uint32_t *epoch = NULL);
+    /**
+     * \brief Replaces the dose calibration applied to every decoded event, and clears the dose.
+     *
+     * The channel weights are rebuilt whenever the gain or bit mode is changed through the Interface.  Until
+     * a gain has been set, e.g. after loadPrevSettings(), no dose is accumulated.
+     * @param calibration The energy calibration and G(E) function.
+     * @return False if the calibration is invalid. The previous one is kept.
+     */
+    bool setDoseCalibration(const DoseCalibration &calibration);
+    /**
+     * \brief Copies out the cumulative dose.
+     *
+     * Like getRoiCounts() the dose only grows, so take rates from the difference between two calls.
+     * @param counts Filled with the dose, its variance and the read time of the last data counted.
+     * @param epoch If not NULL, filled with the configuration epoch.
+     */
+    void getDose(DoseCounts *counts, uint32_t *epoch = NULL);
+    //! \brief Returns the settings last sent to the Ursa. Settings it was not sent are marked not set.
+    AcquisitionSettings getSettings() {
+      return (settings_);
+    }
+    //! \brief Returns the configuration epoch.
+    uint32_t getEpoch() {
+      boost::lock_guard<boost::mutex> lock(array_mutex_);
+      return (epoch_);
+    }
   };
 
 }
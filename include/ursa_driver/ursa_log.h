@@ -0,0 +1,203 @@
+/** The header file for the ursa::Logger class.
+ \file      ursa_log.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef URSA_LOG_H_
+#define URSA_LOG_H_
+
+#include <boost/atomic.hpp>
+#include <boost/array.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <stdint.h>
+#include <cstdarg>
+#include <iostream>
+
+namespace ursa
+{
+  //! \brief The severity of a log message.
+  enum log_level
+  {
+    LOG_DEBUG = 0, //!< Debugging output. Only produced with DEBUG_ defined.
+    LOG_INFO,      //!< Informational messages.
+    LOG_WARN,      //!< Warnings, the driver can continue.
+    LOG_ERROR      //!< Errors, the requested operation failed.
+  };
+
+  /** \brief Message classes used for rate limiting and aggregation.
+   *
+   * Every class has its own rate limit.  Aggregated classes are never queued per occurrence,
+   * instead Logger::count() adds to a counter which is reported once per interval.
+   */
+  enum log_class
+  {
+    LOG_GENERAL = 0,   //!< Command and status messages.
+    LOG_DECODE,        //!< Messages produced while decoding incoming data.
+    LOG_DROPPED_BYTES, //!< Aggregated: bytes dropped while searching for a sync byte.
+    LOG_CLASS_COUNT    //!< The number of message classes.
+  };
+
+  //! \brief Interface for the destination of log messages.
+  class LogSink
+  {
+  public:
+    virtual ~LogSink() {
+    }
+    /** \brief Writes one message.  Only ever called from one thread at a time.
+     * @param level The severity of the message.
+     * @param msg The null terminated message without a trailing new line.
+     */
+    virtual void write(log_level level, const char *msg) = 0;
+  };
+
+  /** \brief A LogSink which writes to a std::ostream.
+   *
+   * Messages are prefixed with the level as "INFO: " etc.  This is the default sink.
+   */
+  class StreamLogSink : public LogSink
+  {
+  private:
+    std::ostream &stream_; //!< The stream messages are written to.
+
+  public:
+    StreamLogSink(std::ostream &stream = std::cout) :
+        stream_(stream) {
+    }
+    void write(log_level level, const char *msg);
+  };
+
+  //! \brief Counters describing the cost and behaviour of a Logger.
+  struct LogStats
+  {
+    uint64_t enqueued;   //!< Messages placed on the queue.
+    uint64_t written;    //!< Messages written to the sink, including aggregate reports.
+    uint64_t suppressed; //!< Messages discarded by rate limiting.
+    uint64_t overflowed; //!< Messages discarded because the queue was full.
+    uint64_t aggregated; //!< Occurrences folded into aggregate reports.
+    uint64_t enqueue_ns; //!< Total time spent formatting and queuing messages in nanoseconds.
+    uint64_t max_enqueue_ns; //!< The longest single call to queue a message in nanoseconds.
+  };
+
+  /** \brief An asynchronous, rate limited logger.
+   *
+   * Callers format into a fixed size record which is pushed on a lock free queue.
+   * A background thread drains the queue into the LogSink, resets the rate limits and reports
+   * aggregated counters once per interval.  Neither the producer nor the flusher allocate after construction.
+   */
+  class Logger
+  {
+  public:
+    static const size_t max_message_length = 192; //!< Longer messages are truncated.
+    static const size_t queue_length = 256; //!< The number of messages which can be waiting to be written.
+
+  private:
+    //! \brief A queued message.  Must be trivially copyable for the lock free queue.
+    struct Record
+    {
+      uint8_t level;
+      char text[max_message_length];
+    };
+
+    boost::lockfree::queue<Record, boost::lockfree::capacity<queue_length> > queue_; //!< Messages waiting for the flusher.
+
+    boost::mutex sink_mutex_; //!< Serializes writes to the sink.
+    StreamLogSink default_sink_; //!< Used when no sink is set.
+    LogSink *sink_;            //!< The current sink. Not owned.
+
+    boost::array<uint32_t, LOG_CLASS_COUNT> limits_; //!< Messages allowed per class per interval. Zero is unlimited.
+    boost::array<boost::atomic<uint32_t>, LOG_CLASS_COUNT> class_counts_; //!< Messages per class in this interval.
+    boost::array<boost::atomic<uint64_t>, LOG_CLASS_COUNT> class_suppressed_; //!< Messages per class suppressed in this interval.
+    boost::array<boost::atomic<uint64_t>, LOG_CLASS_COUNT> aggregates_; //!< Aggregated counts in this interval.
+
+    boost::atomic<uint64_t> enqueued_;
+    boost::atomic<uint64_t> written_;
+    boost::atomic<uint64_t> suppressed_;
+    boost::atomic<uint64_t> overflowed_;
+    boost::atomic<uint64_t> aggregated_;
+    boost::atomic<uint64_t> enqueue_ns_;
+    boost::atomic<uint64_t> max_enqueue_ns_;
+
+    uint64_t interval_ns_;       //!< The rate limiting and aggregation interval.
+    uint64_t interval_start_ns_; //!< Monotonic time the current interval started.
+
+    boost::thread flusher_; //!< The background thread draining the queue.
+
+    void flushLoop(); //!< \brief The body of the flusher thread.
+    void drain(); //!< \brief Writes all queued messages to the sink.
+    void endInterval(uint64_t now); //!< \brief Reports aggregates and suppressions then resets the rate limits.
+    void writeSink(log_level level, const char *msg); //!< \brief Writes one message to the sink.
+
+  public:
+    Logger(); //!< \brief Logger constructor. Starts the flusher thread.
+    ~Logger(); //!< \brief Logger destructor. Stops the flusher thread and writes any queued messages.
+
+    /** \brief Sets the destination for log messages.
+     * @param sink The new sink or NULL to write to std::cout. The Logger does not take ownership.
+     */
+    void setSink(LogSink *sink);
+    /** \brief Sets the number of messages of a class allowed per interval.
+     * @param cls The message class.
+     * @param max_per_interval The limit. Zero removes the limit.
+     */
+    void setRateLimit(log_class cls, uint32_t max_per_interval);
+    /** \brief Sets the rate limiting and aggregation interval.
+     * @param seconds The interval in seconds.
+     */
+    void setInterval(double seconds);
+
+    /** \brief Formats and queues a message.  Safe to call from any thread.
+     *
+     * The cost is bounded by the fixed record size.  Messages over the class rate limit are only counted.
+     * @param level The severity of the message.
+     * @param cls The message class used for rate limiting.
+     * @param format A printf style format string.
+     */
+    void write(log_level level, log_class cls, const char *format, ...)
+        __attribute__((format(printf, 4, 5)));
+    //! \brief va_list version of Logger::write().
+    void vwrite(log_level level, log_class cls, const char *format, va_list args);
+
+    void debug(const char *format, ...) __attribute__((format(printf, 2, 3))); //!< \brief Queues a LOG_GENERAL debug message.
+    void info(const char *format, ...) __attribute__((format(printf, 2, 3))); //!< \brief Queues a LOG_GENERAL info message.
+    void warn(const char *format, ...) __attribute__((format(printf, 2, 3))); //!< \brief Queues a LOG_GENERAL warning.
+    void error(const char *format, ...) __attribute__((format(printf, 2, 3))); //!< \brief Queues a LOG_GENERAL error.
+
+    /** \brief Adds to an aggregated counter.  This is a single atomic add and is safe in the decode loop.
+     * @param cls The aggregated message class.
+     * @param n The number of occurrences.
+     */
+    void count(log_class cls, uint32_t n) {
+      aggregates_[cls].fetch_add(n, boost::memory_order_relaxed);
+    }
+
+    void flush(); //!< \brief Synchronously writes every queued message and the current aggregates.
+    LogStats stats() const; //!< \brief Returns the counters describing the Logger's behaviour.
+  };
+
+}
+
+#endif /* URSA_LOG_H_ */
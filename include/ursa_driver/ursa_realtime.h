@@ -0,0 +1,78 @@
+/** The header file for the real time settings of the reader thread.
+ \file      ursa_realtime.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#ifndef URSA_REALTIME_H_
+#define URSA_REALTIME_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <cstddef>
+
+namespace ursa
+{
+  //! \brief How the reader thread is scheduled.
+  struct RealtimeOptions
+  {
+    int cpu; //!< The core to pin the reader thread to, or -1 to leave it free.
+    int priority; //!< The SCHED_FIFO priority from 1 to 99, or 0 to keep the normal scheduler.
+    bool lock_memory; //!< Lock the process's memory with mlockall() and prefault the reader's stack.
+
+    RealtimeOptions(); //!< \brief RealtimeOptions constructor. Nothing is changed by default.
+  };
+
+  //! \brief Counters describing how promptly the stream has been read.
+  struct ReaderStats
+  {
+    uint64_t reads; //!< The calls to Interface::read().
+    uint64_t max_gap_ns; //!< The longest time between the start of two reads.
+    uint64_t total_gap_ns; //!< The sum of the times between reads. Divide by reads - 1 for the mean.
+    size_t max_backlog; //!< The most bytes one read found waiting.
+    uint64_t full_reads; //!< Reads which filled the receive buffer, so the stream had backed up.
+    bool threaded; //!< True if the reads were made by the reader thread.
+    bool pinned; //!< True if the reader thread is pinned to a core.
+    bool fifo; //!< True if the reader thread runs under SCHED_FIFO.
+    bool locked; //!< True if the process's memory is locked.
+
+    ReaderStats(); //!< \brief ReaderStats constructor. All counters start at zero.
+  };
+
+  /** \brief Applies real time options to a thread.
+   *
+   * Each setting is tried even if an earlier one fails, since SCHED_FIFO and mlockall() need privileges
+   * pinning does not.  Memory locking applies to the whole process.
+   * @param thread The thread to pin and schedule.
+   * @param options The settings to apply.
+   * @param stats The pinned, fifo and locked flags are set for the settings which took effect.
+   * @return 0, or the errno of the first setting which failed.
+   */
+  int applyRealtime(pthread_t thread, const RealtimeOptions &options,
+                    ReaderStats *stats);
+  //! \brief Writes to every page of a stack buffer on the calling thread, so later calls do not fault.
+  void prefaultStack();
+}
+
+#endif /* URSA_REALTIME_H_ */
@@ -0,0 +1,143 @@
+/** The header file for the scoped timeline tracer.
+ \file      ursa_trace.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef URSA_TRACE_H_
+#define URSA_TRACE_H_
+
+#include <ursa_driver/ursa_clock.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//! \brief Times the rest of the enclosing scope as one span. Costs one atomic load when tracing is off.
+#define URSA_TRACE_SCOPE(category, name) \
+  ursa::TraceScope URSA_TRACE_JOIN(trace_scope_, __LINE__)(category, name)
+//! \brief As URSA_TRACE_SCOPE() with a printf style detail shown in the span's arguments.
+#define URSA_TRACE_SCOPE_DETAIL(category, name, ...) \
+  ursa::TraceScope URSA_TRACE_JOIN(trace_scope_, __LINE__)(category, name); \
+  URSA_TRACE_JOIN(trace_scope_, __LINE__).detail(__VA_ARGS__)
+#define URSA_TRACE_JOIN(a, b) URSA_TRACE_JOIN2(a, b)
+#define URSA_TRACE_JOIN2(a, b) a##b
+
+namespace ursa
+{
+  //! \brief One recorded span or instant.
+  struct TraceEvent
+  {
+    static const size_t max_detail_length = 48; //!< Longer details are truncated.
+
+    const char *category; //!< A string literal naming the component, e.g. "driver".
+    const char *name; //!< A string literal naming the phase or command.
+    uint64_t start_ns; //!< The monotonic start time.
+    uint64_t duration_ns; //!< The length of the span. Instants have none.
+    bool instant; //!< True for a point in time rather than a span.
+    uint32_t thread; //!< The kernel thread id.
+    char detail[max_detail_length]; //!< Extra information, may be empty.
+  };
+
+  /** \brief Records spans with monotonic timestamps and writes them as Chrome trace JSON.
+   *
+   * There is one Tracer per process so the driver and the node share a timeline.  Tracing is off until
+   * start() is called.  Events are kept in memory until write(); once the capacity is reached further
+   * events are counted and dropped.  The resulting file loads in chrome://tracing and Perfetto.
+   */
+  class Tracer
+  {
+  private:
+    boost::atomic<bool> enabled_; //!< True between start() and stop().
+    boost::mutex mutex_; //!< Protects events_.
+    std::vector<TraceEvent> events_; //!< The recorded events.
+    size_t capacity_; //!< The most events kept.
+    uint64_t dropped_; //!< Events not kept because the capacity was reached.
+
+    Tracer();
+
+  public:
+    static Tracer &instance(); //!< \brief Returns the process wide tracer.
+
+    /** \brief Starts recording, discarding anything already recorded.
+     * @param capacity The most events kept. The memory is reserved here.
+     */
+    void start(size_t capacity = 65536);
+    void stop(); //!< \brief Stops recording. Recorded events are kept for write().
+    //! \brief Returns true while recording.
+    bool enabled() const {
+      return (enabled_.load(boost::memory_order_relaxed));
+    }
+
+    //! \brief Records a finished event.
+    void record(const TraceEvent &event);
+    /** \brief Records a point in time, e.g. the first data received.
+     * @param category A string literal naming the component.
+     * @param name A string literal naming the instant.
+     */
+    void instant(const char *category, const char *name);
+
+    /** \brief Writes every recorded event as Chrome trace JSON.
+     *
+     * Times are in microseconds from the first event.
+     * @param path The file to write.
+     * @return False if the file could not be written.
+     */
+    bool write(const std::string &path);
+  };
+
+  //! \brief Records the lifetime of a scope as one span. Use URSA_TRACE_SCOPE().
+  class TraceScope
+  {
+  private:
+    TraceEvent event_; //!< The span, filled in when tracing is on.
+    bool active_; //!< True if tracing was on when the scope was entered.
+
+  public:
+    TraceScope(const char *category, const char *name) :
+        active_(Tracer::instance().enabled()) {
+      if (active_)
+      {
+        event_.category = category;
+        event_.name = name;
+        event_.instant = false;
+        event_.detail[0] = '\0';
+        event_.start_ns = monotonicNanos();
+      }
+    }
+    ~TraceScope() {
+      if (active_)
+      {
+        event_.duration_ns = monotonicNanos() - event_.start_ns;
+        Tracer::instance().record(event_);
+      }
+    }
+    //! \brief Sets the span's detail with a printf style format. Does nothing when tracing is off.
+    void detail(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  };
+}
+
+#endif /* URSA_TRACE_H_ */
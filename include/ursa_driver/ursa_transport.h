@@ -0,0 +1,248 @@
+/** The transports the ursa::Interface class talks to the hardware through.
+ \file      ursa_transport.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef URSA_TRANSPORT_H_
+#define URSA_TRANSPORT_H_
+
+#include <serial/serial.h>
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ursa
+{
+  /** \brief A byte stream to and from the Ursa.
+   *
+   * The Interface writes commands and reads responses and acquisition data through a Transport.
+   * Blocking calls wait at most the timeout set with setTimeout().
+   */
+  class Transport
+  {
+  public:
+    virtual ~Transport() {
+    }
+
+    /** \brief Opens the port.
+     * @param port The device to open.
+     * @param baud The baud rate.
+     * @return True if the port is open.
+     */
+    virtual bool open(const std::string &port, int baud) = 0;
+    virtual bool isOpen() = 0; //!< \brief Returns true if the port is open.
+    virtual void close() = 0; //!< \brief Closes the port.
+    /** \brief Sets the timeout of the blocking calls.
+     * @param milliseconds The timeout in milliseconds.
+     */
+    virtual void setTimeout(uint32_t milliseconds) = 0;
+
+    virtual size_t available() = 0; //!< \brief Returns the number of bytes waiting to be read.
+    virtual bool waitReadable() = 0; //!< \brief Waits up to the timeout for data. Returns true if there is data.
+    /** \brief Reads exactly size bytes unless the timeout expires first.
+     * @return The number of bytes read.
+     */
+    virtual size_t read(uint8_t *buffer, size_t size) = 0;
+    /** \brief Reads whatever is waiting, up to size bytes, without waiting for more.
+     *
+     * This is the bulk read used while acquiring. A full buffer means more may be waiting.
+     * @return The number of bytes read, 0 if nothing was waiting.
+     */
+    virtual size_t readSome(uint8_t *buffer, size_t size) = 0;
+    /** \brief Writes a buffer.
+     * @return The number of bytes written.
+     */
+    virtual size_t write(const uint8_t *data, size_t size) = 0;
+    virtual void flush() = 0; //!< \brief Waits until all written data has been sent.
+  };
+
+  //! \brief The original transport through the serial library.
+  class SerialTransport : public Transport
+  {
+  private:
+    serial::Serial serial_; //!< The serial port.
+
+  public:
+    //! Throws serial::IOException and the other serial exceptions on a failed read or write, as the serial library does.
+    bool open(const std::string &port, int baud);
+    bool isOpen();
+    void close();
+    void setTimeout(uint32_t milliseconds);
+    size_t available();
+    bool waitReadable();
+    size_t read(uint8_t *buffer, size_t size);
+    size_t readSome(uint8_t *buffer, size_t size);
+    size_t write(const uint8_t *data, size_t size);
+    void flush();
+  };
+
+  /** \brief The parts of a transport common to any file descriptor.
+   *
+   * read() and write() wait with poll() so they work on blocking and non-blocking descriptors.
+   * available() uses FIONREAD, which ttys and sockets both support.
+   */
+  class FdTransport : public Transport
+  {
+  protected:
+    int fd_; //!< The open descriptor, or -1.
+    int timeout_ms_; //!< The timeout of the blocking calls.
+    bool toggle_blocking_; //!< Switch to non-blocking for the duration of read(), for a blocking descriptor.
+    bool zero_is_eof_; //!< A read of zero bytes means the peer closed, as on a socket, so it and read errors close the descriptor. On a tty it only means no data.
+    bool socket_; //!< Write with send() and MSG_NOSIGNAL, so a closed peer is an EPIPE error that closes the descriptor rather than a SIGPIPE.
+
+    /** \brief Waits for the descriptor to become readable.
+     * @param milliseconds The longest time to wait.
+     * @return True if there is data.
+     */
+    bool poll(int milliseconds);
+
+  public:
+    FdTransport(); //!< \brief FdTransport constructor. The transport starts closed.
+    ~FdTransport(); //!< \brief Closes the descriptor.
+
+    bool isOpen();
+    void close();
+    void setTimeout(uint32_t milliseconds);
+    size_t available();
+    bool waitReadable();
+    size_t read(uint8_t *buffer, size_t size);
+    size_t readSome(uint8_t *buffer, size_t size);
+    size_t write(const uint8_t *data, size_t size);
+    void flush();
+  };
+
+  /** \brief A transport that opens the tty directly in raw mode.
+   *
+   * readSome() is a single read() into the caller's buffer. With the default VMIN = 0 and VTIME = 0 it returns
+   * at once with whatever the kernel holds.  A VMIN above 0 makes readSome() block in the kernel until that
+   * many bytes have arrived, or VTIME tenths of a second pass between bytes, which suits a dedicated reader
+   * thread but will stall a polled one.
+   *
+   * Where the driver supports it ASYNC_LOW_LATENCY is set, which on FTDI adapters drops the latency timer
+   * from 16 ms to 1 ms.
+   */
+  class TtyTransport : public FdTransport
+  {
+  private:
+    uint8_t vmin_; //!< The termios VMIN.
+    uint8_t vtime_; //!< The termios VTIME in tenths of a second.
+    bool want_low_latency_; //!< Try to set ASYNC_LOW_LATENCY.
+    bool low_latency_; //!< True if ASYNC_LOW_LATENCY was set.
+
+  public:
+    /** \brief TtyTransport constructor.
+     * @param vmin The termios VMIN used by readSome().
+     * @param vtime The termios VTIME used by readSome(), in tenths of a second.
+     * @param low_latency Set ASYNC_LOW_LATENCY when the port is opened.
+     */
+    TtyTransport(uint8_t vmin = 0, uint8_t vtime = 0, bool low_latency = true);
+
+    //! Returns false if the port can not be opened or configured, or the baud rate is not a standard rate.
+    bool open(const std::string &port, int baud);
+    void close();
+    void flush();
+
+    //! \brief Returns true if ASYNC_LOW_LATENCY is set on the open port.
+    bool lowLatency() const {
+      return (low_latency_);
+    }
+  };
+
+  /** \brief A transport to a serial to Ethernet converter in raw TCP mode.
+   *
+   * The socket is non-blocking with Nagle disabled, so a one byte command is sent at once and readSome()
+   * never waits.  The baud rate is the converter's line rate; it is not sent anywhere.  A write after the
+   * converter drops the connection closes the transport instead of raising SIGPIPE.
+   */
+  class TcpTransport : public FdTransport
+  {
+  public:
+    TcpTransport(); //!< \brief TcpTransport constructor. The transport starts closed.
+
+    //! Port is "host:port". Returns false if the address does not resolve or the connection fails within the timeout.
+    bool open(const std::string &port, int baud);
+  };
+
+  /** \brief A transport which replays a capture of the Ursa's raw output.
+   *
+   * The capture is served only while acquiring, as the Ursa would: StartAcquire starts it and StopAcquire
+   * stops it, with bytes becoming available at the baud rate times the speed.  CheckComms is answered so
+   * Interface::connect() succeeds.  Other commands are accepted and ignored.  Only the first byte of each
+   * write is treated as a command, which is how the Interface writes them.
+   */
+  class ReplayTransport : public Transport
+  {
+  private:
+    std::vector<uint8_t> data_; //!< The capture.
+    bool open_; //!< True once a capture is loaded.
+    double speed_; //!< The replay speed as a multiple of the baud rate. Zero is unpaced.
+    bool loop_; //!< Restart the capture at its end.
+    double bytes_per_ns_; //!< The paced byte rate.
+    uint32_t timeout_ms_; //!< The timeout of the blocking calls.
+    size_t position_; //!< The next capture byte to serve.
+    bool streaming_; //!< True between StartAcquire and StopAcquire.
+    uint64_t stream_start_ns_; //!< The monotonic time streaming started.
+    size_t stream_start_position_; //!< The capture bytes served before streaming started.
+    std::string response_; //!< The reply waiting to be read, served before capture data.
+
+    size_t due(); //!< \brief Returns the bytes available now.
+    size_t take(uint8_t *buffer, size_t size); //!< \brief Serves up to size available bytes.
+
+  public:
+    /** \brief ReplayTransport constructor.
+     * @param speed The replay speed as a multiple of real time. Zero serves the capture as fast as it is read.
+     * @param loop Restart the capture when it ends instead of going silent.
+     */
+    ReplayTransport(double speed = 1.0, bool loop = false);
+
+    //! Port is the path of the capture. Returns false if it can not be read.
+    bool open(const std::string &port, int baud);
+    bool isOpen();
+    void close();
+    void setTimeout(uint32_t milliseconds);
+    size_t available();
+    bool waitReadable();
+    size_t read(uint8_t *buffer, size_t size);
+    size_t readSome(uint8_t *buffer, size_t size);
+    size_t write(const uint8_t *data, size_t size);
+    void flush();
+  };
+
+  /** \brief Creates a transport for a device address.
+   *
+   * The address is one of
+   *   - "tcp://host:port" for a TcpTransport,
+   *   - "file:///path/to/capture" for a ReplayTransport, with an optional "?speed=2" or "?speed=2&loop=1",
+   *   - "tty:///dev/ttyUSB0" for a TtyTransport,
+   *   - "serial:///dev/ttyUSB0" or a plain device path for a SerialTransport.
+   * @param uri The address.
+   * @param port Filled with what to pass to Transport::open().
+   * @return The new transport, owned by the caller, or NULL for an unknown scheme.
+   */
+  Transport *createTransport(const std::string &uri, std::string *port);
+}
+
+#endif /* URSA_TRANSPORT_H_ */
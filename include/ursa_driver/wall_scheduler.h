@@ -0,0 +1,108 @@
+/** The header file for the wall clock aligned scheduler.
+ \file      wall_scheduler.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#ifndef WALL_SCHEDULER_H_
+#define WALL_SCHEDULER_H_
+
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
+
+#include <stdint.h>
+
+namespace ursa
+{
+  //! \brief Counters describing how closely a WallScheduler kept to its boundaries.
+  struct ScheduleStats
+  {
+    uint64_t ticks; //!< The boundaries a snapshot was taken at.
+    uint64_t missed; //!< Boundaries which passed while the timing thread was busy, so had no tick.
+    uint64_t overruns; //!< Ticks skipped because the previous tick's work had not finished.
+    uint64_t max_late_ns; //!< The latest a snapshot started after its boundary.
+    uint64_t total_late_ns; //!< The sum of how late each snapshot started. Divide by ticks for the mean.
+    uint64_t max_work_ns; //!< The longest the work for one tick took.
+
+    ScheduleStats(); //!< \brief ScheduleStats constructor. All counters start at zero.
+  };
+
+  /** \brief Runs a task on every wall clock boundary of a period, without drift.
+   *
+   * The timing thread sleeps to each boundary with an absolute clock_nanosleep(), runs the short snapshot
+   * task and hands the slow work task to a worker thread, so slow work never delays the next boundary.
+   * Both tasks are given the boundary time.  If the work for the previous tick is still running when a
+   * boundary comes the tick is skipped and counted as an overrun.  Boundaries that pass while the timing
+   * thread is late are counted as missed and not replayed, so a stall never causes a burst of ticks.
+   */
+  class WallScheduler
+  {
+  public:
+    typedef boost::function<void(uint64_t)> Task; //!< A task given the boundary time in nanoseconds since the unix epoch.
+
+  private:
+    uint64_t period_ns_; //!< The time between boundaries.
+    uint64_t offset_ns_; //!< The offset of the boundaries into each period.
+    Task snapshot_; //!< Run by the timing thread at each boundary.
+    Task work_; //!< Run by the worker thread after each snapshot.
+    boost::thread timer_; //!< The timing thread.
+    boost::thread worker_; //!< The worker thread.
+    boost::atomic<bool> stop_; //!< Set to end both threads.
+    boost::mutex mutex_; //!< Protects the pending work and the statistics.
+    boost::condition_variable work_ready_; //!< Signalled when work is pending or the threads are stopping.
+    bool work_pending_; //!< True from a snapshot until its work has finished.
+    uint64_t work_tick_; //!< The boundary of the pending work.
+    ScheduleStats stats_; //!< The counters since the last reset.
+
+    void timerLoop(); //!< \brief The timing thread.
+    void workerLoop(); //!< \brief The worker thread.
+
+  public:
+    WallScheduler(); //!< \brief WallScheduler constructor. Nothing runs until start().
+    ~WallScheduler(); //!< \brief WallScheduler destructor. Stops the threads.
+
+    /** \brief Starts the timing and worker threads, restarting them if they run.
+     * @param period The seconds between boundaries.
+     * @param offset The seconds past each whole period to fire at.
+     * @param snapshot The time critical task, run at each boundary. Keep it short.
+     * @param work The slow task, run on the worker thread after each snapshot. May be empty.
+     */
+    void start(double period, double offset, const Task &snapshot,
+               const Task &work);
+    void stop(); //!< \brief Stops both threads, waiting for running tasks to finish.
+    //! \brief Returns true while the threads run.
+    bool running() {
+      return (timer_.joinable());
+    }
+    /** \brief Returns the counters since the last reset.
+     * @param reset Start the counters again after copying them.
+     */
+    ScheduleStats stats(bool reset);
+  };
+}
+
+#endif /* WALL_SCHEDULER_H_ */
@@ -0,0 +1,97 @@
+/** The header file for the work stealing thread pool.
+ \file      work_pool.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#ifndef WORK_POOL_H_
+#define WORK_POOL_H_
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/atomic.hpp>
+
+#include <stdint.h>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+namespace ursa
+{
+  /** \brief Runs a batch of tasks on a fixed set of threads which steal work from each other.
+   *
+   * Each worker has its own deque.  A worker takes its newest task first, so a task which splits itself
+   * and pushes the pieces keeps working on the piece it was last touching.  A worker whose deque is empty
+   * steals the oldest task of another, which is the largest piece left when tasks split in halves.  The
+   * deques are only locked for the push or pop, so workers only contend when one is stealing.
+   */
+  class WorkStealingPool
+  {
+  public:
+    typedef boost::function<void(size_t)> Task; //!< A task given the index of the worker running it.
+
+  private:
+    //! \brief One worker's tasks.
+    struct Queue
+    {
+      boost::mutex mutex; //!< Protects tasks.
+      std::deque<Task> tasks; //!< Pushed at the back, taken from the back by the owner and from the front by thieves.
+    };
+
+    std::vector<boost::shared_ptr<Queue> > queues_; //!< One for each worker.
+    boost::atomic<size_t> pending_; //!< Tasks pushed which have not finished running.
+    boost::atomic<uint64_t> steals_; //!< Tasks run by a worker other than the one they were pushed to.
+
+    bool take(size_t worker, Task *task); //!< \brief Pops the worker's newest task, or steals another worker's oldest.
+    void workerLoop(size_t worker); //!< \brief Runs tasks until none are pending.
+
+  public:
+    /** \brief WorkStealingPool constructor.
+     * @param threads The workers. Zero uses one per core.
+     */
+    explicit WorkStealingPool(size_t threads);
+
+    //! \brief Returns the number of workers.
+    size_t size() const {
+      return (queues_.size());
+    }
+
+    /** \brief Adds a task.  Tasks may push more tasks while run() is running.
+     * @param worker The worker whose deque takes the task, normally the worker calling.
+     * @param task The task.
+     */
+    void push(size_t worker, const Task &task);
+    /** \brief Runs every task pushed, and every task they push, returning when all have finished.
+     * The calling thread is worker 0.
+     */
+    void run();
+    //! \brief Returns the tasks stolen since the pool was made.
+    uint64_t steals() const {
+      return (steals_);
+    }
+  };
+}
+
+#endif /* WORK_POOL_H_ */
@@ -0,0 +1,362 @@
+/** Implementation of the sequential probability alarm engine.
+ \file      alarm_engine.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/alarm_engine.h>
+#include <ursa_driver/ursa_clock.h>
+
+#include <algorithm>
+#include <cmath>
+#include <math.h>
+
+namespace ursa
+{
+  const uint64_t min_slot_ns(1000000);
+  //! Below this many expected counts ROI thresholds come from the Poisson tail rather than a normal approximation.
+  const double poisson_exact_limit(100);
+
+  namespace
+  {
+    /** Returns the smallest count n with P(N >= n) <= tail for N ~ Poisson(mean).  The pmf is summed
+     * directly, which takes at most a few hundred terms below poisson_exact_limit.
+     */
+    double poissonTrigger(double mean, double tail) {
+      double pmf = std::exp(-mean);
+      double cdf = pmf;
+      double n = 0;
+      while (1 - cdf > tail && n < 4 * poisson_exact_limit)
+      {
+        n++;
+        pmf *= mean / n;
+        cdf += pmf;
+      }
+      return (n + 1);
+    }
+  }
+
+  /** The defaults are a 2x gross rate test at 1e-6 false alarms per decision with a 1 minute background.
+   * At 200 cps the SPRT decides about ten times a second.  An ROI background of at least 0.1 cps needs
+   * 4 counts in the default 1 s window to alarm at 4 sigma.
+   */
+  AlarmConfig::AlarmConfig() :
+      enable(false), drive_outputs(true), learn_seconds(30), background_seconds(
+          60), min_background(1), roi_min_background(0.1), rate_ratio(2), false_alarm(1e-6), missed_alarm(
+          0.01), roi_window(1), roi_sigma(4) {
+  }
+
+  AlarmEngine::AlarmEngine() :
+      enabled_(false), learning_(true), started_(false), log_ratio_(0), upper_(
+          0), lower_(0), slot_ns_(min_slot_ns), batch_ns_(0), arrival_ns_(0), batch_dt_(0), slot_start_ns_(
+          0), window_start_ns_(0), window_ns_(0), slot_(0), batch_counts_(0), learn_counts_(
+          0), learn_ns_(0), background_(0), gross_active_(false), llr_(0), llr_start_ns_(
+          0), llr_counts_(0), roi_count_(0), rois_active_(0), event_head_(0), event_count_(
+          0), events_dropped_(0) {
+    roi_tail_ = 0.5 * erfc(config_.roi_sigma / std::sqrt(2.0));
+  }
+
+  /** The SPRT thresholds are Wald's approximations, ln((1 - beta) / alpha) and ln(beta / (1 - alpha)).
+   * A rate ratio of 1 or less can not be tested so it is raised to 1.01.
+   */
+  void AlarmEngine::configure(const AlarmConfig &config) {
+    clearAlarms();
+    config_ = config;
+    config_.rate_ratio = std::max(config_.rate_ratio, 1.01);
+    config_.false_alarm = std::min(std::max(config_.false_alarm, 1e-12), 0.5);
+    config_.missed_alarm = std::min(std::max(config_.missed_alarm, 1e-12), 0.5);
+    enabled_ = config_.enable;
+
+    log_ratio_ = std::log(config_.rate_ratio);
+    upper_ = std::log((1 - config_.missed_alarm) / config_.false_alarm);
+    lower_ = std::log(config_.missed_alarm / (1 - config_.false_alarm));
+    slot_ns_ = std::max(
+        uint64_t(config_.roi_window * 1e9 / alarm_window_slots), min_slot_ns);
+    roi_tail_ = 0.5 * erfc(config_.roi_sigma / std::sqrt(2.0));
+
+    roi_count_ = std::min(config_.rois.size(), max_alarm_rois);
+    for (size_t i = 0; i < roi_count_; i++)
+    {
+      rois_[i].low = config_.rois[i].low;
+      rois_[i].high = config_.rois[i].high;
+      rois_[i].active = false;
+      rois_[i].learn_counts = 0;
+      rois_[i].background = 0;
+    }
+
+    learning_ = true;
+    learn_counts_ = 0;
+    learn_ns_ = 0;
+    background_ = config_.min_background;
+    restart();
+  }
+
+  void AlarmEngine::restart() {
+    clearAlarms();
+    started_ = false;
+    gross_active_ = false;
+    llr_ = 0;
+    llr_counts_ = 0;
+    batch_counts_ = 0;
+    slot_ = 0;
+    rois_active_ = 0;
+    for (size_t i = 0; i < roi_count_; i++)
+    {
+      Roi &roi = rois_[i];
+      roi.active = false;
+      roi.window = 0;
+      roi.slots.fill(0);
+      roi.batch = 0;
+      roi.expected = 0;
+      roi.sigma = 1;
+      roi.trigger = 1e300;
+      roi.release = 0;
+    }
+  }
+
+  /** The SPRT drift for the time since the last batch is applied before the batch's counts are added.
+   * Crossing the upper threshold part way through a batch is therefore never early, and the lower
+   * threshold is only checked in endBatch() once the batch's counts are in.
+   */
+  void AlarmEngine::beginBatch(uint64_t now_ns, uint64_t arrival_ns) {
+    if (!enabled_)
+      return;
+    arrival_ns_ = (arrival_ns && arrival_ns < now_ns ? arrival_ns : now_ns);
+    if (!started_)
+    {
+      started_ = true;
+      batch_dt_ = 0;
+      slot_start_ns_ = now_ns;
+      window_start_ns_ = now_ns;
+      llr_start_ns_ = now_ns;
+    }
+    else
+      batch_dt_ = (now_ns > batch_ns_ ? now_ns - batch_ns_ : 0);
+    batch_ns_ = now_ns;
+
+    batch_counts_ = 0;
+    for (size_t i = 0; i < roi_count_; i++)
+      rois_[i].batch = 0;
+
+    if (!learning_)
+      llr_ -= (config_.rate_ratio - 1) * background_ * (batch_dt_ * 1e-9);
+    advanceWindow();
+  }
+
+  void AlarmEngine::endBatch() {
+    if (!enabled_ || !started_)
+      return;
+    if (!learning_)
+    {
+      if (llr_ <= lower_)
+        grossDecision(false);
+      for (size_t i = 0; i < roi_count_; i++)
+      {
+        Roi &roi = rois_[i];
+        if (roi.active && roi.window < roi.release)
+          roiDecision(i, false);
+      }
+    }
+    updateBackground();
+  }
+
+  /** Whole slots that have expired are subtracted from the windows.  The expected window counts use the
+   * span of data actually in the window, which is shorter than roi_window just after a restart.
+   *
+   * The trigger is the count whose one sided tail matches roi_sigma standard deviations of a normal
+   * distribution.  At a few expected counts the normal approximation alarms far too often so the
+   * Poisson tail is used until the expectation reaches poisson_exact_limit.
+   */
+  void AlarmEngine::advanceWindow() {
+    uint64_t elapsed = (batch_ns_ - slot_start_ns_) / slot_ns_;
+    for (uint64_t k = 0; k < std::min(elapsed, uint64_t(alarm_window_slots));
+        k++)
+    {
+      slot_ = (slot_ + 1) % alarm_window_slots;
+      for (size_t i = 0; i < roi_count_; i++)
+      {
+        rois_[i].window -= rois_[i].slots[slot_];
+        rois_[i].slots[slot_] = 0;
+      }
+    }
+    slot_start_ns_ += elapsed * slot_ns_;
+    window_ns_ = std::min((alarm_window_slots - 1) * slot_ns_
+                              + (batch_ns_ - slot_start_ns_),
+                          batch_ns_ - window_start_ns_);
+
+    double window_s = window_ns_ * 1e-9;
+    for (size_t i = 0; i < roi_count_; i++)
+    {
+      Roi &roi = rois_[i];
+      roi.expected = roi.background * window_s;
+      roi.sigma = std::sqrt(std::max(roi.expected, 1.0));
+      if (roi.expected < poisson_exact_limit)
+        roi.trigger = poissonTrigger(roi.expected, roi_tail_) - 1;
+      else
+        roi.trigger = roi.expected + config_.roi_sigma * roi.sigma;
+      roi.release = roi.expected + 0.5 * (roi.trigger - roi.expected);
+    }
+  }
+
+  /** While learning the counts are summed.  Afterwards each batch moves the backgrounds towards its rate
+   * by dt / background_seconds.  Both are floored, the gross background at min_background and each ROI
+   * background at roi_min_background.  The gross background is frozen while the gross test alarms and an ROI
+   * background while either it or the gross test alarms.
+   */
+  void AlarmEngine::updateBackground() {
+    if (batch_dt_ == 0)
+      return;
+    double dt = batch_dt_ * 1e-9;
+    if (learning_)
+    {
+      learn_counts_ += batch_counts_;
+      learn_ns_ += batch_dt_;
+      for (size_t i = 0; i < roi_count_; i++)
+        rois_[i].learn_counts += rois_[i].batch;
+      if (learn_ns_ >= config_.learn_seconds * 1e9)
+      {
+        double learned = learn_ns_ * 1e-9;
+        background_ = std::max(learn_counts_ / learned, config_.min_background);
+        for (size_t i = 0; i < roi_count_; i++)
+          rois_[i].background = std::max(rois_[i].learn_counts / learned,
+                                         config_.roi_min_background);
+        learning_ = false;
+        llr_ = 0;
+        llr_counts_ = 0;
+        llr_start_ns_ = batch_ns_;
+      }
+      return;
+    }
+
+    double weight = std::min(dt / config_.background_seconds, 1.0);
+    if (!gross_active_)
+    {
+      background_ += weight * (batch_counts_ / dt - background_);
+      background_ = std::max(background_, config_.min_background);
+    }
+    for (size_t i = 0; i < roi_count_; i++)
+    {
+      Roi &roi = rois_[i];
+      if (!roi.active && !gross_active_)
+      {
+        roi.background += weight * (roi.batch / dt - roi.background);
+        roi.background = std::max(roi.background, config_.roi_min_background);
+      }
+    }
+  }
+
+  /** Every decision restarts the SPRT.  An event is only recorded when the state changes, so a source
+   * that keeps the ratio above the upper threshold raises one alarm rather than one per decision.
+   */
+  void AlarmEngine::grossDecision(bool active) {
+    if (active != gross_active_)
+    {
+      AlarmEvent &event = pushEvent(ALARM_GROSS, -1, active);
+      event.evidence_ns = batch_ns_ - llr_start_ns_;
+      event.rate = (
+          event.evidence_ns > 0 ? llr_counts_ / (event.evidence_ns * 1e-9) : 0);
+      event.background = background_;
+      event.statistic = llr_;
+      output_pending_[(event_head_ + event_count_ - 1) % alarm_event_capacity] =
+          config_.drive_outputs;
+      gross_active_ = active;
+    }
+    llr_ = 0;
+    llr_counts_ = 0;
+    llr_start_ns_ = batch_ns_;
+  }
+
+  //! The ROI alarm output only changes on the first ROI to alarm and the last to clear.
+  void AlarmEngine::roiDecision(size_t index, bool active) {
+    Roi &roi = rois_[index];
+    AlarmEvent &event = pushEvent(ALARM_ROI, index, active);
+    event.evidence_ns = window_ns_;
+    event.rate = (window_ns_ > 0 ? roi.window / (window_ns_ * 1e-9) : 0);
+    event.background = roi.background;
+    event.statistic = (roi.window - roi.expected) / roi.sigma;
+    output_pending_[(event_head_ + event_count_ - 1) % alarm_event_capacity] =
+        config_.drive_outputs && (active ? rois_active_ == 0 : rois_active_ == 1);
+    roi.active = active;
+    if (active)
+      rois_active_++;
+    else
+      rois_active_--;
+  }
+
+  void AlarmEngine::clearAlarms() {
+    if (gross_active_)
+      grossDecision(false);
+    for (size_t i = 0; i < roi_count_; i++)
+    {
+      if (rois_[i].active)
+        roiDecision(i, false);
+    }
+  }
+
+  AlarmEvent &AlarmEngine::pushEvent(alarm_source source, int32_t roi,
+                                     bool active) {
+    size_t index = (event_head_ + event_count_) % alarm_event_capacity;
+    if (event_count_ == alarm_event_capacity)
+    {
+      event_head_ = (event_head_ + 1) % alarm_event_capacity;
+      events_dropped_++;
+    }
+    else
+      event_count_++;
+
+    AlarmEvent &event = events_[index];
+    event.time_ns = wallNanos();
+    event.source = source;
+    event.roi = roi;
+    event.active = active;
+    event.read_ns = batch_ns_;
+    event.arrival_ns = arrival_ns_;
+    event.decision_ns = monotonicNanos();
+    event.output_ns = 0;
+    output_pending_[index] = false;
+    return (event);
+  }
+
+  void AlarmEngine::outputWritten(size_t line, uint64_t now_ns) {
+    for (size_t i = 0; i < event_count_; i++)
+    {
+      size_t index = (event_head_ + i) % alarm_event_capacity;
+      AlarmEvent &event = events_[index];
+      if (output_pending_[index]
+          && (line == 0) == (event.source == ALARM_GROSS))
+      {
+        event.output_ns = now_ns;
+        output_pending_[index] = false;
+      }
+    }
+  }
+
+  size_t AlarmEngine::takeEvents(std::vector<AlarmEvent> *events) {
+    size_t taken = event_count_;
+    for (size_t i = 0; i < taken; i++)
+      events->push_back(events_[(event_head_ + i) % alarm_event_capacity]);
+    event_head_ = 0;
+    event_count_ = 0;
+    return (taken);
+  }
+}
@@ -0,0 +1,125 @@
+/** Implementation of the dose rate accumulator.
+ \file      dose_rate.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/dose_rate.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace ursa
+{
+  DoseCalibration::DoseCalibration() :
+      offset_kev(0), kev_per_channel(3), reference_gain(1), reference_bits(12) {
+  }
+
+  double DoseCalibration::channelWidth(double gain, int bits) const {
+    return (kev_per_channel * reference_gain / gain
+        * std::ldexp(1.0, reference_bits - bits));
+  }
+
+  DoseCounter::DoseCounter() :
+      valid_(false), gain_(0), bits_(12), counts_(0), dose_(0), variance_(0), time_ns_(
+          0) {
+    weights_.fill(0);
+  }
+
+  bool DoseCounter::configure(const DoseCalibration &calibration) {
+    if (calibration.energies.size() != calibration.weights.size()
+        || calibration.kev_per_channel <= 0 || calibration.reference_gain <= 0)
+      return (false);
+    for (size_t k = 0; k < calibration.energies.size(); k++)
+    {
+      if (calibration.energies[k] <= 0 || calibration.weights[k] < 0
+          || (k > 0 && calibration.energies[k] <= calibration.energies[k - 1]))
+        return (false);
+    }
+    calibration_ = calibration;
+    build();
+    counts_ = 0;
+    dose_ = 0;
+    variance_ = 0;
+    return (true);
+  }
+
+  void DoseCounter::setResponse(double gain, int bits) {
+    if (gain == gain_ && bits == bits_)
+      return;
+    gain_ = gain;
+    bits_ = bits;
+    build();
+  }
+
+  /** G(E) is interpolated linearly in log energy and log weight, which follows the power law shape of
+   * dose conversion curves, and held at the end knots outside them.  A zero weight knot is interpolated
+   * linearly instead.  Channels below zero energy get no weight.
+   */
+  void DoseCounter::build() {
+    const std::vector<double> &energies = calibration_.energies;
+    const std::vector<double> &weights = calibration_.weights;
+    valid_ = (gain_ > 0 && !energies.empty());
+    if (!valid_)
+    {
+      weights_.fill(0);
+      return;
+    }
+
+    double width = calibration_.channelWidth(gain_, bits_);
+    for (size_t c = 0; c < spectrum_bins; c++)
+    {
+      double energy = calibration_.offset_kev + width * c;
+      double weight;
+      if (energy <= 0)
+        weight = 0;
+      else if (energy <= energies.front())
+        weight = weights.front();
+      else if (energy >= energies.back())
+        weight = weights.back();
+      else
+      {
+        size_t k = std::upper_bound(energies.begin(), energies.end(), energy)
+            - energies.begin();
+        double e0 = energies[k - 1], e1 = energies[k];
+        double w0 = weights[k - 1], w1 = weights[k];
+        if (w0 > 0 && w1 > 0)
+          weight = w0 * std::exp(std::log(w1 / w0) * std::log(energy / e0)
+                                 / std::log(e1 / e0));
+        else
+          weight = w0 + (w1 - w0) * (energy - e0) / (e1 - e0);
+      }
+      weights_[2 * c] = weight;
+      weights_[2 * c + 1] = weight * weight;
+    }
+  }
+
+  void DoseCounter::read(DoseCounts *counts) const {
+    counts->time_ns = time_ns_;
+    counts->counts = counts_;
+    counts->dose = dose_;
+    counts->variance = variance_;
+    counts->valid = valid_;
+  }
+}
@@ -0,0 +1,96 @@
+/** Implementation of the list mode event buffer.
+ \file      list_mode.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/list_mode.h>
+
+#include <algorithm>
+
+namespace ursa
+{
+  ListModeBuffer::ListModeBuffer() :
+      filling_(&batches_[0]), ready_(&batches_[1]), ready_full_(false), enabled_(
+          false), batch_size_(event_batch_capacity), max_latency_ns_(0), sequence_(
+          0), dropped_(0) {
+    batches_[0].size = 0;
+    batches_[1].size = 0;
+  }
+
+  void ListModeBuffer::configure(bool enable, size_t batch_size,
+                                 double max_latency) {
+    enabled_ = enable;
+    batch_size_ = std::min(std::max(batch_size, size_t(1)),
+                           event_batch_capacity);
+    max_latency_ns_ = (max_latency > 0 ? uint64_t(max_latency * 1e9) : 0);
+    filling_->size = 0;
+    ready_->size = 0;
+    ready_full_ = false;
+    sequence_ = 0;
+    dropped_ = 0;
+  }
+
+  void ListModeBuffer::close() {
+    if (ready_full_ || filling_->size == 0)
+      return;
+    filling_->sequence = sequence_++;
+    filling_->dropped = dropped_;
+    dropped_ = 0;
+    std::swap(filling_, ready_);
+    ready_full_ = true;
+    filling_->size = 0;
+  }
+
+  void ListModeBuffer::poll(uint64_t now_ns) {
+    if (!enabled_ || filling_->size == 0)
+      return;
+    if (filling_->size >= batch_size_
+        || (max_latency_ns_ > 0 && now_ns > filling_->start_ns
+            && now_ns - filling_->start_ns >= max_latency_ns_))
+      close();
+  }
+
+  /** Taking a batch frees the ready slot, so a filling batch that was held back is closed at once if it
+   * is already full.
+   */
+  bool ListModeBuffer::take(EventBatch *batch) {
+    if (!ready_full_)
+      return (false);
+    batch->sequence = ready_->sequence;
+    batch->dropped = ready_->dropped;
+    batch->start_ns = ready_->start_ns;
+    batch->size = ready_->size;
+    std::copy(ready_->offsets.begin(), ready_->offsets.begin() + ready_->size,
+              batch->offsets.begin());
+    std::copy(ready_->channels.begin(),
+              ready_->channels.begin() + ready_->size, batch->channels.begin());
+    std::copy(ready_->counts.begin(), ready_->counts.begin() + ready_->size,
+              batch->counts.begin());
+    ready_->size = 0;
+    ready_full_ = false;
+    if (filling_->size >= batch_size_)
+      close();
+    return (true);
+  }
+}
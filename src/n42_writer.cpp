@@ -0,0 +1,242 @@
+/** Implementation of the streaming ANSI N42.42 writer.
+ \file      n42_writer.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/n42_writer.h>
+
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace ursa
+{
+  namespace
+  {
+    const char n42_namespace[] = "http://physics.nist.gov/N42/2011/N42";
+    //! The text of a measurement without its channel data, with room to spare.
+    const size_t measurement_overhead = 1024;
+    //! The longest text of one channel: a 20 digit count and a space, or a zero run's "0 " and count.
+    const size_t channel_text = 22;
+
+    //! Appends text to out.
+    void put(char *&out, const char *text) {
+      size_t length = strlen(text);
+      memcpy(out, text, length);
+      out += length;
+    }
+
+    //! Appends value in decimal to out.
+    void putUnsigned(char *&out, uint64_t value) {
+      char digits[20];
+      size_t length = 0;
+      do
+      {
+        digits[length++] = '0' + value % 10;
+        value /= 10;
+      } while (value);
+      while (length)
+        *out++ = digits[--length];
+    }
+
+    //! Appends a duration in nanoseconds as an xs:duration in seconds with millisecond resolution.
+    void putDuration(char *&out, uint64_t ns) {
+      uint64_t ms = (ns + 500000) / 1000000;
+      put(out, "PT");
+      putUnsigned(out, ms / 1000);
+      *out++ = '.';
+      *out++ = '0' + ms / 100 % 10;
+      *out++ = '0' + ms / 10 % 10;
+      *out++ = '0' + ms % 10;
+      *out++ = 'S';
+    }
+
+    //! Appends a time in nanoseconds since the unix epoch as an xs:dateTime in UTC.
+    void putDateTime(char *&out, uint64_t ns) {
+      time_t seconds = ns / 1000000000;
+      struct tm utc;
+      gmtime_r(&seconds, &utc);
+      out += strftime(out, 32, "%Y-%m-%dT%H:%M:%S", &utc);
+      out += sprintf(out, ".%03uZ", (unsigned) (ns / 1000000 % 1000));
+    }
+
+    //! Returns text with the XML special characters escaped.
+    std::string escape(const std::string &text) {
+      std::string escaped;
+      for (size_t i = 0; i < text.size(); i++)
+      {
+        switch (text[i])
+        {
+          case '&':
+            escaped += "&amp;";
+            break;
+          case '<':
+            escaped += "&lt;";
+            break;
+          case '>':
+            escaped += "&gt;";
+            break;
+          case '"':
+            escaped += "&quot;";
+            break;
+          default:
+            escaped += text[i];
+            break;
+        }
+      }
+      return (escaped);
+    }
+  }
+
+  N42Header::N42Header() :
+      serial_number(-1), detector_kind("Other"), channels(spectrum_bins) {
+  }
+
+  N42Writer::N42Writer() :
+      channels_(spectrum_bins), calibrated_(false), measurements_(0) {
+  }
+
+  N42Writer::~N42Writer() {
+    close();
+  }
+
+  bool N42Writer::open(const std::string &path, const N42Header &header) {
+    close();
+    file_.clear();
+    file_.open(path.c_str(), std::ios::out | std::ios::trunc);
+    if (!file_.is_open())
+      return (false);
+    channels_ = std::min(std::max(header.channels, (size_t) 1), spectrum_bins);
+    buffer_.resize(measurement_overhead + channels_ * channel_text);
+    measurements_ = 0;
+
+    file_ << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          << "<RadInstrumentData xmlns=\"" << n42_namespace << "\" n42DocUUID=\""
+          << boost::uuids::random_generator()() << "\">\n"
+          << "  <RadInstrumentDataCreatorName>ursa_driver</RadInstrumentDataCreatorName>\n"
+          << "  <RadInstrumentInformation id=\"RadInstrumentInformation-1\">\n"
+          << "    <RadInstrumentManufacturerName>SE International</RadInstrumentManufacturerName>\n";
+    if (header.serial_number >= 0)
+      file_ << "    <RadInstrumentIdentifier>" << header.serial_number
+            << "</RadInstrumentIdentifier>\n";
+    file_ << "    <RadInstrumentModelName>URSA-II</RadInstrumentModelName>\n"
+          << "    <RadInstrumentClassCode>Other</RadInstrumentClassCode>\n"
+          << "    <RadInstrumentVersion>\n"
+          << "      <RadInstrumentComponentName>Software</RadInstrumentComponentName>\n"
+          << "      <RadInstrumentComponentVersion>ursa_driver</RadInstrumentComponentVersion>\n"
+          << "    </RadInstrumentVersion>\n"
+          << "  </RadInstrumentInformation>\n"
+          << "  <RadDetectorInformation id=\"RadDetectorInformation-1\">\n"
+          << "    <RadDetectorCategoryCode>Gamma</RadDetectorCategoryCode>\n"
+          << "    <RadDetectorKindCode>" << escape(header.detector_kind)
+          << "</RadDetectorKindCode>\n";
+    if (!header.detector_description.empty())
+      file_ << "    <RadDetectorDescription>"
+            << escape(header.detector_description)
+            << "</RadDetectorDescription>\n";
+    file_ << "  </RadDetectorInformation>\n";
+    if (!header.coefficients.empty())
+    {
+      file_ << "  <EnergyCalibration id=\"EnergyCalibration-1\">\n"
+            << "    <CoefficientValues>";
+      char number[32];
+      for (size_t i = 0; i < header.coefficients.size(); i++)
+      {
+        snprintf(number, sizeof(number), "%s%.9g", i ? " " : "",
+                 header.coefficients[i]);
+        file_ << number;
+      }
+      file_ << "</CoefficientValues>\n"
+            << "  </EnergyCalibration>\n";
+    }
+    calibrated_ = !header.coefficients.empty();
+    return (file_.good());
+  }
+
+  /** The whole measurement is formatted into the buffer first so the stream sees one large write.
+   * Each zero run is written as a 0 followed by its length.
+   */
+  bool N42Writer::write(uint64_t start_ns, uint64_t real_ns, uint64_t live_ns,
+                        const WideSpectrum &counts) {
+    if (!file_.is_open())
+      return (false);
+    measurements_++;
+    char *out = &buffer_[0];
+    put(out, "  <RadMeasurement id=\"RadMeasurement-");
+    putUnsigned(out, measurements_);
+    put(out, "\">\n    <MeasurementClassCode>Foreground</MeasurementClassCode>\n"
+        "    <StartDateTime>");
+    putDateTime(out, start_ns);
+    put(out, "</StartDateTime>\n    <RealTimeDuration>");
+    putDuration(out, real_ns);
+    put(out, "</RealTimeDuration>\n    <Spectrum id=\"Spectrum-");
+    putUnsigned(out, measurements_);
+    put(out, "\" radDetectorInformationReference=\"RadDetectorInformation-1\"");
+    if (calibrated_)
+      put(out, " energyCalibrationReference=\"EnergyCalibration-1\"");
+    put(out, ">\n      <LiveTimeDuration>");
+    putDuration(out, live_ns);
+    put(out, "</LiveTimeDuration>\n"
+        "      <ChannelData compressionCode=\"CountedZeroes\">");
+
+    const char *separator = "";
+    for (size_t c = 0; c < channels_;)
+    {
+      put(out, separator);
+      separator = " ";
+      if (counts[c])
+      {
+        putUnsigned(out, counts[c++]);
+        continue;
+      }
+      size_t run = c;
+      while (c < channels_ && !counts[c])
+        c++;
+      put(out, "0 ");
+      putUnsigned(out, c - run);
+    }
+
+    put(out, "</ChannelData>\n    </Spectrum>\n  </RadMeasurement>\n");
+    file_.write(&buffer_[0], out - &buffer_[0]);
+    return (file_.good());
+  }
+
+  void N42Writer::flush() {
+    if (file_.is_open())
+      file_.flush();
+  }
+
+  void N42Writer::close() {
+    if (!file_.is_open())
+      return;
+    file_ << "</RadInstrumentData>\n";
+    file_.close();
+  }
+}
@@ -0,0 +1,202 @@
+/** Implementation of the nuclide identification template matcher.
+ \file      nuclide_id.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/nuclide_id.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace ursa
+{
+  namespace
+  {
+    //! Orders identifications best first.
+    bool betterMatch(const Identification &a, const Identification &b) {
+      return (a.score > b.score);
+    }
+  }
+
+  NuclideLibrary::NuclideLibrary() :
+      stride_(0) {
+  }
+
+  /** The weight matrix is laid out again with the new column, which costs a copy of the library.
+   * Libraries are loaded once so this keeps the matrix packed for the per spectrum passes.
+   */
+  bool NuclideLibrary::add(const std::string &name,
+                           const std::vector<double> &response) {
+    size_t length = std::min(response.size(), spectrum_bins);
+    double total = 0;
+    for (size_t c = 0; c < length; c++)
+    {
+      if (response[c] < 0)
+        return (false);
+      total += response[c];
+    }
+    if (total <= 0)
+      return (false);
+
+    double squares = 0;
+    for (size_t c = 0; c < length; c++)
+      squares += (response[c] / total) * (response[c] / total);
+    double variance = squares - 1.0 / spectrum_bins;
+    if (variance <= 0)
+      return (false);
+
+    size_t count = names_.size();
+    size_t stride = (count + 8) & ~size_t(7);
+    if (stride != stride_)
+    {
+      std::vector<float> weights(spectrum_bins * stride, 0.0f);
+      for (size_t c = 0; c < spectrum_bins; c++)
+        std::copy(weights_.begin() + c * stride_,
+                  weights_.begin() + c * stride_ + count,
+                  weights.begin() + c * stride);
+      weights_.swap(weights);
+      stride_ = stride;
+    }
+    for (size_t c = 0; c < length; c++)
+      weights_[c * stride_ + count] = response[c] / total;
+
+    names_.push_back(name);
+    variance_.push_back(variance);
+    return (true);
+  }
+
+  int NuclideLibrary::load(const std::string &path) {
+    std::ifstream file(path.c_str());
+    if (!file.is_open())
+      return (-1);
+    int added = 0;
+    std::string line;
+    std::vector<double> response;
+    while (std::getline(file, line))
+    {
+      std::istringstream fields(line);
+      std::string name;
+      if (!(fields >> name) || name[0] == '#')
+        continue;
+      response.clear();
+      double value;
+      while (fields >> value)
+        response.push_back(value);
+      if (!fields.eof() || !add(name, response))
+        return (-1);
+      added++;
+    }
+    return (added);
+  }
+
+  void NuclideLibrary::clear() {
+    names_.clear();
+    variance_.clear();
+    weights_.clear();
+    stride_ = 0;
+  }
+
+  NuclideIdentifier::NuclideIdentifier(const NuclideLibrary &library) :
+      library_(library), sum_(0), sum_squares_(0), updates_(0) {
+    channels_.reserve(spectrum_bins);
+    deltas_.reserve(spectrum_bins);
+    reset();
+  }
+
+  void NuclideIdentifier::reset() {
+    previous_.fill(0);
+    dots_.assign(library_.stride(), 0);
+    sum_ = 0;
+    sum_squares_ = 0;
+    updates_ = full_update_interval;
+  }
+
+  /** The changed channels are collected in one pass over the spectrum.  A quiet interval touches a few
+   * dozen channels, so the template pass costs a few dozen rows rather than spectrum_bins.
+   */
+  size_t NuclideIdentifier::update(const WideSpectrum &spectrum) {
+    if (dots_.size() != library_.stride())
+      reset();
+
+    bool full = (updates_ >= full_update_interval);
+    for (size_t c = 0; c < spectrum_bins && !full; c++)
+      full = (spectrum[c] < previous_[c]);
+    if (full)
+    {
+      std::fill(dots_.begin(), dots_.end(), 0);
+      previous_.fill(0);
+      sum_ = 0;
+      sum_squares_ = 0;
+      updates_ = 0;
+    }
+    else
+      updates_++;
+
+    channels_.clear();
+    deltas_.clear();
+    for (size_t c = 0; c < spectrum_bins; c++)
+    {
+      if (spectrum[c] != previous_[c])
+      {
+        double now = (double) spectrum[c];
+        double before = (double) previous_[c];
+        channels_.push_back(c);
+        deltas_.push_back(now - before);
+        sum_ += now - before;
+        sum_squares_ += now * now - before * before;
+      }
+    }
+    previous_ = spectrum;
+
+    if (!channels_.empty() && library_.size() > 0)
+      accumulateRows(&dots_[0], library_.weights(), library_.stride(),
+                     &channels_[0], &deltas_[0], channels_.size());
+    return (channels_.size());
+  }
+
+  /** With the template summing to 1 over n channels the correlation is
+   * (dot - sum / n) / sqrt(template spread * (sum of squares - sum^2 / n)).
+   * The attributed counts are the least squares amplitude (dot - sum / n) / template spread.
+   */
+  void NuclideIdentifier::rank(double min_score,
+                               std::vector<Identification> *results) const {
+    results->clear();
+    double spread = sum_squares_ - sum_ * sum_ / spectrum_bins;
+    if (spread <= 0)
+      return;
+    for (size_t t = 0; t < library_.size() && t < dots_.size(); t++)
+    {
+      double covariance = dots_[t] - sum_ / spectrum_bins;
+      Identification match;
+      match.index = t;
+      match.score = covariance / std::sqrt(library_.variance(t) * spread);
+      match.counts = covariance / library_.variance(t);
+      if (match.score >= min_score && match.counts > 0)
+        results->push_back(match);
+    }
+    std::sort(results->begin(), results->end(), betterMatch);
+  }
+}
@@ -0,0 +1,95 @@
+/** Implementation of the region of interest counters.
+ \file      roi_counter.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/roi_counter.h>
+
+#include <algorithm>
+
+namespace ursa
+{
+  RoiCounter::RoiCounter() :
+      size_(0), segments_(1), time_ns_(0) {
+    segment_.fill(0);
+    segment_counts_.fill(0);
+  }
+
+  /** Every region starts a segment at its low channel and ends one after its high channel.  With at most
+   * max_rois regions there are at most 2 * max_rois + 1 segments, so a segment number fits a byte.
+   */
+  bool RoiCounter::configure(const std::vector<ChannelRange> &rois) {
+    if (rois.size() > max_rois)
+      return (false);
+    for (size_t r = 0; r < rois.size(); r++)
+    {
+      if (rois[r].high < rois[r].low)
+        return (false);
+    }
+
+    std::vector<size_t> bounds;
+    bounds.push_back(0);
+    bounds.push_back(spectrum_bins);
+    for (size_t r = 0; r < rois.size(); r++)
+    {
+      bounds.push_back(std::min((size_t) rois[r].low, spectrum_bins));
+      bounds.push_back(std::min((size_t) rois[r].high + 1, spectrum_bins));
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    segments_ = bounds.size() - 1;
+    for (size_t s = 0; s < segments_; s++)
+      std::fill(segment_.begin() + bounds[s], segment_.begin() + bounds[s + 1],
+                (uint8_t) s);
+    for (size_t r = 0; r < rois.size(); r++)
+    {
+      size_t low = std::min((size_t) rois[r].low, spectrum_bins);
+      size_t end = std::min((size_t) rois[r].high + 1, spectrum_bins);
+      first_[r] = (uint8_t) (std::lower_bound(bounds.begin(), bounds.end(), low)
+          - bounds.begin());
+      end_[r] = (uint8_t) (std::lower_bound(bounds.begin(), bounds.end(), end)
+          - bounds.begin());
+    }
+    size_ = rois.size();
+    segment_counts_.fill(0);
+    return (true);
+  }
+
+  void RoiCounter::read(RoiCounts *counts) const {
+    counts->time_ns = time_ns_;
+    counts->gross = 0;
+    for (size_t s = 0; s < segments_; s++)
+      counts->gross += segment_counts_[s];
+    counts->size = size_;
+    for (size_t r = 0; r < size_; r++)
+    {
+      uint64_t sum = 0;
+      for (size_t s = first_[r]; s < end_[r]; s++)
+        sum += segment_counts_[s];
+      counts->counts[r] = sum;
+    }
+  }
+}
@@ -0,0 +1,281 @@
+/** Implementation of the shared memory spectrum and event ring.
+ \file      shm_ring.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/shm_ring.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ursa
+{
+  size_t shmSize(uint32_t event_capacity) {
+    return (sizeof(ShmHeader) + size_t(event_capacity) * sizeof(ShmEvent));
+  }
+
+  ShmWriter::ShmWriter() :
+      header_(NULL), events_(NULL), size_(0), mask_(0), next_event_(0), next_spectrum_(
+          0) {
+  }
+
+  ShmWriter::~ShmWriter() {
+    close();
+  }
+
+  /**
+   * Any object left by a writer that crashed is unlinked first, so readers still mapping it see it stop
+   * rather than see it restart.  The counters are constructed in place and the header published last.
+   */
+  bool ShmWriter::open(const std::string &name, uint32_t event_capacity) {
+    close();
+    uint32_t capacity = 1;
+    while (capacity < event_capacity && capacity < 0x80000000u)
+      capacity <<= 1;
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+      return (false);
+    size_t size = shmSize(capacity);
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+      memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+    {
+      shm_unlink(name.c_str());
+      return (false);
+    }
+
+    header_ = static_cast<ShmHeader *>(memory);
+    new (&header_->active) boost::atomic<uint32_t>(0);
+    new (&header_->spectra) boost::atomic<uint64_t>(0);
+    new (&header_->events) boost::atomic<uint64_t>(0);
+    for (size_t i = 0; i < shm_spectrum_slots; i++)
+      new (&header_->slots[i].sequence) boost::atomic<uint64_t>(0);
+    if (!header_->events.is_lock_free())
+    {
+      munmap(memory, size);
+      shm_unlink(name.c_str());
+      header_ = NULL;
+      return (false);
+    }
+    header_->event_capacity = capacity;
+    header_->spectrum_slots = shm_spectrum_slots;
+    header_->version = shm_version;
+    header_->active.store(1, boost::memory_order_release);
+    header_->magic = shm_magic;
+    boost::atomic_thread_fence(boost::memory_order_release);
+
+    name_ = name;
+    events_ = reinterpret_cast<ShmEvent *>(header_ + 1);
+    size_ = size;
+    mask_ = capacity - 1;
+    next_event_ = 0;
+    next_spectrum_ = 0;
+    return (true);
+  }
+
+  void ShmWriter::close() {
+    if (!header_)
+      return;
+    header_->active.store(0, boost::memory_order_release);
+    munmap(header_, size_);
+    shm_unlink(name_.c_str());
+    header_ = NULL;
+    events_ = NULL;
+  }
+
+  /**
+   * The slot's sequence is made odd before any bin is written.  The release fence keeps the bin stores
+   * after it, so a reader that sees an even sequence before and after its copy saw no writes.
+   */
+  uint64_t *ShmWriter::beginSpectrum() {
+    ShmSpectrumSlot &slot = header_->slots[next_spectrum_ % shm_spectrum_slots];
+    slot.sequence.store(2 * next_spectrum_ + 1, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+    return (slot.bins);
+  }
+
+  void ShmWriter::commitSpectrum(uint64_t time_ns, uint32_t epoch) {
+    ShmSpectrumSlot &slot = header_->slots[next_spectrum_ % shm_spectrum_slots];
+    slot.time_ns = time_ns;
+    slot.epoch = epoch;
+    next_spectrum_++;
+    slot.sequence.store(2 * next_spectrum_, boost::memory_order_release);
+    header_->spectra.store(next_spectrum_, boost::memory_order_release);
+  }
+
+  ShmReader::ShmReader() :
+      header_(NULL), events_(NULL), size_(0), capacity_(0), cursor_(0) {
+  }
+
+  ShmReader::~ShmReader() {
+    close();
+  }
+
+  bool ShmReader::open(const std::string &name) {
+    close();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      return (false);
+    struct stat info;
+    void *memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(ShmHeader))
+      memory = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+      return (false);
+
+    const ShmHeader *header = static_cast<const ShmHeader *>(memory);
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+    if (header->magic != shm_magic || header->version != shm_version
+        || header->spectrum_slots != shm_spectrum_slots
+        || shmSize(header->event_capacity) != size_t(info.st_size))
+    {
+      munmap(memory, info.st_size);
+      return (false);
+    }
+    header_ = header;
+    events_ = reinterpret_cast<const ShmEvent *>(header + 1);
+    size_ = info.st_size;
+    capacity_ = header->event_capacity;
+    cursor_ = header->events.load(boost::memory_order_acquire);
+    return (true);
+  }
+
+  void ShmReader::close() {
+    if (!header_)
+      return;
+    munmap(const_cast<ShmHeader *>(header_), size_);
+    header_ = NULL;
+    events_ = NULL;
+  }
+
+  const ShmSpectrumSlot *ShmReader::latestSpectrum(uint64_t *sequence) const {
+    uint64_t published = header_->spectra.load(boost::memory_order_acquire);
+    if (published == 0)
+      return (NULL);
+    const ShmSpectrumSlot *slot = &header_->slots[(published - 1)
+        % shm_spectrum_slots];
+    *sequence = slot->sequence.load(boost::memory_order_acquire);
+    return (slot);
+  }
+
+  bool ShmReader::spectrumValid(const ShmSpectrumSlot *slot,
+                                uint64_t sequence) const {
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+    return ((sequence & 1) == 0
+        && slot->sequence.load(boost::memory_order_relaxed) == sequence);
+  }
+
+  //! Each retry starts from the newest snapshot, so the loop ends once the copy is faster than the writer.
+  uint64_t ShmReader::readSpectrum(uint64_t *time_ns, uint32_t *epoch,
+                                   uint64_t *bins) const {
+    for (;;)
+    {
+      uint64_t sequence;
+      const ShmSpectrumSlot *slot = latestSpectrum(&sequence);
+      if (!slot)
+        return (0);
+      if (sequence & 1)
+        continue;
+      uint64_t time = slot->time_ns;
+      uint32_t slot_epoch = slot->epoch;
+      memcpy(bins, slot->bins, sizeof(slot->bins));
+      if (!spectrumValid(slot, sequence))
+        continue;
+      if (time_ns)
+        *time_ns = time;
+      if (epoch)
+        *epoch = slot_epoch;
+      return (sequence / 2);
+    }
+  }
+
+  size_t ShmReader::readEvents(ShmEvent *events, size_t max,
+                               uint64_t *dropped) {
+    size_t copied = 0;
+    while (copied < max)
+    {
+      const ShmEvent *first;
+      size_t count = std::min(peekEvents(&first, dropped), max - copied);
+      if (count == 0)
+        break;
+      memcpy(events + copied, first, count * sizeof(ShmEvent));
+      boost::atomic_thread_fence(boost::memory_order_acquire);
+      uint64_t safe = oldestSafe(
+          header_->events.load(boost::memory_order_relaxed));
+      uint64_t start = cursor_;
+      cursor_ += count;
+      if (start < safe)
+      {
+        // Keep only the events the writer had not reached. Later ones it overtook are counted by peekEvents().
+        size_t lost = std::min<uint64_t>(safe - start, count);
+        memmove(events + copied, events + copied + lost,
+                (count - lost) * sizeof(ShmEvent));
+        count -= lost;
+        if (dropped)
+          *dropped += lost;
+      }
+      copied += count;
+    }
+    return (copied);
+  }
+
+  /**
+   * A reader more than a ring behind skips to the oldest event which cannot be being overwritten.
+   */
+  size_t ShmReader::peekEvents(const ShmEvent **first, uint64_t *dropped) {
+    uint64_t head = header_->events.load(boost::memory_order_acquire);
+    uint64_t safe = oldestSafe(head);
+    if (cursor_ < safe)
+    {
+      if (dropped)
+        *dropped += safe - cursor_;
+      cursor_ = safe;
+    }
+    uint64_t index = cursor_ & (capacity_ - 1);
+    *first = events_ + index;
+    return (std::min(head - cursor_, capacity_ - index));
+  }
+
+  /**
+   * The events were only valid if the writer has not since reached any of their slots, which the head
+   * read after them shows.  The cursor moves past them either way.
+   */
+  bool ShmReader::consumeEvents(size_t count) {
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+    uint64_t safe = oldestSafe(header_->events.load(boost::memory_order_relaxed));
+    bool valid = cursor_ >= safe;
+    cursor_ += count;
+    return (valid);
+  }
+}
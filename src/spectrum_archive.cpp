@@ -0,0 +1,599 @@
+/** Implementation of the spectrum archive writer and reader.
+ \file      spectrum_archive.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/spectrum_archive.h>
+
+#include <cstring>
+
+/* File layout, all integers little endian:
+ *
+ *   file header   "URSAARC1", u32 version, u32 bins, u64 chunk_ns, u64 summary_ns
+ *   block         u32 block_magic, u32 kind, u64 start_ns, u64 end_ns,
+ *                 u32 records, u32 summary_bytes, u32 records_bytes, u32 reserved,
+ *                 summary_bytes of sparse spectrum, records_bytes of records
+ *   record        varint offset_ns from the block start, varint length, length bytes of sparse spectrum
+ *   sparse        repeated (varint zero bins skipped, varint count) pairs
+ *   footer        u64 offset of the index block, "URSAIDX1"
+ *
+ * The index block reuses the block header with records set to the number of entries and
+ * summary_bytes holding the entries: u32 kind, u32 records, u64 start_ns, u64 end_ns, u64 offset.
+ */
+
+namespace ursa
+{
+  namespace
+  {
+    const char file_magic[8] = { 'U', 'R', 'S', 'A', 'A', 'R', 'C', '1' };
+    const char footer_magic[8] = { 'U', 'R', 'S', 'A', 'I', 'D', 'X', '1' };
+    const uint32_t block_magic = 0x314B4C42; // "BLK1"
+    const uint32_t archive_version = 1;
+    const size_t file_header_length = 32;
+    const size_t block_header_length = 40;
+    const size_t index_entry_length = 32;
+    const size_t footer_length = 16;
+    const uint64_t ns_per_second = 1000000000ULL;
+
+    void put32(std::vector<uint8_t> &out, uint32_t value) {
+      for (int i = 0; i < 4; i++)
+        out.push_back((uint8_t) (value >> (8 * i)));
+    }
+
+    void put64(std::vector<uint8_t> &out, uint64_t value) {
+      for (int i = 0; i < 8; i++)
+        out.push_back((uint8_t) (value >> (8 * i)));
+    }
+
+    uint32_t get32(const uint8_t *in) {
+      uint32_t value = 0;
+      for (int i = 3; i >= 0; i--)
+        value = (value << 8) | in[i];
+      return (value);
+    }
+
+    uint64_t get64(const uint8_t *in) {
+      uint64_t value = 0;
+      for (int i = 7; i >= 0; i--)
+        value = (value << 8) | in[i];
+      return (value);
+    }
+
+    void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+      while (value >= 0x80)
+      {
+        out.push_back((uint8_t) (value | 0x80));
+        value >>= 7;
+      }
+      out.push_back((uint8_t) value);
+    }
+
+    //! Returns false if the varint runs past end.
+    bool getVarint(const uint8_t *&in, const uint8_t *end, uint64_t *value) {
+      *value = 0;
+      for (int shift = 0; in < end && shift < 64; shift += 7)
+      {
+        uint8_t byte = *in++;
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+          return (true);
+      }
+      return (false);
+    }
+
+    template<typename T>
+    void encodeSparse(std::vector<uint8_t> &out, const T *counts) {
+      uint64_t run = 0;
+      for (size_t i = 0; i < spectrum_bins; i++)
+      {
+        if (counts[i] == 0)
+          run++;
+        else
+        {
+          putVarint(out, run);
+          putVarint(out, counts[i]);
+          run = 0;
+        }
+      }
+    }
+
+    //! Adds the sparse spectrum in [in, end) into sum. Returns false if it is malformed.
+    bool decodeSparse(const uint8_t *in, const uint8_t *end, WideSpectrum *sum) {
+      uint64_t bin = 0;
+      while (in < end)
+      {
+        uint64_t run, count;
+        if (!getVarint(in, end, &run) || !getVarint(in, end, &count))
+          return (false);
+        bin += run;
+        if (bin >= spectrum_bins)
+          return (false);
+        (*sum)[bin++] += count;
+      }
+      return (true);
+    }
+
+    void encodeBlockHeader(std::vector<uint8_t> &out, const ArchiveBlockInfo &info,
+                           uint32_t summary_bytes, uint32_t records_bytes) {
+      put32(out, block_magic);
+      put32(out, info.kind);
+      put64(out, info.start_ns);
+      put64(out, info.end_ns);
+      put32(out, info.records);
+      put32(out, summary_bytes);
+      put32(out, records_bytes);
+      put32(out, 0);
+    }
+
+    //! Decodes a block header. Returns false if the magic is wrong.
+    bool decodeBlockHeader(const uint8_t *in, ArchiveBlockInfo *info,
+                           uint32_t *summary_bytes, uint32_t *records_bytes) {
+      if (get32(in) != block_magic)
+        return (false);
+      info->kind = get32(in + 4);
+      info->start_ns = get64(in + 8);
+      info->end_ns = get64(in + 16);
+      info->records = get32(in + 24);
+      *summary_bytes = get32(in + 28);
+      *records_bytes = get32(in + 32);
+      return (true);
+    }
+  }
+
+  /** The summary length is rounded down to a multiple of the chunk length so chunks never straddle a summary.
+   */
+  SpectrumArchiveWriter::SpectrumArchiveWriter(uint32_t chunk_seconds,
+                                               uint32_t summary_seconds) :
+      chunk_ns_((uint64_t) (chunk_seconds ? chunk_seconds : 1) * ns_per_second), summary_ns_(
+          0), chunk_open_(false), chunk_start_ns_(0), last_ns_(0), chunk_records_(
+          0), summary_open_(false), summary_start_ns_(0), summary_records_(0), have_previous_(
+          false) {
+    summary_ns_ = (uint64_t) summary_seconds * ns_per_second / chunk_ns_
+        * chunk_ns_;
+    if (summary_ns_ == 0)
+      summary_ns_ = chunk_ns_;
+    chunk_sum_.fill(0);
+    summary_sum_.fill(0);
+    previous_.fill(0);
+  }
+
+  SpectrumArchiveWriter::~SpectrumArchiveWriter() {
+    close();
+  }
+
+  bool SpectrumArchiveWriter::open(const std::string &path) {
+    close();
+    file_.open(path.c_str(),
+               std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file_.is_open())
+      return (false);
+
+    std::vector<uint8_t> header(file_magic, file_magic + 8);
+    put32(header, archive_version);
+    put32(header, spectrum_bins);
+    put64(header, chunk_ns_);
+    put64(header, summary_ns_);
+    file_.write((const char *) &header[0], header.size());
+
+    index_.clear();
+    chunk_open_ = false;
+    summary_open_ = false;
+    have_previous_ = false;
+    last_ns_ = 0;
+    return (file_.good());
+  }
+
+  /**
+   * A record in a new chunk or summary period first writes out the finished ones.
+   */
+  bool SpectrumArchiveWriter::append(uint64_t time_ns, const Spectrum &counts) {
+    if (!file_.is_open() || time_ns < last_ns_)
+      return (false);
+
+    uint64_t chunk_start = time_ns - time_ns % chunk_ns_;
+    uint64_t summary_start = time_ns - time_ns % summary_ns_;
+    if (chunk_open_ && chunk_start != chunk_start_ns_)
+      writeChunk();
+    if (summary_open_ && summary_start != summary_start_ns_)
+      writeSummary();
+    if (!chunk_open_)
+    {
+      chunk_open_ = true;
+      chunk_start_ns_ = chunk_start;
+    }
+    if (!summary_open_)
+    {
+      summary_open_ = true;
+      summary_start_ns_ = summary_start;
+    }
+
+    std::vector<uint8_t> record;
+    encodeSparse(record, counts.data());
+    putVarint(chunk_data_, time_ns - chunk_start_ns_);
+    putVarint(chunk_data_, record.size());
+    chunk_data_.insert(chunk_data_.end(), record.begin(), record.end());
+
+    widenAccumulate(chunk_sum_.data(), counts.data(), spectrum_bins);
+    widenAccumulate(summary_sum_.data(), counts.data(), spectrum_bins);
+    chunk_records_++;
+    summary_records_++;
+    last_ns_ = time_ns;
+    return (true);
+  }
+
+  bool SpectrumArchiveWriter::appendCumulative(uint64_t time_ns,
+                                               const WideSpectrum &cumulative) {
+    if (!file_.is_open() || time_ns < last_ns_)
+      return (false);
+    if (!have_previous_)
+    {
+      previous_ = cumulative;
+      have_previous_ = true;
+      last_ns_ = time_ns;
+      return (true);
+    }
+
+    bool cleared = false;
+    for (size_t i = 0; i < spectrum_bins; i++)
+    {
+      if (cumulative[i] < previous_[i])
+      {
+        cleared = true;
+        break;
+      }
+    }
+    for (size_t i = 0; i < spectrum_bins; i++)
+      interval_[i] = cleared ? cumulative[i] : cumulative[i] - previous_[i];
+    previous_ = cumulative;
+    return (append(time_ns, interval_));
+  }
+
+  void SpectrumArchiveWriter::flush() {
+    if (!file_.is_open())
+      return;
+    if (chunk_open_)
+      writeChunk();
+    file_.flush();
+  }
+
+  void SpectrumArchiveWriter::close() {
+    if (!file_.is_open())
+      return;
+    if (chunk_open_)
+      writeChunk();
+    if (summary_open_)
+      writeSummary();
+
+    std::vector<uint8_t> entries;
+    for (size_t i = 0; i < index_.size(); i++)
+    {
+      put32(entries, index_[i].kind);
+      put32(entries, index_[i].records);
+      put64(entries, index_[i].start_ns);
+      put64(entries, index_[i].end_ns);
+      put64(entries, index_[i].offset);
+    }
+    ArchiveBlockInfo info;
+    info.kind = ARCHIVE_INDEX;
+    info.records = index_.size();
+    info.start_ns = 0;
+    info.end_ns = 0;
+    uint64_t index_offset = file_.tellp();
+    std::vector<uint8_t> block;
+    encodeBlockHeader(block, info, entries.size(), 0);
+    block.insert(block.end(), entries.begin(), entries.end());
+    put64(block, index_offset);
+    block.insert(block.end(), footer_magic, footer_magic + 8);
+    file_.write((const char *) &block[0], block.size());
+    file_.close();
+  }
+
+  void SpectrumArchiveWriter::writeChunk() {
+    ArchiveBlockInfo info;
+    info.kind = ARCHIVE_CHUNK;
+    info.records = chunk_records_;
+    info.start_ns = chunk_start_ns_;
+    info.end_ns = chunk_start_ns_ + chunk_ns_;
+    std::vector<uint8_t> summary;
+    encodeSparse(summary, chunk_sum_.data());
+    writeBlock(info, summary, chunk_data_);
+
+    chunk_data_.clear();
+    chunk_sum_.fill(0);
+    chunk_records_ = 0;
+    chunk_open_ = false;
+  }
+
+  void SpectrumArchiveWriter::writeSummary() {
+    ArchiveBlockInfo info;
+    info.kind = ARCHIVE_SUMMARY;
+    info.records = summary_records_;
+    info.start_ns = summary_start_ns_;
+    info.end_ns = summary_start_ns_ + summary_ns_;
+    std::vector<uint8_t> summary;
+    encodeSparse(summary, summary_sum_.data());
+    writeBlock(info, summary, std::vector<uint8_t>());
+
+    summary_sum_.fill(0);
+    summary_records_ = 0;
+    summary_open_ = false;
+  }
+
+  void SpectrumArchiveWriter::writeBlock(ArchiveBlockInfo info,
+                                         const std::vector<uint8_t> &summary,
+                                         const std::vector<uint8_t> &records) {
+    info.offset = file_.tellp();
+    std::vector<uint8_t> header;
+    encodeBlockHeader(header, info, summary.size(), records.size());
+    file_.write((const char *) &header[0], header.size());
+    if (!summary.empty())
+      file_.write((const char *) &summary[0], summary.size());
+    if (!records.empty())
+      file_.write((const char *) &records[0], records.size());
+    index_.push_back(info);
+  }
+
+  SpectrumArchiveReader::SpectrumArchiveReader() :
+      chunk_ns_(0), summary_ns_(0) {
+    rewind();
+  }
+
+  bool SpectrumArchiveReader::open(const std::string &path) {
+    if (file_.is_open())
+      file_.close();
+    file_.clear();
+    index_.clear();
+    file_.open(path.c_str(), std::ios::in | std::ios::binary);
+    uint8_t header[file_header_length];
+    if (!file_.read((char *) header, file_header_length)
+        || memcmp(header, file_magic, 8) != 0
+        || get32(header + 8) != archive_version
+        || get32(header + 12) != spectrum_bins)
+      return (false);
+    chunk_ns_ = get64(header + 16);
+    summary_ns_ = get64(header + 24);
+    rewind();
+    return (readIndex() || scanIndex());
+  }
+
+  bool SpectrumArchiveReader::readIndex() {
+    uint8_t footer[footer_length];
+    file_.clear();
+    file_.seekg(0, std::ios::end);
+    uint64_t size = file_.tellg();
+    if (size < file_header_length + block_header_length + footer_length)
+      return (false);
+    file_.seekg(size - footer_length);
+    if (!file_.read((char *) footer, footer_length)
+        || memcmp(footer + 8, footer_magic, 8) != 0)
+      return (false);
+
+    uint8_t header[block_header_length];
+    ArchiveBlockInfo info;
+    uint32_t entries_bytes, records_bytes;
+    file_.seekg(get64(footer));
+    if (!file_.read((char *) header, block_header_length)
+        || !decodeBlockHeader(header, &info, &entries_bytes, &records_bytes)
+        || info.kind != ARCHIVE_INDEX
+        || entries_bytes != info.records * index_entry_length)
+      return (false);
+    buffer_.resize(entries_bytes);
+    if (entries_bytes && !file_.read((char *) &buffer_[0], entries_bytes))
+      return (false);
+    for (size_t i = 0; i < info.records; i++)
+    {
+      const uint8_t *entry = &buffer_[i * index_entry_length];
+      ArchiveBlockInfo block;
+      block.kind = get32(entry);
+      block.records = get32(entry + 4);
+      block.start_ns = get64(entry + 8);
+      block.end_ns = get64(entry + 16);
+      block.offset = get64(entry + 24);
+      index_.push_back(block);
+    }
+    return (true);
+  }
+
+  /**
+   * Walks the block headers from the start of the file.  A truncated final block is ignored.
+   */
+  bool SpectrumArchiveReader::scanIndex() {
+    index_.clear();
+    file_.clear();
+    file_.seekg(0, std::ios::end);
+    uint64_t size = file_.tellg();
+    uint64_t offset = file_header_length;
+    uint8_t header[block_header_length];
+    while (offset + block_header_length <= size)
+    {
+      ArchiveBlockInfo info;
+      uint32_t summary_bytes, records_bytes;
+      file_.seekg(offset);
+      if (!file_.read((char *) header, block_header_length)
+          || !decodeBlockHeader(header, &info, &summary_bytes, &records_bytes))
+        break;
+      uint64_t next = offset + block_header_length + summary_bytes
+          + records_bytes;
+      if (next > size || info.kind == ARCHIVE_INDEX)
+        break;
+      info.offset = offset;
+      index_.push_back(info);
+      offset = next;
+    }
+    file_.clear();
+    return (true);
+  }
+
+  bool SpectrumArchiveReader::addSummary(const ArchiveBlockInfo &info,
+                                         WideSpectrum *sum) {
+    uint8_t header[block_header_length];
+    ArchiveBlockInfo block;
+    uint32_t summary_bytes, records_bytes;
+    file_.clear();
+    file_.seekg(info.offset);
+    if (!file_.read((char *) header, block_header_length)
+        || !decodeBlockHeader(header, &block, &summary_bytes, &records_bytes))
+      return (false);
+    buffer_.resize(summary_bytes);
+    if (summary_bytes && !file_.read((char *) &buffer_[0], summary_bytes))
+      return (false);
+    return (summary_bytes == 0
+        || decodeSparse(&buffer_[0], &buffer_[0] + summary_bytes, sum));
+  }
+
+  bool SpectrumArchiveReader::addRecords(const ArchiveBlockInfo &info,
+                                         uint64_t start_ns, uint64_t end_ns,
+                                         WideSpectrum *sum, uint64_t *records) {
+    uint8_t header[block_header_length];
+    ArchiveBlockInfo block;
+    uint32_t summary_bytes, records_bytes;
+    file_.clear();
+    file_.seekg(info.offset);
+    if (!file_.read((char *) header, block_header_length)
+        || !decodeBlockHeader(header, &block, &summary_bytes, &records_bytes))
+      return (false);
+    file_.seekg(summary_bytes, std::ios::cur);
+    buffer_.resize(records_bytes);
+    if (records_bytes && !file_.read((char *) &buffer_[0], records_bytes))
+      return (false);
+
+    const uint8_t *in = records_bytes ? &buffer_[0] : NULL;
+    const uint8_t *end = in + records_bytes;
+    while (in < end)
+    {
+      uint64_t offset, length;
+      if (!getVarint(in, end, &offset) || !getVarint(in, end, &length)
+          || length > (uint64_t) (end - in))
+        return (false);
+      uint64_t time_ns = block.start_ns + offset;
+      if (time_ns >= start_ns && time_ns < end_ns)
+      {
+        if (!decodeSparse(in, in + length, sum))
+          return (false);
+        (*records)++;
+      }
+      in += length;
+    }
+    return (true);
+  }
+
+  /**
+   * Summary blocks entirely inside the range are used first.  Chunks inside one of those summaries are
+   * skipped, chunks entirely inside the range use their chunk summary and only chunks on the edges of the
+   * range have their records decoded.
+   */
+  bool SpectrumArchiveReader::query(uint64_t start_ns, uint64_t end_ns,
+                                    WideSpectrum *sum, uint64_t *records) {
+    uint64_t count = 0;
+    sum->fill(0);
+    std::vector<const ArchiveBlockInfo *> covered;
+    for (size_t i = 0; i < index_.size(); i++)
+    {
+      const ArchiveBlockInfo &block = index_[i];
+      if (block.kind == ARCHIVE_SUMMARY && block.start_ns >= start_ns
+          && block.end_ns <= end_ns)
+      {
+        if (!addSummary(block, sum))
+          return (false);
+        count += block.records;
+        covered.push_back(&block);
+      }
+    }
+
+    for (size_t i = 0; i < index_.size(); i++)
+    {
+      const ArchiveBlockInfo &block = index_[i];
+      if (block.kind != ARCHIVE_CHUNK || block.end_ns <= start_ns
+          || block.start_ns >= end_ns)
+        continue;
+      bool in_summary = false;
+      for (size_t j = 0; j < covered.size() && !in_summary; j++)
+        in_summary = (block.start_ns >= covered[j]->start_ns
+            && block.start_ns < covered[j]->end_ns);
+      if (in_summary)
+        continue;
+
+      if (block.start_ns >= start_ns && block.end_ns <= end_ns)
+      {
+        if (!addSummary(block, sum))
+          return (false);
+        count += block.records;
+      }
+      else if (!addRecords(block, start_ns, end_ns, sum, &count))
+        return (false);
+    }
+
+    if (records)
+      *records = count;
+    return (true);
+  }
+
+  void SpectrumArchiveReader::rewind() {
+    next_block_ = 0;
+    records_.clear();
+    record_offset_ = 0;
+  }
+
+  /** Chunks are read in index order, which is the order they were written and so time order.
+   * Summary blocks are skipped.
+   */
+  bool SpectrumArchiveReader::next(uint64_t *time_ns, WideSpectrum *counts) {
+    while (record_offset_ >= records_.size())
+    {
+      while (next_block_ < index_.size()
+          && index_[next_block_].kind != ARCHIVE_CHUNK)
+        next_block_++;
+      if (next_block_ >= index_.size())
+        return (false);
+
+      uint8_t header[block_header_length];
+      ArchiveBlockInfo block;
+      uint32_t summary_bytes, records_bytes;
+      file_.clear();
+      file_.seekg(index_[next_block_++].offset);
+      if (!file_.read((char *) header, block_header_length)
+          || !decodeBlockHeader(header, &block, &summary_bytes, &records_bytes))
+        return (false);
+      file_.seekg(summary_bytes, std::ios::cur);
+      records_.resize(records_bytes);
+      if (records_bytes && !file_.read((char *) &records_[0], records_bytes))
+        return (false);
+      chunk_start_ns_ = block.start_ns;
+      record_offset_ = 0;
+    }
+
+    const uint8_t *in = &records_[record_offset_];
+    const uint8_t *end = &records_[0] + records_.size();
+    uint64_t offset, length;
+    if (!getVarint(in, end, &offset) || !getVarint(in, end, &length)
+        || length > (uint64_t) (end - in))
+      return (false);
+    counts->fill(0);
+    if (!decodeSparse(in, in + length, counts))
+      return (false);
+    *time_ns = chunk_start_ns_ + offset;
+    record_offset_ = in + length - &records_[0];
+    return (true);
+  }
+}
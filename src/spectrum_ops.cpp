@@ -0,0 +1,494 @@
+/** Implementation of the vectorized spectrum kernels.
+ \file      spectrum_ops.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/spectrum_ops.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+/* The SIMD kernels are compiled with per function target attributes and selected at run time,
+ * so the package does not need to be built with -mavx2 to use AVX2 where it is available.
+ * GCC before 4.9 cannot use intrinsics outside the global target so it only gets the scalar kernels.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define URSA_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace ursa
+{
+  namespace
+  {
+    enum simd_level
+    {
+      SIMD_SCALAR = 0,
+      SIMD_SSE2,
+      SIMD_AVX2
+    };
+
+    simd_level detectSimd() {
+#ifdef URSA_SIMD_DISPATCH
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2"))
+        return (SIMD_AVX2);
+      if (__builtin_cpu_supports("sse2"))
+        return (SIMD_SSE2);
+#endif
+      return (SIMD_SCALAR);
+    }
+
+    simd_level simd_limit = SIMD_AVX2; //!< The highest instruction set limitSimd() allows.
+
+    //! The instruction set is detected once on first use.
+    simd_level currentSimd() {
+      static const simd_level level = detectSimd();
+      return (std::min(level, simd_limit));
+    }
+
+    void widenAccumulateScalar(uint64_t *dst, const uint32_t *src, size_t n) {
+      for (size_t i = 0; i < n; i++)
+        dst[i] += src[i];
+    }
+
+#ifdef URSA_SIMD_DISPATCH
+    //! Zero extends 4 counts to two pairs of 64 bit lanes by interleaving with zero.
+    __attribute__((target("sse2")))
+    void widenAccumulateSSE2(uint64_t *dst, const uint32_t *src, size_t n) {
+      const __m128i zero = _mm_setzero_si128();
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128i counts = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i lo = _mm_unpacklo_epi32(counts, zero);
+        __m128i hi = _mm_unpackhi_epi32(counts, zero);
+        __m128i *out = (__m128i *) (dst + i);
+        _mm_storeu_si128(out, _mm_add_epi64(_mm_loadu_si128(out), lo));
+        _mm_storeu_si128(out + 1, _mm_add_epi64(_mm_loadu_si128(out + 1), hi));
+      }
+      widenAccumulateScalar(dst + i, src + i, n - i);
+    }
+
+    //! Zero extends 8 counts per iteration with vpmovzxdq.
+    __attribute__((target("avx2")))
+    void widenAccumulateAVX2(uint64_t *dst, const uint32_t *src, size_t n) {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256i lo = _mm256_cvtepu32_epi64(
+            _mm_loadu_si128((const __m128i *) (src + i)));
+        __m256i hi = _mm256_cvtepu32_epi64(
+            _mm_loadu_si128((const __m128i *) (src + i + 4)));
+        __m256i *out = (__m256i *) (dst + i);
+        _mm256_storeu_si256(out, _mm256_add_epi64(_mm256_loadu_si256(out), lo));
+        _mm256_storeu_si256(out + 1,
+                            _mm256_add_epi64(_mm256_loadu_si256(out + 1), hi));
+      }
+      widenAccumulateScalar(dst + i, src + i, n - i);
+    }
+#endif
+
+    void accumulateRowsScalar(double *acc, const float *matrix, size_t stride,
+                              const uint32_t *rows, const double *scale,
+                              size_t n) {
+      for (size_t i = 0; i < n; i++)
+      {
+        const float *row = matrix + (size_t) rows[i] * stride;
+        for (size_t t = 0; t < stride; t++)
+          acc[t] += scale[i] * row[t];
+      }
+    }
+
+#ifdef URSA_SIMD_DISPATCH
+    //! Widens 2 weights per step with cvtps2pd.
+    __attribute__((target("sse2")))
+    void accumulateRowsSSE2(double *acc, const float *matrix, size_t stride,
+                            const uint32_t *rows, const double *scale,
+                            size_t n) {
+      size_t vector_end = stride & ~size_t(1);
+      for (size_t i = 0; i < n; i++)
+      {
+        const float *row = matrix + (size_t) rows[i] * stride;
+        __m128d factor = _mm_set1_pd(scale[i]);
+        size_t t = 0;
+        for (; t < vector_end; t += 2)
+        {
+          __m128d weights = _mm_cvtps_pd(
+              _mm_castpd_ps(_mm_load_sd((const double *) (row + t))));
+          _mm_storeu_pd(
+              acc + t,
+              _mm_add_pd(_mm_loadu_pd(acc + t), _mm_mul_pd(factor, weights)));
+        }
+        for (; t < stride; t++)
+          acc[t] += scale[i] * row[t];
+      }
+    }
+
+    //! Widens 8 weights per step to two vectors of 4 doubles.
+    __attribute__((target("avx2")))
+    void accumulateRowsAVX2(double *acc, const float *matrix, size_t stride,
+                            const uint32_t *rows, const double *scale,
+                            size_t n) {
+      size_t vector_end = stride & ~size_t(7);
+      for (size_t i = 0; i < n; i++)
+      {
+        const float *row = matrix + (size_t) rows[i] * stride;
+        __m256d factor = _mm256_set1_pd(scale[i]);
+        size_t t = 0;
+        for (; t < vector_end; t += 8)
+        {
+          __m256 weights = _mm256_loadu_ps(row + t);
+          __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(weights));
+          __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(weights, 1));
+          _mm256_storeu_pd(
+              acc + t,
+              _mm256_add_pd(_mm256_loadu_pd(acc + t), _mm256_mul_pd(factor, lo)));
+          _mm256_storeu_pd(
+              acc + t + 4,
+              _mm256_add_pd(_mm256_loadu_pd(acc + t + 4),
+                            _mm256_mul_pd(factor, hi)));
+        }
+        for (; t < stride; t++)
+          acc[t] += scale[i] * row[t];
+      }
+    }
+#endif
+
+    void subtractBackgroundScalar(double *net, double *variance,
+                                  const uint32_t *gross,
+                                  const uint32_t *background, double scale,
+                                  size_t n) {
+      double scale2 = scale * scale;
+      for (size_t i = 0; i < n; i++)
+      {
+        net[i] = gross[i] - scale * background[i];
+        if (variance)
+          variance[i] = gross[i] + scale2 * background[i];
+      }
+    }
+
+    void sumSpectraScalar(uint64_t *dst, const uint32_t *const *sources,
+                          size_t count, size_t n) {
+      for (size_t i = 0; i < n; i++)
+      {
+        uint64_t sum = 0;
+        for (size_t k = 0; k < count; k++)
+          sum += sources[k][i];
+        dst[i] = sum;
+      }
+    }
+
+    //! Sums each whole block of 8 bins, returning the number of blocks.
+    size_t blockSumsScalar(uint64_t *blocks, const uint32_t *spectrum,
+                           size_t n) {
+      size_t count = n / 8;
+      for (size_t b = 0; b < count; b++)
+      {
+        const uint32_t *bins = spectrum + b * 8;
+        blocks[b] = (uint64_t) bins[0] + bins[1] + bins[2] + bins[3] + bins[4]
+            + bins[5] + bins[6] + bins[7];
+      }
+      return (count);
+    }
+
+#ifdef URSA_SIMD_DISPATCH
+    //! Converts 4 unsigned counts to doubles. cvtdq2pd is signed so counts of 2^31 and above are corrected.
+    __attribute__((target("avx2")))
+    inline __m256d countsToDouble(__m128i counts) {
+      __m256d value = _mm256_cvtepi32_pd(counts);
+      __m256d wrapped = _mm256_and_pd(
+          _mm256_cmp_pd(value, _mm256_setzero_pd(), _CMP_LT_OQ),
+          _mm256_set1_pd(4294967296.0));
+      return (_mm256_add_pd(value, wrapped));
+    }
+
+    //! Converts and scales 4 bins per step.
+    __attribute__((target("avx2")))
+    void subtractBackgroundAVX2(double *net, double *variance,
+                                const uint32_t *gross,
+                                const uint32_t *background, double scale,
+                                size_t n) {
+      __m256d factor = _mm256_set1_pd(scale);
+      __m256d factor2 = _mm256_set1_pd(scale * scale);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m256d g = countsToDouble(
+            _mm_loadu_si128((const __m128i *) (gross + i)));
+        __m256d b = countsToDouble(
+            _mm_loadu_si128((const __m128i *) (background + i)));
+        _mm256_storeu_pd(net + i, _mm256_sub_pd(g, _mm256_mul_pd(factor, b)));
+        if (variance)
+          _mm256_storeu_pd(variance + i,
+                           _mm256_add_pd(g, _mm256_mul_pd(factor2, b)));
+      }
+      subtractBackgroundScalar(net + i, variance ? variance + i : NULL, gross + i,
+                               background + i, scale, n - i);
+    }
+
+    //! Keeps 8 bins of the sum in two 64 bit vectors while every source is added.
+    __attribute__((target("avx2")))
+    void sumSpectraAVX2(uint64_t *dst, const uint32_t *const *sources,
+                        size_t count, size_t n) {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        for (size_t k = 0; k < count; k++)
+        {
+          const uint32_t *src = sources[k] + i;
+          lo = _mm256_add_epi64(
+              lo, _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *) src)));
+          hi = _mm256_add_epi64(
+              hi,
+              _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *) (src + 4))));
+        }
+        _mm256_storeu_si256((__m256i *) (dst + i), lo);
+        _mm256_storeu_si256((__m256i *) (dst + i + 4), hi);
+      }
+      for (; i < n; i++)
+      {
+        uint64_t sum = 0;
+        for (size_t k = 0; k < count; k++)
+          sum += sources[k][i];
+        dst[i] = sum;
+      }
+    }
+
+    //! Reduces two blocks of 8 bins per step, interleaving the blocks so one horizontal add serves both.
+    __attribute__((target("avx2")))
+    size_t blockSumsAVX2(uint64_t *blocks, const uint32_t *spectrum, size_t n) {
+      size_t count = n / 8;
+      size_t b = 0;
+      for (; b + 2 <= count; b += 2)
+      {
+        const uint32_t *bins = spectrum + b * 8;
+        __m256i first = _mm256_add_epi64(
+            _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *) bins)),
+            _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *) (bins + 4))));
+        __m256i second = _mm256_add_epi64(
+            _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *) (bins + 8))),
+            _mm256_cvtepu32_epi64(
+                _mm_loadu_si128((const __m128i *) (bins + 12))));
+        __m256i pairs = _mm256_add_epi64(_mm256_unpacklo_epi64(first, second),
+                                         _mm256_unpackhi_epi64(first, second));
+        _mm_storeu_si128((__m128i *) (blocks + b),
+                         _mm_add_epi64(_mm256_castsi256_si128(pairs),
+                                       _mm256_extracti128_si256(pairs, 1)));
+      }
+      blockSumsScalar(blocks + b, spectrum + b * 8, n - b * 8);
+      return (count);
+    }
+#endif
+
+    size_t blockSums(uint64_t *blocks, const uint32_t *spectrum, size_t n) {
+#ifdef URSA_SIMD_DISPATCH
+      if (currentSimd() == SIMD_AVX2)
+        return (blockSumsAVX2(blocks, spectrum, n));
+#endif
+      return (blockSumsScalar(blocks, spectrum, n));
+    }
+  }
+
+  void widenAccumulate(uint64_t *dst, const uint32_t *src, size_t n) {
+    switch (currentSimd())
+    {
+#ifdef URSA_SIMD_DISPATCH
+      case SIMD_AVX2:
+        widenAccumulateAVX2(dst, src, n);
+        break;
+      case SIMD_SSE2:
+        widenAccumulateSSE2(dst, src, n);
+        break;
+#endif
+      default:
+        widenAccumulateScalar(dst, src, n);
+        break;
+    }
+  }
+
+  void accumulateRows(double *acc, const float *matrix, size_t stride,
+                      const uint32_t *rows, const double *scale, size_t n) {
+    switch (currentSimd())
+    {
+#ifdef URSA_SIMD_DISPATCH
+      case SIMD_AVX2:
+        accumulateRowsAVX2(acc, matrix, stride, rows, scale, n);
+        break;
+      case SIMD_SSE2:
+        accumulateRowsSSE2(acc, matrix, stride, rows, scale, n);
+        break;
+#endif
+      default:
+        accumulateRowsScalar(acc, matrix, stride, rows, scale, n);
+        break;
+    }
+  }
+
+  void subtractBackground(double *net, double *variance, const uint32_t *gross,
+                          const uint32_t *background, double scale, size_t n) {
+    switch (currentSimd())
+    {
+#ifdef URSA_SIMD_DISPATCH
+      case SIMD_AVX2:
+        subtractBackgroundAVX2(net, variance, gross, background, scale, n);
+        break;
+#endif
+      default:
+        subtractBackgroundScalar(net, variance, gross, background, scale, n);
+        break;
+    }
+  }
+
+  void sumSpectra(uint64_t *dst, const uint32_t *const *sources, size_t count,
+                  size_t n) {
+    switch (currentSimd())
+    {
+#ifdef URSA_SIMD_DISPATCH
+      case SIMD_AVX2:
+        sumSpectraAVX2(dst, sources, count, n);
+        break;
+#endif
+      default:
+        sumSpectraScalar(dst, sources, count, n);
+        break;
+    }
+  }
+
+  void roiSums(const uint32_t *spectrum, size_t n, const ChannelRange *ranges,
+               size_t count, uint64_t *sums) {
+    if (n > spectrum_bins)
+      n = spectrum_bins;
+
+    // prefix[b] holds the counts in bins [0, 8 * b).
+    uint64_t prefix[spectrum_bins / 8 + 1];
+    size_t blocks = blockSums(prefix + 1, spectrum, n);
+    prefix[0] = 0;
+    for (size_t b = 1; b <= blocks; b++)
+      prefix[b] += prefix[b - 1];
+
+    for (size_t r = 0; r < count; r++)
+    {
+      size_t low = ranges[r].low;
+      size_t end = std::min((size_t) ranges[r].high + 1, n);
+      uint64_t sum = 0;
+      if (low < end)
+      {
+        size_t first_block = (low + 7) / 8;
+        size_t last_block = end / 8;
+        if (first_block <= last_block)
+        {
+          sum = prefix[last_block] - prefix[first_block];
+          for (size_t i = low; i < first_block * 8; i++)
+            sum += spectrum[i];
+          for (size_t i = last_block * 8; i < end; i++)
+            sum += spectrum[i];
+        }
+        else
+        {
+          for (size_t i = low; i < end; i++)
+            sum += spectrum[i];
+        }
+      }
+      sums[r] = sum;
+    }
+  }
+
+  //! The sums are kept on the stack, so longer lists of ranges are done in blocks of max_fused_ranges.
+  void netRoiSums(const uint32_t *gross, const uint32_t *background,
+                  double scale, size_t n, const ChannelRange *ranges,
+                  size_t count, double *net, double *variance) {
+    uint64_t gross_sums[max_fused_ranges];
+    uint64_t background_sums[max_fused_ranges];
+    for (size_t first = 0; first < count; first += max_fused_ranges)
+    {
+      size_t block = std::min(count - first, max_fused_ranges);
+      roiSums(gross, n, ranges + first, block, gross_sums);
+      roiSums(background, n, ranges + first, block, background_sums);
+      for (size_t r = 0; r < block; r++)
+      {
+        net[first + r] = gross_sums[r] - scale * background_sums[r];
+        if (variance)
+          variance[first + r] = gross_sums[r] + scale * scale * background_sums[r];
+      }
+    }
+  }
+
+  /** Propagates the variances to first order, var(a / b) = (var(a) + (a / b)^2 var(b)) / b^2.
+   */
+  void rangeRatios(const double *values, const double *variances,
+                   const RangeRatio *ratios, size_t count, double *results,
+                   double *sigmas) {
+    for (size_t r = 0; r < count; r++)
+    {
+      double top = values[ratios[r].numerator];
+      double bottom = values[ratios[r].denominator];
+      if (bottom <= 0)
+      {
+        results[r] = 0;
+        if (sigmas)
+          sigmas[r] = 0;
+        continue;
+      }
+
+      double ratio = top / bottom;
+      results[r] = ratio;
+      if (sigmas)
+      {
+        double top_var = variances ? variances[ratios[r].numerator] : std::max(top, 0.0);
+        double bottom_var = variances ? variances[ratios[r].denominator] : bottom;
+        sigmas[r] = std::sqrt(top_var + ratio * ratio * bottom_var) / bottom;
+      }
+    }
+  }
+
+  bool limitSimd(const char *level) {
+    std::string name(level);
+    if (name == "avx2")
+      simd_limit = SIMD_AVX2;
+    else if (name == "sse2")
+      simd_limit = SIMD_SSE2;
+    else if (name == "scalar")
+      simd_limit = SIMD_SCALAR;
+    else
+      return (false);
+    return (true);
+  }
+
+  const char *simdLevel() {
+    switch (currentSimd())
+    {
+      case SIMD_AVX2:
+        return ("avx2");
+      case SIMD_SSE2:
+        return ("sse2");
+      default:
+        return ("scalar");
+    }
+  }
+}
@@ -0,0 +1,426 @@
+/** The topics the ROS node publishes, each at its own rate.
+ \file      topic_publisher.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "topic_publisher.h"
+#include "ursa_driver/ursa_trace.h"
+#include <boost/bind.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <algorithm>
+#include <cmath>
+
+TopicPublishers::TopicPublishers() :
+    ursa_(NULL), serial_mutex_(NULL), gm_total_(0), library_(NULL), identifier_(
+        NULL), min_score_(0.5), first_publish_(true) {
+}
+
+void TopicPublishers::setDriver(ursa::Interface *ursa,
+                                boost::mutex *serial_mutex) {
+  ursa_ = ursa;
+  serial_mutex_ = serial_mutex;
+}
+
+void TopicPublishers::setIdentifier(const ursa::NuclideLibrary *library,
+                                    ursa::NuclideIdentifier *identifier,
+                                    double min_score) {
+  library_ = library;
+  identifier_ = identifier;
+  min_score_ = min_score;
+}
+
+/** Each topic keeps its messages with the frame already set and its arrays sized, so publishing only
+ * changes values.
+ */
+void TopicPublishers::advertise(ros::NodeHandle &nh, const std::string &frame_id,
+                                size_t rois, bool wall_clock) {
+  for (size_t i = 0; i < topics_.size(); i++)
+  {
+    TopicPublisher &topic = topics_[i];
+    switch (topic.type)
+    {
+      case TOPIC_SPECTRA:
+        topic.publisher = nh.advertise<ursa_driver::ursa_spectra>(topic.name,
+                                                                  10);
+        break;
+      case TOPIC_WIDE_SPECTRA:
+        topic.publisher = nh.advertise<ursa_driver::ursa_wide_spectra>(
+            topic.name, 10);
+        break;
+      case TOPIC_COUNTS:
+        topic.publisher = nh.advertise<ursa_driver::ursa_counts>(topic.name,
+                                                                 10);
+        break;
+      case TOPIC_IDENTIFICATIONS:
+        topic.publisher = nh.advertise<ursa_driver::ursa_identifications>(
+            topic.name, 10);
+        break;
+      case TOPIC_ROI_RATES:
+        topic.publisher = nh.advertise<ursa_driver::ursa_roi_rates>(topic.name,
+                                                                    10);
+        break;
+      case TOPIC_DOSE_RATE:
+        topic.publisher = nh.advertise<ursa_driver::ursa_dose_rate>(topic.name,
+                                                                    10);
+        break;
+      case TOPIC_INTERVAL:
+        topic.publisher = nh.advertise<ursa_driver::ursa_interval>(topic.name,
+                                                                   10);
+        break;
+      case TOPIC_SPECTRUM_VIEW:
+        topic.publisher = nh.advertise<ursa_driver::ursa_spectrum_view>(
+            topic.name, 10);
+        break;
+    }
+    topic.spectra.header.frame_id = frame_id;
+    topic.wide_spectra.header.frame_id = frame_id;
+    topic.counts_msg.header.frame_id = frame_id;
+    topic.roi_msg.header.frame_id = frame_id;
+    topic.roi_msg.counts.resize(rois);
+    topic.roi_msg.rates.resize(rois);
+    topic.dose_msg.header.frame_id = frame_id;
+    topic.identifications_msg.header.frame_id = frame_id;
+    topic.interval_msg.header.frame_id = frame_id;
+    topic.view_msg.header.frame_id = frame_id;
+    topic.view_msg.first = topic.view_first;
+    topic.view_msg.group = topic.view_group;
+    topic.view_msg.bins.resize(
+        ursa::Interface::spectrumViewSize(topic.view_first,
+                                          topic.view_channels,
+                                          topic.view_group));
+    if (wall_clock)
+      topic.scheduler.reset(new ursa::WallScheduler());
+    else
+      topic.timer = nh.createTimer(
+          ros::Duration(1.0 / topic.rate),
+          boost::bind(&TopicPublishers::timerCallback, this, _1, i), false,
+          false);
+    if (topic.target_counts)
+      ROS_INFO("Publishing %s every %llu new counts, checked at %g Hz, between %g and %g s apart%s",
+               topic.name.c_str(), (unsigned long long) topic.target_counts,
+               topic.rate, topic.min_interval, topic.max_interval,
+               wall_clock ? " on wall clock boundaries" : "");
+    else
+      ROS_INFO("Publishing %s at %g Hz%s", topic.name.c_str(), topic.rate,
+               wall_clock ? " on wall clock boundaries" : "");
+  }
+}
+
+/** Count and ROI rate topics are primed when they gain a subscriber so the first message only covers
+ * one period.
+ */
+void TopicPublishers::start(double wall_clock_offset) {
+  for (size_t i = 0; i < topics_.size(); i++)
+  {
+    topics_[i].primed = false;
+    topics_[i].adaptive_ns = 0;
+    if (topics_[i].scheduler)
+      topics_[i].scheduler->start(
+          1.0 / topics_[i].rate, wall_clock_offset,
+          boost::bind(&TopicPublishers::snapshotTask, this, _1, i),
+          boost::bind(&TopicPublishers::publishTask, this, _1, i));
+    else
+      topics_[i].timer.start();
+  }
+}
+
+void TopicPublishers::stop() {
+  for (size_t i = 0; i < topics_.size(); i++)
+  {
+    topics_[i].timer.stop();
+    if (topics_[i].scheduler)
+      topics_[i].scheduler->stop();
+  }
+}
+
+/** Called at each topic's own rate by its ROS timer.  When a topic has no subscribers nothing is copied,
+ * serialized or requested from the Ursa.
+ */
+void TopicPublishers::timerCallback(const ros::TimerEvent& event,
+                                    size_t index) {
+  ros::Time now = ros::Time::now();
+  if (takeSnapshot(topics_[index]))
+    publishTopic(topics_[index], now);
+}
+
+//! Run by a topic's WallScheduler at each boundary.
+void TopicPublishers::snapshotTask(uint64_t tick_ns, size_t index) {
+  topics_[index].snapshot_taken = takeSnapshot(topics_[index]);
+}
+
+//! Run by a topic's WallScheduler on its worker thread after each snapshot. The message is stamped with the boundary.
+void TopicPublishers::publishTask(uint64_t tick_ns, size_t index) {
+  if (!topics_[index].snapshot_taken)
+    return;
+  ros::Time stamp;
+  stamp.fromNSec(tick_ns);
+  publishTopic(topics_[index], stamp);
+}
+
+/** Decides whether an adaptive topic publishes at this tick.  The topic publishes once the counts since it
+ * last published reach target_counts, so their relative uncertainty 1 / sqrt(counts) has reached the
+ * topic's precision, but never within min_interval of the last publish and always by max_interval.  The
+ * counts come from the region of interest counters the decoder keeps, so this reads a few running totals
+ * rather than the spectrum.  The first tick only takes the baseline.
+ */
+bool TopicPublishers::adaptiveDue(TopicPublisher &topic) {
+  ursa::RoiCounts counts;
+  ursa_->getRoiCounts(&counts);
+  uint64_t now_ns = ros::Time::now().toNSec();
+  uint64_t measured = (
+      topic.precision_roi < 0 ?
+          counts.gross : counts.counts[topic.precision_roi]);
+  if (!topic.adaptive_ns)
+  {
+    topic.adaptive_counts = measured;
+    topic.adaptive_ns = now_ns;
+    return (false);
+  }
+
+  //the counters start again when the regions are changed
+  uint64_t fresh = (
+      measured >= topic.adaptive_counts ?
+          measured - topic.adaptive_counts : measured);
+  double elapsed = (now_ns - topic.adaptive_ns) / 1e9;
+  if (elapsed < topic.min_interval
+      || (fresh < topic.target_counts && elapsed < topic.max_interval))
+    return (false);
+  topic.adaptive_counts = measured;
+  topic.adaptive_ns = now_ns;
+  return (true);
+}
+
+/** Copies what a topic publishes out of the driver into the topic's buffers.  This is the time critical
+ * half of a publish, so it does nothing slower than a copy or, for counts, the request to the Ursa.
+ * @return False if there is nothing to publish.
+ */
+bool TopicPublishers::takeSnapshot(TopicPublisher &topic) {
+  if (topic.publisher.getNumSubscribers() == 0)
+  {
+    topic.primed = false;
+    return (false);
+  }
+
+  if (topic.target_counts && !adaptiveDue(topic))
+    return (false);
+
+  URSA_TRACE_SCOPE_DETAIL("node", "snapshot", "%s", topic.name.c_str());
+  switch (topic.type)
+  {
+    case TOPIC_SPECTRA:
+      ursa_->getSpectra(&topic.spectra.bins);
+      break;
+    case TOPIC_WIDE_SPECTRA:
+    case TOPIC_IDENTIFICATIONS:
+      ursa_->getWideSpectra(&topic.wide_spectra.bins,
+                              &topic.wide_spectra.epoch);
+      break;
+    case TOPIC_COUNTS:
+    {
+      boost::lock_guard<boost::mutex> lock(*serial_mutex_);
+      gm_total_ += ursa_->requestCounts();
+      topic.counts = gm_total_;
+      if (!topic.primed)
+      {
+        topic.last_counts = gm_total_;
+        topic.primed = true;
+        return (false);
+      }
+      break;
+    }
+    case TOPIC_ROI_RATES:
+    {
+      ursa_->getRoiCounts(&topic.rois, &topic.epoch);
+      if (!topic.primed || topic.rois.time_ns <= topic.last_rois.time_ns)
+      {
+        if (!topic.primed)
+          topic.last_rois = topic.rois;
+        topic.primed = true;
+        return (false);
+      }
+      break;
+    }
+    case TOPIC_DOSE_RATE:
+    {
+      ursa_->getDose(&topic.dose, &topic.epoch);
+      if (!topic.dose.valid)
+        return (false);
+      if (!topic.primed || topic.dose.time_ns <= topic.last_dose.time_ns)
+      {
+        if (!topic.primed)
+          topic.last_dose = topic.dose;
+        topic.primed = true;
+        return (false);
+      }
+      break;
+    }
+    case TOPIC_SPECTRUM_VIEW:
+      ursa_->getSpectrumView(topic.view_first, topic.view_channels,
+                               topic.view_group, &topic.view_msg.bins[0],
+                               &topic.view_msg.epoch);
+      break;
+    case TOPIC_INTERVAL:
+    {
+      ursa_driver::ursa_interval &msg = topic.interval_msg;
+      ursa::SpectrumInterval interval;
+      ursa_->swapSpectra(&msg.bins, &interval);
+      msg.header.stamp.fromNSec(interval.end_ns);
+      msg.sequence = interval.sequence;
+      msg.epoch = interval.epoch;
+      msg.start.fromNSec(interval.start_ns);
+      msg.interval = (interval.end_ns - interval.start_ns) / 1e9;
+      msg.total = interval.counts;
+      break;
+    }
+  }
+  return (true);
+}
+
+/** Builds and publishes a topic's message from the snapshot in its buffers.  Each topic keeps its messages
+ * with the frame already set, so only the values change here and nothing is allocated before the message
+ * reaches roscpp.
+ */
+void TopicPublishers::publishTopic(TopicPublisher &topic,
+                                   const ros::Time &stamp) {
+  ROS_DEBUG("Publishing %s.", topic.name.c_str());
+  URSA_TRACE_SCOPE_DETAIL("node", "publish", "%s", topic.name.c_str());
+  switch (topic.type)
+  {
+    case TOPIC_SPECTRA:
+    {
+      topic.spectra.header.stamp = stamp;
+      topic.publisher.publish(topic.spectra);
+      break;
+    }
+    case TOPIC_WIDE_SPECTRA:
+    {
+      topic.wide_spectra.header.stamp = stamp;
+      topic.publisher.publish(topic.wide_spectra);
+      break;
+    }
+    case TOPIC_COUNTS:
+    {
+      ursa_driver::ursa_counts &msg = topic.counts_msg;
+      msg.header.stamp = stamp;
+      msg.counts = topic.counts - topic.last_counts;
+      topic.last_counts = topic.counts;
+      topic.publisher.publish(msg);
+      break;
+    }
+    case TOPIC_IDENTIFICATIONS:
+    {
+      boost::lock_guard<boost::mutex> lock(identify_mutex_);
+      identifier_->update(topic.wide_spectra.bins);
+      identifier_->rank(min_score_, &identifications_);
+      ursa_driver::ursa_identifications &msg = topic.identifications_msg;
+      msg.header.stamp = stamp;
+      msg.nuclides.resize(identifications_.size());
+      msg.scores.resize(identifications_.size());
+      msg.counts.resize(identifications_.size());
+      for (size_t i = 0; i < identifications_.size(); i++)
+      {
+        msg.nuclides[i] = library_->name(identifications_[i].index);
+        msg.scores[i] = identifications_[i].score;
+        msg.counts[i] = identifications_[i].counts;
+      }
+      topic.publisher.publish(msg);
+      break;
+    }
+    case TOPIC_ROI_RATES:
+    {
+      const ursa::RoiCounts &counts = topic.rois;
+      double interval = (counts.time_ns - topic.last_rois.time_ns) / 1e9;
+      ursa_driver::ursa_roi_rates &msg = topic.roi_msg;
+      msg.header.stamp.fromNSec(counts.time_ns);
+      msg.epoch = topic.epoch;
+      msg.interval = interval;
+      msg.gross_counts = counts.gross - topic.last_rois.gross;
+      msg.gross_rate = msg.gross_counts / interval;
+      msg.counts.resize(counts.size);
+      msg.rates.resize(counts.size);
+      for (size_t r = 0; r < counts.size; r++)
+      {
+        msg.counts[r] = counts.counts[r] - topic.last_rois.counts[r];
+        msg.rates[r] = msg.counts[r] / interval;
+      }
+      topic.last_rois = counts;
+      topic.publisher.publish(msg);
+      break;
+    }
+    case TOPIC_DOSE_RATE:
+    {
+      const ursa::DoseCounts &dose = topic.dose;
+      double interval = (dose.time_ns - topic.last_dose.time_ns) / 1e9;
+      ursa_driver::ursa_dose_rate &msg = topic.dose_msg;
+      msg.header.stamp.fromNSec(dose.time_ns);
+      msg.epoch = topic.epoch;
+      msg.interval = interval;
+      msg.counts = dose.counts - topic.last_dose.counts;
+      msg.dose_rate = (dose.dose - topic.last_dose.dose) * 3600 / interval;
+      msg.sigma = std::sqrt(std::max(dose.variance - topic.last_dose.variance,
+                                     0.0)) * 3600 / interval;
+      topic.last_dose = dose;
+      topic.publisher.publish(msg);
+      break;
+    }
+    case TOPIC_INTERVAL:
+    {
+      topic.publisher.publish(topic.interval_msg);
+      break;
+    }
+    case TOPIC_SPECTRUM_VIEW:
+    {
+      topic.view_msg.header.stamp = stamp;
+      topic.publisher.publish(topic.view_msg);
+      break;
+    }
+  }
+  if (first_publish_.exchange(false))
+  {
+    ursa::Tracer::instance().instant("node", "first publish");
+    if (on_first_publish_)
+      on_first_publish_();
+  }
+}
+
+/** Logs how closely each wall clock topic kept to its boundaries since the last report, then starts the
+ * counters again.  Lateness is from the boundary to the snapshot starting.
+ */
+void TopicPublishers::reportSchedules() {
+  for (size_t i = 0; i < topics_.size(); i++)
+  {
+    if (!topics_[i].scheduler)
+      continue;
+    ursa::ScheduleStats stats = topics_[i].scheduler->stats(true);
+    if (stats.ticks == 0)
+      continue;
+    ROS_INFO("Topic %s: %llu ticks, late mean %.3f ms max %.3f ms, %llu missed, "
+             "%llu overruns, work max %.2f ms.",
+             topics_[i].name.c_str(), (unsigned long long) stats.ticks,
+             stats.total_late_ns / 1e6 / stats.ticks, stats.max_late_ns / 1e6,
+             (unsigned long long) stats.missed,
+             (unsigned long long) stats.overruns, stats.max_work_ns / 1e6);
+  }
+}
@@ -0,0 +1,179 @@
+/** The header file for the topics the ROS node publishes, each at its own rate.
+ \file      topic_publisher.h
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+
+#ifndef TOPIC_PUBLISHER_H_
+#define TOPIC_PUBLISHER_H_
+
+#include "ursa_driver/ursa_driver.h"
+#include "ursa_driver/nuclide_id.h"
+#include "ursa_driver/wall_scheduler.h"
+#include "ros/ros.h"
+#include "ursa_driver/ursa_counts.h"
+#include "ursa_driver/ursa_spectra.h"
+#include "ursa_driver/ursa_wide_spectra.h"
+#include "ursa_driver/ursa_identifications.h"
+#include "ursa_driver/ursa_roi_rates.h"
+#include "ursa_driver/ursa_dose_rate.h"
+#include "ursa_driver/ursa_interval.h"
+#include "ursa_driver/ursa_spectrum_view.h"
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <vector>
+
+//! The kinds of data a topic can publish.
+enum topic_type
+{
+  TOPIC_SPECTRA = 0, //!< ursa_spectra, the 32 bit spectrum. Left without an epoch so recorded bags still match; spectra_wide carries it.
+  TOPIC_WIDE_SPECTRA, //!< ursa_wide_spectra, the 64 bit spectrum.
+  TOPIC_COUNTS, //!< ursa_counts, the GM counts since the topic last published.
+  TOPIC_IDENTIFICATIONS, //!< ursa_identifications, the nuclide templates matching the spectrum.
+  TOPIC_ROI_RATES, //!< ursa_roi_rates, the count rates in the regions of interest since the topic last published.
+  TOPIC_DOSE_RATE, //!< ursa_dose_rate, the dose rate since the topic last published.
+  TOPIC_INTERVAL, //!< ursa_interval, the spectrum since the last interval was taken. The cumulative spectrum is unaffected.
+  TOPIC_SPECTRUM_VIEW //!< ursa_spectrum_view, a channel range of the spectrum summed into coarser bins.
+};
+
+//! A published topic with its own rate.
+struct TopicPublisher
+{
+  std::string name; //!< The topic name relative to the node.
+  topic_type type; //!< What the topic publishes.
+  double rate; //!< The publish rate in Hz.
+  ros::Publisher publisher;
+  ros::Timer timer;
+  boost::shared_ptr<ursa::WallScheduler> scheduler; //!< Used instead of timer when wall_clock_publish is set.
+  bool primed; //!< Count topics only. False until a baseline has been taken with a subscriber present.
+  uint64_t last_counts; //!< Count topics only. The GM total when the topic last published.
+  ursa::RoiCounts last_rois; //!< ROI rate topics only. The region counts when the topic last published.
+  ursa::DoseCounts last_dose; //!< Dose rate topics only. The dose when the topic last published.
+  uint64_t target_counts; //!< Adaptive spectrum topics only. The new counts which publish, or 0 to publish at every tick.
+  int precision_roi; //!< Adaptive topics only. The region of interest whose counts are measured, or -1 for all counts.
+  double min_interval; //!< Adaptive topics only. The fewest seconds between publishes.
+  double max_interval; //!< Adaptive topics only. The most seconds between publishes, however few the counts.
+  uint64_t adaptive_counts; //!< Adaptive topics only. The measured counts when the topic last published.
+  uint64_t adaptive_ns; //!< Adaptive topics only. When the topic last published, or 0 until a baseline is taken.
+  size_t view_first; //!< Spectrum view topics only. The first channel.
+  size_t view_channels; //!< Spectrum view topics only. The channels in the view.
+  size_t view_group; //!< Spectrum view topics only. The channels summed into each bin.
+
+  bool snapshot_taken; //!< True if the last snapshot has something to publish.
+  ursa_driver::ursa_spectra spectra; //!< The snapshot for spectra topics.
+  ursa_driver::ursa_wide_spectra wide_spectra; //!< The snapshot for spectra_wide and identification topics.
+  ursa_driver::ursa_counts counts_msg; //!< The message for count topics, reused so publishing does not allocate.
+  ursa_driver::ursa_roi_rates roi_msg; //!< The message for ROI rate topics. Its arrays keep their size.
+  ursa_driver::ursa_dose_rate dose_msg; //!< The message for dose rate topics.
+  ursa_driver::ursa_identifications identifications_msg; //!< The message for identification topics.
+  ursa_driver::ursa_interval interval_msg; //!< The snapshot for interval topics.
+  ursa_driver::ursa_spectrum_view view_msg; //!< The snapshot for spectrum view topics. Its bins keep their size.
+  uint64_t counts; //!< The snapshot for count topics, the GM total.
+  ursa::RoiCounts rois; //!< The snapshot for ROI rate topics.
+  ursa::DoseCounts dose; //!< The snapshot for dose rate topics.
+  uint32_t epoch; //!< The configuration epoch of the ROI or dose snapshot.
+};
+
+/** \brief The node's topics and the state their snapshots and publishes share.
+ *
+ * Each topic is driven by its own ROS timer, or by a WallScheduler which takes the snapshot at the boundary
+ * and publishes from its worker thread.  The halves run from several threads, so the state they share is
+ * kept here: the GM total under the serial mutex and the identifier under its own mutex.
+ */
+class TopicPublishers
+{
+private:
+  std::vector<TopicPublisher> topics_; //!< The topics, in the order they were added.
+  ursa::Interface *ursa_; //!< The driver snapshots are taken from.
+  boost::mutex *serial_mutex_; //!< Serializes GM count requests with the node's other requests that read replies.
+  uint64_t gm_total_; //!< The GM counts received since startup, summed from requestCounts().
+  const ursa::NuclideLibrary *library_; //!< The templates identifications are named from.
+  ursa::NuclideIdentifier *identifier_; //!< Ranks the templates for identification topics.
+  double min_score_; //!< The lowest score published by identification topics.
+  boost::mutex identify_mutex_; //!< Protects the identifier when identification topics publish from scheduler threads.
+  std::vector<ursa::Identification> identifications_; //!< Scratch space for the ranked templates.
+  boost::atomic<bool> first_publish_; //!< True until a topic has published, which ends the traced startup.
+  boost::function<void()> on_first_publish_; //!< Called once the first message is published.
+
+  void timerCallback(const ros::TimerEvent& event, size_t index); //!< \brief Takes and publishes a snapshot at a ROS timer tick.
+  void snapshotTask(uint64_t tick_ns, size_t index); //!< \brief Takes a snapshot at a wall clock boundary.
+  void publishTask(uint64_t tick_ns, size_t index); //!< \brief Publishes the snapshot taken at a wall clock boundary.
+  bool adaptiveDue(TopicPublisher &topic); //!< \brief Returns true when an adaptive topic has counted enough to publish.
+  bool takeSnapshot(TopicPublisher &topic); //!< \brief Copies what a topic publishes out of the driver.
+  void publishTopic(TopicPublisher &topic, const ros::Time &stamp); //!< \brief Builds and publishes a topic's message.
+
+public:
+  TopicPublishers(); //!< \brief TopicPublishers constructor. There are no topics and no driver yet.
+
+  //! \brief Adds a topic. Only before advertise().
+  void add(const TopicPublisher &topic) {
+    topics_.push_back(topic);
+  }
+  //! \brief Removes every topic.
+  void clear() {
+    topics_.clear();
+  }
+  //! \brief Returns the topics.
+  const std::vector<TopicPublisher> &topics() const {
+    return (topics_);
+  }
+
+  /** \brief Sets the driver snapshots are taken from.
+   * @param ursa The driver.
+   * @param serial_mutex Held while GM counts are requested, so no other request reads their reply.
+   */
+  void setDriver(ursa::Interface *ursa, boost::mutex *serial_mutex);
+  /** \brief Sets what identification topics rank the spectrum against.
+   * @param library The templates.
+   * @param identifier The identifier built on library.
+   * @param min_score The lowest score published.
+   */
+  void setIdentifier(const ursa::NuclideLibrary *library,
+                     ursa::NuclideIdentifier *identifier, double min_score);
+  //! \brief Sets the function called once the first message is published.
+  void setFirstPublish(const boost::function<void()> &callback) {
+    on_first_publish_ = callback;
+  }
+
+  /** \brief Advertises every topic and creates its timer or scheduler, stopped.
+   * @param nh The node handle topic names are relative to.
+   * @param frame_id The frame of every message.
+   * @param rois The number of regions of interest, which sizes the ROI rate messages.
+   * @param wall_clock Publish on wall clock boundaries with a WallScheduler instead of a ROS timer.
+   */
+  void advertise(ros::NodeHandle &nh, const std::string &frame_id, size_t rois,
+                 bool wall_clock);
+  /** \brief Starts every topic's timer or scheduler.
+   * @param wall_clock_offset The seconds after each wall clock boundary scheduled topics fire.
+   */
+  void start(double wall_clock_offset);
+  void stop(); //!< \brief Stops every topic's timer or scheduler.
+  void reportSchedules(); //!< \brief Logs how closely each wall clock topic kept to its boundaries.
+};
+
+#endif /* TOPIC_PUBLISHER_H_ */
@@ -0,0 +1,64 @@
+/** Command line tool which sums the spectra in an archive over a time range.
+ \file      ursa_archive_query.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "ursa_driver/spectrum_archive.h"
+#include <iostream>
+#include <cstdlib>
+
+/** Usage: ursa_archive_query <archive> <start> <end>
+ *
+ * Start and end are unix times in seconds.  The summed spectrum is written to std::cout as
+ * one count per line in the same format as ursa_example.
+ */
+int main(int argc, char **argv) {
+  if (argc != 4)
+  {
+    std::cerr << "Usage: " << argv[0] << " <archive> <start> <end>" << std::endl;
+    return (-1);
+  }
+
+  ursa::SpectrumArchiveReader reader;
+  if (!reader.open(argv[1]))
+  {
+    std::cerr << "ERROR: " << argv[1] << " is not a spectrum archive." << std::endl;
+    return (-1);
+  }
+
+  uint64_t start = atof(argv[2]) * 1e9;
+  uint64_t end = atof(argv[3]) * 1e9;
+  ursa::WideSpectrum sum;
+  uint64_t records = 0;
+  if (!reader.query(start, end, &sum, &records))
+  {
+    std::cerr << "ERROR: Failed to read " << argv[1] << std::endl;
+    return (-1);
+  }
+
+  std::cerr << "INFO: Summed " << records << " spectra." << std::endl;
+  for (size_t i = 0; i < sum.size(); i++)
+    std::cout << sum[i] << "," << std::endl;
+  return (0);
+}
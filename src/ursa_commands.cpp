@@ -0,0 +1,105 @@
+/** Implementation of the command encoders used by the ursa::Interface class.
+ \file      ursa_commands.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/ursa_commands.h>
+
+#include <cmath>
+
+namespace ursa
+{
+  namespace commands
+  {
+    //! The upper limit of each coarse gain range.
+    const int coarse_gains[] = { 2, 4, 15, 35, 125, 250 };
+    const int coarse_gain_count = sizeof(coarse_gains) / sizeof(coarse_gains[0]);
+
+    //! The full scale register value is 65532 at 2000 volts.
+    uint16_t voltageRegister(int voltage) {
+      return (round(double(voltage) / 2000 * 65532));
+    }
+
+    /** The register is clamped to 16838 above 16383.
+     * This matches the values sent since the first release and is kept so the wire format does not change.
+     */
+    uint16_t rampRegister(int seconds) {
+      uint16_t ramp = round((seconds * 303.45) - 1197);
+      if (ramp > 16383)
+        ramp = 16838;
+      return (ramp);
+    }
+
+    /** The smallest coarse gain above the requested gain is used and the fine gain scales it down.
+     */
+    bool gainSetting(double gain, GainSetting *setting) {
+      for (int i = 0; i < coarse_gain_count; i++)
+      {
+        if (gain < coarse_gains[i])
+        {
+          setting->coarse = i;
+          setting->fine = round((gain / coarse_gains[i]) * 256 - 1);
+          return (true);
+        }
+      }
+      return (false);
+    }
+
+    int coarseGain(int coarse) {
+      if (coarse < 0 || coarse >= coarse_gain_count)
+        return (0);
+      return (coarse_gains[coarse]);
+    }
+
+    Command setVoltage(int voltage) {
+      return (SetVoltage::encode(voltageRegister(voltage)));
+    }
+
+    Command setRamp(int seconds) {
+      return (SetRamp::encode(rampRegister(seconds)));
+    }
+
+    Command setGain(const GainSetting &setting) {
+      return (SetGain::encode(setting.coarse, setting.fine));
+    }
+
+    /** The threshold register is twice the millivolts. The offset is the millivolts with a minimum of 100.
+     */
+    Command setThresholdOffset(int mVolts) {
+      uint16_t min_offset = 50;
+      uint16_t thresh = mVolts * 2;
+      uint16_t offset = 0;
+      if (mVolts > min_offset * 2)
+        offset = mVolts;  //offset = mV/2 *2
+      else
+        offset = min_offset * 2;
+      return (SetThresholdOffset::encode(thresh, offset));
+    }
+
+    //! The Ursa takes the number of bits dropped from 13.
+    Command setBitMode(int bits) {
+      return (SetBitMode::encode(13 - bits));
+    }
+  }
+}
@@ -25,28 +25,73 @@
  */
 
 #include <ursa_driver/ursa_driver.h>
+#include <ursa_driver/ursa_clock.h>
+#include <ursa_driver/frame_decoder.h>
+#include <ursa_driver/ursa_trace.h>
+
+#include <algorithm>
+#include <cstring>
 
 namespace ursa
 {
   const size_t max_line_length(64);
+  //! Interval counts at which the 32 bit tier is folded into the 64 bit totals. No bin can wrap below 2^32.
+  const uint32_t max_interval_counts(0x80000000);
+  //! The pause between commands sent by reconfigure() in place of the 100 ms settle.
+  const useconds_t command_gap_us(10000);
+  //! How long alive() waits for the reply to a probe sent while acquiring.
+  const uint64_t probe_timeout_ns(1000000000);
+  //! How long the line must be silent after StopAcquire before quiesce() treats the Ursa as stopped.
+  const uint64_t quiet_ns(20000000);
+  //! The longest quiesce() waits for silence before falling back to stopAcquire().
+  const uint64_t quiesce_timeout_ns(1000000000);
+
+  AcquisitionSettings::AcquisitionSettings() :
+      set_gain(false), gain(0), set_threshold(false), threshold(0), set_shaping_time(
+          false), shaping(TIME1uS), set_input(false), input(INPUT1NEG), set_bits(
+          false), bits(12) {
+  }
+
+  void SpectrumBuffer::clear() {
+    pulses.fill(0);
+    totals.fill(0);
+    interval_counts = 0;
+  }
 
-  //! All private variables are initialized to zero or there initial values. The pulses_ array is filled with zeros.
-  Interface::Interface(const char *port, int baud) :
-      port_(port), baud_(baud), connected_(false), serial_(NULL), acquiring_(
-          false), responsive_(false), gmMode_(false), battV_(0), ramp_(6), voltage_(
-          0) {
-    pulses_.fill(0);
+  /** All private variables are initialized to zero or there initial values. Both spectrum buffers are filled with zeros.
+   * Without a transport connect() creates a serial one.
+   */
+  Interface::Interface(const char *port, int baud, Transport *transport) :
+      port_(port), baud_(baud), connected_(false), responsive_(false), last_rx_ns_(
+          0), silence_ns_(5000000000ULL), probe_ns_(0), acquiring_(false), gmMode_(
+          false), transport_(transport), rx_length_(0), rx_time_ns_(0), battV_(0), ramp_(
+          6), voltage_(0), spectrum_(NULL), past_total_(NULL), retiring_(NULL), interval_sequence_(
+          0), interval_start_ns_(0), epoch_(0), shm_period_ns_(0), shm_last_ns_(0), reader_stop_(
+          false), last_read_ns_(0), last_fetch_ns_(0), ready_ns_(0), rx_arrival_ns_(0) {
+    spectra_[0].clear();
+    spectra_[1].clear();
+    spectrum_ = &spectra_[0];
+    past_[0].fill(0);
+    past_[1].fill(0);
+    past_total_ = &past_[0];
+    alarm_outputs_.fill(false);
   }
 
   /** Stops acquire mode and immediately disables voltage if still enabled.
    * @todo In practice this doesn't work. The serial port is probably destroyed first.
    */
   Interface::~Interface() {
-    tx_buffer_ << "R" << "v";
-    transmit();
+    stopReader();
+    if (transport_ && transport_->isOpen())
+    {
+      Command cmd = commands::StopAcquire::encode();
+      cmd.append(commands::StopVoltage::encode());
+      transmit(cmd);
+    }
+    delete transport_;
   }
   /**
-   * This function first creates a new serial object. Then sets the timeout, port and baud rate.
+   * This function first creates a SerialTransport if no transport was given. Then sets the timeout.
    * The timeout is a global attribute for the serial port. Changing it will change the behavior of waitReadable
    * and therefore the function of many of the Interfaces functions.
    *
@@ -55,30 +100,29 @@ namespace ursa
    *
    * It then tries calling checkComms 5 times. If this is successful Interface::responsive_ is set to true.
    *
-   * If either fail an error is writen to cout.
+   * If either fail an error is logged.
    */
   void Interface::connect() {
-    if (!serial_)
-      serial_ = new serial::Serial();
-    serial::Timeout timeout(serial::Timeout::simpleTimeout(1000));
-    serial_->setTimeout(timeout);
-    serial_->setPort(port_);
-    serial_->setBaudrate(baud_);
+    URSA_TRACE_SCOPE("driver", "connect");
+    if (!transport_)
+      transport_ = new SerialTransport();
+    transport_->setTimeout(1000);
 
     for (int i = 0; i < 5; i++)
     {
       if (!connected_)
       {
+        URSA_TRACE_SCOPE_DETAIL("driver", "open", "attempt %d", i + 1);
         try
         {
-          serial_->open();
-          stopAcquire();
+          if (transport_->open(port_, baud_))
+            stopAcquire();
         }
-        catch (serial::IOException & err)
+        catch (std::exception & err)
         {
         }
 
-        if (serial_->isOpen())
+        if (transport_->isOpen())
         {
 
           connected_ = true;
@@ -87,8 +131,7 @@ namespace ursa
         else
         {
           connected_ = false;
-          std::cout << "WARN: Unable to connect to serial port:" << port_
-              << std::endl;
+          log_.warn("Unable to connect to serial port:%s", port_);
         }
       }
     }
@@ -102,126 +145,504 @@ namespace ursa
       else
       {
         responsive_ = false;
-        std::cout << "WARN: URSA not responding." << std::endl;
+        log_.warn("URSA not responding.");
       }
     }
-    std::cout << "ERROR: Unable to communicate with URSA" << std::endl;
+    log_.error("Unable to communicate with URSA");
   }
 
   /**
-   * This function writes the whole output buffer to the serial port as a string.
-   * It will write an error to cout if a serial timeout occurs.
-   * With DEBUG_ enabled it will write the buffer to std::cout.
+   * This function writes the encoded command to the serial port in one write.
+   * It will log an error if a serial timeout occurs.
+   * Unless settle is false it then sleeps 100 ms, which commands sent while acquiring can skip.
+   * With DEBUG_ enabled it will log the command.
    */
-  void Interface::transmit() {
+  void Interface::transmit(const Command &cmd, bool settle) {
+    URSA_TRACE_SCOPE_DETAIL("serial", "transmit", "%.*s", (int) cmd.size,
+                            (const char *) cmd.data);
 #ifdef DEBUG_
-    std::cout << "DEBUG: Transmitting:" << tx_buffer_.str() << std::endl;
+    log_.debug("Transmitting:%.*s", (int) cmd.size, (const char *) cmd.data);
 #endif
-    ssize_t bytes_written = serial_->write(tx_buffer_.str());
-    if (bytes_written < tx_buffer_.tellp())
+    size_t bytes_written = transport_->write(cmd.data, cmd.size);
+    if (bytes_written < cmd.size)
     {
-      std::cout << "ERROR: Serial write timeout, " << bytes_written
-          << " bytes written of " << tx_buffer_.tellp() << "." << std::endl;
+      log_.error("Serial write timeout, %d bytes written of %d.",
+                 (int) bytes_written, (int) cmd.size);
     }
-    tx_buffer_.str("");
-    usleep(100000);  //for stability
+    if (settle)
+      usleep(100000);  //for stability
   }
 
   /**
-   * This uses a while loop to read a buffer of length max_line_length from the serial buffer.
-   * This is copied into the rx_buffer buffer.
+   * This reads everything waiting straight into the free end of rx_buffer_ with Transport::readSome() and
+   * decodes it.  Normally that is one read per call.  Only if a read fills the buffer is the data decoded
+   * and the read repeated.
    *
-   * If DEBUG_ enable prints out the length of the rx_buffer after filling it.
+   * The bytes of a read arrived no earlier than the last time the transport was emptied, and no later than
+   * the reader thread saw them waiting.  That time is handed to the alarm engine so alarm latency counts
+   * from the first byte rather than from the read.
    *
-   * Commented out line will print the input buffer straight to cout.
+   * Once acquiring nothing here allocates: the receive buffer, the list mode batches, the alarm ring and
+   * the shared memory ring are all sized up front.  test_allocation.cpp checks this and the snapshot
+   * functions under a counting allocator, so keep heap use out of this path.
+   *
+   * If DEBUG_ enable logs the length of the rx_buffer after filling it.
    */
   void Interface::read() {
-    while (serial_->available())
+    uint64_t start_ns = monotonicNanos();
+    size_t space;
+    size_t length;
+    size_t backlog = 0;
+    bool full = false;
+    rx_arrival_ns_ = (ready_ns_ ? ready_ns_ : (last_fetch_ns_ ? last_fetch_ns_ : start_ns));
+    ready_ns_ = 0;
+    do
+    {
+      space = rx_buffer_.size() - rx_length_;
+      length = transport_->readSome(rx_buffer_.data() + rx_length_, space);
+      last_fetch_ns_ = monotonicNanos();
+      rx_time_ns_ = wallNanos();
+      if (length)
+        last_rx_ns_ = monotonicNanos();
+      rx_length_ += length;
+      backlog += length;
+      full = full || length == space;
+#ifdef DEBUG_
+      log_.debug("Receive buffer size: %d", (int) rx_length_);
+#endif
+      processData();
+    }
+    while (length == space);
+    {
+      boost::lock_guard<boost::mutex> lock(array_mutex_);
+      reader_stats_.reads++;
+      if (last_read_ns_)
+      {
+        uint64_t gap = start_ns - last_read_ns_;
+        reader_stats_.total_gap_ns += gap;
+        reader_stats_.max_gap_ns = std::max(reader_stats_.max_gap_ns, gap);
+      }
+      reader_stats_.max_backlog = std::max(reader_stats_.max_backlog, backlog);
+      reader_stats_.full_reads += full;
+    }
+    last_read_ns_ = start_ns;
+    applyAlarmOutputs();
+    if (shm_.isOpen())
+      publishSnapshot();
+  }
+
+  /**
+   * The affinity and priority are applied to the thread from here, so a failure is logged and returned
+   * but the thread keeps running without that setting.  The statistics start again with the thread.
+   */
+  bool Interface::startReader(const RealtimeOptions &options) {
+    stopReader();
+    reader_options_ = options;
+    last_read_ns_ = 0;
+    reader_stop_ = false;
+    reader_ = boost::thread(&Interface::readerLoop, this);
+
+    ReaderStats stats;
+    stats.threaded = true;
+    int error = applyRealtime(reader_.native_handle(), options, &stats);
+    {
+      boost::lock_guard<boost::mutex> lock(array_mutex_);
+      reader_stats_ = stats;
+    }
+    if (error)
     {
-      uint8_t temp[max_line_length];
-      long length = serial_->read(temp, max_line_length);
-      rx_buffer_.insert(rx_buffer_.end(), temp, temp + length);
-      //std::cout<< "RX: " << reinterpret_cast<const char*>(temp) << std::endl;
+      log_.warn("Reader thread runs without some real time settings: %s",
+                strerror(error));
+      return (false);
     }
+    return (true);
+  }
+
+  void Interface::stopReader() {
+    if (!reader_.joinable())
+      return;
+    reader_stop_ = true;
+    reader_.join();
+    reader_ = boost::thread();
+  }
+
+  /** Waits for data with the transport's timeout so a stop request is seen within one timeout.  Nothing
+   * here allocates, and with memory locked the stack used by read() is prefaulted first.
+   */
+  void Interface::readerLoop() {
+    if (reader_options_.lock_memory)
+      prefaultStack();
+    while (!reader_stop_)
+    {
+      if (transport_->waitReadable())
+      {
+        ready_ns_ = monotonicNanos();
+        read();
+      }
+      else if (!transport_->isOpen())
+        usleep(10000);
+    }
+  }
+
+  ReaderStats Interface::getReaderStats(bool reset) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    ReaderStats stats = reader_stats_;
+    if (reset)
+    {
+      reader_stats_ = ReaderStats();
+      reader_stats_.threaded = stats.threaded;
+      reader_stats_.pinned = stats.pinned;
+      reader_stats_.fifo = stats.fifo;
+      reader_stats_.locked = stats.locked;
+    }
+    return (stats);
+  }
+
+  std::string Interface::readString(size_t size) {
+    URSA_TRACE_SCOPE("serial", "readString");
+    uint8_t buffer[128];
+    size_t length = readBytes(buffer, std::min(size, sizeof(buffer)));
+    return (std::string((const char *) buffer, length));
+  }
+
+  size_t Interface::readBytes(uint8_t *buffer, size_t size) {
+    size_t length = transport_->read(buffer, size);
+    if (length)
+      last_rx_ns_ = monotonicNanos();
+    return (length);
+  }
+
+  void Interface::setAlarmConfig(const AlarmConfig &config) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    alarm_.configure(config);
+  }
+
+  void Interface::getAlarmEvents(std::vector<AlarmEvent> *events) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    alarm_.takeEvents(events);
+  }
+
+  void Interface::setListMode(bool enable, size_t batch_size,
+                              double max_latency) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    list_mode_.configure(enable, batch_size, max_latency);
+  }
+
+  bool Interface::getEvents(EventBatch *batch) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    return (list_mode_.take(batch));
+  }
+
+  bool Interface::setSharedMemory(const std::string &name,
+                                  uint32_t event_capacity,
+                                  double snapshot_period) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    shm_period_ns_ = uint64_t(snapshot_period * 1e9);
+    shm_last_ns_ = 0;
+    if (name.empty())
+    {
+      shm_.close();
+      return (true);
+    }
+    return (shm_.open(name, event_capacity));
+  }
+
+  //! The 64 bit spectrum is summed straight into the ring slot, the same way getWideSpectra() builds it.
+  void Interface::publishSnapshot() {
+    uint64_t now = monotonicNanos();
+    if (now - shm_last_ns_ < shm_period_ns_)
+      return;
+    shm_last_ns_ = now;
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    readCumulative(0, spectrum_bins, shm_.beginSpectrum());
+    shm_.commitSpectrum(wallNanos(), epoch_);
+  }
+
+  bool Interface::setRois(const std::vector<ChannelRange> &rois) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    return (rois_.configure(rois));
+  }
+
+  void Interface::getRoiCounts(RoiCounts *counts, uint32_t *epoch) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    rois_.read(counts);
+    if (epoch)
+      *epoch = epoch_;
+  }
+
+  bool Interface::setDoseCalibration(const DoseCalibration &calibration) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    return (dose_.configure(calibration));
+  }
+
+  void Interface::getDose(DoseCounts *counts, uint32_t *epoch) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    dose_.read(counts);
+    if (epoch)
+      *epoch = epoch_;
+  }
+
+  //! The Ursa powers up in 12 bit mode, so that is assumed until a bit mode is set.
+  void Interface::updateDoseResponse() {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    dose_.setResponse(settings_.set_gain ? settings_.gain : 0,
+                      settings_.set_bits ? settings_.bits : 12);
+  }
+
+  /**
+   * Called from read() once the decode pass has released the array_mutex_, so the serial write is not made
+   * with the spectrum locked.  The write time is handed back to the AlarmEngine so each event carries the
+   * delay from its bytes being read to the output changing.
+   */
+  void Interface::applyAlarmOutputs() {
+    boost::array<bool, 2> wanted;
+    {
+      boost::lock_guard<boost::mutex> lock(array_mutex_);
+      if (!alarm_.enabled() || !alarm_.config().drive_outputs)
+        return;
+      wanted[0] = alarm_.output(0);
+      wanted[1] = alarm_.output(1);
+    }
+    for (size_t line = 0; line < 2; line++)
+    {
+      if (wanted[line] != alarm_outputs_[line])
+      {
+        writeAlarmOutput(line, wanted[line]);
+        boost::lock_guard<boost::mutex> lock(array_mutex_);
+        alarm_.outputWritten(line, monotonicNanos());
+      }
+    }
+  }
+
+  void Interface::writeAlarmOutput(size_t line, bool enable) {
+    if (line == 0)
+      transmit(enable ? commands::EnableAlarm0::encode() :
+                        commands::DisableAlarm0::encode(),
+               false);
+    else
+      transmit(enable ? commands::EnableAlarm1::encode() :
+                        commands::DisableAlarm1::encode(),
+               false);
+    alarm_outputs_[line] = enable;
+  }
+
+  /**
+   * Each event is counted into the spectrum, then handed to the AlarmEngine, which decides on the event that
+   * crosses a threshold, and to the region of interest and dose counters.  Once the running count reaches
+   * max_interval_counts the 32 bit tier is folded into the 64 bit totals so a bin can never wrap.
+   *
+   * If DEBUG_ is enabled then each increment of the pulses array is logged in the rate limited LOG_DECODE class.
+   *
+   * In list mode each event is also recorded with its arrival time.  The last byte of the read arrived at
+   * rx_time_ns_, so an event's last byte arrived one byte time at the baud rate earlier for every byte
+   * after it.  This assumes the read followed the data closely, which holds for a blocking reader but not
+   * for a slow poll.  The same time is used for events published to the shared memory ring.
+   */
+  inline void Interface::FrameHandler::event(size_t end, uint16_t channel,
+                                             uint8_t counts) {
+#ifdef DEBUG_
+    ursa.log_.write(LOG_DEBUG, LOG_DECODE, "Incrementing Bin: %d By amount: %d",
+                    channel, counts);
+#endif
+    spectrum.pulses[channel] += counts;
+    spectrum.interval_counts += counts;
+    if (spectrum.interval_counts >= max_interval_counts)
+      ursa.foldSpectra();
+    ursa.alarm_.addEvent(channel, counts);
+    ursa.rois_.add(channel, counts);
+    if (ursa.dose_.valid())
+      ursa.dose_.add(channel, counts);
+    if (ursa.list_mode_.enabled() || ursa.shm_.isOpen())
+    {
+      uint64_t time_ns = ursa.rx_time_ns_ - (ursa.rx_length_ - end) * byte_ns;
+      if (ursa.list_mode_.enabled())
+        ursa.list_mode_.add(time_ns, channel, counts);
+      if (ursa.shm_.isOpen())
+        ursa.shm_.addEvent(time_ns, channel, counts);
+    }
+  }
+
+  inline void Interface::FrameHandler::battery(uint16_t reading) {
+    ursa.processBatt(reading);
+  }
+
+  //! Dropped bytes are only counted here; the Logger reports the total once per interval so a noisy line cannot stall the decode loop with console writes.
+  inline void Interface::FrameHandler::dropped(uint32_t bytes) {
 #ifdef DEBUG_
-    std::cout << "DEBUG: Receive buffer size: " << rx_buffer_.size()
-    << std::endl;
+    ursa.log_.write(LOG_DEBUG, LOG_DECODE, "Dropped %u chars", bytes);
 #endif
-    processData();
+    ursa.log_.count(LOG_DROPPED_BYTES, bytes);
   }
 
   /**
-   * This function processes incoming data in acquire mode.
+   * This function processes incoming data in acquire mode with decodeFrames(), the same decoder
+   * ursa_reprocess runs over captures, and the FrameHandler.
    * The spectra data comes in as 3 bytes starting with 0xFF then a 4 bit count and then 12 bits of energy.
-   * The 12 bit energy is used as an index for the Interface::pulses_ array which is incremented by the 4 bit count.
+   * The 12 bit energy is used as an index for the pulses of the decoded SpectrumBuffer which is incremented by the 4 bit count.
    *
    * If the top 6 bits of the second byte is 0 the data is 10bit battery data and can be treated as such.
    * This function loops until there is less than 3 bytes in the receive buffer.
    *
    * If the first byte is not 0xFF then bytes are dropped until there is a 0xFF on the front of the buffer.
    *
-   * If DEBUG_ is enabled then each increment of the pulses_ array is reported to std::cout.
+   * The array_mutex_ is held for the whole pass rather than per event.  The per event work is a 32 bit
+   * increment of the pulses and a running count.
    */
   void Interface::processData() {
-    while (rx_buffer_.size() >= 3)
-    {
-      if (rx_buffer_.front() == 0xff)
-      {
-        rx_buffer_.pop_front();      //drop the first byte it is only for sync
-        uint8_t char1, char2, count;
-        uint16_t energy;
-
-        char1 = rx_buffer_.front();
-        rx_buffer_.pop_front();
-        char2 = rx_buffer_.front();
-        rx_buffer_.pop_front();
-
-        count = char1 >> 2;
-        energy = (char1 & 0x03) << 8 | char2;
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    alarm_.beginBatch(monotonicNanos(), rx_arrival_ns_);
+    FrameHandler handler = { *this, *spectrum_, 10000000000ULL / baud_ };   //8N1 is 10 bits per byte
+    size_t pos = decodeFrames(rx_buffer_.data(), rx_length_, handler);
+    //keep the partial event at the front for the next read
+    rx_length_ -= pos;
+    memmove(rx_buffer_.data(), rx_buffer_.data() + pos, rx_length_);
+    alarm_.endBatch();
+    list_mode_.poll(rx_time_ns_);
+    rois_.mark(rx_time_ns_);
+    dose_.mark(rx_time_ns_);
+  }
 
-        if (count == 0)
-          processBatt(energy);
-        else
-        {
-          boost::lock_guard<boost::mutex> lock(array_mutex_);
-#ifdef DEBUG_
-          std::cout << "DEBUG: Incrementing Bin: "
-          << boost::lexical_cast<std::string>(energy) << " By amount: "
-          << boost::lexical_cast<std::string>(count >> 2) << std::endl;
-#endif
-          pulses_[energy] += (count >> 2);
-        }
-      }
-      else
-      {
-        std::cout << "ERROR: Read error, dropping chars:"
-            << (int) rx_buffer_.front();
-        rx_buffer_.pop_front();
-        while (rx_buffer_.front() != 0xff && rx_buffer_.size() > 0)
-        {
-          std::cout << ", " << (int) rx_buffer_.front();
-          rx_buffer_.pop_front();
-        }
-        std::cout << std::endl;
-      }
+  /**
+   * The cumulative spectrum is the retired intervals in past_total_, the buffer swapSpectra() is still
+   * retiring if any, and the buffer being decoded into.  Each buffer's 64 bit totals are added and its
+   * 32 bit pulses widened on top with widenAccumulate().  None of them are modified.
+   */
+  void Interface::readCumulative(size_t first, size_t channels,
+                                 uint64_t *bins) {
+    const uint64_t *past = past_total_->data() + first;
+    const uint64_t *totals = spectrum_->totals.data() + first;
+    for (size_t i = 0; i < channels; i++)
+      bins[i] = past[i] + totals[i];
+    widenAccumulate(bins, spectrum_->pulses.data() + first, channels);
+    if (retiring_)
+    {
+      totals = retiring_->totals.data() + first;
+      for (size_t i = 0; i < channels; i++)
+        bins[i] += totals[i];
+      widenAccumulate(bins, retiring_->pulses.data() + first, channels);
     }
   }
 
   /**
    * The function uses a boost::lock_gaurd before copying to protect against multiple access errors.
    * This should help in the future if multithreading is implemented.
+   *
+   * The result is the low 32 bits of the total counts, which is what this function has always returned
+   * for a bin that wrapped.  Use getWideSpectra() for long dwells.
+   */
+  void Interface::getSpectra(boost::array<unsigned int, 4096>* array,
+                             uint32_t *epoch) {
+    boost::array<uint64_t, 4096> wide;
+    getWideSpectra(&wide, epoch);
+    for (size_t i = 0; i < spectrum_bins; i++)
+      (*array)[i] = uint32_t(wide[i]);
+  }
+
+  //! The internal tiers are not modified, see readCumulative().
+  void Interface::getWideSpectra(boost::array<uint64_t, 4096>* array,
+                                 uint32_t *epoch) {
+    boost::lock_guard<boost::mutex> lock(array_mutex_);
+    readCumulative(0, spectrum_bins, array->data());
+    if (epoch)
+      *epoch = epoch_;
+  }
+
+  size_t Interface::spectrumViewSize(size_t first, size_t channels,
+                                     size_t group) {
+    if (first >= spectrum_bins)
+      return (0);
+    channels = std::min(channels, spectrum_bins - first);
+    group = std::max(group, size_t(1));
+    return ((channels + group - 1) / group);
+  }
+
+  /**
+   * Only the channels in the range are read, as in getWideSpectra(), into a buffer on the stack.
    */
-  void Interface::getSpectra(boost::array<unsigned int, 4096>* array) {
+  size_t Interface::getSpectrumView(size_t first, size_t channels,
+                                    size_t group, uint64_t *bins,
+                                    uint32_t *epoch) {
+    first = std::min(first, spectrum_bins);
+    channels = std::min(channels, spectrum_bins - first);
+    group = std::max(group, size_t(1));
+    size_t size = spectrumViewSize(first, channels, group);
+    boost::array<uint64_t, 4096> counts;
     boost::lock_guard<boost::mutex> lock(array_mutex_);
-    *array = pulses_;
+    readCumulative(first, channels, counts.data());
+    for (size_t bin = 0; bin < size; bin++)
+    {
+      size_t end = std::min(channels, (bin + 1) * group);
+      uint64_t sum = 0;
+      for (size_t i = bin * group; i < end; i++)
+        sum += counts[i];
+      bins[bin] = sum;
+    }
+    if (epoch)
+      *epoch = epoch_;
+    return (size);
   }
 
   /**
-   * This function sets all elements in the pulses_ array to zero using a boost:lock_gaurd to prevent multiple access errors.
+   * This function sets all elements in the decoded buffer and the retired intervals to zero using a boost:lock_gaurd
+   * to prevent multiple access errors.  swap_mutex_ is taken first so no swap is part way through.
    */
   void Interface::clearSpectra() {
+    boost::lock_guard<boost::mutex> swap_lock(swap_mutex_);
     boost::lock_guard<boost::mutex> lock(array_mutex_);
-    pulses_.fill(0);
+    spectrum_->clear();
+    past_total_->fill(0);
+    interval_start_ns_ = wallNanos();
+  }
+
+  /**
+   * Only pointers change under the array_mutex_, so the decoder waits for a pointer exchange rather than a
+   * copy and fill of both tiers.  The retired buffer is widened into the caller's array outside the lock and
+   * added to the spare entry of past_, then both past_ entries are exchanged.  Until then readCumulative()
+   * adds the retired buffer itself, so the cumulative spectrum never drops an interval.  The retired buffer
+   * is zeroed last, ready for the next swap.  swap_mutex_ keeps a second caller from handing it back to the
+   * decoder before it is zeroed.
+   */
+  void Interface::swapSpectra(boost::array<uint64_t, 4096>* array,
+                              SpectrumInterval *interval) {
+    boost::lock_guard<boost::mutex> swap_lock(swap_mutex_);
+    SpectrumBuffer *retired;
+    SpectrumInterval taken;
+    {
+      boost::lock_guard<boost::mutex> lock(array_mutex_);
+      retired = spectrum_;
+      spectrum_ = (retired == &spectra_[0] ? &spectra_[1] : &spectra_[0]);
+      retiring_ = retired;
+      taken.sequence = ++interval_sequence_;
+      taken.epoch = epoch_;
+      taken.end_ns = wallNanos();
+      taken.start_ns = interval_start_ns_ ? interval_start_ns_ : taken.end_ns;
+      interval_start_ns_ = taken.end_ns;
+    }
+    *array = retired->totals;
+    widenAccumulate(array->data(), retired->pulses.data(), spectrum_bins);
+    boost::array<uint64_t, 4096> *past = past_total_;
+    boost::array<uint64_t, 4096> *next = (past == &past_[0] ? &past_[1] : &past_[0]);
+    for (size_t i = 0; i < spectrum_bins; i++)
+      (*next)[i] = (*past)[i] + (*array)[i];
+    {
+      boost::lock_guard<boost::mutex> lock(array_mutex_);
+      past_total_ = next;
+      retiring_ = NULL;
+    }
+    retired->clear();
+    taken.counts = 0;
+    for (size_t i = 0; i < spectrum_bins; i++)
+      taken.counts += (*array)[i];
+    if (interval)
+      *interval = taken;
+  }
+
+  //! Must be called with array_mutex_ held.
+  void Interface::foldSpectra() {
+    widenAccumulate(spectrum_->totals.data(), spectrum_->pulses.data(),
+                    spectrum_bins);
+    spectrum_->pulses.fill(0);
+    spectrum_->interval_counts = 0;
   }
 
   /** Called from processData().  The reading is multiplied by 12/1024 to get volts.
@@ -232,8 +653,8 @@ namespace ursa
     battV_ = (float) input * 12 / 1024;
 
 #ifdef DEBUG_
-    std::cout << "DEBUG: Battery voltage processed: "
-    << boost::lexical_cast<std::string>(battV_) << std::endl;
+    log_.write(LOG_DEBUG, LOG_DECODE, "Battery voltage processed: %f",
+               battV_);
 #endif
   }
 
@@ -243,11 +664,13 @@ namespace ursa
    * If this is what is received the function responds true otherwise it returns false.
    */
   bool Interface::checkComms() {
+    URSA_TRACE_SCOPE("driver", "checkComms");
+    if (acquiring_)
+      return (alive());
     stopAcquire();
-    serial_->flush();
-    tx_buffer_ << "U";
-    transmit();
-    std::string msg = serial_->read(max_line_length);
+    transport_->flush();
+    transmit(commands::CheckComms::encode());
+    std::string msg = readString(max_line_length);
     boost::trim(msg);
     if (msg == "URSA2")
       return (true);
@@ -255,46 +678,287 @@ namespace ursa
       return (false);
   }
 
+  /**
+   * While data keeps arriving this only compares two times.  After silence_ns_ without data:
+   *   - acquiring spectra, RequestBatt is sent without stopping.  The battery frame comes back in the
+   *     stream and is seen by the next read().  If nothing arrives within probe_timeout_ns the Ursa is
+   *     marked unresponsive and probed again on the next call.
+   *   - in GM mode requestBatt() asks for the voltage directly, which does not disturb the GM counts.
+   *   - when not acquiring there is nothing to interrupt, so checkComms() is used, at most once per silence_ns_.
+   *
+   * The reader thread can receive bytes after now is taken, so a last receive time at or after now counts as data.
+   */
+  bool Interface::alive() {
+    uint64_t now = monotonicNanos();
+    uint64_t last_rx = last_rx_ns_;
+    if (last_rx != 0 && (last_rx >= now || now - last_rx < silence_ns_))
+    {
+      if (!responsive_ && acquiring_)
+        log_.info("URSA responding again.");
+      responsive_ = true;
+      probe_ns_ = 0;
+      return (true);
+    }
+
+    if (!acquiring_)
+    {
+      if (probe_ns_ == 0 || now - probe_ns_ >= silence_ns_)
+      {
+        probe_ns_ = now;
+        responsive_ = checkComms();
+      }
+      return (responsive_);
+    }
+
+    if (probe_ns_ == 0)
+    {
+      if (responsive_)
+        log_.warn("No data for %.1f s while acquiring. Probing.",
+                  (now - last_rx) / 1e9);
+      probe_ns_ = now;
+      if (gmMode_)
+        requestBatt();
+      else
+        transmit(commands::RequestBatt::encode(), false);
+      if (last_rx_ns_ >= now)
+      {
+        probe_ns_ = 0;
+        responsive_ = true;
+      }
+    }
+    else if (now - probe_ns_ >= probe_timeout_ns)
+    {
+      if (responsive_)
+        log_.error("URSA not responding.");
+      responsive_ = false;
+      probe_ns_ = 0;
+    }
+    return (responsive_);
+  }
+
+  /** Alarm outputs left on by the AlarmEngine are switched off.  Data still arriving is read into the
+   * receive buffer and discarded, so stopping does not allocate.
+   */
   void Interface::stopAcquire() {
+    URSA_TRACE_SCOPE("driver", "stopAcquire");
+    stopReader();
     do
     {
-      std::string ignored = serial_->read(128);
-      tx_buffer_ << "R";
-      transmit();
+      readBytes(rx_buffer_.data(), 128);
+      transmit(commands::StopAcquire::encode());
       usleep(500);
     }
-    while (serial_->available());
+    while (transport_->available());
+    rx_length_ = 0;
     acquiring_ = false;
+    for (size_t line = 0; line < 2; line++)
+    {
+      if (alarm_outputs_[line])
+        writeAlarmOutput(line, false);
+    }
   }
 
   void Interface::startAcquire() {
+    URSA_TRACE_SCOPE("driver", "startAcquire");
     if (!acquiring_)
     {
-      tx_buffer_ << "G";
-      transmit();
+      transmit(commands::StartAcquire::encode());
       acquiring_ = true;
+      last_rx_ns_ = monotonicNanos();   //the silence starts now
+      probe_ns_ = 0;
+      boost::lock_guard<boost::mutex> lock(array_mutex_);
+      alarm_.restart();
+      if (!interval_start_ns_)
+        interval_start_ns_ = wallNanos();
     }
     else
-      std::cout << "WARNING: Already acquiring" << std::endl;
+      log_.warn("Already acquiring");
+  }
+
+  /**
+   * StopAcquire is sent without the settle and the pulses still in flight are decoded into the current
+   * epoch as they arrive.  Once the line has been silent for quiet_ns the Ursa has stopped.
+   */
+  void Interface::quiesce() {
+    URSA_TRACE_SCOPE("driver", "quiesce");
+    transmit(commands::StopAcquire::encode(), false);
+    uint64_t start = monotonicNanos();
+    uint64_t last_data = start;
+    for (;;)
+    {
+      uint64_t now = monotonicNanos();
+      if (transport_->available())
+      {
+        read();
+        last_data = now;
+      }
+      else if (now - last_data >= quiet_ns)
+        break;
+      else
+        usleep(1000);
+      if (now - start >= quiesce_timeout_ns)
+      {
+        log_.warn("Ursa did not go quiet after stopping. Stopping again.");
+        stopAcquire();
+        return;
+      }
+    }
+    rx_length_ = 0;
+    acquiring_ = false;
+  }
+
+  /**
+   * Every setting is validated before anything is sent, so an invalid request leaves acquisition untouched.
+   * Settings equal to those last sent are skipped.  If nothing differs no command is sent and the epoch does not change.
+   *
+   * Otherwise acquisition is stopped with quiesce(), the changed settings are sent command_gap_us apart with a
+   * single settle at the end, the epoch is incremented and acquisition is restarted.  The dead time is measured
+   * from the stop command to the start command.  An input change cycles the high voltage, which takes the
+   * ramp time both ways.
+   *
+   * If not acquiring the settings are applied and the epoch changed the same way but acquisition is not started.
+   *
+   * A gain, threshold or resolution change moves counts between channels and changes the count rate, so the
+   * alarm backgrounds are learned again rather than kept.  Any active alarm is cleared first.
+   */
+  ReconfigureResult Interface::reconfigure(const AcquisitionSettings &settings,
+                                           bool clear) {
+    URSA_TRACE_SCOPE("driver", "reconfigure");
+    ReconfigureResult result;
+    result.success = false;
+    result.applied = 0;
+    result.dead_ns = 0;
+    result.epoch = getEpoch();
+
+    commands::GainSetting gain_setting;
+    if (gmMode_)
+    {
+      log_.error("In GM mode. Stop GM mode to reconfigure.");
+      return (result);
+    }
+    if (settings.set_gain && !commands::gainSetting(settings.gain, &gain_setting))
+    {
+      log_.error("Gain must be bellow 250x");
+      return (result);
+    }
+    if (settings.set_threshold
+        && (settings.threshold < 25 || settings.threshold > 1023))
+    {
+      log_.error("Threshold must be between 25 and 1024 mV");
+      return (result);
+    }
+    if (settings.set_bits && (settings.bits < 8 || settings.bits > 12))
+    {
+      log_.error("Bits must be between 12 and 8 bits");
+      return (result);
+    }
+    result.success = true;
+
+    bool gain = settings.set_gain
+        && !(settings_.set_gain && settings_.gain == settings.gain);
+    bool threshold = settings.set_threshold
+        && !(settings_.set_threshold && settings_.threshold == settings.threshold);
+    bool shaping = settings.set_shaping_time
+        && !(settings_.set_shaping_time && settings_.shaping == settings.shaping);
+    bool input = settings.set_input
+        && !(settings_.set_input && settings_.input == settings.input);
+    bool bits = settings.set_bits
+        && !(settings_.set_bits && settings_.bits == settings.bits);
+    result.applied = gain + threshold + shaping + input + bits;
+    if (result.applied == 0)
+      return (result);
+
+    bool restart = acquiring_;
+    bool reader = reader_.joinable();
+    stopReader();
+    uint64_t stop_ns = monotonicNanos();
+    if (restart)
+      quiesce();
+
+    if (input)
+    {
+      int voltage = voltage_;
+      setInput(settings.input);
+      if (voltage)
+        setVoltage(voltage);
+    }
+    if (gain)
+    {
+      transmit(commands::setGain(gain_setting), false);
+      settings_.set_gain = true;
+      settings_.gain = settings.gain;
+      usleep(command_gap_us);
+    }
+    if (threshold)
+    {
+      transmit(commands::setThresholdOffset(settings.threshold), false);
+      settings_.set_threshold = true;
+      settings_.threshold = settings.threshold;
+      usleep(command_gap_us);
+    }
+    if (shaping)
+    {
+      transmit(commands::SetShapingTime::encode(settings.shaping), false);
+      settings_.set_shaping_time = true;
+      settings_.shaping = settings.shaping;
+      usleep(command_gap_us);
+    }
+    if (bits)
+    {
+      transmit(commands::setBitMode(settings.bits), false);
+      settings_.set_bits = true;
+      settings_.bits = settings.bits;
+      usleep(command_gap_us);
+    }
+    if (!input)
+      usleep(100000 - command_gap_us);  //one settle for the whole group
+
+    {
+      boost::lock_guard<boost::mutex> swap_lock(swap_mutex_);
+      boost::lock_guard<boost::mutex> lock(array_mutex_);
+      result.epoch = ++epoch_;
+      dose_.setResponse(settings_.set_gain ? settings_.gain : 0,
+                        settings_.set_bits ? settings_.bits : 12);
+      if (clear)
+      {
+        spectrum_->clear();
+        past_total_->fill(0);
+        interval_start_ns_ = wallNanos();
+      }
+      if (gain || threshold || bits)
+        alarm_.configure(alarm_.config());
+      else if (restart)
+        alarm_.restart();
+    }
+    if (restart)
+    {
+      transmit(commands::StartAcquire::encode(), false);
+      acquiring_ = true;
+      result.dead_ns = monotonicNanos() - stop_ns;
+    }
+    if (reader)
+      startReader(reader_options_);
+    log_.info("Configuration epoch %u: %d settings changed, dead for %.1f ms",
+              (unsigned) result.epoch, (int) result.applied,
+              result.dead_ns / 1e6);
+    return (result);
   }
 
   void Interface::startGM() {
     if (!acquiring_)
     {
-      tx_buffer_ << "J";
-      transmit();
+      transmit(commands::StartGM::encode());
       gmMode_ = true;
       startAcquire();
     }
     else
-      std::cout << "WARNING: Already acquiring" << std::endl;
+      log_.warn("Already acquiring");
   }
 
   void Interface::stopGM() {
     if (acquiring_)
       stopAcquire();
-    tx_buffer_ << "j";
-    transmit();
+    transmit(commands::StopGM::encode());
     gmMode_ = false;
   }
 
@@ -302,7 +966,7 @@ namespace ursa
    * This function will only work in GM mode and while acquiring. The number of counts counted since the last time
    * this function was called is returned via serial as 4 bytes.  This function then combines the 4 bytes into one 32 but number and returns the number.
    *
-   * If the number of bytes in the serial buffer is not 4 an error is written to cout.
+   * If the number of bytes in the serial buffer is not 4 an error is logged.
    *
    */
   uint32_t Interface::requestCounts() {
@@ -310,34 +974,31 @@ namespace ursa
     {
       uint8_t temp_buffer[10];
       uint8_t count = 0;
-      tx_buffer_ << "c";
-      transmit();
-      serial_->waitReadable();
-      if (serial_->available() <= 4)
+      transmit(commands::RequestCounts::encode());
+      transport_->waitReadable();
+      if (transport_->available() <= 4)
       {
-        count = serial_->read(temp_buffer, 4);
+        count = transport_->read(temp_buffer, 4);
         if (count == 4)
         {
+          last_rx_ns_ = monotonicNanos();
           return (((uint32_t) temp_buffer[0] << 24)
               | ((uint32_t) temp_buffer[1] << 16)
               | ((uint32_t) temp_buffer[2] << 8) | ((uint32_t) temp_buffer[3]));
         }
       }
-      std::cout << "ERROR: Did not receive correct number of bytes"
-          << std::endl;
+      log_.error("Did not receive correct number of bytes");
       return (0);
     }
     else
     {
-      std::cout << "ERROR: Either not acquiring or not in GM mode."
-          << std::endl;
+      log_.error("Either not acquiring or not in GM mode.");
       return (0);
     }
   }
 
   void Interface::stopVoltage() {
-    tx_buffer_ << "v";
-    transmit();
+    transmit(commands::StopVoltage::encode());
   }
   /**
    * The battery voltage is reported to the driver differently depending on if the driver is in acquire mode.
@@ -346,18 +1007,18 @@ namespace ursa
    * In either case to get the voltage see: Interface::getBatt.
    */
   void Interface::requestBatt() {
-    tx_buffer_ << "B";
-    transmit();
+    transmit(commands::RequestBatt::encode());
     if (!acquiring_ || gmMode_)
     {
       uint8_t gm = (gmMode_ ? 1 : 0);
-      serial_->waitReadable();
-      if (serial_->available() <= (2 + gm))
+      transport_->waitReadable();
+      if (transport_->available() <= (2 + gm))
       {
         uint8_t temp_buffer[3];
-        uint8_t count = serial_->read(temp_buffer, 2 + gm);
+        uint8_t count = transport_->read(temp_buffer, 2 + gm);
         if (count == (2 + gm))
         {
+          last_rx_ns_ = monotonicNanos();
           processBatt(
               ((uint16_t) temp_buffer[0 + gm] << 8)
                   | ((uint16_t) temp_buffer[1 + gm]));
@@ -366,7 +1027,7 @@ namespace ursa
       }
       else
       {
-        std::cout << "ERROR: Failed to process Batt. voltage." << std::endl;
+        log_.error("Failed to process Batt. voltage.");
       }
     }
   }
@@ -378,40 +1039,43 @@ namespace ursa
   void Interface::startASCII() {
     if (!acquiring_)
     {
-      tx_buffer_ << "A";
-      transmit();
+      transmit(commands::StartASCII::encode());
     }
     else
-      std::cout << "ERROR: Acquiring. Stop acquiring to switch ASCII mode."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to switch ASCII mode.");
   }
 
   void Interface::stopASCII() {
     if (!acquiring_)
     {
-      tx_buffer_ << "N";
-      transmit();
+      transmit(commands::StopASCII::encode());
     }
     else
-      std::cout << "ERROR: Acquiring. Stop acquiring to switch ASCII mode."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to switch ASCII mode.");
   }
 
   int Interface::requestSerialNumber() {
+    URSA_TRACE_SCOPE("driver", "requestSerialNumber");
     if (!acquiring_)
     {
-      tx_buffer_ << "@";
-      transmit();
+      transmit(commands::RequestSerialNumber::encode());
       usleep(50000);
-      std::string msg = serial_->read(max_line_length);
+      std::string msg = readString(max_line_length);
       boost::trim(msg);
-      std::cout << "INFO: The serial number is: " << msg << std::endl;
-      return (boost::lexical_cast<int>(msg.c_str()));
+      log_.info("The serial number is: %s", msg.c_str());
+      try
+      {
+        return (boost::lexical_cast<int>(msg.c_str()));
+      }
+      catch (boost::bad_lexical_cast & err)
+      {
+        log_.error("Unable to parse the serial number.");
+        return (-1);
+      }
     }
     else
     {
-      std::cout << "ERROR: Acquiring. Stop acquiring to switch ASCII mode."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to request the serial number.");
       return (-1);
     }
   }
@@ -422,18 +1086,17 @@ namespace ursa
    * The max HV is almost always 2000.
    */
   void Interface::requestMaxHV() {
+    URSA_TRACE_SCOPE("driver", "requestMaxHV");
     if (!acquiring_)
     {
-      tx_buffer_ << "2";
-      transmit();
+      transmit(commands::RequestMaxHV::encode());
       usleep(50000);
-      std::string msg = serial_->read(max_line_length);
+      std::string msg = readString(max_line_length);
       boost::trim(msg);
-      std::cout << "INFO: The max HV is: " << msg << std::endl;
+      log_.info("The max HV is: %s", msg.c_str());
     }
     else
-      std::cout << "ERROR: Acquiring. Stop acquiring to request Max HV."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to request Max HV.");
   }
 
 #ifdef ADMIN_
@@ -444,16 +1107,12 @@ namespace ursa
   {
     if (!acquiring_ && serial >= 200000 && serial <= 299999)
     {
-      tx_buffer_ << "#";
-      transmit();
-      tx_buffer_ << boost::lexical_cast<std::string>(serial);
-      transmit();
+      transmit(commands::SetSerialNumber::encode());
+      transmit(commands::SerialNumberValue::encode(serial));
       sleep(3);
     }
     else
-    std::cout
-    << "ERROR: Serial must be between 200000 and 299999 and the system must not be acquiring."
-    << std::endl;
+    log_.error("Serial must be between 200000 and 299999 and the system must not be acquiring.");
   }
 
   /**
@@ -463,13 +1122,10 @@ namespace ursa
   {
     if (!acquiring_ && smudge >= 0 && smudge <= 4)
     {
-      tx_buffer_ << "X" << boost::lexical_cast<std::string>(smudge);
-      transmit();
+      transmit(commands::SetSmudgeFactor::encode(smudge));
     }
     else
-    std::cout
-    << "ERROR: Smudge factor must be between 0 and 4 and the system must not be acquiring."
-    << std::endl;
+    log_.error("Smudge factor must be between 0 and 4 and the system must not be acquiring.");
   }
 
   //This function must NOT be used
@@ -496,37 +1152,35 @@ namespace ursa
    * See: setVoltage().
    */
   void Interface::loadPrevSettings() {
+    URSA_TRACE_SCOPE("driver", "loadPrevSettings");
     if (!acquiring_)
     {
-      tx_buffer_ << "r";
-      transmit();
+      transmit(commands::LoadPrevSettings::encode());
       int seconds = 1;
       //This sets HV so we need to wait for ramp
-      std::string msg = serial_->read(max_line_length);
-      while (!serial_->waitReadable())
+      std::string msg = readString(max_line_length);
+      while (!transport_->waitReadable())
       {
-        tx_buffer_ << "B";
-        transmit();
-        std::cout << "INFO: Ramping HV.  Approx. seconds elapsed: " << seconds
-            << std::endl;
+        transmit(commands::RequestBatt::encode());
+        log_.info("Ramping HV.  Approx. seconds elapsed: %d", seconds);
         seconds++;
       }
-      msg = serial_->read(max_line_length);
+      msg = readString(max_line_length);
+      settings_ = AcquisitionSettings();
+      updateDoseResponse();
     }
     else
-      std::cout << "ERROR: Acquiring. Stop acquiring to load settings."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to load settings.");
   }
 
   void Interface::setNoSave() {
+    URSA_TRACE_SCOPE("driver", "setNoSave");
     if (!acquiring_)
     {
-      tx_buffer_ << "d";
-      transmit();
+      transmit(commands::SetNoSave::encode());
     }
     else
-      std::cout << "ERROR: Acquiring. Stop acquiring to disable EEPROM saving."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to disable EEPROM saving.");
   }
 
   /**
@@ -534,7 +1188,7 @@ namespace ursa
    * If no ramping time is set the high voltage will ramp as fast as it can.
    *
    * While the ursa is ramping it cannot respond to any command.  This function will block and wait till the ursa is responsive again.
-   * While it waits an approximation of the time remaining will be printed to std::cout.
+   * While it waits an approximation of the time remaining will be logged.
    *
    * This function can only be called when not in acquire mode.
    *
@@ -543,35 +1197,30 @@ namespace ursa
    * @param voltage The voltage to ramp to as an int.
    */
   void Interface::setVoltage(int voltage) {
+    URSA_TRACE_SCOPE_DETAIL("driver", "setVoltage", "%d V", voltage);
     if (!acquiring_ && voltage >= 0 && voltage <= 2000)
     {
 
       if (voltage == 0)
         setNoSave();
-      uint16_t outVolts = 0;
-      outVolts = round(double(voltage) / 2000 * 65532);
-      tx_buffer_ << "V" << (uint8_t) (outVolts >> 8)
-          << (uint8_t) (outVolts & 0xff);
-      transmit();
+      transmit(commands::setVoltage(voltage));
       //calculate seconds for ramp then adjust for the loop taking 1.1 seconds
       int seconds = ((ramp_ * abs(voltage - voltage_) / 100) / 1.1) - 1;
       // blocking call to serial to wait for responsiveness
-      std::string msg = serial_->read(max_line_length);
-      while (!serial_->waitReadable())
+      std::string msg = readString(max_line_length);
+      while (!transport_->waitReadable())
       {
-        std::cout << "INFO: Ramping HV to: " << voltage
-            << " Approx. Seconds Remaining: " << seconds << std::endl;
+        log_.info("Ramping HV to: %d Approx. Seconds Remaining: %d", voltage,
+                  seconds);
         seconds--;
-        tx_buffer_ << "B";
-        transmit();
+        transmit(commands::RequestBatt::encode());
       }
-      msg = serial_->read(max_line_length);
+      msg = readString(max_line_length);
       voltage_ = voltage;
     }
     else
-      std::cout
-          << "ERROR: Voltage must be between 0 and 2000 volts and the system must not be acquiring"
-          << std::endl;
+      log_.error(
+          "Voltage must be between 0 and 2000 volts and the system must not be acquiring");
   }
 
   /**
@@ -583,64 +1232,29 @@ namespace ursa
    * @param gain the desired gain as a double
    */
   void Interface::setGain(double gain) {
+    URSA_TRACE_SCOPE_DETAIL("driver", "setGain", "%g", gain);
     if (!acquiring_)
     {
-      char coarse;
-      uint8_t fine;
-      std::string coarse_str;
-      if (gain < 2)
-      {
-        coarse = '0';
-        fine = round((gain / 2) * 256 - 1);
-        coarse_str = "2";
-      }
-      else if (gain < 4)
+      commands::GainSetting setting;
+      if (!commands::gainSetting(gain, &setting))
       {
-        coarse = '1';
-        fine = round((gain / 4) * 256 - 1);
-        coarse_str = "4";
-      }
-      else if (gain < 15)
-      {
-        coarse = '2';
-        fine = round((gain / 15) * 256 - 1);
-        coarse_str = "15";
-      }
-      else if (gain < 35)
-      {
-        coarse = '3';
-        fine = round((gain / 35) * 256 - 1);
-        coarse_str = "35";
-      }
-      else if (gain < 125)
-      {
-        coarse = '4';
-        fine = round((gain / 125) * 256 - 1);
-        coarse_str = "125";
-      }
-      else if (gain < 250)
-      {
-        coarse = '5';
-        fine = round((gain / 250) * 256 - 1);
-        coarse_str = "250";
-      }
-      else
-      {
-        std::cout << "ERROR: Gain must be bellow 250x" << std::endl;
+        log_.error("Gain must be bellow 250x");
         return;
       }
 
-      std::cout << "INFO: Setting coarse gain to: " << coarse_str << std::endl;
+      log_.info("Setting coarse gain to: %d",
+                commands::coarseGain(setting.coarse));
 
-      double confirmGain = ((double(fine) + 1) / 256);
-      std::cout << "INFO: Setting fine gain to: "
-          << boost::lexical_cast<std::string>(confirmGain) << std::endl;
-      tx_buffer_ << "C" << coarse << "F" << fine;
-      transmit();
+      double confirmGain = ((double(setting.fine) + 1) / 256);
+      log_.info("Setting fine gain to: %s",
+                boost::lexical_cast<std::string>(confirmGain).c_str());
+      transmit(commands::setGain(setting));
+      settings_.set_gain = true;
+      settings_.gain = gain;
+      updateDoseResponse();
     }
     else
-      std::cout << "ERROR: Acquiring. Stop acquiring to change gain."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to change gain.");
   }
 
   /**
@@ -653,16 +1267,16 @@ namespace ursa
    * @param input The desired input and polarity as a ursa:inputs.
    */
   void Interface::setInput(inputs input) {
+    URSA_TRACE_SCOPE_DETAIL("driver", "setInput", "%d", (int) input);
     if (!acquiring_)
     {
       setVoltage(0);
-      tx_buffer_ << "I" << boost::lexical_cast<std::string>(input);
-      transmit();
+      transmit(commands::SetInput::encode(input));
+      settings_.set_input = true;
+      settings_.input = input;
     }
     else
-      std::cout
-          << "ERROR: Acquiring. Stop acquiring to switch inputs or polarity."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to switch inputs or polarity.");
   }
 
   /**
@@ -675,14 +1289,15 @@ namespace ursa
    * @param time The shaping time as an ursa::shaping_time
    */
   void Interface::setShapingTime(shaping_time time) {
+    URSA_TRACE_SCOPE_DETAIL("driver", "setShapingTime", "%d", (int) time);
     if (!acquiring_)
     {
-      tx_buffer_ << "S" << boost::lexical_cast<std::string>(time);
-      transmit();
+      transmit(commands::SetShapingTime::encode(time));
+      settings_.set_shaping_time = true;
+      settings_.shaping = time;
     }
     else
-      std::cout << "ERROR: Acquiring. Stop acquiring to change shaping time."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to change shaping time.");
   }
 
   /**
@@ -695,27 +1310,16 @@ namespace ursa
    * @param mVolts The threshold in millivolts as an int.
    */
   void Interface::setThresholdOffset(int mVolts) {
+    URSA_TRACE_SCOPE_DETAIL("driver", "setThresholdOffset", "%d mV", mVolts);
     if (!acquiring_ && mVolts >= 25 && mVolts <= 1023)
     {
-      uint16_t min_offset = 50;
-      uint16_t thresh = mVolts * 2;
-      uint16_t offset = 0;
-      if (mVolts > min_offset * 2)
-      {
-        offset = mVolts;  //offset = mV/2 *2
-      }
-      else
-        offset = min_offset * 2;
-
-      tx_buffer_ << "T" << (unsigned char) ((thresh >> 4) & 0xFF)
-          << (unsigned char) (((thresh & 0x0F) << 4) | ((offset >> 8) & 0x0F))
-          << (unsigned char) (offset & 0xFF);
-      transmit();
+      transmit(commands::setThresholdOffset(mVolts));
+      settings_.set_threshold = true;
+      settings_.threshold = mVolts;
     }
     else
-      std::cout
-          << "ERROR: Threshold must be between 25 and 1024 mV and the system must not be acquiring"
-          << std::endl;
+      log_.error(
+          "Threshold must be between 25 and 1024 mV and the system must not be acquiring");
   }
 
   /**
@@ -725,15 +1329,17 @@ namespace ursa
    * @param bits The number of bits to use as an int.
    */
   void Interface::setBitMode(int bits) {
+    URSA_TRACE_SCOPE_DETAIL("driver", "setBitMode", "%d", bits);
     if (!acquiring_ && bits >= 8 && bits <= 12)
     {
-      tx_buffer_ << "M" << boost::lexical_cast<std::string>(13 - bits);
-      transmit();
+      transmit(commands::setBitMode(bits));
+      settings_.set_bits = true;
+      settings_.bits = bits;
+      updateDoseResponse();
     }
     else
-      std::cout
-          << "ERROR: Bits must be between 12 and 8 bits and the system must not be acquiring"
-          << std::endl;
+      log_.error(
+          "Bits must be between 12 and 8 bits and the system must not be acquiring");
   }
 
   /**
@@ -745,39 +1351,37 @@ namespace ursa
    * @param seconds The ramping time in seconds as an int.
    */
   void Interface::setRamp(int seconds) {
+    URSA_TRACE_SCOPE_DETAIL("driver", "setRamp", "%d s", seconds);
     if (!acquiring_ && seconds >= 6 && seconds <= 219)
     {
       ramp_ = seconds;
-      uint16_t ramp = round((seconds * 303.45) - 1197);
-      if (ramp > 16383)
-        ramp = 16838;
-      tx_buffer_ << "P" << (uint8_t) (ramp >> 8) << (uint8_t) (ramp & 0xFF);
-      transmit();
+      transmit(commands::setRamp(seconds));
     }
     else
-      std::cout
-          << "ERROR: Ramp must be between 6 and 219 seconds and the system must not be acquiring"
-          << std::endl;
+      log_.error(
+          "Ramp must be between 6 and 219 seconds and the system must not be acquiring");
   }
 
   void Interface::noRamp() {
     if (!acquiring_)
     {
-      tx_buffer_ << "p";
-      transmit();
+      transmit(commands::NoRamp::encode());
     }
     else
-      std::cout << "ERROR: Acquiring. Stop acquiring to disable ramping of HV."
-          << std::endl;
+      log_.error("Acquiring. Stop acquiring to disable ramping of HV.");
   }
 
   void Interface::setAlarm0(bool enable) {
-    tx_buffer_ << (enable ? "Z" : "z");
-    transmit();
+    transmit(
+        enable ?
+            commands::EnableAlarm0::encode() :
+            commands::DisableAlarm0::encode());
   }
 
   void Interface::setAlarm1(bool enable) {
-    tx_buffer_ << (enable ? "W" : "w");
-    transmit();
+    transmit(
+        enable ?
+            commands::EnableAlarm1::encode() :
+            commands::DisableAlarm1::encode());
   }
 }
@@ -62,12 +62,14 @@ int main(int argc, char **argv) {
   if (GMmode)
   {
     ursa->startGM();
+    uint64_t tick = ursa::nextWallBoundary(ursa::wallNanos(), 1000000000ULL, 0);
     for (int i = 0; i < 30; i++)
     {
-      std::cout << "Approx CPS: " << ursa->requestCounts() << std::endl; //number of counts since last read
+      ursa::sleepUntilWall(tick); //wake on each whole second however long the requests took
+      std::cout << "CPS: " << ursa->requestCounts() << std::endl; //number of counts since last read
       ursa->requestBatt();
       std::cout << "Ursa Batt. voltage: " << boost::lexical_cast<std::string>(ursa->getBatt()) <<std::endl;
-      sleep(1); //Terrible way to get 1Hz (actual rate on my pc ~.8 Hz)
+      tick = ursa::nextWallBoundary(ursa::wallNanos(), 1000000000ULL, 0);
     }
     ursa->stopGM();
   }
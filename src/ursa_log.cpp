@@ -0,0 +1,268 @@
+/** Implementation of the ursa::Logger class.
+ \file      ursa_log.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/ursa_log.h>
+#include <ursa_driver/ursa_clock.h>
+
+#include <boost/thread/lock_guard.hpp>
+#include <cstdio>
+
+namespace ursa
+{
+  const uint64_t flush_period_ms(20);
+
+  //! Human readable names of each log_class used in suppression reports.
+  const char *class_names[LOG_CLASS_COUNT] = { "general", "decode",
+                                               "dropped bytes" };
+  //! Report formats for aggregated classes. NULL for classes that are not aggregated.
+  const char *aggregate_formats[LOG_CLASS_COUNT] = {
+      NULL, NULL, "Read error, dropped %llu bytes in %.1f s" };
+  //! The level aggregated reports are written at.
+  const log_level aggregate_levels[LOG_CLASS_COUNT] = { LOG_INFO, LOG_INFO,
+                                                        LOG_ERROR };
+
+  void StreamLogSink::write(log_level level, const char *msg) {
+    switch (level)
+    {
+      case LOG_DEBUG:
+        stream_ << "DEBUG: ";
+        break;
+      case LOG_INFO:
+        stream_ << "INFO: ";
+        break;
+      case LOG_WARN:
+        stream_ << "WARN: ";
+        break;
+      default:
+        stream_ << "ERROR: ";
+        break;
+    }
+    stream_ << msg << std::endl;
+  }
+
+  /** The default interval is one second. The decode class is limited to 10 messages per interval and
+   * general messages to 50 so a misbehaving device cannot flood the sink.
+   */
+  Logger::Logger() :
+      sink_(&default_sink_), interval_ns_(1000000000ULL), interval_start_ns_(
+          monotonicNanos()) {
+    for (size_t i = 0; i < LOG_CLASS_COUNT; i++)
+    {
+      limits_[i] = 0;
+      class_counts_[i].store(0);
+      class_suppressed_[i].store(0);
+      aggregates_[i].store(0);
+    }
+    limits_[LOG_GENERAL] = 50;
+    limits_[LOG_DECODE] = 10;
+    enqueued_.store(0);
+    written_.store(0);
+    suppressed_.store(0);
+    overflowed_.store(0);
+    aggregated_.store(0);
+    enqueue_ns_.store(0);
+    max_enqueue_ns_.store(0);
+    flusher_ = boost::thread(&Logger::flushLoop, this);
+  }
+
+  Logger::~Logger() {
+    flusher_.interrupt();
+    flusher_.join();
+    flush();
+  }
+
+  void Logger::setSink(LogSink *sink) {
+    boost::lock_guard<boost::mutex> lock(sink_mutex_);
+    sink_ = (sink ? sink : &default_sink_);
+  }
+
+  void Logger::setRateLimit(log_class cls, uint32_t max_per_interval) {
+    limits_[cls] = max_per_interval;
+  }
+
+  void Logger::setInterval(double seconds) {
+    boost::lock_guard<boost::mutex> lock(sink_mutex_);
+    interval_ns_ = seconds * 1e9;
+  }
+
+  void Logger::write(log_level level, log_class cls, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vwrite(level, cls, format, args);
+    va_end(args);
+  }
+
+  /**
+   * The rate limit is checked before formatting so suppressed messages only cost an atomic increment.
+   * The time spent formatting and queuing is accumulated in the LogStats.
+   */
+  void Logger::vwrite(log_level level, log_class cls, const char *format,
+                      va_list args) {
+    uint64_t start = monotonicNanos();
+    if (limits_[cls]
+        && class_counts_[cls].fetch_add(1, boost::memory_order_relaxed)
+            >= limits_[cls])
+    {
+      class_suppressed_[cls].fetch_add(1, boost::memory_order_relaxed);
+      suppressed_.fetch_add(1, boost::memory_order_relaxed);
+      return;
+    }
+
+    Record record;
+    record.level = level;
+    vsnprintf(record.text, max_message_length, format, args);
+    if (queue_.bounded_push(record))
+      enqueued_.fetch_add(1, boost::memory_order_relaxed);
+    else
+      overflowed_.fetch_add(1, boost::memory_order_relaxed);
+
+    uint64_t elapsed = monotonicNanos() - start;
+    enqueue_ns_.fetch_add(elapsed, boost::memory_order_relaxed);
+    uint64_t max = max_enqueue_ns_.load(boost::memory_order_relaxed);
+    while (elapsed > max
+        && !max_enqueue_ns_.compare_exchange_weak(max, elapsed,
+                                                  boost::memory_order_relaxed))
+      ;
+  }
+
+  void Logger::debug(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vwrite(LOG_DEBUG, LOG_GENERAL, format, args);
+    va_end(args);
+  }
+
+  void Logger::info(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vwrite(LOG_INFO, LOG_GENERAL, format, args);
+    va_end(args);
+  }
+
+  void Logger::warn(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vwrite(LOG_WARN, LOG_GENERAL, format, args);
+    va_end(args);
+  }
+
+  void Logger::error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vwrite(LOG_ERROR, LOG_GENERAL, format, args);
+    va_end(args);
+  }
+
+  void Logger::flush() {
+    boost::lock_guard<boost::mutex> lock(sink_mutex_);
+    drain();
+    endInterval(monotonicNanos());
+  }
+
+  LogStats Logger::stats() const {
+    LogStats stats;
+    stats.enqueued = enqueued_.load();
+    stats.written = written_.load();
+    stats.suppressed = suppressed_.load();
+    stats.overflowed = overflowed_.load();
+    stats.aggregated = aggregated_.load();
+    stats.enqueue_ns = enqueue_ns_.load();
+    stats.max_enqueue_ns = max_enqueue_ns_.load();
+    return (stats);
+  }
+
+  /**
+   * Wakes every flush_period_ms to drain the queue.  The sleep is an interruption point which the
+   * destructor uses to stop the thread.
+   */
+  void Logger::flushLoop() {
+    try
+    {
+      while (true)
+      {
+        {
+          boost::lock_guard<boost::mutex> lock(sink_mutex_);
+          drain();
+          uint64_t now = monotonicNanos();
+          if (now - interval_start_ns_ >= interval_ns_)
+            endInterval(now);
+        }
+        boost::this_thread::sleep(
+            boost::posix_time::milliseconds(flush_period_ms));
+      }
+    }
+    catch (boost::thread_interrupted &)
+    {
+    }
+  }
+
+  //! Must be called with sink_mutex_ held.
+  void Logger::drain() {
+    Record record;
+    while (queue_.pop(record))
+      writeSink((log_level) record.level, record.text);
+  }
+
+  /** Must be called with sink_mutex_ held.
+   * Each aggregated class with a non zero count is reported using its entry in aggregate_formats.
+   * Classes which hit their rate limit report how many messages were suppressed.
+   */
+  void Logger::endInterval(uint64_t now) {
+    double seconds = double(now - interval_start_ns_) / 1e9;
+    char text[max_message_length];
+    for (size_t i = 0; i < LOG_CLASS_COUNT; i++)
+    {
+      if (aggregate_formats[i])
+      {
+        uint64_t n = aggregates_[i].exchange(0, boost::memory_order_relaxed);
+        if (n)
+        {
+          aggregated_.fetch_add(n, boost::memory_order_relaxed);
+          snprintf(text, max_message_length, aggregate_formats[i],
+                   (unsigned long long) n, seconds);
+          writeSink(aggregate_levels[i], text);
+        }
+      }
+      uint64_t suppressed = class_suppressed_[i].exchange(
+          0, boost::memory_order_relaxed);
+      class_counts_[i].store(0, boost::memory_order_relaxed);
+      if (suppressed)
+      {
+        snprintf(text, max_message_length,
+                 "Suppressed %llu %s messages in %.1f s",
+                 (unsigned long long) suppressed, class_names[i], seconds);
+        writeSink(LOG_WARN, text);
+      }
+    }
+    interval_start_ns_ = now;
+  }
+
+  //! Must be called with sink_mutex_ held.
+  void Logger::writeSink(log_level level, const char *msg) {
+    sink_->write(level, msg);
+    written_.fetch_add(1, boost::memory_order_relaxed);
+  }
+}
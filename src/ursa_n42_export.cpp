@@ -0,0 +1,94 @@
+/** Command line tool which exports the spectra in an archive to an ANSI N42.42 file.
+ \file      ursa_n42_export.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "ursa_driver/spectrum_archive.h"
+#include "ursa_driver/n42_writer.h"
+#include "ursa_driver/ursa_clock.h"
+#include <iostream>
+#include <cstdlib>
+
+/** Usage: ursa_n42_export <archive> <output> [period] [serial] [kev_offset kev_per_channel]
+ *
+ * Every record in the archive becomes one measurement, read and written one at a time so the export
+ * takes constant memory however long the run.  A record holds the counts since the one before it, so
+ * its real time is the gap to the previous record.  Gaps longer than twice the archive period span a
+ * stop and are taken as one period.  The archive does not record dead time, so the live time is the
+ * real time.
+ */
+int main(int argc, char **argv) {
+  if (argc != 3 && argc != 4 && argc != 5 && argc != 7)
+  {
+    std::cerr << "Usage: " << argv[0]
+        << " <archive> <output> [period] [serial] [kev_offset kev_per_channel]"
+        << std::endl;
+    return (-1);
+  }
+
+  ursa::SpectrumArchiveReader reader;
+  if (!reader.open(argv[1]))
+  {
+    std::cerr << "ERROR: " << argv[1] << " is not a spectrum archive." << std::endl;
+    return (-1);
+  }
+
+  uint64_t period_ns = (argc > 3 ? atof(argv[3]) : 1.0) * 1e9;
+  ursa::N42Header header;
+  if (argc > 4)
+    header.serial_number = atoi(argv[4]);
+  if (argc > 6)
+  {
+    header.coefficients.push_back(atof(argv[5]));
+    header.coefficients.push_back(atof(argv[6]));
+  }
+  ursa::N42Writer writer;
+  if (!writer.open(argv[2], header))
+  {
+    std::cerr << "ERROR: Unable to open " << argv[2] << std::endl;
+    return (-1);
+  }
+
+  uint64_t start = ursa::monotonicNanos();
+  uint64_t time_ns, previous_ns = 0;
+  ursa::WideSpectrum counts;
+  while (reader.next(&time_ns, &counts))
+  {
+    uint64_t real_ns = time_ns - previous_ns;
+    if (!previous_ns || real_ns > 2 * period_ns)
+      real_ns = period_ns;
+    previous_ns = time_ns;
+    if (!writer.write(time_ns - real_ns, real_ns, real_ns, counts))
+    {
+      std::cerr << "ERROR: Failed to write " << argv[2] << std::endl;
+      return (-1);
+    }
+  }
+  writer.close();
+
+  std::cerr << "INFO: Exported " << writer.measurements() << " spectra in "
+      << (ursa::monotonicNanos() - start) / 1e9 << " s." << std::endl;
+  return (0);
+}
@@ -24,15 +24,32 @@
  SOFTWARE.
  */
 
-#include "ursa_driver/ursa_driver.h"
+#include "topic_publisher.h"
+#include "ursa_driver/spectrum_archive.h"
+#include "ursa_driver/n42_writer.h"
+#include "ursa_driver/ursa_trace.h"
 #include "ros/ros.h"
-#include "ursa_driver/ursa_counts.h"
-#include "ursa_driver/ursa_spectra.h"
+#include "ursa_driver/ursa_alarm.h"
+#include "ursa_driver/ursa_events.h"
+#include "ursa_driver/ursa_config.h"
+#include "ursa_driver/ursa_reconfigure.h"
+#include "ursa_driver/ursa_take_interval.h"
+#include "ursa_driver/ursa_get_spectrum_view.h"
 #include "std_srvs/Empty.h"
 #include <std_msgs/String.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <cmath>
 
 int32_t baud;
 std::string port = "";
+std::string transport = "";
+std::string device = ""; //!< What the transport opens, the port without its URI scheme.
+int tty_vmin = 0;
+int tty_vtime = 0;
+bool low_latency;
 std::string detector_frame = "";
 
 int HV = 0;
@@ -50,39 +67,232 @@ std::map<std::string, ursa::inputs> input_map;
 bool load_prev;
 bool GMmode;
 bool imeadiate;
+bool publish_wide;
+double read_rate;
+std::string archive_directory = "";
+double archive_period = 1;
+std::string n42_directory = "";
+double n42_period = 1;
+std::string n42_detector_kind = "NaI";
+double n42_dead_time = 0; //!< The dead time per count in seconds, subtracted from the real time for the N42 live time.
+int serial_number = -1; //!< The Ursa's serial number, requested at startup when exporting N42.
+ursa::AlarmConfig alarm_config;
+std::string nuclide_library_path = "";
+double min_score = 0.5;
+bool list_mode;
+int list_batch_size = 1024;
+double list_max_latency = 0.05;
+std::string shm_name = "";
+std::string trace_file = "";
+double silence_timeout = 5;
+int shm_event_capacity = 65536;
+double shm_snapshot_period = 0.1;
+std::vector<ursa::ChannelRange> rois; //!< The regions of interest counted as events are decoded.
+ursa::DoseCalibration dose_calibration; //!< The dose weights applied as events are decoded, if it has knots.
+bool realtime; //!< Read from a dedicated thread with reader_options instead of the read timer.
+ursa::RealtimeOptions reader_options;
+double reader_report_period = 60;
+bool wall_clock_publish; //!< Publish topics on wall clock boundaries with a WallScheduler instead of ROS timers.
+double wall_clock_offset = 0;
+
+TopicPublishers publishers; //!< The topics, with the state their snapshots and publishes share.
+std::map<std::string, topic_type> topic_map;
 
 void fill_maps();
 int get_params(ros::NodeHandle nh);
-void timerCallback(const ros::TimerEvent& event);
+int get_topics(ros::NodeHandle nh);
+int get_alarms(ros::NodeHandle nh);
+int get_rois(ros::NodeHandle nh);
+int get_dose(ros::NodeHandle nh);
+void startTimers();
+void stopTimers();
+void readCallback(const ros::TimerEvent& event);
+void archiveCallback(const ros::TimerEvent& event);
+bool openN42();
+void primeN42();
+void n42Callback(const ros::TimerEvent& event);
+void livenessCallback(const ros::TimerEvent& event);
+void reportCallback(const ros::TimerEvent& event);
+void reportReader();
+void publishEvents();
 bool startAcquireCB(std_srvs::Empty::Request& request,
                     std_srvs::Empty::Response& response);
 bool stopAcquireCB(std_srvs::Empty::Request& request,
                    std_srvs::Empty::Response& response);
 bool clearSpectraCB(std_srvs::Empty::Request& request,
                     std_srvs::Empty::Response& response);
+bool reconfigureCB(ursa_driver::ursa_reconfigure::Request& request,
+                   ursa_driver::ursa_reconfigure::Response& response);
+bool takeIntervalCB(ursa_driver::ursa_take_interval::Request& request,
+                    ursa_driver::ursa_take_interval::Response& response);
+bool spectrumViewCB(ursa_driver::ursa_get_spectrum_view::Request& request,
+                    ursa_driver::ursa_get_spectrum_view::Response& response);
+void publishConfig(double dead_time);
+void writeTrace();
+
+//! Writes ursa::Interface log messages to the ROS console.
+class RosLogSink : public ursa::LogSink
+{
+public:
+  void write(ursa::log_level level, const char *msg) {
+    switch (level)
+    {
+      case ursa::LOG_DEBUG:
+        ROS_DEBUG("%s", msg);
+        break;
+      case ursa::LOG_INFO:
+        ROS_INFO("%s", msg);
+        break;
+      case ursa::LOG_WARN:
+        ROS_WARN("%s", msg);
+        break;
+      default:
+        ROS_ERROR("%s", msg);
+        break;
+    }
+  }
+};
 
 ursa::Interface * my_ursa;
-ros::Publisher publisher;
-ros::Timer timer;
+RosLogSink ros_log_sink;
+ros::Timer read_timer;
+ros::Timer archive_timer;
+ros::Timer liveness_timer;
+ros::Timer report_timer;
+ursa::SpectrumArchiveWriter archive;
+ursa::WideSpectrum archive_spectrum;
+ros::Timer n42_timer;
+ursa::N42Writer n42;
+ursa::WideSpectrum n42_spectrum; //!< The cumulative spectrum at the last N42 measurement.
+ursa::WideSpectrum n42_interval; //!< Scratch space for the counts of one N42 measurement.
+uint64_t n42_time_ns = 0; //!< The time of the last N42 measurement.
+ros::Publisher alarm_pub;
+std::vector<ursa::AlarmEvent> alarm_events;
+ursa::NuclideLibrary nuclide_library;
+ursa::NuclideIdentifier identifier(nuclide_library);
+boost::mutex serial_mutex; //!< Serializes GM count requests and liveness probes, which read replies.
+ros::Publisher events_pub;
+ursa::EventBatch event_batch;
+ursa_driver::ursa_events events_msg;
+ros::Publisher config_pub;
 
 int main(int argc, char **argv) {
   ros::init(argc, argv, "ursa_driver");
   ros::NodeHandle nh("~");
 
-  if (!get_params(nh))
+  nh.param<std::string>("trace_file", trace_file, "");
+  if (!trace_file.empty())
+    ursa::Tracer::instance().start();
+  ursa::Tracer::instance().instant("node", "start");
+
+  if (get_params(nh) < 0)
     return (-1);
 
-  my_ursa = new ursa::Interface(port.c_str(), baud);
+  if (port.find("://") != std::string::npos)
+  {
+    ursa::Transport *uri_transport = ursa::createTransport(port, &device);
+    if (!uri_transport)
+    {
+      ROS_ERROR("Unknown transport in port %s", port.c_str());
+      return (-1);
+    }
+    my_ursa = new ursa::Interface(device.c_str(), baud, uri_transport);
+  }
+  else if (transport == "tty")
+    my_ursa = new ursa::Interface(
+        port.c_str(), baud,
+        new ursa::TtyTransport(tty_vmin, tty_vtime, low_latency));
+  else
+    my_ursa = new ursa::Interface(port.c_str(), baud);
+  my_ursa->setLogSink(&ros_log_sink);
+  my_ursa->setSilenceTimeout(silence_timeout);
   my_ursa->connect();
   if (my_ursa->connected())
+  {
     ROS_INFO("URSA Connected");
+    ursa::Tracer::instance().instant("node", "connected");
+  }
   else
     return (-1);
 
-  if (GMmode)
-    publisher = nh.advertise<ursa_driver::ursa_counts>("counts", 10);
-  else
-    publisher = nh.advertise<ursa_driver::ursa_spectra>("spectra", 10);
+  if (alarm_config.enable)
+  {
+    if (GMmode)
+    {
+      ROS_ERROR("The alarm engine needs spectra and can not run in GM mode.");
+      return (-1);
+    }
+    my_ursa->setAlarmConfig(alarm_config);
+    alarm_pub = nh.advertise<ursa_driver::ursa_alarm>("alarms", 10);
+    alarm_events.reserve(ursa::alarm_event_capacity);
+  }
+
+  if (list_mode)
+  {
+    if (GMmode)
+    {
+      ROS_ERROR("List mode needs spectra and can not run in GM mode.");
+      return (-1);
+    }
+    my_ursa->setListMode(true, list_batch_size, list_max_latency);
+    events_pub = nh.advertise<ursa_driver::ursa_events>("events", 10);
+    events_msg.header.frame_id = detector_frame;
+  }
+
+  if (!shm_name.empty())
+  {
+    if (GMmode)
+    {
+      ROS_ERROR("The shared memory ring needs spectra and can not run in GM mode.");
+      return (-1);
+    }
+    if (!my_ursa->setSharedMemory(shm_name, shm_event_capacity,
+                                  shm_snapshot_period))
+    {
+      ROS_ERROR("Unable to create shared memory %s", shm_name.c_str());
+      return (-1);
+    }
+    ROS_INFO("Publishing to shared memory %s", shm_name.c_str());
+  }
+
+  if (!rois.empty() && !my_ursa->setRois(rois))
+  {
+    ROS_ERROR("Unable to count the regions of interest.");
+    return (-1);
+  }
+  if (!dose_calibration.energies.empty()
+      && !my_ursa->setDoseCalibration(dose_calibration))
+  {
+    ROS_ERROR("Invalid dose calibration.");
+    return (-1);
+  }
+
+  publishers.setDriver(my_ursa, &serial_mutex);
+  publishers.setIdentifier(&nuclide_library, &identifier, min_score);
+  publishers.setFirstPublish(writeTrace);
+  publishers.advertise(nh, detector_frame, rois.size(), wall_clock_publish);
+  read_timer = nh.createTimer(ros::Duration(1.0 / read_rate), readCallback,
+                              false, false);
+
+  if (!GMmode && !archive_directory.empty())
+  {
+    std::string path = archive_directory + "/spectra_"
+        + boost::lexical_cast<std::string>(ros::Time::now().sec) + ".uarc";
+    if (!archive.open(path))
+    {
+      ROS_ERROR("Unable to open spectrum archive %s", path.c_str());
+      return (-1);
+    }
+    ROS_INFO("Archiving spectra to %s", path.c_str());
+    archive_timer = nh.createTimer(ros::Duration(archive_period),
+                                   archiveCallback, false, false);
+  }
+
+  liveness_timer = nh.createTimer(ros::Duration(1.0), livenessCallback, false,
+                                  false);
+  if (reader_report_period > 0)
+    report_timer = nh.createTimer(ros::Duration(reader_report_period),
+                                  reportCallback, false, false);
 
   ros::ServiceServer startSrv = nh.advertiseService("startAcquire",
                                                     startAcquireCB);
@@ -90,7 +300,16 @@ int main(int argc, char **argv) {
                                                    stopAcquireCB);
   ros::ServiceServer spectraSrv = nh.advertiseService("clearSpectra",
                                                       clearSpectraCB);
-  timer = nh.createTimer(ros::Duration(1.0), timerCallback, false, false); //!< @todo look at createWallTimer
+  ros::ServiceServer reconfigureSrv = nh.advertiseService("reconfigure",
+                                                          reconfigureCB);
+  ros::ServiceServer intervalSrv;
+  ros::ServiceServer viewSrv;
+  if (!GMmode)
+  {
+    intervalSrv = nh.advertiseService("takeInterval", takeIntervalCB);
+    viewSrv = nh.advertiseService("getSpectrumView", spectrumViewCB);
+  }
+  config_pub = nh.advertise<ursa_driver::ursa_config>("config", 1, true);
 
   if (load_prev)
   {
@@ -105,6 +324,17 @@ int main(int argc, char **argv) {
     my_ursa->setRamp(ramp);
     my_ursa->setVoltage(HV);
   }
+  publishConfig(0);
+  ursa::Tracer::instance().instant("node", "configured");
+
+  if (!GMmode && !n42_directory.empty())
+  {
+    serial_number = my_ursa->requestSerialNumber();
+    if (!openN42())
+      return (-1);
+    n42_timer = nh.createTimer(ros::Duration(n42_period), n42Callback, false,
+                               false);
+  }
 
   if (imeadiate)
   {
@@ -112,12 +342,28 @@ int main(int argc, char **argv) {
       my_ursa->startGM();
     else
       my_ursa->startAcquire();
-    timer.start();
+    startTimers();
   }
 
   ros::spin();
+  // The reader and the topic schedulers talk to the Ursa from their own threads, so they stop first.
+  stopTimers();
   my_ursa->stopAcquire();
   my_ursa->setVoltage(0);
+  archive.close();
+  n42.close();
+  my_ursa->setSharedMemory("", 0, 0);
+  writeTrace();
+
+  ursa::LogStats stats = my_ursa->getLogStats();
+  ROS_INFO("Driver logging: %llu queued, %llu suppressed, %llu overflowed, "
+           "%llu aggregated, max enqueue %.1f us.",
+           (unsigned long long) stats.enqueued,
+           (unsigned long long) stats.suppressed,
+           (unsigned long long) stats.overflowed,
+           (unsigned long long) stats.aggregated,
+           stats.max_enqueue_ns / 1e3);
+  my_ursa->setLogSink(NULL);
 }
 
 bool startAcquireCB(std_srvs::Empty::Request& request,
@@ -126,13 +372,13 @@ bool startAcquireCB(std_srvs::Empty::Request& request,
     my_ursa->startGM();
   else
     my_ursa->startAcquire();
-  timer.start();
+  startTimers();
   return (true);
 }
 
 bool stopAcquireCB(std_srvs::Empty::Request& request,
                    std_srvs::Empty::Response& response) {
-  timer.stop();
+  stopTimers();
   if (GMmode)
     my_ursa->stopGM();
   else
@@ -146,29 +392,361 @@ bool clearSpectraCB(std_srvs::Empty::Request& request,
   return (true);
 }
 
-void timerCallback(const ros::TimerEvent& event) {
-  ROS_DEBUG("Hit timer callback.");
-  ros::Time now = ros::Time::now();
+/** Hands back the spectrum since the last interval and starts the next, as an interval topic does when
+ * it publishes.  Every taker shares the one sequence, so a caller that also subscribes to an interval
+ * topic sees the intervals it took as gaps there.
+ */
+bool takeIntervalCB(ursa_driver::ursa_take_interval::Request& request,
+                    ursa_driver::ursa_take_interval::Response& response) {
+  ursa::SpectrumInterval interval;
+  my_ursa->swapSpectra(&response.bins, &interval);
+  response.sequence = interval.sequence;
+  response.epoch = interval.epoch;
+  response.start.fromNSec(interval.start_ns);
+  response.end.fromNSec(interval.end_ns);
+  response.total = interval.counts;
+  return (true);
+}
+
+/** Reads a channel range, or one of the rois, from the live spectrum summed into bins of group channels.
+ * Only the range is copied out of the driver and sent.
+ */
+bool spectrumViewCB(ursa_driver::ursa_get_spectrum_view::Request& request,
+                    ursa_driver::ursa_get_spectrum_view::Response& response) {
+  size_t first = request.first;
+  size_t channels = request.channels ? request.channels : ursa::spectrum_bins;
+  if (request.roi >= 0)
+  {
+    if (request.roi >= (int) rois.size())
+    {
+      response.message = "The ROI must be one of the rois parameter.";
+      return (true);
+    }
+    first = rois[request.roi].low;
+    channels = rois[request.roi].high - rois[request.roi].low + 1;
+  }
+  if (first >= ursa::spectrum_bins)
+  {
+    response.message = "The first channel must be in the spectrum.";
+    return (true);
+  }
+  size_t group = std::max((size_t) request.group, (size_t) 1);
+  response.bins.resize(
+      ursa::Interface::spectrumViewSize(first, channels, group));
+  my_ursa->getSpectrumView(first, channels, group, &response.bins[0],
+                           &response.epoch);
+  response.first = first;
+  response.group = group;
+  response.success = true;
+  return (true);
+}
+
+/** Applies the requested settings as one stop, apply, restart transaction while acquiring.
+ * Unless keep_spectra is set the spectrum is cleared so it only holds counts taken with the new settings.
+ */
+bool reconfigureCB(ursa_driver::ursa_reconfigure::Request& request,
+                   ursa_driver::ursa_reconfigure::Response& response) {
+  ursa::AcquisitionSettings settings;
+  settings.set_gain = request.set_gain;
+  settings.gain = request.gain;
+  settings.set_threshold = request.set_threshold;
+  settings.threshold = request.threshold;
+  settings.set_shaping_time = request.set_shaping_time;
+  settings.set_input = request.set_input;
+  settings.set_bits = request.set_bits;
+  settings.bits = request.bits;
+  if (request.set_shaping_time)
+  {
+    if (shape_map.find(request.shaping_time) == shape_map.end())
+    {
+      response.message = "Shaping time must be valid. Input as double in microseconds.";
+      return (true);
+    }
+    settings.shaping = shape_map[request.shaping_time];
+  }
+  if (request.set_input)
+  {
+    if (input_map.find(request.input_and_polarity) == input_map.end())
+    {
+      response.message = "Input and polarity must be valid.";
+      return (true);
+    }
+    settings.input = input_map[request.input_and_polarity];
+  }
   if (GMmode)
   {
-    ursa_driver::ursa_counts temp;
-    temp.header.stamp = now;
-    temp.header.frame_id = detector_frame;
-    temp.counts = my_ursa->requestCounts();
-    publisher.publish(temp);
+    response.message = "Settings can not be changed in GM mode.";
+    return (true);
   }
+
+  ursa::ReconfigureResult result = my_ursa->reconfigure(settings,
+                                                        !request.keep_spectra);
+  response.success = result.success;
+  response.epoch = result.epoch;
+  response.applied = result.applied;
+  response.dead_time = result.dead_ns / 1e9;
+  if (!result.success)
+    response.message = "Invalid settings, nothing was changed.";
+  else if (result.applied == 0)
+    response.message = "Settings unchanged.";
   else
   {
-    ursa_driver::ursa_spectra temp;
-    temp.header.stamp = now;
-    temp.header.frame_id = detector_frame;
+    response.message = "Reconfigured.";
+    publishConfig(response.dead_time);
+    if (n42.isOpen() && (settings.set_gain || settings.set_bits) && openN42())
+      primeN42();
+  }
+  return (true);
+}
+
+//! Publishes the current settings on the latched config topic.
+void publishConfig(double dead_time) {
+  ursa::AcquisitionSettings settings = my_ursa->getSettings();
+  ursa_driver::ursa_config temp;
+  temp.header.stamp = ros::Time::now();
+  temp.header.frame_id = detector_frame;
+  temp.epoch = my_ursa->getEpoch();
+  if (settings.set_gain)
+    temp.gain = settings.gain;
+  if (settings.set_threshold)
+    temp.threshold = settings.threshold;
+  if (settings.set_bits)
+    temp.bits = settings.bits;
+  std::map<double, ursa::shaping_time>::iterator shape;
+  for (shape = shape_map.begin(); shape != shape_map.end(); ++shape)
+  {
+    if (settings.set_shaping_time && shape->second == settings.shaping)
+    {
+      temp.shaping_time = shape->first;
+      break;
+    }
+  }
+  std::map<std::string, ursa::inputs>::iterator input;
+  for (input = input_map.begin(); input != input_map.end(); ++input)
+  {
+    if (settings.set_input && input->second == settings.input)
+    {
+      temp.input_and_polarity = input->first;
+      break;
+    }
+  }
+  temp.dead_time = dead_time;
+  config_pub.publish(temp);
+}
+
+/** In real time mode the read timer still runs to publish what the reader thread decoded.
+ */
+void startTimers() {
+  publishers.start(wall_clock_offset);
+  if (!GMmode)
+  {
+    // Alarms are decided as data is decoded, so they get the reader thread even without real time settings.
+    if ((realtime || alarm_config.enable) && !my_ursa->startReader(reader_options))
+      ROS_WARN("The reader thread could not apply every real time setting. "
+               "SCHED_FIFO and memory locking need CAP_SYS_NICE and CAP_IPC_LOCK or a raised rlimit.");
+    read_timer.start();
+  }
+  if (archive.isOpen())
+    archive_timer.start();
+  if (n42.isOpen())
+  {
+    primeN42();
+    n42_timer.start();
+  }
+  liveness_timer.start();
+  report_timer.start();
+}
+
+void stopTimers() {
+  my_ursa->stopReader();
+  reportReader();
+  read_timer.stop();
+  report_timer.stop();
+  archive_timer.stop();
+  n42_timer.stop();
+  liveness_timer.stop();
+  publishers.stop();
+  publishers.reportSchedules();
+  archive.flush();
+  n42.flush();
+}
+
+/** Drains the serial port into the histogram.  This runs whether or not anyone is subscribed
+ * so the serial buffers never back up.
+ */
+void readCallback(const ros::TimerEvent& event) {
+  if (!my_ursa->readerRunning())
     my_ursa->read();
-    my_ursa->getSpectra(&temp.bins);
-    publisher.publish(temp);
+  if (list_mode)
+    publishEvents();
+  if (!alarm_config.enable)
+    return;
+
+  alarm_events.clear();
+  my_ursa->getAlarmEvents(&alarm_events);
+  for (size_t i = 0; i < alarm_events.size(); i++)
+  {
+    const ursa::AlarmEvent &event = alarm_events[i];
+    ursa_driver::ursa_alarm msg;
+    msg.header.stamp.fromNSec(event.time_ns);
+    msg.header.frame_id = detector_frame;
+    msg.source = event.source;
+    msg.roi = event.roi;
+    msg.active = event.active;
+    msg.rate = event.rate;
+    msg.background = event.background;
+    msg.statistic = event.statistic;
+    msg.evidence_time = event.evidence_ns / 1e9;
+    msg.latency_ms = (
+        event.output_ns ? (event.output_ns - event.arrival_ns) / 1e6 :
+                          (event.decision_ns - event.arrival_ns) / 1e6);
+    alarm_pub.publish(msg);
+    if (event.roi < 0)
+      ROS_WARN("Gross count alarm %s: %.1f cps against %.1f cps, %.2f ms.",
+               event.active ? "raised" : "cleared", event.rate,
+               event.background, msg.latency_ms);
+    else
+      ROS_WARN("ROI %d alarm %s: %.1f cps against %.1f cps, %.2f ms.",
+               event.roi, event.active ? "raised" : "cleared", event.rate,
+               event.background, msg.latency_ms);
+  }
+}
+
+/** Publishes every complete batch of list mode events.  The message's arrays keep their capacity
+ * between batches.
+ */
+void publishEvents() {
+  while (my_ursa->getEvents(&event_batch))
+  {
+    size_t size = event_batch.size;
+    events_msg.header.stamp.fromNSec(event_batch.start_ns);
+    events_msg.sequence = event_batch.sequence;
+    events_msg.dropped = event_batch.dropped;
+    events_msg.offsets.assign(event_batch.offsets.begin(),
+                              event_batch.offsets.begin() + size);
+    events_msg.channels.assign(event_batch.channels.begin(),
+                               event_batch.channels.begin() + size);
+    events_msg.counts.assign(event_batch.counts.begin(),
+                             event_batch.counts.begin() + size);
+    events_pub.publish(events_msg);
+  }
+}
+
+/** Appends the counts since the last call to the archive.  Like readCallback() this runs
+ * whether or not anyone is subscribed.
+ */
+void archiveCallback(const ros::TimerEvent& event) {
+  my_ursa->getWideSpectra(&archive_spectrum);
+  archive.appendCumulative(ros::Time::now().toNSec(), archive_spectrum);
+}
+
+/** Starts a new N42 file with the current calibration.  The file is named for its start time, so a
+ * calibration change during a run starts a second file.
+ */
+bool openN42() {
+  ursa::AcquisitionSettings settings = my_ursa->getSettings();
+  int bits = settings.set_bits ? settings.bits : 12;
+  ursa::N42Header header;
+  header.serial_number = serial_number;
+  header.detector_kind = n42_detector_kind;
+  header.channels = (size_t) 1 << bits;
+  if (settings.set_gain && settings.gain > 0)
+  {
+    header.coefficients.push_back(dose_calibration.offset_kev);
+    header.coefficients.push_back(
+        dose_calibration.channelWidth(settings.gain, bits));
   }
+
+  std::string path = n42_directory + "/spectra_"
+      + boost::lexical_cast<std::string>(ros::Time::now().toNSec()) + ".n42";
+  if (!n42.open(path, header))
+  {
+    ROS_ERROR("Unable to open N42 file %s", path.c_str());
+    return (false);
+  }
+  ROS_INFO("Exporting N42 spectra to %s", path.c_str());
+  return (true);
+}
+
+//! Starts the next N42 measurement from the current spectrum.
+void primeN42() {
+  my_ursa->getWideSpectra(&n42_spectrum);
+  n42_time_ns = ros::Time::now().toNSec();
+}
+
+/** Writes the counts since the last call as one N42 measurement.  Like archiveCallback() this runs
+ * whether or not anyone is subscribed.  If any bin went down the spectrum was cleared and is written as is.
+ */
+void n42Callback(const ros::TimerEvent& event) {
+  uint64_t now_ns = ros::Time::now().toNSec();
+  my_ursa->getWideSpectra(&n42_interval);
+  bool cleared = false;
+  for (size_t i = 0; i < ursa::spectrum_bins && !cleared; i++)
+    cleared = n42_interval[i] < n42_spectrum[i];
+  uint64_t total = 0;
+  for (size_t i = 0; i < ursa::spectrum_bins; i++)
+  {
+    uint64_t cumulative = n42_interval[i];
+    if (!cleared)
+      n42_interval[i] -= n42_spectrum[i];
+    n42_spectrum[i] = cumulative;
+    total += n42_interval[i];
+  }
+
+  uint64_t real_ns = now_ns - n42_time_ns;
+  uint64_t dead_ns = total * n42_dead_time * 1e9;
+  n42.write(n42_time_ns, real_ns, dead_ns < real_ns ? real_ns - dead_ns : 0,
+            n42_interval);
+  n42_time_ns = now_ns;
+}
+
+/** Checks the Ursa is still sending.  This only probes the Ursa when the line has been silent for
+ * silence_timeout, and never stops the acquisition.
+ */
+void livenessCallback(const ros::TimerEvent& event) {
+  boost::lock_guard<boost::mutex> lock(serial_mutex);
+  my_ursa->alive();
+}
+
+void reportCallback(const ros::TimerEvent& event) {
+  reportReader();
+  publishers.reportSchedules();
+}
+
+/** Logs how promptly the stream was read since the last report, then starts the counters again.  The
+ * longest gap between reads and the most bytes one read found waiting show how close the serial
+ * buffers came to backing up.
+ */
+void reportReader() {
+  ursa::ReaderStats stats = my_ursa->getReaderStats(true);
+  if (stats.reads < 2)
+    return;
+  ROS_INFO("Reads: %llu by the %s, gap mean %.2f ms max %.2f ms, backlog max %zu bytes, "
+           "%llu full buffers%s%s%s.",
+           (unsigned long long) stats.reads,
+           stats.threaded ? "reader thread" : "read timer",
+           stats.total_gap_ns / 1e6 / (stats.reads - 1), stats.max_gap_ns / 1e6,
+           stats.max_backlog, (unsigned long long) stats.full_reads,
+           stats.pinned ? ", pinned" : "", stats.fifo ? ", SCHED_FIFO" : "",
+           stats.locked ? ", memory locked" : "");
+}
+
+
+/** The trace is written when the first message is published, so startup can be inspected while the node
+ * runs, and again at shutdown.
+ */
+void writeTrace() {
+  if (trace_file.empty())
+    return;
+  if (ursa::Tracer::instance().write(trace_file))
+    ROS_INFO("Wrote timeline trace to %s", trace_file.c_str());
+  else
+    ROS_WARN("Unable to write timeline trace to %s", trace_file.c_str());
 }
 
 int get_params(ros::NodeHandle nh) {
+  URSA_TRACE_SCOPE("node", "get_params");
+  fill_maps();
   nh.param("load_previous_settings", load_prev, false);
 
   if (!load_prev)
@@ -204,8 +782,6 @@ int get_params(ros::NodeHandle nh) {
       return (-1);
     }
 
-    fill_maps();
-
     if (shape_map.find(shaping_time) == shape_map.end())
     {
       ROS_ERROR("Shaping time must be valid. Input as double in microseconds.");
@@ -226,10 +802,402 @@ int get_params(ros::NodeHandle nh) {
 
   nh.param<std::string>("port", port, "/dev/ttyUSB0");
   nh.param("baud", baud, 115200);
+  nh.param<std::string>("transport", transport, "serial");
+  nh.param("tty_vmin", tty_vmin, 0);
+  nh.param("tty_vtime", tty_vtime, 0);
+  nh.param("low_latency", low_latency, true);
+  if (transport != "serial" && transport != "tty")
+  {
+    ROS_ERROR("Transport must be \"serial\" or \"tty\".");
+    return (-1);
+  }
+  if (tty_vmin < 0 || tty_vmin > 255 || tty_vtime < 0 || tty_vtime > 255)
+  {
+    ROS_ERROR("tty_vmin and tty_vtime must be between 0 and 255.");
+    return (-1);
+  }
+
+  nh.param("silence_timeout", silence_timeout, 5.0);
+  if (silence_timeout <= 0)
+  {
+    ROS_ERROR("The silence timeout must be positive.");
+    return (-1);
+  }
+
+  nh.param("realtime", realtime, false);
+  nh.param("realtime_cpu", reader_options.cpu, -1);
+  nh.param("realtime_priority", reader_options.priority, 80);
+  nh.param("realtime_lock_memory", reader_options.lock_memory, true);
+  nh.param("reader_report_period", reader_report_period, 60.0);
+  nh.param("wall_clock_publish", wall_clock_publish, false);
+  nh.param("wall_clock_offset", wall_clock_offset, 0.0);
+  if (wall_clock_offset < 0)
+  {
+    ROS_ERROR("The wall clock offset must not be negative.");
+    return (-1);
+  }
+  if (!realtime)
+    reader_options = ursa::RealtimeOptions();
+  if (reader_options.priority < 0 || reader_options.priority > 99)
+  {
+    ROS_ERROR("The real time priority must be between 0 and 99.");
+    return (-1);
+  }
 
   nh.param("use_GM_mode", GMmode, false);
   nh.param("imeadiate_mode", imeadiate, false);
+  nh.param("publish_wide_spectra", publish_wide, false);
   nh.param<std::string>("detector_frame", detector_frame, "rad_link");
+  nh.param<std::string>("archive_directory", archive_directory, "");
+  nh.param("archive_period", archive_period, 1.0);
+  if (archive_period <= 0)
+  {
+    ROS_ERROR("Archive period must be positive.");
+    return (-1);
+  }
+  nh.param<std::string>("n42_directory", n42_directory, "");
+  nh.param("n42_period", n42_period, 1.0);
+  nh.param<std::string>("n42_detector_kind", n42_detector_kind, "NaI");
+  nh.param("n42_dead_time", n42_dead_time, 0.0);
+  if (n42_period <= 0 || n42_dead_time < 0)
+  {
+    ROS_ERROR("N42 period must be positive and the dead time must not be negative.");
+    return (-1);
+  }
+
+  if (!get_topics(nh))
+    return (-1);
+  const std::vector<TopicPublisher> &topics = publishers.topics();
+  if (!get_alarms(nh))
+    return (-1);
+  if (!get_rois(nh))
+    return (-1);
+  for (size_t i = 0; i < topics.size(); i++)
+  {
+    if (topics[i].target_counts && topics[i].precision_roi >= (int) rois.size())
+    {
+      ROS_ERROR("Topic %s: precision_roi %d is not one of the rois.",
+                topics[i].name.c_str(), topics[i].precision_roi);
+      return (-1);
+    }
+  }
+  if (!get_dose(nh))
+    return (-1);
+
+  nh.param("list_mode", list_mode, false);
+  nh.param("list_batch_size", list_batch_size, 1024);
+  nh.param("list_max_latency", list_max_latency, 0.05);
+  if (list_batch_size < 1 || list_batch_size > (int) ursa::event_batch_capacity
+      || list_max_latency <= 0)
+  {
+    ROS_ERROR("List batch size must be between 1 and %d and the latency positive.",
+              (int) ursa::event_batch_capacity);
+    return (-1);
+  }
+
+  nh.param<std::string>("shm_name", shm_name, "");
+  nh.param("shm_event_capacity", shm_event_capacity, 65536);
+  nh.param("shm_snapshot_period", shm_snapshot_period, 0.1);
+  if (shm_event_capacity < 1 || shm_snapshot_period < 0)
+  {
+    ROS_ERROR("The shared memory event capacity must be positive and the snapshot period not negative.");
+    return (-1);
+  }
+
+  nh.param<std::string>("nuclide_library", nuclide_library_path, "");
+  nh.param("identification_min_score", min_score, 0.5);
+  for (size_t i = 0; i < topics.size(); i++)
+  {
+    if (topics[i].type == TOPIC_IDENTIFICATIONS && nuclide_library.size() == 0)
+    {
+      int loaded = nuclide_library.load(nuclide_library_path);
+      if (loaded <= 0)
+      {
+        ROS_ERROR("Identification topics need a valid nuclide_library file.");
+        return (-1);
+      }
+      ROS_INFO("Loaded %d nuclide templates.", loaded);
+    }
+  }
+
+  double max_rate = 1.0;
+  for (size_t i = 0; i < topics.size(); i++)
+    max_rate = std::max(max_rate, topics[i].rate);
+  // Without the reader thread alarms are only decided once per read, so read often by default.
+  if (alarm_config.enable)
+    max_rate = std::max(max_rate, 20.0);
+  nh.param("read_rate", read_rate, max_rate);
+  if (read_rate <= 0)
+  {
+    ROS_ERROR("Read rate must be positive.");
+    return (-1);
+  }
+  return (1);
+}
+
+//! Reads a number from the parameter server that may have been written as an int or a double.
+bool get_number(XmlRpc::XmlRpcValue &value, double *out) {
+  if (value.getType() == XmlRpc::XmlRpcValue::TypeDouble)
+    *out = static_cast<double>(value);
+  else if (value.getType() == XmlRpc::XmlRpcValue::TypeInt)
+    *out = static_cast<int>(value);
+  else
+    return (false);
+  return (true);
+}
+
+/** Reads the "topics" parameter, a list of {name, type, rate} entries where type is one of spectra,
+ * spectra_wide, identifications, roi_rates, dose_rate or counts.  Without it the node publishes counts or spectra (and spectra_wide if
+ * publish_wide_spectra is set) at 1 Hz as it always has.
+ */
+int get_topics(ros::NodeHandle nh) {
+  publishers.clear();
+  XmlRpc::XmlRpcValue list;
+  if (!nh.getParam("topics", list))
+  {
+    TopicPublisher topic;
+    topic.rate = 1.0;
+    topic.target_counts = 0;
+    topic.view_first = 0;
+    topic.view_channels = ursa::spectrum_bins;
+    topic.view_group = 1;
+    if (GMmode)
+    {
+      topic.name = "counts";
+      topic.type = TOPIC_COUNTS;
+      publishers.add(topic);
+    }
+    else
+    {
+      topic.name = "spectra";
+      topic.type = TOPIC_SPECTRA;
+      publishers.add(topic);
+      if (publish_wide)
+      {
+        topic.name = "spectra_wide";
+        topic.type = TOPIC_WIDE_SPECTRA;
+        publishers.add(topic);
+      }
+    }
+    return (1);
+  }
+
+  if (list.getType() != XmlRpc::XmlRpcValue::TypeArray)
+  {
+    ROS_ERROR("Topics must be a list of {name, type, rate}.");
+    return (0);
+  }
+  for (int i = 0; i < list.size(); i++)
+  {
+    XmlRpc::XmlRpcValue &entry = list[i];
+    TopicPublisher topic;
+    if (entry.getType() != XmlRpc::XmlRpcValue::TypeStruct
+        || !entry.hasMember("name") || !entry.hasMember("type")
+        || !entry.hasMember("rate")
+        || entry["name"].getType() != XmlRpc::XmlRpcValue::TypeString
+        || entry["type"].getType() != XmlRpc::XmlRpcValue::TypeString
+        || !get_number(entry["rate"], &topic.rate) || topic.rate <= 0)
+    {
+      ROS_ERROR("Topic %d must have a name, a type and a positive rate.", i);
+      return (0);
+    }
+    topic.name = static_cast<std::string>(entry["name"]);
+    std::string type = static_cast<std::string>(entry["type"]);
+    if (topic_map.find(type) == topic_map.end())
+    {
+      ROS_ERROR(
+          "Topic type must be one of \"spectra\", \"spectra_wide\", \"interval\", \"spectrum_view\", \"identifications\", \"roi_rates\", \"dose_rate\" or \"counts\".");
+      return (0);
+    }
+    topic.type = topic_map[type];
+    if ((topic.type == TOPIC_COUNTS) != GMmode)
+    {
+      ROS_ERROR("Topic %s: counts topics need GM mode and spectra topics can not use it.",
+                topic.name.c_str());
+      return (0);
+    }
+    if (topic.type == TOPIC_DOSE_RATE && !nh.hasParam("dose_function"))
+    {
+      ROS_ERROR("Topic %s: dose_rate topics need a dose_function.",
+                topic.name.c_str());
+      return (0);
+    }
+
+    double precision = 0, roi = -1;
+    topic.min_interval = 0;
+    topic.max_interval = 60;
+    if ((entry.hasMember("precision")
+        && !get_number(entry["precision"], &precision))
+        || (entry.hasMember("precision_roi")
+            && !get_number(entry["precision_roi"], &roi))
+        || (entry.hasMember("min_interval")
+            && !get_number(entry["min_interval"], &topic.min_interval))
+        || (entry.hasMember("max_interval")
+            && !get_number(entry["max_interval"], &topic.max_interval))
+        || precision < 0 || precision >= 1 || roi < -1
+        || topic.min_interval < 0 || topic.max_interval < topic.min_interval)
+    {
+      ROS_ERROR("Topic %s: precision must be between 0 and 1, precision_roi a region index and "
+                "max_interval at least min_interval.",
+                topic.name.c_str());
+      return (0);
+    }
+    topic.precision_roi = (int) roi;
+
+    double first = 0, channels = ursa::spectrum_bins, group = 1;
+    if ((entry.hasMember("first") && !get_number(entry["first"], &first))
+        || (entry.hasMember("channels")
+            && !get_number(entry["channels"], &channels))
+        || (entry.hasMember("group") && !get_number(entry["group"], &group))
+        || first < 0 || first >= ursa::spectrum_bins || channels < 1
+        || group < 1)
+    {
+      ROS_ERROR("Topic %s: first must be a channel, and channels and group positive.",
+                topic.name.c_str());
+      return (0);
+    }
+    topic.view_first = (size_t) first;
+    topic.view_channels = (size_t) channels;
+    topic.view_group = (size_t) group;
+    topic.target_counts = (
+        precision > 0 ? (uint64_t) std::ceil(1 / (precision * precision)) : 0);
+    if (topic.target_counts
+        && (topic.type == TOPIC_COUNTS || topic.type == TOPIC_ROI_RATES
+            || topic.type == TOPIC_DOSE_RATE))
+    {
+      ROS_ERROR("Topic %s: only spectrum topics publish adaptively.",
+                topic.name.c_str());
+      return (0);
+    }
+    publishers.add(topic);
+  }
+  return (1);
+}
+
+/** Reads the alarm_* parameters into alarm_config.  alarm_rois is a list of [low, high] channel pairs.
+ */
+int get_alarms(ros::NodeHandle nh) {
+  nh.param("alarm_enable", alarm_config.enable, false);
+  nh.param("alarm_drive_outputs", alarm_config.drive_outputs, true);
+  nh.param("alarm_learn_time", alarm_config.learn_seconds, 30.0);
+  nh.param("alarm_background_time", alarm_config.background_seconds, 60.0);
+  nh.param("alarm_min_background", alarm_config.min_background, 1.0);
+  nh.param("alarm_roi_min_background", alarm_config.roi_min_background, 0.1);
+  nh.param("alarm_rate_ratio", alarm_config.rate_ratio, 2.0);
+  nh.param("alarm_false_alarm", alarm_config.false_alarm, 1e-6);
+  nh.param("alarm_missed_alarm", alarm_config.missed_alarm, 0.01);
+  nh.param("alarm_roi_window", alarm_config.roi_window, 1.0);
+  nh.param("alarm_roi_sigma", alarm_config.roi_sigma, 4.0);
+  if (alarm_config.learn_seconds <= 0 || alarm_config.background_seconds <= 0
+      || alarm_config.roi_window <= 0 || alarm_config.rate_ratio <= 1
+      || alarm_config.roi_min_background <= 0)
+  {
+    ROS_ERROR("Alarm times and the ROI minimum background must be positive and the rate ratio above 1.");
+    return (0);
+  }
+
+  alarm_config.rois.clear();
+  XmlRpc::XmlRpcValue list;
+  if (!nh.getParam("alarm_rois", list))
+    return (1);
+  if (list.getType() != XmlRpc::XmlRpcValue::TypeArray
+      || list.size() > (int) ursa::max_alarm_rois)
+  {
+    ROS_ERROR("Alarm ROIs must be a list of at most %d [low, high] pairs.",
+              (int) ursa::max_alarm_rois);
+    return (0);
+  }
+  for (int i = 0; i < list.size(); i++)
+  {
+    double low, high;
+    if (list[i].getType() != XmlRpc::XmlRpcValue::TypeArray
+        || list[i].size() != 2 || !get_number(list[i][0], &low)
+        || !get_number(list[i][1], &high) || low < 0 || high < low
+        || high >= ursa::spectrum_bins)
+    {
+      ROS_ERROR("Alarm ROI %d must be a [low, high] channel pair.", i);
+      return (0);
+    }
+    ursa::AlarmRoi roi;
+    roi.low = (uint16_t) low;
+    roi.high = (uint16_t) high;
+    alarm_config.rois.push_back(roi);
+  }
+  return (1);
+}
+
+/** Reads the "rois" parameter, a list of [low, high] channel pairs counted as events are decoded and
+ * published by roi_rates topics.
+ */
+int get_rois(ros::NodeHandle nh) {
+  rois.clear();
+  XmlRpc::XmlRpcValue list;
+  if (!nh.getParam("rois", list))
+    return (1);
+  if (list.getType() != XmlRpc::XmlRpcValue::TypeArray
+      || list.size() > (int) ursa::max_rois)
+  {
+    ROS_ERROR("ROIs must be a list of at most %d [low, high] pairs.",
+              (int) ursa::max_rois);
+    return (0);
+  }
+  for (int i = 0; i < list.size(); i++)
+  {
+    double low, high;
+    if (list[i].getType() != XmlRpc::XmlRpcValue::TypeArray
+        || list[i].size() != 2 || !get_number(list[i][0], &low)
+        || !get_number(list[i][1], &high) || low < 0 || high < low
+        || high >= ursa::spectrum_bins)
+    {
+      ROS_ERROR("ROI %d must be a [low, high] channel pair.", i);
+      return (0);
+    }
+    ursa::ChannelRange roi;
+    roi.low = (uint16_t) low;
+    roi.high = (uint16_t) high;
+    rois.push_back(roi);
+  }
+  return (1);
+}
+
+/** Reads the dose_* parameters into dose_calibration.  dose_function is a list of [keV, nSv per count]
+ * knots of G(E), and the channel energies are dose_kev_offset plus dose_kev_per_channel per channel at
+ * dose_reference_gain and dose_reference_bits.
+ */
+int get_dose(ros::NodeHandle nh) {
+  dose_calibration = ursa::DoseCalibration();
+  nh.param("dose_kev_offset", dose_calibration.offset_kev, 0.0);
+  nh.param("dose_kev_per_channel", dose_calibration.kev_per_channel, 3.0);
+  nh.param("dose_reference_gain", dose_calibration.reference_gain, 70.0);
+  nh.param("dose_reference_bits", dose_calibration.reference_bits, 12);
+
+  XmlRpc::XmlRpcValue list;
+  if (!nh.getParam("dose_function", list))
+    return (1);
+  if (list.getType() != XmlRpc::XmlRpcValue::TypeArray || list.size() == 0)
+  {
+    ROS_ERROR("The dose function must be a list of [keV, nSv per count] pairs.");
+    return (0);
+  }
+  for (int i = 0; i < list.size(); i++)
+  {
+    double energy, weight;
+    if (list[i].getType() != XmlRpc::XmlRpcValue::TypeArray
+        || list[i].size() != 2 || !get_number(list[i][0], &energy)
+        || !get_number(list[i][1], &weight))
+    {
+      ROS_ERROR("Dose function knot %d must be a [keV, nSv per count] pair.", i);
+      return (0);
+    }
+    dose_calibration.energies.push_back(energy);
+    dose_calibration.weights.push_back(weight);
+  }
+  if (!ursa::DoseCounter().configure(dose_calibration))
+  {
+    ROS_ERROR("The dose function energies must ascend, the weights must not be negative and the "
+              "calibration must be positive.");
+    return (0);
+  }
   return (1);
 }
 
@@ -248,5 +1216,14 @@ void fill_maps() {
   input_map["input2_negative"] = ursa::INPUT2NEG;
   input_map["input2_positive"] = ursa::INPUT1POS;
   input_map["shaped_input"] = ursa::INPUTXPOS;
+
+  topic_map["spectra"] = TOPIC_SPECTRA;
+  topic_map["spectra_wide"] = TOPIC_WIDE_SPECTRA;
+  topic_map["counts"] = TOPIC_COUNTS;
+  topic_map["identifications"] = TOPIC_IDENTIFICATIONS;
+  topic_map["roi_rates"] = TOPIC_ROI_RATES;
+  topic_map["dose_rate"] = TOPIC_DOSE_RATE;
+  topic_map["interval"] = TOPIC_INTERVAL;
+  topic_map["spectrum_view"] = TOPIC_SPECTRUM_VIEW;
 }
 
@@ -0,0 +1,172 @@
+/** A benchmark of nuclide identification throughput against library size.
+ \file      ursa_nuclide_bench.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "ursa_driver/nuclide_id.h"
+#include "ursa_driver/ursa_clock.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/** Usage: ursa_nuclide_bench [max_templates]
+ *
+ * Builds synthetic libraries of 8 up to max_templates templates, each one to three Gaussian peaks on a
+ * falling continuum, and a spectrum of the first template on a flat background.  For each library size
+ * it times a full pass over the spectrum and an incremental update that adds 400 events, about what a
+ * detector adds in 100 ms, and prints matches per second for both.
+ */
+
+namespace
+{
+  //! A small linear congruential generator so the benchmark is repeatable.
+  class Random
+  {
+  private:
+    uint64_t state_;
+
+  public:
+    explicit Random(uint64_t seed) :
+        state_(seed) {
+    }
+    double uniform() {
+      state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+      return ((state_ >> 11) * (1.0 / 9007199254740992.0));
+    }
+  };
+
+  std::vector<double> makeTemplate(Random &random) {
+    std::vector<double> response(1024, 0);
+    int peaks = 1 + (int) (random.uniform() * 3);
+    for (int p = 0; p < peaks; p++)
+    {
+      double centre = 50 + random.uniform() * 900;
+      double width = 3 + centre * 0.02;
+      double height = 0.2 + random.uniform();
+      for (size_t c = 0; c < response.size(); c++)
+      {
+        double z = (c - centre) / width;
+        response[c] += height * std::exp(-0.5 * z * z);
+      }
+    }
+    for (size_t c = 0; c < response.size(); c++)
+      response[c] += 0.002 * std::exp(-(double) c / 300);
+    return (response);
+  }
+
+  //! Adds events drawn from a template plus a flat background to a spectrum.
+  void addEvents(Random &random, const std::vector<double> &cdf, size_t events,
+                 ursa::WideSpectrum *spectrum) {
+    for (size_t e = 0; e < events; e++)
+    {
+      size_t channel;
+      if (random.uniform() < 0.3)
+        channel = (size_t) (random.uniform() * 1024);
+      else
+      {
+        double u = random.uniform() * cdf.back();
+        channel = 0;
+        while (channel + 1 < cdf.size() && cdf[channel] < u)
+          channel++;
+      }
+      (*spectrum)[channel]++;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t max_templates = (argc > 1 ? atoi(argv[1]) : 256);
+  if (max_templates < 8)
+  {
+    std::cerr << "Usage: " << argv[0] << " [max_templates]" << std::endl;
+    return (-1);
+  }
+
+  printf("Kernels: %s\n", ursa::simdLevel());
+  printf("%9s %14s %14s %14s %14s %6s\n", "templates", "full us",
+         "full match/s", "update us", "update match/s", "top");
+
+  for (size_t size = 8; size <= max_templates; size *= 2)
+  {
+    Random random(size);
+    ursa::NuclideLibrary library;
+    std::vector<double> first;
+    while (library.size() < size)
+    {
+      std::vector<double> response = makeTemplate(random);
+      if (library.size() == 0)
+        first = response;
+      char name[32];
+      snprintf(name, sizeof(name), "template%zu", library.size());
+      library.add(name, response);
+    }
+
+    std::vector<double> cdf(first.size());
+    double total = 0;
+    for (size_t c = 0; c < first.size(); c++)
+    {
+      total += first[c];
+      cdf[c] = total;
+    }
+    ursa::WideSpectrum spectrum;
+    spectrum.fill(0);
+    addEvents(random, cdf, 20000, &spectrum);
+
+    ursa::NuclideIdentifier identifier(library);
+    std::vector<ursa::Identification> results;
+    size_t passes = 200;
+    uint64_t start = ursa::monotonicNanos();
+    for (size_t i = 0; i < passes; i++)
+    {
+      identifier.reset();
+      identifier.update(spectrum);
+      identifier.rank(0.5, &results);
+    }
+    double full = (ursa::monotonicNanos() - start) / 1e3 / passes;
+
+    std::vector<ursa::WideSpectrum> steps(256);
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+      addEvents(random, cdf, 400, &spectrum);
+      steps[i] = spectrum;
+    }
+    identifier.reset();
+    identifier.update(steps[0]);
+    start = ursa::monotonicNanos();
+    for (size_t i = 1; i < steps.size(); i++)
+    {
+      identifier.update(steps[i]);
+      identifier.rank(0.5, &results);
+    }
+    double update = (ursa::monotonicNanos() - start) / 1e3 / (steps.size() - 1);
+
+    printf("%9zu %14.1f %14.0f %14.1f %14.0f %6s\n", size, full,
+           size / full * 1e6, update, size / update * 1e6,
+           (!results.empty() && results[0].index == 0) ? "ok" : "wrong");
+  }
+  return (0);
+}
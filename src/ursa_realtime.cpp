@@ -0,0 +1,97 @@
+/** Implementation of the real time settings of the reader thread.
+ \file      ursa_realtime.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/ursa_realtime.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ursa
+{
+  const size_t prefault_stack_bytes = 256 * 1024; //!< The stack the reader touches so it never faults in a page.
+
+  RealtimeOptions::RealtimeOptions() :
+      cpu(-1), priority(0), lock_memory(false) {
+  }
+
+  ReaderStats::ReaderStats() :
+      reads(0), max_gap_ns(0), total_gap_ns(0), max_backlog(0), full_reads(0), threaded(
+          false), pinned(false), fifo(false), locked(false) {
+  }
+
+  /** One byte per page is written through the volatile array, which the compiler cannot drop.  The pages
+   * stay resident, and locked once mlockall() has run.
+   */
+  void prefaultStack() {
+    volatile uint8_t stack[prefault_stack_bytes];
+    size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < prefault_stack_bytes; i += page)
+      stack[i] = 0;
+    (void) stack;
+  }
+
+  /** MCL_FUTURE keeps memory mapped later, such as thread stacks and ROS message buffers, resident too.
+   */
+  int applyRealtime(pthread_t thread, const RealtimeOptions &options,
+                    ReaderStats *stats) {
+    int error = 0;
+    if (options.lock_memory)
+    {
+      if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        stats->locked = true;
+      else
+        error = errno;
+    }
+
+    if (options.cpu >= 0)
+    {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(options.cpu, &cpus);
+      int result = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+      if (result == 0)
+        stats->pinned = true;
+      else if (!error)
+        error = result;
+    }
+
+    if (options.priority > 0)
+    {
+      sched_param param;
+      param.sched_priority = options.priority;
+      int result = pthread_setschedparam(thread, SCHED_FIFO, &param);
+      if (result == 0)
+        stats->fifo = true;
+      else if (!error)
+        error = result;
+    }
+    return (error);
+  }
+}
@@ -0,0 +1,293 @@
+/** Command line tool which decodes raw captures in parallel into spectra and region of interest counts.
+ \file      ursa_reprocess.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "ursa_driver/frame_decoder.h"
+#include "ursa_driver/spectrum_ops.h"
+#include "ursa_driver/work_pool.h"
+#include "ursa_driver/ursa_clock.h"
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//! A capture mapped into memory, with the results merged from its chunks.
+struct Capture
+{
+  std::string path;
+  const uint8_t *data;
+  size_t size;
+  boost::mutex mutex; //!< Protects the results below.
+  ursa::WideSpectrum counts; //!< The spectrum of the whole capture.
+  uint64_t events; //!< The event frames decoded.
+  uint64_t battery_frames; //!< The battery frames decoded.
+  uint64_t dropped_bytes; //!< The bytes dropped searching for a sync byte.
+  uint32_t chunks; //!< The chunks the capture was decoded in.
+};
+
+//! Counts what decodeFrames() finds in one chunk into the worker's own spectrum.
+struct ChunkHandler
+{
+  ursa::WideSpectrum &counts;
+  uint64_t events;
+  uint64_t battery_frames;
+  uint64_t dropped_bytes;
+
+  void event(size_t end, uint16_t channel, uint8_t count) {
+    counts[channel] += count;
+    events++;
+  }
+  void battery(uint16_t reading) {
+    battery_frames++;
+  }
+  void dropped(uint32_t bytes) {
+    dropped_bytes += bytes;
+  }
+};
+
+ursa::WorkStealingPool *pool;
+std::vector<ursa::WideSpectrum> scratch; //!< Each worker's chunk spectrum, so decoding shares nothing.
+size_t chunk_bytes = 4 << 20;
+
+/** Decodes [begin, end) of a capture.  While the range is longer than chunk_bytes the back half, from the
+ * first frame boundary past the middle, is pushed for any worker to steal and the front half is kept.
+ * Splitting at frame boundaries gives exactly the result of decoding the capture whole, so the bytes the
+ * whole decode would drop before a boundary are counted as dropped here.
+ */
+void decodeChunk(Capture *capture, size_t begin, size_t end, size_t worker) {
+  while (end - begin > chunk_bytes)
+  {
+    size_t middle = ursa::findFrameBoundary(capture->data, end,
+                                            begin + (end - begin) / 2);
+    if (middle >= end)
+      break;
+    pool->push(worker, boost::bind(decodeChunk, capture, middle, end, _1));
+    end = middle;
+  }
+
+  ursa::WideSpectrum &counts = scratch[worker];
+  ChunkHandler handler = { counts, 0, 0, 0 };
+  size_t used = ursa::decodeFrames(capture->data + begin, end - begin,
+                                   handler);
+  if (end < capture->size)
+    handler.dropped_bytes += end - begin - used;
+
+  boost::lock_guard<boost::mutex> lock(capture->mutex);
+  for (size_t i = 0; i < ursa::spectrum_bins; i++)
+    capture->counts[i] += counts[i];
+  counts.fill(0);
+  capture->events += handler.events;
+  capture->battery_frames += handler.battery_frames;
+  capture->dropped_bytes += handler.dropped_bytes;
+  capture->chunks++;
+}
+
+//! Maps a capture read only. Returns false if it can not be opened.
+bool mapCapture(Capture *capture) {
+  capture->data = NULL;
+  capture->size = 0;
+  int fd = open(capture->path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return (false);
+  struct stat status;
+  if (fstat(fd, &status) != 0)
+  {
+    close(fd);
+    return (false);
+  }
+  capture->size = status.st_size;
+  if (capture->size > 0)
+  {
+    void *data = mmap(NULL, capture->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      close(fd);
+      return (false);
+    }
+    madvise(data, capture->size, MADV_SEQUENTIAL);
+    capture->data = static_cast<const uint8_t *>(data);
+  }
+  close(fd);
+  return (true);
+}
+
+//! Writes a spectrum as one count per line in the same format as ursa_archive_query.
+void writeSpectrum(std::ostream &out, const ursa::WideSpectrum &counts) {
+  for (size_t i = 0; i < counts.size(); i++)
+    out << counts[i] << "," << std::endl;
+}
+
+//! Returns the counts in an inclusive channel range.
+uint64_t sumRange(const ursa::WideSpectrum &counts,
+                  const ursa::ChannelRange &range) {
+  uint64_t sum = 0;
+  for (size_t i = range.low; i <= range.high && i < counts.size(); i++)
+    sum += counts[i];
+  return (sum);
+}
+
+/** Usage: ursa_reprocess [-j threads] [-c chunk_kb] [-r low:high]... [-o directory] <capture>...
+ *
+ * Captures are the raw acquisition stream, as replayed by the file:// transport.  They are decoded with
+ * decodeFrames(), the decoder the Interface runs on the live stream, on a work stealing pool with one
+ * worker per core by default.  Captures longer than the chunk size are split at frame boundaries as they
+ * are decoded, so a single long capture spreads over every worker too.
+ *
+ * The merged spectrum of all captures is written to std::cout as one count per line in the same format as
+ * ursa_archive_query.  Each capture's totals and region of interest counts are written to std::cerr, and
+ * with -o each capture's spectrum is written to the directory as <capture name>.csv.
+ */
+int main(int argc, char **argv) {
+  size_t threads = 0;
+  std::string directory;
+  std::vector<ursa::ChannelRange> rois;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; arg++)
+  {
+    if (arg + 1 >= argc)
+      break;
+    std::string option = argv[arg];
+    if (option == "-j")
+      threads = atoi(argv[++arg]);
+    else if (option == "-c")
+      chunk_bytes = std::max(atoi(argv[++arg]), 1) * size_t(1024);
+    else if (option == "-o")
+      directory = argv[++arg];
+    else if (option == "-r")
+    {
+      ursa::ChannelRange range;
+      unsigned low, high;
+      if (sscanf(argv[++arg], "%u:%u", &low, &high) != 2 || high < low)
+        break;
+      range.low = low;
+      range.high = high;
+      rois.push_back(range);
+    }
+    else
+      break;
+  }
+  if (arg >= argc || argv[arg][0] == '-')
+  {
+    std::cerr << "Usage: " << argv[0]
+        << " [-j threads] [-c chunk_kb] [-r low:high]... [-o directory] <capture>..."
+        << std::endl;
+    return (-1);
+  }
+
+  std::vector<boost::shared_ptr<Capture> > captures;
+  uint64_t bytes = 0;
+  for (; arg < argc; arg++)
+  {
+    boost::shared_ptr<Capture> capture(new Capture());
+    capture->path = argv[arg];
+    if (!mapCapture(capture.get()))
+    {
+      std::cerr << "ERROR: Unable to open " << capture->path << std::endl;
+      return (-1);
+    }
+    capture->counts.fill(0);
+    capture->events = 0;
+    capture->battery_frames = 0;
+    capture->dropped_bytes = 0;
+    capture->chunks = 0;
+    bytes += capture->size;
+    captures.push_back(capture);
+  }
+
+  ursa::WorkStealingPool workers(threads);
+  pool = &workers;
+  ursa::WideSpectrum empty;
+  empty.fill(0);
+  scratch.assign(workers.size(), empty);
+  for (size_t i = 0; i < captures.size(); i++)
+  {
+    if (captures[i]->size > 0)
+      workers.push(i, boost::bind(decodeChunk, captures[i].get(), 0,
+                                  captures[i]->size, _1));
+  }
+  uint64_t start = ursa::monotonicNanos();
+  workers.run();
+  double seconds = (ursa::monotonicNanos() - start) / 1e9;
+
+  ursa::WideSpectrum total = empty;
+  uint32_t chunks = 0;
+  for (size_t i = 0; i < captures.size(); i++)
+  {
+    Capture &capture = *captures[i];
+    uint64_t counts = 0;
+    for (size_t bin = 0; bin < ursa::spectrum_bins; bin++)
+    {
+      total[bin] += capture.counts[bin];
+      counts += capture.counts[bin];
+    }
+    chunks += capture.chunks;
+    std::cerr << "INFO: " << capture.path << ": " << capture.events
+        << " events, " << counts << " counts, " << capture.battery_frames
+        << " battery readings, " << capture.dropped_bytes
+        << " bytes dropped." << std::endl;
+    for (size_t r = 0; r < rois.size(); r++)
+      std::cerr << "INFO:   ROI " << rois[r].low << ":" << rois[r].high << " "
+          << sumRange(capture.counts, rois[r]) << " counts." << std::endl;
+
+    if (!directory.empty())
+    {
+      std::string name = capture.path.substr(capture.path.rfind('/') + 1);
+      std::ofstream file((directory + "/" + name + ".csv").c_str());
+      writeSpectrum(file, capture.counts);
+      if (!file)
+      {
+        std::cerr << "ERROR: Unable to write " << directory << "/" << name
+            << ".csv" << std::endl;
+        return (-1);
+      }
+    }
+    if (capture.size > 0)
+      munmap(const_cast<uint8_t *>(capture.data), capture.size);
+  }
+
+  for (size_t r = 0; r < rois.size(); r++)
+    std::cerr << "INFO: All captures ROI " << rois[r].low << ":"
+        << rois[r].high << " " << sumRange(total, rois[r]) << " counts."
+        << std::endl;
+  std::cerr << "INFO: Decoded " << bytes / 1e6 << " MB in " << seconds
+      << " s (" << bytes / 1e6 / seconds << " MB/s) as " << chunks
+      << " chunks on " << workers.size() << " threads, "
+      << workers.steals() << " stolen." << std::endl;
+  writeSpectrum(std::cout, total);
+  return (0);
+}
@@ -0,0 +1,90 @@
+/** Command line tool which follows the shared memory ring written by the driver.
+ \file      ursa_shm_monitor.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "ursa_driver/shm_ring.h"
+#include <iostream>
+#include <unistd.h>
+
+/** Usage: ursa_shm_monitor [name]
+ *
+ * Once a second prints the latest snapshot's number, epoch and total counts, and the events received,
+ * lost and summed over the second.  Both are read in place without copying.  The name defaults to "/ursa".
+ */
+int main(int argc, char **argv) {
+  std::string name = (argc > 1 ? argv[1] : "/ursa");
+  ursa::ShmReader reader;
+  if (!reader.open(name))
+  {
+    std::cerr << "ERROR: " << name << " is not an Ursa shared memory ring." << std::endl;
+    return (-1);
+  }
+
+  while (reader.writerActive())
+  {
+    uint64_t events = 0;
+    uint64_t counts = 0;
+    uint64_t dropped = 0;
+    for (int i = 0; i < 100; i++)
+    {
+      const ursa::ShmEvent *first;
+      size_t available;
+      while ((available = reader.peekEvents(&first, &dropped)) > 0)
+      {
+        uint64_t sum = 0;
+        for (size_t e = 0; e < available; e++)
+          sum += first[e].counts;
+        if (reader.consumeEvents(available))
+        {
+          events += available;
+          counts += sum;
+        }
+        else
+          dropped += available;
+      }
+      usleep(10000);
+    }
+
+    uint64_t sequence;
+    const ursa::ShmSpectrumSlot *slot = reader.latestSpectrum(&sequence);
+    uint64_t total = 0;
+    uint32_t epoch = 0;
+    if (slot)
+    {
+      epoch = slot->epoch;
+      for (size_t i = 0; i < ursa::shm_spectrum_bins; i++)
+        total += slot->bins[i];
+    }
+    if (slot && reader.spectrumValid(slot, sequence))
+      std::cout << "spectrum " << sequence / 2 << " epoch " << epoch
+          << " total " << total;
+    else
+      std::cout << "spectrum none";
+    std::cout << ", events " << events << " counts " << counts << " lost "
+        << dropped << std::endl;
+  }
+  std::cerr << "INFO: The driver closed " << name << std::endl;
+  return (0);
+}
@@ -0,0 +1,241 @@
+/** A benchmark of the spectrum arithmetic kernels against plain loops.
+ \file      ursa_spectrum_bench.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "ursa_driver/spectrum_ops.h"
+#include "ursa_driver/ursa_clock.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/** Usage: ursa_spectrum_bench [detectors] [ranges]
+ *
+ * Fills detectors synthetic spectra and a background, then times background subtraction, the sum of
+ * every detector and the integration of ranges channel ranges, each with the library kernels and with
+ * the plain loops they replace.  Prints nanoseconds per call for both and whether the results agree.
+ */
+
+namespace
+{
+  //! A small linear congruential generator so the benchmark is repeatable.
+  class Random
+  {
+  private:
+    uint64_t state_;
+
+  public:
+    explicit Random(uint64_t seed) :
+        state_(seed) {
+    }
+    double uniform() {
+      state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+      return ((state_ >> 11) * (1.0 / 9007199254740992.0));
+    }
+  };
+
+  //! A falling continuum with a few peaks, scaled to about counts in total.
+  void makeSpectrum(Random &random, double counts, ursa::Spectrum *spectrum) {
+    for (size_t c = 0; c < ursa::spectrum_bins; c++)
+    {
+      double mean = std::exp(-(double) c / 600) * counts / 600;
+      (*spectrum)[c] = (uint32_t) (mean * (0.5 + random.uniform()));
+    }
+    for (int p = 0; p < 4; p++)
+    {
+      double centre = 100 + random.uniform() * 3000;
+      double width = 3 + centre * 0.01;
+      for (int c = (int) (centre - 4 * width); c < centre + 4 * width; c++)
+      {
+        double z = (c - centre) / width;
+        (*spectrum)[c] += (uint32_t) (counts * 0.01 * std::exp(-0.5 * z * z));
+      }
+    }
+  }
+
+  //! Calls f repeatedly and returns the mean nanoseconds per call.
+  template<typename F>
+  double timeIt(F f, size_t passes) {
+    uint64_t start = ursa::monotonicNanos();
+    for (size_t i = 0; i < passes; i++)
+      f();
+    return ((ursa::monotonicNanos() - start) / (double) passes);
+  }
+
+  struct Inputs
+  {
+    std::vector<ursa::Spectrum> detectors;
+    ursa::Spectrum background;
+    std::vector<ursa::ChannelRange> ranges;
+    std::vector<const uint32_t *> sources;
+    double scale;
+  };
+
+  struct PlainSubtract
+  {
+    const Inputs *in;
+    std::vector<double> *net, *variance;
+    void operator()() {
+      const uint32_t *gross = in->detectors[0].data();
+      for (size_t i = 0; i < ursa::spectrum_bins; i++)
+      {
+        (*net)[i] = gross[i] - in->scale * in->background[i];
+        (*variance)[i] = gross[i] + in->scale * in->scale * in->background[i];
+      }
+    }
+  };
+
+  struct KernelSubtract
+  {
+    const Inputs *in;
+    std::vector<double> *net, *variance;
+    void operator()() {
+      ursa::subtractBackground(&(*net)[0], &(*variance)[0],
+                               in->detectors[0].data(), in->background.data(),
+                               in->scale, ursa::spectrum_bins);
+    }
+  };
+
+  struct PlainSum
+  {
+    const Inputs *in;
+    std::vector<uint64_t> *sum;
+    void operator()() {
+      std::fill(sum->begin(), sum->end(), 0);
+      for (size_t k = 0; k < in->detectors.size(); k++)
+        for (size_t i = 0; i < ursa::spectrum_bins; i++)
+          (*sum)[i] += in->detectors[k][i];
+    }
+  };
+
+  struct KernelSum
+  {
+    const Inputs *in;
+    std::vector<uint64_t> *sum;
+    void operator()() {
+      ursa::sumSpectra(&(*sum)[0], &in->sources[0], in->sources.size(),
+                       ursa::spectrum_bins);
+    }
+  };
+
+  struct PlainRanges
+  {
+    const Inputs *in;
+    std::vector<uint64_t> *sums;
+    void operator()() {
+      const uint32_t *spectrum = in->detectors[0].data();
+      for (size_t r = 0; r < in->ranges.size(); r++)
+      {
+        uint64_t sum = 0;
+        for (size_t i = in->ranges[r].low; i <= in->ranges[r].high; i++)
+          sum += spectrum[i];
+        (*sums)[r] = sum;
+      }
+    }
+  };
+
+  struct KernelRanges
+  {
+    const Inputs *in;
+    std::vector<uint64_t> *sums;
+    void operator()() {
+      ursa::roiSums(in->detectors[0].data(), ursa::spectrum_bins,
+                    &in->ranges[0], in->ranges.size(), &(*sums)[0]);
+    }
+  };
+
+  template<typename T>
+  bool near(const std::vector<T> &a, const std::vector<T> &b) {
+    for (size_t i = 0; i < a.size(); i++)
+      if (std::fabs((double) a[i] - (double) b[i]) > 1e-6 * (1 + std::fabs((double) a[i])))
+        return (false);
+    return (true);
+  }
+
+  void report(const char *name, double plain, double kernel, bool agree) {
+    printf("%-22s %12.0f %12.0f %8.2fx %6s\n", name, plain, kernel,
+           plain / kernel, agree ? "ok" : "wrong");
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t detectors = (argc > 1 ? atoi(argv[1]) : 4);
+  size_t ranges = (argc > 2 ? atoi(argv[2]) : 32);
+  if (detectors < 1 || ranges < 1)
+  {
+    std::cerr << "Usage: " << argv[0] << " [detectors] [ranges]" << std::endl;
+    return (-1);
+  }
+
+  Random random(1);
+  Inputs in;
+  in.detectors.resize(detectors);
+  for (size_t k = 0; k < detectors; k++)
+  {
+    makeSpectrum(random, 1e6, &in.detectors[k]);
+    in.sources.push_back(in.detectors[k].data());
+  }
+  makeSpectrum(random, 1e7, &in.background);
+  in.scale = ursa::liveTimeScale(60, 600);
+  for (size_t r = 0; r < ranges; r++)
+  {
+    ursa::ChannelRange range;
+    range.low = (uint16_t) (random.uniform() * 3800);
+    range.high = (uint16_t) (range.low + 8 + random.uniform() * 250);
+    in.ranges.push_back(range);
+  }
+
+  size_t passes = 20000;
+  printf("Kernels: %s, %zu detectors, %zu ranges\n", ursa::simdLevel(),
+         detectors, ranges);
+  printf("%-22s %12s %12s %9s %6s\n", "operation", "plain ns", "kernel ns",
+         "speedup", "check");
+
+  std::vector<double> net_a(ursa::spectrum_bins), var_a(ursa::spectrum_bins);
+  std::vector<double> net_b(ursa::spectrum_bins), var_b(ursa::spectrum_bins);
+  PlainSubtract plain_subtract = { &in, &net_a, &var_a };
+  KernelSubtract kernel_subtract = { &in, &net_b, &var_b };
+  double plain = timeIt(plain_subtract, passes);
+  double kernel = timeIt(kernel_subtract, passes);
+  report("background subtract", plain, kernel,
+         near(net_a, net_b) && near(var_a, var_b));
+
+  std::vector<uint64_t> sum_a(ursa::spectrum_bins), sum_b(ursa::spectrum_bins);
+  PlainSum plain_sum = { &in, &sum_a };
+  KernelSum kernel_sum = { &in, &sum_b };
+  plain = timeIt(plain_sum, passes);
+  kernel = timeIt(kernel_sum, passes);
+  report("detector sum", plain, kernel, sum_a == sum_b);
+
+  std::vector<uint64_t> roi_a(ranges), roi_b(ranges);
+  PlainRanges plain_ranges = { &in, &roi_a };
+  KernelRanges kernel_ranges = { &in, &roi_b };
+  plain = timeIt(plain_ranges, passes);
+  kernel = timeIt(kernel_ranges, passes);
+  report("range integration", plain, kernel, roi_a == roi_b);
+  return (0);
+}
@@ -0,0 +1,170 @@
+/** Implementation of the scoped timeline tracer.
+ \file      ursa_trace.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/ursa_trace.h>
+
+#include <boost/thread/lock_guard.hpp>
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ursa
+{
+  namespace
+  {
+    uint32_t threadId() {
+      return ((uint32_t) syscall(SYS_gettid));
+    }
+
+    //! Writes a string as a JSON string literal.
+    void writeString(std::ostream &out, const char *text) {
+      out << '"';
+      for (const char *c = text; *c; c++)
+      {
+        if (*c == '"' || *c == '\\')
+          out << '\\' << *c;
+        else if ((unsigned char) *c < 0x20 || (unsigned char) *c >= 0x7f)
+        {
+          // Command bytes are not always text, so anything outside printable ASCII is escaped.
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned) (unsigned char) *c);
+          out << escaped;
+        }
+        else
+          out << *c;
+      }
+      out << '"';
+    }
+  }
+
+  Tracer::Tracer() :
+      enabled_(false), capacity_(0), dropped_(0) {
+  }
+
+  Tracer &Tracer::instance() {
+    static Tracer tracer;
+    return (tracer);
+  }
+
+  void Tracer::start(size_t capacity) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    events_.clear();
+    events_.reserve(capacity);
+    capacity_ = capacity;
+    dropped_ = 0;
+    enabled_.store(true);
+  }
+
+  void Tracer::stop() {
+    enabled_.store(false);
+  }
+
+  void Tracer::record(const TraceEvent &event) {
+    TraceEvent copy = event;
+    copy.thread = threadId();
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (events_.size() < capacity_)
+      events_.push_back(copy);
+    else
+      dropped_++;
+  }
+
+  void Tracer::instant(const char *category, const char *name) {
+    if (!enabled())
+      return;
+    TraceEvent event;
+    event.category = category;
+    event.name = name;
+    event.start_ns = monotonicNanos();
+    event.duration_ns = 0;
+    event.instant = true;
+    event.detail[0] = '\0';
+    record(event);
+  }
+
+  /**
+   * Spans are written as complete ("X") events and instants as process scoped ("i") events.
+   * The dropped count is written as metadata so a truncated trace is obvious.
+   */
+  bool Tracer::write(const std::string &path) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    std::ofstream out(path.c_str());
+    if (!out)
+      return (false);
+
+    uint64_t origin = (events_.empty() ? 0 : events_[0].start_ns);
+    for (size_t i = 1; i < events_.size(); i++)
+      origin = std::min(origin, events_[i].start_ns);
+    int pid = getpid();
+
+    out << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":" << dropped_
+        << "},\"traceEvents\":[";
+    char times[64];
+    for (size_t i = 0; i < events_.size(); i++)
+    {
+      const TraceEvent &event = events_[i];
+      out << (i ? ",\n" : "\n") << "{\"name\":";
+      writeString(out, event.name);
+      out << ",\"cat\":";
+      writeString(out, event.category);
+      if (event.instant)
+      {
+        snprintf(times, sizeof(times), "%.3f",
+                 (event.start_ns - origin) / 1e3);
+        out << ",\"ph\":\"i\",\"s\":\"p\",\"ts\":" << times;
+      }
+      else
+      {
+        snprintf(times, sizeof(times), "%.3f,\"dur\":%.3f",
+                 (event.start_ns - origin) / 1e3, event.duration_ns / 1e3);
+        out << ",\"ph\":\"X\",\"ts\":" << times;
+      }
+      out << ",\"pid\":" << pid << ",\"tid\":" << event.thread;
+      if (event.detail[0])
+      {
+        out << ",\"args\":{\"detail\":";
+        writeString(out, event.detail);
+        out << "}";
+      }
+      out << "}";
+    }
+    out << "\n]}\n";
+    return (out.good());
+  }
+
+  void TraceScope::detail(const char *format, ...) {
+    if (!active_)
+      return;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(event_.detail, sizeof(event_.detail), format, args);
+    va_end(args);
+  }
+}
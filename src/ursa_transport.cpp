@@ -0,0 +1,575 @@
+/** Implementation of the serial and tty transports.
+ \file      ursa_transport.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/ursa_transport.h>
+
+#include <ursa_driver/ursa_commands.h>
+#include <ursa_driver/ursa_clock.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+namespace ursa
+{
+  bool SerialTransport::open(const std::string &port, int baud) {
+    serial_.setPort(port);
+    serial_.setBaudrate(baud);
+    try
+    {
+      serial_.open();
+    }
+    catch (serial::IOException &err)
+    {
+    }
+    return (serial_.isOpen());
+  }
+
+  bool SerialTransport::isOpen() {
+    return (serial_.isOpen());
+  }
+
+  void SerialTransport::close() {
+    serial_.close();
+  }
+
+  void SerialTransport::setTimeout(uint32_t milliseconds) {
+    serial::Timeout timeout(serial::Timeout::simpleTimeout(milliseconds));
+    serial_.setTimeout(timeout);
+  }
+
+  size_t SerialTransport::available() {
+    return (serial_.available());
+  }
+
+  bool SerialTransport::waitReadable() {
+    return (serial_.waitReadable());
+  }
+
+  size_t SerialTransport::read(uint8_t *buffer, size_t size) {
+    return (serial_.read(buffer, size));
+  }
+
+  /** The serial library's read() waits for the full size, so only what available() reports is requested.
+   */
+  size_t SerialTransport::readSome(uint8_t *buffer, size_t size) {
+    size_t waiting = serial_.available();
+    if (waiting == 0)
+      return (0);
+    return (serial_.read(buffer, waiting < size ? waiting : size));
+  }
+
+  size_t SerialTransport::write(const uint8_t *data, size_t size) {
+    return (serial_.write(data, size));
+  }
+
+  void SerialTransport::flush() {
+    serial_.flush();
+  }
+
+  namespace
+  {
+    //! Returns the termios speed for a baud rate, or B0 if it is not a standard rate.
+    speed_t baudSpeed(int baud) {
+      switch (baud)
+      {
+        case 9600:
+          return (B9600);
+        case 19200:
+          return (B19200);
+        case 38400:
+          return (B38400);
+        case 57600:
+          return (B57600);
+        case 115200:
+          return (B115200);
+        case 230400:
+          return (B230400);
+#ifdef B460800
+        case 460800:
+          return (B460800);
+#endif
+#ifdef B921600
+        case 921600:
+          return (B921600);
+#endif
+        default:
+          return (B0);
+      }
+    }
+
+    //! Sets or clears O_NONBLOCK.
+    void setNonBlocking(int fd, bool enable) {
+      int flags = fcntl(fd, F_GETFL);
+      if (flags >= 0)
+        fcntl(fd, F_SETFL, enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+    }
+  }
+
+  FdTransport::FdTransport() :
+      fd_(-1), timeout_ms_(1000), toggle_blocking_(false), zero_is_eof_(false), socket_(
+          false) {
+  }
+
+  FdTransport::~FdTransport() {
+    FdTransport::close();
+  }
+
+  bool FdTransport::isOpen() {
+    return (fd_ >= 0);
+  }
+
+  void FdTransport::close() {
+    if (fd_ >= 0)
+      ::close(fd_);
+    fd_ = -1;
+  }
+
+  void FdTransport::setTimeout(uint32_t milliseconds) {
+    timeout_ms_ = milliseconds;
+  }
+
+  size_t FdTransport::available() {
+    int waiting = 0;
+    if (fd_ < 0 || ioctl(fd_, FIONREAD, &waiting) != 0)
+      return (0);
+    return (waiting);
+  }
+
+  bool FdTransport::poll(int milliseconds) {
+    if (fd_ < 0)
+      return (false);
+    pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ready;
+    do
+    {
+      ready = ::poll(&pfd, 1, milliseconds);
+    }
+    while (ready < 0 && errno == EINTR);
+    return (ready > 0 && (pfd.revents & POLLIN));
+  }
+
+  bool FdTransport::waitReadable() {
+    return (poll(timeout_ms_));
+  }
+
+  /** The timeout covers the whole read, as it does for the serial library's simple timeout.
+   * A socket reporting end of file or an error is closed, so isOpen() shows a dropped connection.
+   */
+  size_t FdTransport::read(uint8_t *buffer, size_t size) {
+    if (fd_ < 0)
+      return (0);
+    if (toggle_blocking_)
+      setNonBlocking(fd_, true);
+
+    size_t total = 0;
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (total < size)
+    {
+      ssize_t length = ::read(fd_, buffer + total, size - total);
+      if (length > 0)
+      {
+        total += length;
+        continue;
+      }
+      bool failed = (length < 0 && errno != EAGAIN && errno != EINTR);
+      if (zero_is_eof_ && (length == 0 || failed))
+      {
+        close();
+        break;
+      }
+      if (failed)
+        break;
+      timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      long elapsed = (now.tv_sec - start.tv_sec) * 1000
+          + (now.tv_nsec - start.tv_nsec) / 1000000;
+      if (elapsed >= timeout_ms_ || !poll(timeout_ms_ - elapsed))
+        break;
+    }
+
+    if (toggle_blocking_)
+      setNonBlocking(fd_, false);
+    return (total);
+  }
+
+  size_t FdTransport::readSome(uint8_t *buffer, size_t size) {
+    if (fd_ < 0)
+      return (0);
+    ssize_t length;
+    do
+    {
+      length = ::read(fd_, buffer, size);
+    }
+    while (length < 0 && errno == EINTR);
+    if (zero_is_eof_ && size > 0
+        && (length == 0 || (length < 0 && errno != EAGAIN)))
+      close();
+    return (length > 0 ? length : 0);
+  }
+
+  //! As read(), a socket whose peer has gone is closed.
+  size_t FdTransport::write(const uint8_t *data, size_t size) {
+    if (fd_ < 0)
+      return (0);
+    size_t total = 0;
+    while (total < size)
+    {
+      ssize_t length = (
+          socket_ ? ::send(fd_, data + total, size - total, MSG_NOSIGNAL) :
+                    ::write(fd_, data + total, size - total));
+      if (length > 0)
+        total += length;
+      else if (length < 0 && errno == EINTR)
+        continue;
+      else if (length < 0 && errno == EAGAIN)
+      {
+        pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (::poll(&pfd, 1, timeout_ms_) <= 0)
+          break;
+      }
+      else
+      {
+        if (zero_is_eof_ && length < 0)
+          close();
+        break;
+      }
+    }
+    return (total);
+  }
+
+  void FdTransport::flush() {
+  }
+
+  TtyTransport::TtyTransport(uint8_t vmin, uint8_t vtime, bool low_latency) :
+      vmin_(vmin), vtime_(vtime), want_low_latency_(low_latency), low_latency_(
+          false) {
+    toggle_blocking_ = (vmin > 0 || vtime > 0);
+  }
+
+  /**
+   * The tty is put in raw mode, 8N1 without flow control, with the configured VMIN and VTIME.  It is
+   * left blocking so that VMIN and VTIME apply to readSome(); read() switches to non-blocking for its
+   * own timeout when either is set.
+   */
+  bool TtyTransport::open(const std::string &port, int baud) {
+    close();
+    speed_t speed = baudSpeed(baud);
+    if (speed == B0)
+      return (false);
+    fd_ = ::open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd_ < 0)
+      return (false);
+
+    termios tio;
+    if (tcgetattr(fd_, &tio) != 0)
+    {
+      close();
+      return (false);
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= (CLOCAL | CREAD);
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+    tio.c_cc[VMIN] = vmin_;
+    tio.c_cc[VTIME] = vtime_;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd_, TCSANOW, &tio) != 0)
+    {
+      close();
+      return (false);
+    }
+    tcflush(fd_, TCIOFLUSH);
+    setNonBlocking(fd_, false);
+
+    low_latency_ = false;
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+    serial_struct info;
+    if (want_low_latency_ && ioctl(fd_, TIOCGSERIAL, &info) == 0)
+    {
+      info.flags |= ASYNC_LOW_LATENCY;
+      low_latency_ = (ioctl(fd_, TIOCSSERIAL, &info) == 0);
+    }
+#endif
+    return (true);
+  }
+
+  void TtyTransport::close() {
+    FdTransport::close();
+    low_latency_ = false;
+  }
+
+  void TtyTransport::flush() {
+    if (fd_ >= 0)
+      tcdrain(fd_);
+  }
+
+  /**
+   * Each resolved address is tried in turn with a non-blocking connect that waits at most the timeout.
+   */
+  TcpTransport::TcpTransport() {
+    zero_is_eof_ = true;
+    socket_ = true;
+  }
+
+  bool TcpTransport::open(const std::string &port, int baud) {
+    close();
+    size_t colon = port.rfind(':');
+    if (colon == std::string::npos)
+      return (false);
+    std::string host = port.substr(0, colon);
+    std::string service = port.substr(colon + 1);
+    if (host.size() > 1 && host[0] == '[' && host[host.size() - 1] == ']')
+      host = host.substr(1, host.size() - 2);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = NULL;
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses) != 0)
+      return (false);
+
+    for (addrinfo *address = addresses; address && fd_ < 0;
+        address = address->ai_next)
+    {
+      fd_ = socket(address->ai_family, address->ai_socktype,
+                   address->ai_protocol);
+      if (fd_ < 0)
+        continue;
+      setNonBlocking(fd_, true);
+      int result = connect(fd_, address->ai_addr, address->ai_addrlen);
+      if (result < 0 && errno == EINPROGRESS)
+      {
+        pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        int error = ETIMEDOUT;
+        socklen_t length = sizeof(error);
+        if (::poll(&pfd, 1, timeout_ms_) > 0)
+          getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &length);
+        result = (error == 0 ? 0 : -1);
+      }
+      if (result < 0)
+        close();
+    }
+    freeaddrinfo(addresses);
+    if (fd_ < 0)
+      return (false);
+
+    int enable = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    setsockopt(fd_, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    return (true);
+  }
+
+  ReplayTransport::ReplayTransport(double speed, bool loop) :
+      open_(false), speed_(speed), loop_(loop), bytes_per_ns_(0), timeout_ms_(
+          1000), position_(0), streaming_(false), stream_start_ns_(0), stream_start_position_(
+          0) {
+  }
+
+  bool ReplayTransport::open(const std::string &port, int baud) {
+    close();
+    std::ifstream file(port.c_str(), std::ios::binary);
+    if (!file)
+      return (false);
+    data_.assign(std::istreambuf_iterator<char>(file),
+                 std::istreambuf_iterator<char>());
+    bytes_per_ns_ = speed_ * baud / 10 / 1e9;   //8N1 is 10 bits per byte
+    open_ = true;
+    return (true);
+  }
+
+  bool ReplayTransport::isOpen() {
+    return (open_);
+  }
+
+  void ReplayTransport::close() {
+    data_.clear();
+    open_ = false;
+    streaming_ = false;
+    position_ = 0;
+    response_.clear();
+  }
+
+  void ReplayTransport::setTimeout(uint32_t milliseconds) {
+    timeout_ms_ = milliseconds;
+  }
+
+  size_t ReplayTransport::due() {
+    size_t waiting = response_.size();
+    if (!streaming_ || data_.empty())
+      return (waiting);
+    size_t end = data_.size();
+    if (speed_ > 0)
+    {
+      uint64_t paced = stream_start_position_
+          + uint64_t((monotonicNanos() - stream_start_ns_) * bytes_per_ns_);
+      end = size_t(std::min<uint64_t>(paced, loop_ ? paced : data_.size()));
+    }
+    else if (loop_)
+      end = position_ + data_.size();
+    return (waiting + (end > position_ ? end - position_ : 0));
+  }
+
+  size_t ReplayTransport::take(uint8_t *buffer, size_t size) {
+    size_t count = std::min(size, due());
+    size_t replies = std::min(count, response_.size());
+    memcpy(buffer, response_.data(), replies);
+    response_.erase(0, replies);
+    for (size_t i = replies; i < count; i++)
+      buffer[i] = data_[position_++ % data_.size()];
+    return (count);
+  }
+
+  size_t ReplayTransport::available() {
+    return (due());
+  }
+
+  bool ReplayTransport::waitReadable() {
+    uint64_t deadline = monotonicNanos() + timeout_ms_ * 1000000ULL;
+    while (due() == 0)
+    {
+      if (monotonicNanos() >= deadline)
+        return (false);
+      usleep(1000);
+    }
+    return (true);
+  }
+
+  size_t ReplayTransport::read(uint8_t *buffer, size_t size) {
+    uint64_t deadline = monotonicNanos() + timeout_ms_ * 1000000ULL;
+    size_t total = take(buffer, size);
+    while (total < size && monotonicNanos() < deadline)
+    {
+      usleep(1000);
+      total += take(buffer + total, size - total);
+    }
+    return (total);
+  }
+
+  size_t ReplayTransport::readSome(uint8_t *buffer, size_t size) {
+    return (take(buffer, size));
+  }
+
+  size_t ReplayTransport::write(const uint8_t *data, size_t size) {
+    if (!open_ || size == 0)
+      return (0);
+    if (data[0] == commands::StartAcquire::encode().data[0] && !streaming_)
+    {
+      streaming_ = true;
+      stream_start_ns_ = monotonicNanos();
+      stream_start_position_ = position_;
+    }
+    else if (data[0] == commands::StopAcquire::encode().data[0])
+      streaming_ = false;
+    else if (data[0] == commands::CheckComms::encode().data[0])
+      response_ = "URSA2";
+    return (size);
+  }
+
+  void ReplayTransport::flush() {
+  }
+
+  namespace
+  {
+    //! Returns the value of a "key=value" pair in a URI query, or an empty string.
+    std::string queryValue(const std::string &query, const std::string &key) {
+      size_t start = 0;
+      while (start < query.size())
+      {
+        size_t end = query.find('&', start);
+        if (end == std::string::npos)
+          end = query.size();
+        std::string pair = query.substr(start, end - start);
+        if (pair.compare(0, key.size() + 1, key + "=") == 0)
+          return (pair.substr(key.size() + 1));
+        start = end + 1;
+      }
+      return ("");
+    }
+  }
+
+  Transport *createTransport(const std::string &uri, std::string *port) {
+    size_t separator = uri.find("://");
+    if (separator == std::string::npos)
+    {
+      *port = uri;
+      return (new SerialTransport());
+    }
+    std::string scheme = uri.substr(0, separator);
+    std::string address = uri.substr(separator + 3);
+    std::string query;
+    size_t question = address.find('?');
+    if (question != std::string::npos)
+    {
+      query = address.substr(question + 1);
+      address.erase(question);
+    }
+    *port = address;
+
+    if (scheme == "serial")
+      return (new SerialTransport());
+    if (scheme == "tty")
+      return (new TtyTransport());
+    if (scheme == "tcp")
+      return (new TcpTransport());
+    if (scheme == "file")
+    {
+      std::string speed = queryValue(query, "speed");
+      std::string loop = queryValue(query, "loop");
+      return (new ReplayTransport(speed.empty() ? 1.0 : atof(speed.c_str()),
+                                  loop == "1" || loop == "true"));
+    }
+    return (NULL);
+  }
+}
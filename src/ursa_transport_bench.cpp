@@ -0,0 +1,310 @@
+/** A benchmark comparing the transports on a pseudo terminal.
+ \file      ursa_transport_bench.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "ursa_driver/ursa_transport.h"
+#include "ursa_driver/ursa_clock.h"
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+/** Usage: ursa_transport_bench [seconds] [events_per_second] [read_period_ms]
+ *
+ * A writer thread feeds the master side of a pty with 3 byte events in 1 ms bursts, as a USB serial
+ * adapter would deliver them.  Each transport reads the slave side:
+ *
+ *   legacy        SerialTransport read the way Interface::read() used to, available() then 64 byte reads.
+ *   serial        SerialTransport with one bulk readSome() per period.
+ *   tty           TtyTransport with VMIN = 0, one bulk readSome() per period.
+ *   tty_blocking  TtyTransport with VMIN = 1 in a loop, as a dedicated reader thread would use it.
+ *
+ * The polled modes wake every read_period_ms like the node's read timer.  For each mode the read
+ * syscalls (syscr from /proc/self/io, which does not count ioctl, select or poll), the transport calls,
+ * the share of time spent inside them and the delay from a burst being written to it being read are
+ * printed.  Time inside the transport is time the node's callback thread is blocked.
+ */
+
+namespace
+{
+  const size_t event_size = 3;
+
+  struct Options
+  {
+    double seconds;
+    double rate;
+    double period_ms;
+  };
+
+  //! Returns the read syscalls made by this process so far.
+  unsigned long long readSyscalls() {
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    unsigned long long value;
+    while (io >> key >> value)
+    {
+      if (key == "syscr:")
+        return (value);
+    }
+    return (0);
+  }
+
+  //! Sleeps until an absolute monotonic time.
+  void sleepUntil(uint64_t ns) {
+    timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+      ;
+  }
+
+  //! Writes bursts of events to the pty master and records when each burst was written.
+  class Writer
+  {
+  private:
+    int fd_;
+    size_t burst_events_;
+    size_t bursts_;
+    std::vector<uint64_t> times_;
+    boost::thread thread_;
+
+    void run() {
+      std::vector<uint8_t> burst(burst_events_ * event_size);
+      for (size_t i = 0; i < burst_events_; i++)
+      {
+        burst[i * event_size] = 0xff;
+        burst[i * event_size + 1] = 0x10;
+        burst[i * event_size + 2] = i & 0xff;
+      }
+      uint64_t next = ursa::monotonicNanos();
+      for (size_t b = 0; b < bursts_; b++)
+      {
+        sleepUntil(next);
+        times_[b] = ursa::monotonicNanos();
+        size_t written = 0;
+        while (written < burst.size())
+        {
+          ssize_t length = ::write(fd_, &burst[written], burst.size() - written);
+          if (length > 0)
+            written += length;
+        }
+        next += 1000000;
+      }
+    }
+
+  public:
+    Writer(int fd, size_t burst_events, size_t bursts) :
+        fd_(fd), burst_events_(burst_events), bursts_(bursts), times_(bursts, 0) {
+    }
+    void start() {
+      thread_ = boost::thread(&Writer::run, this);
+    }
+    void join() {
+      thread_.join();
+    }
+    uint64_t time(size_t burst) const {
+      return (times_[burst]);
+    }
+    size_t totalBytes() const {
+      return (burst_events_ * event_size * bursts_);
+    }
+    size_t burstBytes() const {
+      return (burst_events_ * event_size);
+    }
+  };
+
+  //! Tracks which bursts have been read and the delay to reading each.
+  class Receiver
+  {
+  private:
+    const Writer &writer_;
+    size_t total_;
+    size_t burst_;
+    std::vector<double> latency_ms_;
+
+  public:
+    explicit Receiver(const Writer &writer) :
+        writer_(writer), total_(0), burst_(0) {
+      latency_ms_.reserve(writer.totalBytes() / writer.burstBytes());
+    }
+    void add(size_t bytes) {
+      total_ += bytes;
+      uint64_t now = ursa::monotonicNanos();
+      while ((burst_ + 1) * writer_.burstBytes() <= total_)
+      {
+        latency_ms_.push_back((now - writer_.time(burst_)) / 1e6);
+        burst_++;
+      }
+    }
+    bool done() const {
+      return (total_ >= writer_.totalBytes());
+    }
+    void print(const char *mode, unsigned long long syscalls,
+               unsigned long long calls, uint64_t busy_ns, double seconds) {
+      std::sort(latency_ms_.begin(), latency_ms_.end());
+      double mean = 0;
+      for (size_t i = 0; i < latency_ms_.size(); i++)
+        mean += latency_ms_[i];
+      if (!latency_ms_.empty())
+        mean /= latency_ms_.size();
+      double p99 = (
+          latency_ms_.empty() ? 0 : latency_ms_[latency_ms_.size() * 99 / 100]);
+      double max = (latency_ms_.empty() ? 0 : latency_ms_.back());
+      printf("%-13s %9.0f %9.0f %9.1f %10.2f %10.2f %10.2f\n", mode,
+             syscalls / seconds, calls / seconds, busy_ns / seconds / 1e7, mean,
+             p99, max);
+    }
+  };
+
+  enum bench_mode
+  {
+    MODE_LEGACY,
+    MODE_BULK,
+    MODE_BLOCKING
+  };
+
+  void run(const char *name, ursa::Transport *transport, bench_mode mode,
+           const Options &options) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+      std::cerr << "ERROR: Unable to open a pty." << std::endl;
+      exit(-1);
+    }
+    termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    std::string slave = ptsname(master);
+
+    transport->setTimeout(1000);
+    if (!transport->open(slave, 115200))
+    {
+      std::cerr << "ERROR: " << name << " could not open " << slave << std::endl;
+      exit(-1);
+    }
+
+    size_t burst_events = std::max<size_t>(1, options.rate / 1000 + 0.5);
+    Writer writer(master, burst_events, options.seconds * 1000);
+    Receiver receiver(writer);
+    std::vector<uint8_t> buffer(16384);
+    unsigned long long calls = 0;
+    unsigned long long syscalls = readSyscalls();
+    uint64_t period = options.period_ms * 1e6;
+
+    writer.start();
+    uint64_t start = ursa::monotonicNanos();
+    uint64_t next = start;
+    uint64_t deadline = start + (options.seconds + 2) * 1e9;
+    uint64_t busy = 0;
+    while (!receiver.done() && ursa::monotonicNanos() < deadline)
+    {
+      size_t length;
+      uint64_t begin;
+      switch (mode)
+      {
+        case MODE_LEGACY:
+          next += period;
+          sleepUntil(next);
+          calls++;
+          begin = ursa::monotonicNanos();
+          while (transport->available())
+          {
+            length = transport->read(&buffer[0], 64);
+            receiver.add(length);
+            calls += 2;
+          }
+          busy += ursa::monotonicNanos() - begin;
+          break;
+        case MODE_BULK:
+          next += period;
+          sleepUntil(next);
+          begin = ursa::monotonicNanos();
+          do
+          {
+            length = transport->readSome(&buffer[0], buffer.size());
+            receiver.add(length);
+            calls++;
+          }
+          while (length == buffer.size());
+          busy += ursa::monotonicNanos() - begin;
+          break;
+        case MODE_BLOCKING:
+          begin = ursa::monotonicNanos();
+          length = transport->readSome(&buffer[0], buffer.size());
+          busy += ursa::monotonicNanos() - begin;
+          receiver.add(length);
+          calls++;
+          break;
+      }
+    }
+    double seconds = (ursa::monotonicNanos() - start) / 1e9;
+    syscalls = readSyscalls() - syscalls;
+    writer.join();
+    if (!receiver.done())
+      std::cerr << "WARNING: " << name << " did not receive every byte." << std::endl;
+    receiver.print(name, syscalls, calls, busy, seconds);
+    transport->close();
+    close(master);
+  }
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  options.seconds = (argc > 1 ? atof(argv[1]) : 10);
+  options.rate = (argc > 2 ? atof(argv[2]) : 3000);
+  options.period_ms = (argc > 3 ? atof(argv[3]) : 10);
+  if (options.seconds <= 0 || options.rate <= 0 || options.period_ms <= 0)
+  {
+    std::cerr << "Usage: " << argv[0]
+        << " [seconds] [events_per_second] [read_period_ms]" << std::endl;
+    return (-1);
+  }
+
+  printf("%.0f events/s in 1 ms bursts for %.0f s, polled every %.1f ms\n",
+         options.rate, options.seconds, options.period_ms);
+  printf("%-13s %9s %9s %9s %10s %10s %10s\n", "mode", "reads/s", "calls/s",
+         "in read %", "mean ms", "p99 ms", "max ms");
+
+  ursa::SerialTransport legacy;
+  run("legacy", &legacy, MODE_LEGACY, options);
+  ursa::SerialTransport serial;
+  run("serial", &serial, MODE_BULK, options);
+  ursa::TtyTransport tty(0, 0);
+  run("tty", &tty, MODE_BULK, options);
+  ursa::TtyTransport blocking(1, 0);
+  run("tty_blocking", &blocking, MODE_BLOCKING, options);
+  return (0);
+}
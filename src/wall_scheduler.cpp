@@ -0,0 +1,159 @@
+/** Implementation of the wall clock aligned scheduler.
+ \file      wall_scheduler.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/wall_scheduler.h>
+#include <ursa_driver/ursa_clock.h>
+
+#include <algorithm>
+
+namespace ursa
+{
+  const uint64_t stop_poll_ns = 100000000ULL; //!< The longest the timing thread sleeps before checking for stop().
+
+  ScheduleStats::ScheduleStats() :
+      ticks(0), missed(0), overruns(0), max_late_ns(0), total_late_ns(0), max_work_ns(
+          0) {
+  }
+
+  WallScheduler::WallScheduler() :
+      period_ns_(1000000000ULL), offset_ns_(0), stop_(false), work_pending_(
+          false), work_tick_(0) {
+  }
+
+  WallScheduler::~WallScheduler() {
+    stop();
+  }
+
+  void WallScheduler::start(double period, double offset,
+                            const Task &snapshot, const Task &work) {
+    stop();
+    period_ns_ = std::max(uint64_t(period * 1e9), uint64_t(1));
+    offset_ns_ = uint64_t(std::max(offset, 0.0) * 1e9) % period_ns_;
+    snapshot_ = snapshot;
+    work_ = work;
+    work_pending_ = false;
+    stats_ = ScheduleStats();
+    stop_ = false;
+    worker_ = boost::thread(&WallScheduler::workerLoop, this);
+    timer_ = boost::thread(&WallScheduler::timerLoop, this);
+  }
+
+  void WallScheduler::stop() {
+    if (!timer_.joinable())
+      return;
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_ready_.notify_all();
+    timer_.join();
+    worker_.join();
+    timer_ = boost::thread();
+    worker_ = boost::thread();
+  }
+
+  ScheduleStats WallScheduler::stats(bool reset) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    ScheduleStats stats = stats_;
+    if (reset)
+      stats_ = ScheduleStats();
+    return (stats);
+  }
+
+  /** The next boundary is always computed from the clock rather than by adding the period, so it never
+   * falls behind and a step of the wall clock is followed within one period.  Long sleeps are split so
+   * stop() is seen within stop_poll_ns, but the last sleep always ends at the boundary itself.
+   */
+  void WallScheduler::timerLoop() {
+    uint64_t tick = nextWallBoundary(wallNanos(), period_ns_, offset_ns_);
+    while (!stop_)
+    {
+      uint64_t now = wallNanos();
+      if (now < tick)
+      {
+        if (tick - now > period_ns_)   //the clock was stepped back
+          tick = nextWallBoundary(now, period_ns_, offset_ns_);
+        sleepUntilWall(std::min(tick, now + stop_poll_ns));
+        continue;
+      }
+
+      bool busy;
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        busy = work_pending_;
+        if (busy)
+          stats_.overruns++;
+        else
+        {
+          uint64_t late = now - tick;
+          stats_.ticks++;
+          stats_.total_late_ns += late;
+          stats_.max_late_ns = std::max(stats_.max_late_ns, late);
+        }
+      }
+      if (!busy)
+      {
+        snapshot_(tick);
+        {
+          boost::lock_guard<boost::mutex> lock(mutex_);
+          work_pending_ = true;
+          work_tick_ = tick;
+        }
+        work_ready_.notify_one();
+      }
+
+      uint64_t next = nextWallBoundary(wallNanos(), period_ns_, offset_ns_);
+      if (next > tick + period_ns_)
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stats_.missed += (next - tick) / period_ns_ - 1;
+      }
+      tick = next;
+    }
+  }
+
+  void WallScheduler::workerLoop() {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (true)
+    {
+      while (!work_pending_ && !stop_)
+        work_ready_.wait(lock);
+      if (stop_)
+        return;
+
+      uint64_t tick = work_tick_;
+      lock.unlock();
+      uint64_t start = monotonicNanos();
+      if (work_)
+        work_(tick);
+      uint64_t elapsed = monotonicNanos() - start;
+      lock.lock();
+      stats_.max_work_ns = std::max(stats_.max_work_ns, elapsed);
+      work_pending_ = false;
+    }
+  }
+}
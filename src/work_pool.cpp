@@ -0,0 +1,109 @@
+/** The implementation of the work stealing thread pool.
+ \file      work_pool.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/work_pool.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/bind.hpp>
+
+namespace ursa
+{
+  WorkStealingPool::WorkStealingPool(size_t threads) :
+      pending_(0), steals_(0) {
+    if (threads == 0)
+      threads = boost::thread::hardware_concurrency();
+    if (threads == 0)
+      threads = 1;
+    for (size_t i = 0; i < threads; i++)
+      queues_.push_back(boost::shared_ptr<Queue>(new Queue()));
+  }
+
+  //! The pending count is raised before the task is visible, so no worker can see the pool idle in between.
+  void WorkStealingPool::push(size_t worker, const Task &task) {
+    pending_++;
+    Queue &queue = *queues_[worker % queues_.size()];
+    boost::lock_guard<boost::mutex> lock(queue.mutex);
+    queue.tasks.push_back(task);
+  }
+
+  /** The victims are tried in turn starting after the thief, so thieves spread over the workers rather than
+   * all raiding worker 0.
+   */
+  bool WorkStealingPool::take(size_t worker, Task *task) {
+    {
+      Queue &own = *queues_[worker];
+      boost::lock_guard<boost::mutex> lock(own.mutex);
+      if (!own.tasks.empty())
+      {
+        task->swap(own.tasks.back());
+        own.tasks.pop_back();
+        return (true);
+      }
+    }
+    for (size_t i = 1; i < queues_.size(); i++)
+    {
+      Queue &victim = *queues_[(worker + i) % queues_.size()];
+      boost::lock_guard<boost::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty())
+      {
+        task->swap(victim.tasks.front());
+        victim.tasks.pop_front();
+        steals_++;
+        return (true);
+      }
+    }
+    return (false);
+  }
+
+  /** A worker with nothing to take yields until a running task pushes more or every task has finished.
+   * pending_ only reaches zero once no task is queued or running, so no task can be left behind.
+   */
+  void WorkStealingPool::workerLoop(size_t worker) {
+    Task task;
+    while (pending_ > 0)
+    {
+      if (take(worker, &task))
+      {
+        task(worker);
+        task.clear();
+        pending_--;
+      }
+      else
+        boost::this_thread::yield();
+    }
+  }
+
+  void WorkStealingPool::run() {
+    boost::thread_group threads;
+    for (size_t i = 1; i < queues_.size(); i++)
+      threads.create_thread(
+          boost::bind(&WorkStealingPool::workerLoop, this, i));
+    workerLoop(0);
+    threads.join_all();
+  }
+}
@@ -0,0 +1,329 @@
+/** Tests of the alarm engine on synthetic event streams.
+ \file      test_alarm.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/ursa_driver.h>
+#include <gtest/gtest.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace ursa;
+
+namespace
+{
+  const uint64_t batch_ns = 10000000; //!< Batches are 10 ms apart, about how often the reader thread wakes at low rates.
+
+  //! A config with a short learning time and one ROI on channels 100 to 110.
+  AlarmConfig testConfig() {
+    AlarmConfig config;
+    config.enable = true;
+    config.drive_outputs = false;
+    config.learn_seconds = 5;
+    AlarmRoi roi;
+    roi.low = 100;
+    roi.high = 110;
+    config.rois.push_back(roi);
+    return (config);
+  }
+
+  /** Feeds batches of counts on one channel every batch_ns.  Counts are spread evenly so the rate is
+   * rate_cps without any randomness.
+   * @return The monotonic time after the last batch.
+   */
+  uint64_t feed(AlarmEngine &engine, uint64_t now_ns, double seconds,
+                double rate_cps, uint16_t channel) {
+    size_t batches = size_t(seconds * 1e9 / batch_ns);
+    double owed = 0;
+    for (size_t i = 0; i < batches; i++)
+    {
+      now_ns += batch_ns;
+      engine.beginBatch(now_ns, now_ns - batch_ns / 2);
+      owed += rate_cps * batch_ns * 1e-9;
+      for (; owed >= 1; owed--)
+        engine.addEvent(channel, 1);
+      engine.endBatch();
+    }
+    return (now_ns);
+  }
+
+  /** An Ursa streaming one count events at a steady rate while acquiring.  A threshold command, or
+   * stepRate(), multiplies the rate by four, and the alarm 0 output commands are recorded.
+   */
+  class RateUrsa : public Transport
+  {
+  private:
+    boost::mutex mutex_;
+    double rate_;
+    bool streaming_;
+    bool reply_;
+    bool alarm0_;
+    uint64_t stream_start_ns_;
+    uint64_t served_;
+
+    //! Returns the whole frames due since streaming started. Call with mutex_ held.
+    size_t due() {
+      if (reply_)
+        return (5);
+      if (!streaming_)
+        return (0);
+      uint64_t frames = uint64_t((monotonicNanos() - stream_start_ns_) * 1e-9 * rate_);
+      return ((frames - served_) * 3);
+    }
+
+    //! Changes the rate without changing the frames already due.
+    void setRate(double rate) {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      uint64_t now = monotonicNanos();
+      stream_start_ns_ = now - uint64_t(served_ / rate * 1e9);
+      rate_ = rate;
+    }
+
+  public:
+    explicit RateUrsa(double rate) :
+        rate_(rate), streaming_(false), reply_(false), alarm0_(false), stream_start_ns_(
+            0), served_(0) {
+    }
+    void stepRate() {
+      setRate(rate_ * 4);
+    }
+    bool alarm0() {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return (alarm0_);
+    }
+    bool open(const std::string &port, int baud) {
+      return (true);
+    }
+    bool isOpen() {
+      return (true);
+    }
+    void close() {
+    }
+    void setTimeout(uint32_t milliseconds) {
+    }
+    size_t available() {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return (due());
+    }
+    bool waitReadable() {
+      if (available())
+        return (true);
+      usleep(1000);
+      return (available() > 0);
+    }
+    size_t read(uint8_t *buffer, size_t size) {
+      return (readSome(buffer, size));
+    }
+    size_t readSome(uint8_t *buffer, size_t size) {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      if (reply_)
+      {
+        reply_ = false;
+        memcpy(buffer, "URSA2", std::min(size, size_t(5)));
+        return (std::min(size, size_t(5)));
+      }
+      size_t frames = std::min(due(), size) / 3;
+      for (size_t i = 0; i < frames; i++)
+      {
+        uint16_t channel = (served_ + i) * 37 % 1024;
+        buffer[3 * i] = 0xff;
+        buffer[3 * i + 1] = uint8_t((1 << 4) | (channel >> 8));
+        buffer[3 * i + 2] = uint8_t(channel & 0xff);
+      }
+      served_ += frames;
+      return (frames * 3);
+    }
+    size_t write(const uint8_t *data, size_t size) {
+      if (data[0] == 'T')
+      {
+        stepRate();
+        return (size);
+      }
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      if (data[0] == 'G')
+      {
+        streaming_ = true;
+        stream_start_ns_ = monotonicNanos();
+        served_ = 0;
+      }
+      else if (data[0] == 'R')
+        streaming_ = false;
+      else if (data[0] == 'U')
+        reply_ = true;
+      else if (data[0] == 'Z')
+        alarm0_ = true;
+      else if (data[0] == 'z')
+        alarm0_ = false;
+      return (size);
+    }
+    void flush() {
+    }
+  };
+
+  //! Waits up to seconds for the alarm 0 output to reach state.
+  bool waitAlarm0(RateUrsa *ursa, bool state, double seconds) {
+    for (int i = 0; i < seconds * 100; i++)
+    {
+      if (ursa->alarm0() == state)
+        return (true);
+      usleep(10000);
+    }
+    return (ursa->alarm0() == state);
+  }
+}
+
+//! A steady rate learns a background and raises nothing; four times that rate raises the gross alarm quickly.
+TEST(AlarmEngine, SprtDetectsRateStep)
+{
+  AlarmEngine engine;
+  engine.configure(testConfig());
+  uint64_t now_ns = feed(engine, 1000000000ULL, 6, 100, 500);
+  ASSERT_FALSE(engine.learning());
+  EXPECT_NEAR(100, engine.background(), 2);
+
+  now_ns = feed(engine, now_ns, 10, 100, 500);
+  std::vector<AlarmEvent> events;
+  EXPECT_EQ(0u, engine.takeEvents(&events));
+  EXPECT_FALSE(engine.output(0));
+
+  uint64_t step_ns = now_ns;
+  now_ns = feed(engine, now_ns, 1, 400, 500);
+  ASSERT_EQ(1u, engine.takeEvents(&events));
+  EXPECT_EQ(ALARM_GROSS, events[0].source);
+  EXPECT_TRUE(events[0].active);
+  EXPECT_TRUE(engine.output(0));
+  EXPECT_GT(events[0].rate, 200);
+  EXPECT_LT(events[0].read_ns - step_ns, 200000000u);
+  EXPECT_EQ(events[0].read_ns - batch_ns / 2, events[0].arrival_ns);
+}
+
+//! An ROI that saw nothing while learning is floored at roi_min_background, so a count or two does not alarm.
+TEST(AlarmEngine, QuietRoiIgnoresStrayCounts)
+{
+  AlarmEngine engine;
+  engine.configure(testConfig());
+  uint64_t now_ns = feed(engine, 1000000000ULL, 6, 100, 500);
+  ASSERT_FALSE(engine.learning());
+
+  std::vector<AlarmEvent> events;
+  for (int i = 0; i < 5; i++)
+  {
+    now_ns = feed(engine, now_ns, 2, 100, 500);
+    now_ns += batch_ns;
+    engine.beginBatch(now_ns);
+    engine.addEvent(105, 1);
+    engine.addEvent(105, 1);
+    engine.endBatch();
+  }
+  engine.takeEvents(&events);
+  for (size_t i = 0; i < events.size(); i++)
+    EXPECT_NE(ALARM_ROI, events[i].source);
+  EXPECT_FALSE(engine.output(1));
+
+  now_ns = feed(engine, now_ns, 0.5, 20, 105);
+  events.clear();
+  engine.takeEvents(&events);
+  ASSERT_FALSE(events.empty());
+  EXPECT_EQ(ALARM_ROI, events.back().source);
+  EXPECT_TRUE(engine.output(1));
+}
+
+//! A background learned again with configure() clears the alarm it raised, and the clear is an event.
+TEST(AlarmEngine, RelearnClearsAlarm)
+{
+  AlarmEngine engine;
+  engine.configure(testConfig());
+  uint64_t now_ns = feed(engine, 1000000000ULL, 6, 100, 500);
+  now_ns = feed(engine, now_ns, 1, 400, 500);
+  std::vector<AlarmEvent> events;
+  ASSERT_EQ(1u, engine.takeEvents(&events));
+  ASSERT_TRUE(engine.output(0));
+
+  // The gross background is frozen while alarming, so the new rate alone never clears it.
+  now_ns = feed(engine, now_ns, 30, 400, 500);
+  EXPECT_TRUE(engine.output(0));
+
+  engine.configure(engine.config());
+  EXPECT_FALSE(engine.output(0));
+  EXPECT_TRUE(engine.learning());
+  events.clear();
+  ASSERT_EQ(1u, engine.takeEvents(&events));
+  EXPECT_EQ(ALARM_GROSS, events[0].source);
+  EXPECT_FALSE(events[0].active);
+
+  now_ns = feed(engine, now_ns, 20, 400, 500);
+  EXPECT_NEAR(400, engine.background(), 8);
+  EXPECT_FALSE(engine.output(0));
+  EXPECT_EQ(0u, engine.takeEvents(&events));
+}
+
+/** A rate step raises alarm 0.  A threshold change, which here raises the rate again, learns the
+ * background afresh, so the output is cleared and stays clear.
+ */
+TEST(AlarmEngine, ReconfigureClearsAlarm)
+{
+  RateUrsa *emulated = new RateUrsa(1000);
+  Interface ursa("emulated", 115200, emulated);
+  ursa.connect();
+  ASSERT_TRUE(ursa.connected());
+  AlarmConfig config = testConfig();
+  config.drive_outputs = true;
+  config.learn_seconds = 0.5;
+  ursa.setAlarmConfig(config);
+  ursa.startAcquire();
+  ASSERT_TRUE(ursa.startReader(RealtimeOptions()));
+  usleep(1000000);
+  EXPECT_FALSE(emulated->alarm0());
+
+  emulated->stepRate();
+  ASSERT_TRUE(waitAlarm0(emulated, true, 2));
+
+  AcquisitionSettings settings;
+  settings.set_threshold = true;
+  settings.threshold = 100;
+  ASSERT_TRUE(ursa.reconfigure(settings, false).success);
+  EXPECT_TRUE(waitAlarm0(emulated, false, 0.5));
+  usleep(2000000);
+  EXPECT_FALSE(emulated->alarm0());
+  ursa.stopReader();
+  ursa.stopAcquire();
+
+  std::vector<AlarmEvent> events;
+  ursa.getAlarmEvents(&events);
+  ASSERT_EQ(2u, events.size());
+  EXPECT_TRUE(events[0].active);
+  EXPECT_FALSE(events[1].active);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
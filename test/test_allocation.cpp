@@ -0,0 +1,251 @@
+/** Tests that the steady state acquisition path does not allocate, under a counting allocator.
+ \file      test_allocation.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/ursa_driver.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace ursa;
+
+namespace
+{
+  //! Set while the test thread runs the steady state. Other threads, e.g. the log flusher, are not counted.
+  __thread bool counting = false;
+  __thread size_t allocations = 0;
+
+  void *allocate(size_t size) {
+    if (counting)
+      allocations++;
+    void *memory = malloc(size ? size : 1);
+    if (!memory)
+      throw std::bad_alloc();
+    return (memory);
+  }
+}
+
+void *operator new(size_t size) {
+  return (allocate(size));
+}
+
+void *operator new[](size_t size) {
+  return (allocate(size));
+}
+
+void operator delete(void *memory) throw () {
+  free(memory);
+}
+
+void operator delete[](void *memory) throw () {
+  free(memory);
+}
+
+/** An Ursa that answers CheckComms and streams a capture in a loop between StartAcquire and StopAcquire.
+ *
+ * Each readSome() serves up to burst bytes, which splits frames across reads like a real port.
+ */
+class EmulatedUrsa : public Transport
+{
+private:
+  std::vector<uint8_t> capture_;
+  size_t burst_;
+  size_t position_;
+  bool streaming_;
+  bool reply_;
+
+  size_t waiting() {
+    return (reply_ ? 5 : streaming_ ? burst_ : 0);
+  }
+
+public:
+  EmulatedUrsa(const std::vector<uint8_t> &capture, size_t burst) :
+      capture_(capture), burst_(burst), position_(0), streaming_(false), reply_(
+          false) {
+  }
+  bool open(const std::string &port, int baud) {
+    return (true);
+  }
+  bool isOpen() {
+    return (true);
+  }
+  void close() {
+  }
+  void setTimeout(uint32_t milliseconds) {
+  }
+  size_t available() {
+    return (waiting());
+  }
+  bool waitReadable() {
+    return (waiting() > 0);
+  }
+  size_t read(uint8_t *buffer, size_t size) {
+    return (readSome(buffer, size));
+  }
+  size_t readSome(uint8_t *buffer, size_t size) {
+    if (reply_)
+    {
+      reply_ = false;
+      memcpy(buffer, "URSA2", std::min(size, size_t(5)));
+      return (std::min(size, size_t(5)));
+    }
+    if (!streaming_)
+      return (0);
+    size_t count = std::min(size, burst_);
+    for (size_t i = 0; i < count; i++)
+      buffer[i] = capture_[position_++ % capture_.size()];
+    return (count);
+  }
+  size_t write(const uint8_t *data, size_t size) {
+    if (data[0] == 'G')
+      streaming_ = true;
+    else if (data[0] == 'R')
+      streaming_ = false;
+    else if (data[0] == 'U')
+      reply_ = true;
+    return (size);
+  }
+  void flush() {
+  }
+};
+
+/** Events spread over the first 1024 channels with counts of 1 to 3, a battery frame and a stray byte,
+ * so the decoder also resynchronizes.
+ */
+std::vector<uint8_t> capture() {
+  std::vector<uint8_t> bytes;
+  for (size_t i = 0; i < 3000; i++)
+  {
+    uint16_t channel = (i * 37) % 1024;
+    uint8_t counts = 1 + i % 3;
+    bytes.push_back(0xff);
+    bytes.push_back(uint8_t((counts << 4) | (channel >> 8)));
+    bytes.push_back(uint8_t(channel & 0xff));
+  }
+  bytes.push_back(0xff);
+  bytes.push_back(0x02);
+  bytes.push_back(0x80);
+  bytes.push_back(0x12);
+  return (bytes);
+}
+
+//! Makes sure the counting allocator is in place, so a pass below means something.
+TEST(Allocation, Counted) {
+  counting = true;
+  std::string text(100, 'x');
+  counting = false;
+  EXPECT_EQ(1u, allocations);
+  allocations = 0;
+}
+
+/** Everything a consumer reads while acquiring: the decode pass and every snapshot the node takes. Every
+ * feature that adds work to the decode path is enabled.
+ */
+TEST(Allocation, SteadyStateAcquire) {
+  Interface ursa("emulated", 115200, new EmulatedUrsa(capture(), 1000));
+  ursa.connect();
+  ASSERT_TRUE(ursa.connected());
+
+  AlarmConfig alarm;
+  alarm.enable = true;
+  alarm.learn_seconds = 0.01;
+  AlarmRoi roi = { 100, 200 };
+  alarm.rois.push_back(roi);
+  ursa.setAlarmConfig(alarm);
+  ursa.setListMode(true, 256, 0.001);
+  std::vector<ChannelRange> rois(2);
+  rois[0].low = 0;
+  rois[0].high = 511;
+  rois[1].low = 300;
+  rois[1].high = 700;
+  ASSERT_TRUE(ursa.setRois(rois));
+  DoseCalibration dose;
+  dose.reference_gain = 70;
+  dose.energies.push_back(100);
+  dose.energies.push_back(1000);
+  dose.weights.push_back(0.003);
+  dose.weights.push_back(0.015);
+  ASSERT_TRUE(ursa.setDoseCalibration(dose));
+  ursa.setGain(70);
+  char shm_name[64];
+  snprintf(shm_name, sizeof(shm_name), "/ursa_test_allocation_%d", (int) getpid());
+  bool shm = ursa.setSharedMemory(shm_name, 4096, 0);
+
+  boost::array<uint32_t, 4096> spectrum;
+  boost::array<uint64_t, 4096> wide;
+  RoiCounts roi_counts;
+  DoseCounts dose_counts;
+  static EventBatch batch;
+  std::vector<AlarmEvent> events;
+  events.reserve(alarm_event_capacity);
+  uint32_t epoch;
+  size_t batches = 0;
+
+  ursa.startAcquire();
+  for (int pass = 0; pass < 2; pass++)
+  {
+    counting = (pass == 1);
+    for (int i = 0; i < 2000; i++)
+    {
+      ursa.read();
+      ursa.getSpectra(&spectrum, &epoch);
+      ursa.getWideSpectra(&wide, &epoch);
+      ursa.getRoiCounts(&roi_counts, &epoch);
+      ursa.getDose(&dose_counts, &epoch);
+      while (ursa.getEvents(&batch))
+        batches++;
+      events.clear();
+      ursa.getAlarmEvents(&events);
+      ursa.alive();
+      ursa.getReaderStats(false);
+    }
+    counting = false;
+  }
+  ursa.stopAcquire();
+  if (shm)
+    ursa.setSharedMemory("", 0, 0);
+
+  EXPECT_EQ(0u, allocations);
+  uint64_t total = 0;
+  for (size_t bin = 0; bin < wide.size(); bin++)
+    total += wide[bin];
+  EXPECT_GT(total, 1000000u);
+  EXPECT_GT(batches, 100u);
+  EXPECT_GT(roi_counts.counts[0], 0u);
+  EXPECT_TRUE(dose_counts.valid);
+  EXPECT_GT(dose_counts.dose, 0);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,283 @@
+/** Tests of the spectrum archive against brute force sums of the records written.
+ \file      test_archive.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/spectrum_archive.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace ursa;
+
+namespace
+{
+  const uint64_t ns_per_second = 1000000000ULL;
+  //! An unaligned start, so records straddle chunk and summary boundaries at odd offsets.
+  const uint64_t base_ns = 1500000000ULL * ns_per_second + 700000000ULL;
+
+  //! One record as written, kept for the brute force sums.
+  struct Record
+  {
+    uint64_t time_ns;
+    Spectrum counts;
+  };
+
+  /** A sparse spectrum with the first and last bins sometimes set and counts up to 2^28, so both short
+   * and long varints are written.  Some are entirely empty.
+   */
+  Spectrum randomSpectrum() {
+    Spectrum counts;
+    counts.fill(0);
+    if (std::rand() % 8 == 0)
+      return (counts);
+    int filled = std::rand() % 40;
+    for (int i = 0; i < filled; i++)
+      counts[std::rand() % spectrum_bins] += std::rand() % 200;
+    if (std::rand() % 4 == 0)
+      counts[0] = std::rand() % (1 << 28);
+    if (std::rand() % 4 == 0)
+      counts[spectrum_bins - 1] = std::rand() % (1 << 28);
+    return (counts);
+  }
+
+  //! Writes seconds of records every step_ns from base_ns, keeping every record in records.
+  void writeRecords(SpectrumArchiveWriter &writer, double seconds,
+                    uint64_t step_ns, std::vector<Record> *records) {
+    for (uint64_t t = 0; t < seconds * ns_per_second; t += step_ns)
+    {
+      Record record;
+      record.time_ns = base_ns + t;
+      record.counts = randomSpectrum();
+      ASSERT_TRUE(writer.append(record.time_ns, record.counts));
+      records->push_back(record);
+    }
+  }
+
+  //! Sums the records with a time in [start_ns, end_ns).
+  uint64_t bruteForce(const std::vector<Record> &records, uint64_t start_ns,
+                      uint64_t end_ns, WideSpectrum *sum) {
+    uint64_t count = 0;
+    sum->fill(0);
+    for (size_t i = 0; i < records.size(); i++)
+    {
+      if (records[i].time_ns < start_ns || records[i].time_ns >= end_ns)
+        continue;
+      widenAccumulate(sum->data(), records[i].counts.data(), spectrum_bins);
+      count++;
+    }
+    return (count);
+  }
+
+  //! Checks a query against the brute force sum of the same range.
+  void expectQuery(SpectrumArchiveReader &reader,
+                   const std::vector<Record> &records, uint64_t start_ns,
+                   uint64_t end_ns) {
+    WideSpectrum expected, sum;
+    uint64_t expected_records = bruteForce(records, start_ns, end_ns, &expected);
+    uint64_t queried = 0;
+    ASSERT_TRUE(reader.query(start_ns, end_ns, &sum, &queried));
+    EXPECT_EQ(expected_records, queried) << start_ns - base_ns << " to "
+        << end_ns - base_ns;
+    EXPECT_TRUE(expected == sum) << start_ns - base_ns << " to "
+        << end_ns - base_ns;
+  }
+
+  //! Range queries on whole blocks, on every chunk and summary edge, on record times and at random.
+  void expectQueries(SpectrumArchiveReader &reader,
+                     const std::vector<Record> &records) {
+    const std::vector<ArchiveBlockInfo> &index = reader.index();
+    uint64_t first = records.front().time_ns;
+    uint64_t last = records.back().time_ns;
+    expectQuery(reader, records, 0, ~0ULL);
+    expectQuery(reader, records, first, last);
+    expectQuery(reader, records, first, last + 1);
+    for (size_t i = 0; i < index.size(); i++)
+    {
+      expectQuery(reader, records, index[i].start_ns, index[i].end_ns);
+      expectQuery(reader, records, index[i].start_ns - 1, index[i].end_ns + 1);
+      expectQuery(reader, records, index[i].start_ns + 1, index[i].end_ns - 1);
+      for (size_t j = i + 1; j < index.size(); j += 3)
+        expectQuery(reader, records, index[i].start_ns, index[j].end_ns);
+    }
+    for (int i = 0; i < 200; i++)
+    {
+      uint64_t a = first + uint64_t(std::rand()) * 1000 % (last - first + 1);
+      uint64_t b = first + uint64_t(std::rand()) * 1000 % (last - first + 1);
+      expectQuery(reader, records, std::min(a, b), std::max(a, b));
+      const Record &record = records[std::rand() % records.size()];
+      expectQuery(reader, records, record.time_ns, record.time_ns + 1);
+      expectQuery(reader, records, record.time_ns, std::max(a, b) + 1);
+    }
+  }
+
+  //! Checks that next() returns every record in order with its exact counts.
+  void expectRecords(SpectrumArchiveReader &reader,
+                     const std::vector<Record> &records) {
+    reader.rewind();
+    uint64_t time_ns;
+    WideSpectrum counts;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+      ASSERT_TRUE(reader.next(&time_ns, &counts)) << i;
+      EXPECT_EQ(records[i].time_ns, time_ns);
+      WideSpectrum expected;
+      expected.fill(0);
+      widenAccumulate(expected.data(), records[i].counts.data(), spectrum_bins);
+      EXPECT_TRUE(expected == counts) << i;
+    }
+    EXPECT_FALSE(reader.next(&time_ns, &counts));
+  }
+
+  //! A unique temporary path.
+  std::string tempPath() {
+    char path[] = "/tmp/ursa_archive_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0)
+      ::close(fd);
+    return (path);
+  }
+}
+
+//! 2 s chunks in 10 s summaries, written every 0.3 s for a minute and closed with an index.
+TEST(Archive, QueriesMatchBruteForce) {
+  std::srand(30);
+  std::string path = tempPath();
+  std::vector<Record> records;
+  {
+    SpectrumArchiveWriter writer(2, 10);
+    ASSERT_TRUE(writer.open(path));
+    writeRecords(writer, 60, 300000000ULL, &records);
+    writer.close();
+  }
+
+  SpectrumArchiveReader reader;
+  ASSERT_TRUE(reader.open(path));
+  size_t chunks = 0, summaries = 0;
+  for (size_t i = 0; i < reader.index().size(); i++)
+  {
+    chunks += (reader.index()[i].kind == ARCHIVE_CHUNK);
+    summaries += (reader.index()[i].kind == ARCHIVE_SUMMARY);
+  }
+  EXPECT_EQ(31u, chunks);
+  EXPECT_EQ(7u, summaries);
+  expectRecords(reader, records);
+  expectQueries(reader, records);
+  unlink(path.c_str());
+}
+
+//! Without an index, after a flush or with the index cut off, the block headers are scanned instead.
+TEST(Archive, ScanWithoutIndex) {
+  std::srand(31);
+  std::string path = tempPath();
+  std::vector<Record> records;
+  SpectrumArchiveWriter writer(2, 10);
+  ASSERT_TRUE(writer.open(path));
+  writeRecords(writer, 25, 700000000ULL, &records);
+  writer.flush();
+  {
+    SpectrumArchiveReader reader;
+    ASSERT_TRUE(reader.open(path));
+    expectRecords(reader, records);
+    expectQueries(reader, records);
+  }
+
+  // Cut the file part way into the last block, the final summary, so the index and footer are lost too.
+  writer.close();
+  std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+  uint64_t size = file.tellg();
+  uint8_t footer[8];
+  file.seekg(size - 16);
+  file.read((char *) footer, sizeof(footer));
+  file.close();
+  uint64_t index_offset = 0;
+  for (int i = 7; i >= 0; i--)
+    index_offset = (index_offset << 8) | footer[i];
+  ASSERT_EQ(0, truncate(path.c_str(), index_offset - 3));
+  SpectrumArchiveReader reader;
+  ASSERT_TRUE(reader.open(path));
+  expectRecords(reader, records);
+  expectQueries(reader, records);
+  unlink(path.c_str());
+}
+
+//! appendCumulative() stores differences, and a bin going down means a clear so the spectrum is stored as is.
+TEST(Archive, AppendCumulative) {
+  std::string path = tempPath();
+  SpectrumArchiveWriter writer(2, 10);
+  ASSERT_TRUE(writer.open(path));
+  WideSpectrum cumulative;
+  cumulative.fill(0);
+  cumulative[5] = 100;
+  cumulative[4095] = 1ULL << 40;
+  ASSERT_TRUE(writer.appendCumulative(base_ns, cumulative));
+  cumulative[5] += 7;
+  cumulative[6] += 3;
+  ASSERT_TRUE(writer.appendCumulative(base_ns + ns_per_second, cumulative));
+  cumulative[6] += 1;
+  ASSERT_TRUE(writer.appendCumulative(base_ns + 2 * ns_per_second, cumulative));
+  cumulative.fill(0);
+  cumulative[9] = 2;
+  ASSERT_TRUE(writer.appendCumulative(base_ns + 3 * ns_per_second, cumulative));
+  EXPECT_FALSE(writer.appendCumulative(base_ns, cumulative));
+  writer.close();
+
+  SpectrumArchiveReader reader;
+  ASSERT_TRUE(reader.open(path));
+  uint64_t time_ns;
+  WideSpectrum counts;
+  ASSERT_TRUE(reader.next(&time_ns, &counts));
+  EXPECT_EQ(base_ns + ns_per_second, time_ns);
+  EXPECT_EQ(7u, counts[5]);
+  EXPECT_EQ(3u, counts[6]);
+  EXPECT_EQ(0u, counts[4095]);
+  ASSERT_TRUE(reader.next(&time_ns, &counts));
+  EXPECT_EQ(0u, counts[5]);
+  EXPECT_EQ(1u, counts[6]);
+  ASSERT_TRUE(reader.next(&time_ns, &counts));
+  EXPECT_EQ(base_ns + 3 * ns_per_second, time_ns);
+  EXPECT_EQ(0u, counts[5]);
+  EXPECT_EQ(2u, counts[9]);
+  EXPECT_FALSE(reader.next(&time_ns, &counts));
+
+  WideSpectrum sum;
+  uint64_t records;
+  ASSERT_TRUE(reader.query(0, ~0ULL, &sum, &records));
+  EXPECT_EQ(3u, records);
+  EXPECT_EQ(7u, sum[5]);
+  EXPECT_EQ(4u, sum[6]);
+  EXPECT_EQ(2u, sum[9]);
+  unlink(path.c_str());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,125 @@
+/** Tests pinning the wire bytes of every command sent by the ursa::Interface class.
+ \file      test_commands.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/ursa_driver.h>
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace ursa;
+
+//! Returns the encoded bytes as a string so failures print the whole command.
+std::string bytes(const Command &cmd) {
+  return (std::string((const char *) cmd.data, cmd.size));
+}
+
+TEST(Commands, SingleByte) {
+  EXPECT_EQ("G", bytes(commands::StartAcquire::encode()));
+  EXPECT_EQ("R", bytes(commands::StopAcquire::encode()));
+  EXPECT_EQ("J", bytes(commands::StartGM::encode()));
+  EXPECT_EQ("j", bytes(commands::StopGM::encode()));
+  EXPECT_EQ("c", bytes(commands::RequestCounts::encode()));
+  EXPECT_EQ("v", bytes(commands::StopVoltage::encode()));
+  EXPECT_EQ("B", bytes(commands::RequestBatt::encode()));
+  EXPECT_EQ("A", bytes(commands::StartASCII::encode()));
+  EXPECT_EQ("N", bytes(commands::StopASCII::encode()));
+  EXPECT_EQ("U", bytes(commands::CheckComms::encode()));
+  EXPECT_EQ("@", bytes(commands::RequestSerialNumber::encode()));
+  EXPECT_EQ("2", bytes(commands::RequestMaxHV::encode()));
+  EXPECT_EQ("r", bytes(commands::LoadPrevSettings::encode()));
+  EXPECT_EQ("d", bytes(commands::SetNoSave::encode()));
+  EXPECT_EQ("p", bytes(commands::NoRamp::encode()));
+  EXPECT_EQ("Z", bytes(commands::EnableAlarm0::encode()));
+  EXPECT_EQ("z", bytes(commands::DisableAlarm0::encode()));
+  EXPECT_EQ("W", bytes(commands::EnableAlarm1::encode()));
+  EXPECT_EQ("w", bytes(commands::DisableAlarm1::encode()));
+  EXPECT_EQ("#", bytes(commands::SetSerialNumber::encode()));
+}
+
+TEST(Commands, Append) {
+  Command cmd = commands::StopAcquire::encode();
+  cmd.append(commands::StopVoltage::encode());
+  EXPECT_EQ("Rv", bytes(cmd));
+}
+
+TEST(Commands, SetVoltage) {
+  EXPECT_EQ(std::string("V\x73\x31", 3), bytes(commands::setVoltage(900)));
+  EXPECT_EQ(std::string("V\xFF\xFC", 3), bytes(commands::setVoltage(2000)));
+  EXPECT_EQ(std::string("V\x00\x00", 3), bytes(commands::setVoltage(0)));
+}
+
+TEST(Commands, SetRamp) {
+  EXPECT_EQ(std::string("P\x02\x70", 3), bytes(commands::setRamp(6)));
+  EXPECT_EQ(std::string("P\x41\xC6", 3), bytes(commands::setRamp(60)));
+  EXPECT_EQ(std::string("P\x41\xC6", 3), bytes(commands::setRamp(219)));
+}
+
+TEST(Commands, SetGain) {
+  commands::GainSetting setting;
+  ASSERT_TRUE(commands::gainSetting(70, &setting));
+  EXPECT_EQ(125, commands::coarseGain(setting.coarse));
+  EXPECT_EQ(std::string("C4F\x8E", 4), bytes(commands::setGain(setting)));
+
+  ASSERT_TRUE(commands::gainSetting(1, &setting));
+  EXPECT_EQ(std::string("C0F\x7F", 4), bytes(commands::setGain(setting)));
+
+  ASSERT_TRUE(commands::gainSetting(10, &setting));
+  EXPECT_EQ(std::string("C2F\xAA", 4), bytes(commands::setGain(setting)));
+
+  ASSERT_TRUE(commands::gainSetting(249, &setting));
+  EXPECT_EQ(std::string("C5F\xFE", 4), bytes(commands::setGain(setting)));
+
+  EXPECT_FALSE(commands::gainSetting(250, &setting));
+}
+
+TEST(Commands, SetThresholdOffset) {
+  EXPECT_EQ(std::string("T\x0C\x80\x64", 4),
+            bytes(commands::setThresholdOffset(100)));
+  EXPECT_EQ(std::string("T\x3E\x81\xF4", 4),
+            bytes(commands::setThresholdOffset(500)));
+  EXPECT_EQ(std::string("T\x03\x20\x64", 4),
+            bytes(commands::setThresholdOffset(25)));
+}
+
+TEST(Commands, Digits) {
+  EXPECT_EQ("I0", bytes(commands::SetInput::encode(INPUT1NEG)));
+  EXPECT_EQ("I4", bytes(commands::SetInput::encode(INPUTXPOS)));
+  EXPECT_EQ("S2", bytes(commands::SetShapingTime::encode(TIME1uS)));
+  EXPECT_EQ("S7", bytes(commands::SetShapingTime::encode(TIME10uS)));
+  EXPECT_EQ("M1", bytes(commands::setBitMode(12)));
+  EXPECT_EQ("M5", bytes(commands::setBitMode(8)));
+  EXPECT_EQ("X3", bytes(commands::SetSmudgeFactor::encode(3)));
+}
+
+TEST(Commands, SerialNumber) {
+  EXPECT_EQ("212345", bytes(commands::SerialNumberValue::encode(212345)));
+  EXPECT_EQ("200000", bytes(commands::SerialNumberValue::encode(200000)));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,190 @@
+/** Compares the dose counter with dose summed channel by channel from the calibration.
+ \file      test_dose_rate.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/dose_rate.h>
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+
+using namespace ursa;
+
+//! G(E) straight from the knots: log-log between positive knots, linear next to a zero, held at the ends.
+double responseAt(const DoseCalibration &calibration, double energy) {
+  const std::vector<double> &e = calibration.energies;
+  const std::vector<double> &w = calibration.weights;
+  if (energy <= 0)
+    return (0);
+  if (energy <= e.front())
+    return (w.front());
+  if (energy >= e.back())
+    return (w.back());
+  size_t k = 1;
+  while (e[k] < energy)
+    k++;
+  if (w[k - 1] > 0 && w[k] > 0)
+    return (std::exp(std::log(w[k - 1])
+        + (std::log(w[k]) - std::log(w[k - 1])) * (std::log(energy) - std::log(e[k - 1]))
+            / (std::log(e[k]) - std::log(e[k - 1]))));
+  return (w[k - 1] + (w[k] - w[k - 1]) * (energy - e[k - 1]) / (e[k] - e[k - 1]));
+}
+
+class DoseCounterTest : public testing::Test
+{
+protected:
+  DoseCalibration calibration_;
+  DoseCounter counter_;
+  std::vector<uint64_t> bins_; //!< The spectrum of the events given to the counter.
+  uint64_t state_; //!< The pseudo random sequence, fixed so failures repeat.
+
+  //! 3 keV channels at gain 1 and 12 bits, with a zero weight knot and channels below zero energy.
+  void SetUp() {
+    calibration_.offset_kev = -10;
+    calibration_.kev_per_channel = 3;
+    calibration_.reference_gain = 1;
+    calibration_.reference_bits = 12;
+    const double energies[] = { 30, 50, 100, 300, 662, 1500, 3000 };
+    const double weights[] = { 0, 0.02, 0.05, 0.3, 0.9, 2.5, 4 };
+    calibration_.energies.assign(energies, energies + 7);
+    calibration_.weights.assign(weights, weights + 7);
+    bins_.assign(spectrum_bins, 0);
+    state_ = 1357;
+  }
+
+  uint32_t random(uint32_t limit) {
+    state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t(state_ >> 33) % limit);
+  }
+
+  //! Counts events into the counter, when it is valid as the Interface does, and into the spectrum.
+  void addEvents(size_t events) {
+    for (size_t i = 0; i < events; i++)
+    {
+      uint16_t channel = uint16_t(random(spectrum_bins));
+      uint32_t counts = 1 + random(15);
+      if (counter_.valid())
+        counter_.add(channel, counts);
+      bins_[channel] += counts;
+    }
+  }
+
+  //! Checks the totals against the spectrum weighted channel by channel at the given settings.
+  void expectDose(double gain, int bits) {
+    double width = calibration_.kev_per_channel * calibration_.reference_gain / gain
+        * std::pow(2.0, calibration_.reference_bits - bits);
+    uint64_t events = 0;
+    double dose = 0;
+    double variance = 0;
+    for (size_t c = 0; c < spectrum_bins; c++)
+    {
+      double weight = responseAt(calibration_, calibration_.offset_kev + width * c);
+      events += bins_[c];
+      dose += weight * bins_[c];
+      variance += weight * weight * bins_[c];
+    }
+    DoseCounts counts;
+    counter_.read(&counts);
+    EXPECT_TRUE(counts.valid);
+    EXPECT_EQ(events, counts.counts);
+    EXPECT_NEAR(dose, counts.dose, dose * 1e-12);
+    EXPECT_NEAR(variance, counts.variance, variance * 1e-12);
+  }
+};
+
+TEST_F(DoseCounterTest, InvalidWithoutResponse) {
+  addEvents(1000);
+  DoseCounts counts;
+  counter_.read(&counts);
+  EXPECT_FALSE(counts.valid);
+  EXPECT_EQ(0u, counts.counts);
+
+  ASSERT_TRUE(counter_.configure(calibration_));
+  EXPECT_FALSE(counter_.valid());
+  counter_.setResponse(0, 12);
+  EXPECT_FALSE(counter_.valid());
+  counter_.setResponse(1, 12);
+  EXPECT_TRUE(counter_.valid());
+  counter_.setResponse(0, 12);
+  EXPECT_FALSE(counter_.valid());
+}
+
+TEST_F(DoseCounterTest, MatchesChannelSums) {
+  ASSERT_TRUE(counter_.configure(calibration_));
+  counter_.setResponse(1, 12);
+  addEvents(500000);
+  expectDose(1, 12);
+}
+
+//! A higher gain narrows the channels and each bit fewer doubles their width.
+TEST_F(DoseCounterTest, FollowsSettings) {
+  ASSERT_TRUE(counter_.configure(calibration_));
+  const double gains[] = { 2.5, 0.7, 1 };
+  const int bits[] = { 12, 11, 10 };
+  for (size_t k = 0; k < 3; k++)
+  {
+    SCOPED_TRACE(k);
+    ASSERT_TRUE(counter_.configure(calibration_));
+    bins_.assign(spectrum_bins, 0);
+    counter_.setResponse(gains[k], bits[k]);
+    addEvents(200000);
+    expectDose(gains[k], bits[k]);
+  }
+}
+
+//! Channel 224 sits exactly on the 662 keV knot at the reference settings, and channel 0 is below zero energy.
+TEST_F(DoseCounterTest, KnotWeight) {
+  ASSERT_TRUE(counter_.configure(calibration_));
+  counter_.setResponse(1, 12);
+  counter_.add(224, 3);
+  counter_.add(0, 5);
+  DoseCounts counts;
+  counter_.read(&counts);
+  EXPECT_DOUBLE_EQ(2.7, counts.dose);
+  EXPECT_DOUBLE_EQ(2.43, counts.variance);
+  EXPECT_EQ(8u, counts.counts);
+}
+
+TEST_F(DoseCounterTest, RejectsInvalid) {
+  DoseCalibration bad = calibration_;
+  bad.weights.pop_back();
+  EXPECT_FALSE(counter_.configure(bad));
+  bad = calibration_;
+  bad.energies[2] = bad.energies[1];
+  EXPECT_FALSE(counter_.configure(bad));
+  bad = calibration_;
+  bad.weights[3] = -1;
+  EXPECT_FALSE(counter_.configure(bad));
+  bad = calibration_;
+  bad.kev_per_channel = 0;
+  EXPECT_FALSE(counter_.configure(bad));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
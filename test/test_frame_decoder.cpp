@@ -0,0 +1,179 @@
+/** Tests that captures split at frame boundaries decode exactly as they do whole.
+ \file      test_frame_decoder.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/frame_decoder.h>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+
+using namespace ursa;
+
+namespace
+{
+  //! What decodeFrames() found, summed the way ursa_reprocess sums its chunks.
+  struct Totals
+  {
+    std::vector<uint64_t> counts;
+    uint64_t events;
+    uint64_t battery_frames;
+    uint64_t dropped_bytes;
+
+    Totals() :
+        counts(1024, 0), events(0), battery_frames(0), dropped_bytes(0) {
+    }
+    void event(size_t end, uint16_t channel, uint8_t count) {
+      counts[channel] += count;
+      events++;
+    }
+    void battery(uint16_t reading) {
+      battery_frames++;
+    }
+    void dropped(uint32_t bytes) {
+      dropped_bytes += bytes;
+    }
+  };
+
+  /** A capture that is mostly 0xff: runs of sync bytes, frames with 0xff data bytes, battery frames,
+   * valid events and short runs of garbage, so both aligned and misaligned decodes are common.
+   */
+  std::vector<uint8_t> randomCapture(size_t length) {
+    std::vector<uint8_t> bytes;
+    while (bytes.size() < length)
+    {
+      switch (std::rand() % 6)
+      {
+        case 0:
+          bytes.insert(bytes.end(), 1 + std::rand() % 4, frame_sync);
+          break;
+        case 1:
+          bytes.push_back(frame_sync);
+          bytes.push_back(std::rand() % 2 ? frame_sync : uint8_t(std::rand()));
+          bytes.push_back(std::rand() % 2 ? frame_sync : uint8_t(std::rand()));
+          break;
+        case 2:
+          bytes.push_back(frame_sync);
+          bytes.push_back(std::rand() % 4);
+          bytes.push_back(std::rand() % 256);
+          break;
+        case 3:
+          for (int garbage = 1 + std::rand() % 3; garbage > 0; garbage--)
+            bytes.push_back(std::rand() % 2 ? frame_sync : uint8_t(std::rand() % 255));
+          break;
+        default:
+          bytes.push_back(frame_sync);
+          bytes.push_back(uint8_t(0x10 + std::rand() % 0xef));
+          bytes.push_back(std::rand() % 255);
+          break;
+      }
+    }
+    bytes.resize(length);
+    return (bytes);
+  }
+
+  //! Returns every point findFrameBoundary() can return in the capture, in order.
+  std::vector<size_t> boundaries(const std::vector<uint8_t> &bytes) {
+    std::vector<size_t> points;
+    size_t from = 0;
+    while (true)
+    {
+      size_t point = findFrameBoundary(&bytes[0], bytes.size(), from);
+      if (point >= bytes.size())
+        break;
+      points.push_back(point);
+      from = point - frame_size + 1;
+    }
+    return (points);
+  }
+
+  /** Decodes [begin, end) into totals.  A piece that does not end the capture counts what it leaves
+   * undecoded as dropped, as ursa_reprocess does.
+   * @return The offset decoding stopped at.
+   */
+  size_t decodePiece(const std::vector<uint8_t> &bytes, size_t begin,
+                     size_t end, Totals *totals) {
+    size_t used = decodeFrames(&bytes[0] + begin, end - begin, *totals);
+    if (end < bytes.size())
+      totals->dropped_bytes += end - begin - used;
+    return (begin + used);
+  }
+
+  void expectEqual(const Totals &whole, const Totals &split) {
+    EXPECT_EQ(whole.events, split.events);
+    EXPECT_EQ(whole.battery_frames, split.battery_frames);
+    EXPECT_EQ(whole.dropped_bytes, split.dropped_bytes);
+    EXPECT_TRUE(whole.counts == split.counts);
+  }
+}
+
+//! Splitting at any one boundary, or at all of them, gives the whole decode's spectrum and dropped bytes.
+TEST(FrameDecoder, SplitAtBoundaries) {
+  std::srand(48);
+  size_t points_tested = 0;
+  for (int capture = 0; capture < 20; capture++)
+  {
+    std::vector<uint8_t> bytes = randomCapture(2000 + std::rand() % 2000);
+    Totals whole;
+    size_t whole_end = decodePiece(bytes, 0, bytes.size(), &whole);
+    ASSERT_GT(whole.events, 0u);
+    ASSERT_GT(whole.dropped_bytes, 0u);
+
+    std::vector<size_t> points = boundaries(bytes);
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      Totals split;
+      decodePiece(bytes, 0, points[i], &split);
+      EXPECT_EQ(whole_end, decodePiece(bytes, points[i], bytes.size(), &split));
+      expectEqual(whole, split);
+      points_tested++;
+    }
+
+    Totals pieces;
+    size_t begin = 0;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      decodePiece(bytes, begin, points[i], &pieces);
+      begin = points[i];
+    }
+    EXPECT_EQ(whole_end, decodePiece(bytes, begin, bytes.size(), &pieces));
+    expectEqual(whole, pieces);
+  }
+  EXPECT_GT(points_tested, 1000u);
+}
+
+//! A point is a sync byte right after a frame with no sync in its data, and there is none past the last.
+TEST(FrameDecoder, BoundaryPoints) {
+  const uint8_t bytes[] = { 0xff, 0xff, 0x12, 0xff, 0x34, 0x56, 0xff, 0x10, 0x20 };
+  EXPECT_EQ(6u, findFrameBoundary(bytes, sizeof(bytes), 0));
+  EXPECT_EQ(sizeof(bytes), findFrameBoundary(bytes, sizeof(bytes), 4));
+  EXPECT_EQ(5u, findFrameBoundary(bytes, 5, 0));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
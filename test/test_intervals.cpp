@@ -0,0 +1,213 @@
+/** Tests of the spectrum intervals taken by swapSpectra() while the reader thread decodes a replay.
+ \file      test_intervals.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/ursa_driver.h>
+#include <gtest/gtest.h>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace ursa;
+
+/** Writes a capture of events cycling through the first 1024 channels with a count of 1.
+ * @return The capture's path, or an empty string if it could not be written.
+ */
+std::string writeCapture(size_t events) {
+  std::vector<uint8_t> data;
+  for (size_t i = 0; i < events; i++)
+  {
+    uint16_t channel = i % 1024;
+    data.push_back(0xff);
+    data.push_back(uint8_t((1 << 4) | (channel >> 8)));
+    data.push_back(uint8_t(channel & 0xff));
+  }
+  char path[] = "/tmp/ursa_replay_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return ("");
+  bool written = (::write(fd, &data[0], data.size()) == (ssize_t) data.size());
+  ::close(fd);
+  if (!written)
+  {
+    unlink(path);
+    return ("");
+  }
+  return (path);
+}
+
+/** Takes intervals while the reader thread decodes a paced replay.  Every event lands in exactly one
+ * interval, and the intervals are numbered and timed back to back.
+ */
+TEST(Intervals, SwapIntervals) {
+  const size_t events = 20000;
+  std::string path = writeCapture(events);
+  ASSERT_FALSE(path.empty());
+
+  Interface ursa(path.c_str(), 115200, new ReplayTransport(4.0));
+  ursa.connect();
+  ASSERT_TRUE(ursa.connected());
+  ursa.startAcquire();
+  ASSERT_TRUE(ursa.startReader(RealtimeOptions()));
+
+  boost::array<uint64_t, 4096> bins;
+  SpectrumInterval interval;
+  SpectrumInterval last;
+  last.sequence = 0;
+  last.end_ns = 0;
+  uint64_t total = 0;
+  size_t busy = 0;
+  for (int i = 0; i < 4000 && total < events; i++)
+  {
+    usleep(1000);
+    ursa.swapSpectra(&bins, &interval);
+    uint64_t counts = 0;
+    for (size_t bin = 0; bin < bins.size(); bin++)
+      counts += bins[bin];
+    EXPECT_EQ(counts, interval.counts);
+    EXPECT_EQ(last.sequence + 1, interval.sequence);
+    if (last.end_ns)
+    {
+      EXPECT_EQ(last.end_ns, interval.start_ns);
+    }
+    EXPECT_GE(interval.end_ns, interval.start_ns);
+    if (counts)
+      busy++;
+    total += counts;
+    last = interval;
+    ursa.getWideSpectra(&bins);
+    uint64_t cumulative = 0;
+    for (size_t bin = 0; bin < bins.size(); bin++)
+      cumulative += bins[bin];
+    EXPECT_GE(cumulative, total);
+  }
+  ursa.stopReader();
+  EXPECT_EQ(events, total);
+  EXPECT_GT(busy, 10u);
+  ursa.getWideSpectra(&bins);
+  for (size_t bin = 0; bin < 1024; bin++)
+    EXPECT_EQ(events / 1024 + (bin < events % 1024), bins[bin]);
+  unlink(path.c_str());
+}
+
+//! The intervals a Swapper took.
+struct TakenInterval
+{
+  SpectrumInterval interval;
+  boost::array<uint64_t, 4096> bins;
+};
+
+//! Takes an interval every millisecond until stopped.
+void takeIntervals(Interface *ursa, boost::atomic<bool> *running,
+                   std::vector<TakenInterval> *taken) {
+  TakenInterval next;
+  while (running->load())
+  {
+    usleep(1000);
+    ursa->swapSpectra(&next.bins, &next.interval);
+    taken->push_back(next);
+  }
+}
+
+/** A clearing reconfigure() while another thread takes intervals.  No interval spans the clear: those
+ * taken after it have the new epoch and the cumulative spectrum is exactly their sum, while those taken
+ * before it keep the old epoch and are gone from the cumulative spectrum.
+ */
+TEST(Intervals, ReconfigureClearsBetweenSwaps) {
+  const size_t events = 20000;
+  std::string path = writeCapture(events);
+  ASSERT_FALSE(path.empty());
+
+  Interface ursa(path.c_str(), 115200, new ReplayTransport(4.0));
+  ursa.connect();
+  ASSERT_TRUE(ursa.connected());
+  ursa.startAcquire();
+  ASSERT_TRUE(ursa.startReader(RealtimeOptions()));
+  uint32_t old_epoch = ursa.getEpoch();
+
+  boost::atomic<bool> running(true);
+  std::vector<TakenInterval> taken;
+  taken.reserve(5000);
+  boost::thread swapper(boost::bind(&takeIntervals, &ursa, &running, &taken));
+  usleep(300000);
+  AcquisitionSettings settings;
+  settings.set_gain = true;
+  settings.gain = 2;
+  ReconfigureResult result = ursa.reconfigure(settings, true);
+  ASSERT_TRUE(result.success);
+  EXPECT_EQ(old_epoch + 1, result.epoch);
+  usleep(2000000);
+  running.store(false);
+  swapper.join();
+  ursa.stopReader();
+  TakenInterval last;
+  ursa.swapSpectra(&last.bins, &last.interval);
+  taken.push_back(last);
+
+  boost::array<uint64_t, 4096> after;
+  after.fill(0);
+  uint64_t before_counts = 0;
+  uint64_t after_counts = 0;
+  for (size_t i = 0; i < taken.size(); i++)
+  {
+    const SpectrumInterval &interval = taken[i].interval;
+    EXPECT_EQ(i + 1, interval.sequence);
+    if (i > 0)
+    {
+      EXPECT_GE(interval.epoch, taken[i - 1].interval.epoch);
+    }
+    if (interval.epoch == old_epoch)
+      before_counts += interval.counts;
+    else
+    {
+      EXPECT_EQ(result.epoch, interval.epoch);
+      after_counts += interval.counts;
+      for (size_t bin = 0; bin < after.size(); bin++)
+        after[bin] += taken[i].bins[bin];
+    }
+  }
+  EXPECT_GT(before_counts, 0u);
+  EXPECT_GT(after_counts, 0u);
+  EXPECT_LE(before_counts + after_counts, events);
+
+  boost::array<uint64_t, 4096> cumulative;
+  uint32_t epoch;
+  ursa.getWideSpectra(&cumulative, &epoch);
+  EXPECT_EQ(result.epoch, epoch);
+  for (size_t bin = 0; bin < cumulative.size(); bin++)
+    ASSERT_EQ(after[bin], cumulative[bin]) << "bin " << bin;
+  unlink(path.c_str());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,157 @@
+/** Tests how the list mode buffer closes batches and when it drops events.
+ \file      test_list_mode.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/list_mode.h>
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+
+using namespace ursa;
+
+class ListModeTest : public testing::Test
+{
+protected:
+  ListModeBuffer buffer_;
+  EventBatch batch_;
+
+  //! Adds count events a microsecond apart, numbering their channels from first.
+  void addEvents(uint64_t start_ns, size_t first, size_t count) {
+    for (size_t i = 0; i < count; i++)
+      buffer_.add(start_ns + 1000 * i, uint16_t((first + i) & 0xfff), uint8_t(1 + i % 15));
+  }
+};
+
+TEST_F(ListModeTest, DisabledRecordsNothing) {
+  buffer_.configure(false, 1, 0);
+  EXPECT_FALSE(buffer_.enabled());
+  addEvents(1000000000ULL, 0, 10);
+  buffer_.poll(2000000000ULL);
+  EXPECT_FALSE(buffer_.take(&batch_));
+}
+
+TEST_F(ListModeTest, BatchSizeCloses) {
+  buffer_.configure(true, 4, 0);
+  addEvents(1000000000ULL, 0, 3);
+  EXPECT_FALSE(buffer_.take(&batch_));
+  buffer_.add(1000003000ULL, 3, 4);
+  ASSERT_TRUE(buffer_.take(&batch_));
+  EXPECT_EQ(0u, batch_.sequence);
+  EXPECT_EQ(0u, batch_.dropped);
+  EXPECT_EQ(1000000000ULL, batch_.start_ns);
+  ASSERT_EQ(4u, batch_.size);
+  for (size_t i = 0; i < 4; i++)
+  {
+    EXPECT_EQ(1000 * i, batch_.offsets[i]);
+    EXPECT_EQ(i, batch_.channels[i]);
+    EXPECT_EQ(1 + i, batch_.counts[i]);
+  }
+  EXPECT_FALSE(buffer_.take(&batch_));
+
+  addEvents(2000000000ULL, 4, 4);
+  ASSERT_TRUE(buffer_.take(&batch_));
+  EXPECT_EQ(1u, batch_.sequence);
+  EXPECT_EQ(4u, batch_.channels[0]);
+}
+
+TEST_F(ListModeTest, LatencyCloses) {
+  buffer_.configure(true, 100, 0.5);
+  addEvents(1000000000ULL, 0, 3);
+  buffer_.poll(1499999999ULL);
+  EXPECT_FALSE(buffer_.take(&batch_));
+  buffer_.poll(1500000000ULL);
+  ASSERT_TRUE(buffer_.take(&batch_));
+  EXPECT_EQ(3u, batch_.size);
+
+  // Without a latency bound only the batch size closes a batch.
+  buffer_.configure(true, 100, 0);
+  addEvents(1000000000ULL, 0, 3);
+  buffer_.poll(100000000000ULL);
+  EXPECT_FALSE(buffer_.take(&batch_));
+}
+
+/** With the ready slot full the filling batch grows to event_batch_capacity and then drops.  Taking the
+ * ready batch closes the held back batch at once, carrying the drop count.
+ */
+TEST_F(ListModeTest, FullReadySlotDrops) {
+  buffer_.configure(true, 2, 0);
+  addEvents(1000000000ULL, 0, 2);
+  addEvents(1000002000ULL, 2, event_batch_capacity + 3);
+
+  ASSERT_TRUE(buffer_.take(&batch_));
+  EXPECT_EQ(0u, batch_.sequence);
+  EXPECT_EQ(2u, batch_.size);
+  ASSERT_TRUE(buffer_.take(&batch_));
+  EXPECT_EQ(1u, batch_.sequence);
+  EXPECT_EQ(3u, batch_.dropped);
+  ASSERT_EQ(event_batch_capacity, batch_.size);
+  EXPECT_EQ(2u, batch_.channels[0]);
+  EXPECT_EQ((event_batch_capacity + 1) & 0xfff, batch_.channels[event_batch_capacity - 1]);
+  EXPECT_FALSE(buffer_.take(&batch_));
+}
+
+/** An offset past 32 bits closes the batch.  When the ready slot is full the event is dropped instead
+ * of being stored with a truncated offset.
+ */
+TEST_F(ListModeTest, OverflowDrops) {
+  const uint64_t start = 1000000000ULL;
+  const uint64_t later = start + 5000000000ULL;
+  buffer_.configure(true, 3, 0);
+  buffer_.add(start, 1, 1);
+  buffer_.add(later, 2, 1);
+  buffer_.add(later + 1, 3, 1);
+  buffer_.add(later + 5000000000ULL, 4, 1);
+  buffer_.add(later + 2, 5, 1);
+
+  ASSERT_TRUE(buffer_.take(&batch_));
+  EXPECT_EQ(start, batch_.start_ns);
+  ASSERT_EQ(1u, batch_.size);
+  EXPECT_EQ(0u, batch_.dropped);
+
+  ASSERT_TRUE(buffer_.take(&batch_));
+  EXPECT_EQ(later, batch_.start_ns);
+  EXPECT_EQ(1u, batch_.dropped);
+  ASSERT_EQ(3u, batch_.size);
+  for (size_t i = 0; i < 3; i++)
+    EXPECT_EQ(i, batch_.offsets[i]);
+  EXPECT_EQ(2u, batch_.channels[0]);
+  EXPECT_EQ(5u, batch_.channels[2]);
+}
+
+//! Time going backwards within a batch is clamped to its start.
+TEST_F(ListModeTest, BackwardsTimeClamped) {
+  buffer_.configure(true, 2, 0);
+  buffer_.add(1000000000ULL, 1, 1);
+  buffer_.add(999999000ULL, 2, 1);
+  ASSERT_TRUE(buffer_.take(&batch_));
+  ASSERT_EQ(2u, batch_.size);
+  EXPECT_EQ(0u, batch_.offsets[1]);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,150 @@
+/** Tests the Logger's per class rate limits and aggregated counters.
+ \file      test_log.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/ursa_log.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace ursa;
+
+//! Keeps every message written.  The Logger serializes writes so no locking is needed.
+class CaptureSink : public LogSink
+{
+public:
+  std::vector<std::pair<log_level, std::string> > messages;
+
+  void write(log_level level, const char *msg) {
+    messages.push_back(std::make_pair(level, std::string(msg)));
+  }
+  //! Returns the number of messages starting with prefix.
+  size_t count(const std::string &prefix) const {
+    size_t n = 0;
+    for (size_t i = 0; i < messages.size(); i++)
+      if (messages[i].second.compare(0, prefix.size(), prefix) == 0)
+        n++;
+    return (n);
+  }
+};
+
+/** The interval is made long enough that only flush() ends it, so the test decides when the rate
+ * limits reset and the aggregates are reported.
+ */
+class LoggerTest : public testing::Test
+{
+protected:
+  Logger logger_;
+  CaptureSink sink_;
+
+  void SetUp() {
+    logger_.setInterval(1000);
+    logger_.flush();
+    logger_.setSink(&sink_);
+  }
+  void TearDown() {
+    logger_.setSink(NULL);
+  }
+};
+
+TEST_F(LoggerTest, RateLimitSuppresses) {
+  logger_.setRateLimit(LOG_DECODE, 3);
+  for (int i = 0; i < 10; i++)
+    logger_.write(LOG_WARN, LOG_DECODE, "decode %d", i);
+  logger_.flush();
+
+  ASSERT_EQ(4u, sink_.messages.size());
+  for (int i = 0; i < 3; i++)
+  {
+    EXPECT_EQ(LOG_WARN, sink_.messages[i].first);
+    EXPECT_EQ("decode " + std::string(1, char('0' + i)), sink_.messages[i].second);
+  }
+  EXPECT_EQ(LOG_WARN, sink_.messages[3].first);
+  EXPECT_EQ(1u, sink_.count("Suppressed 7 decode messages in "));
+  LogStats stats = logger_.stats();
+  EXPECT_EQ(3u, stats.enqueued);
+  EXPECT_EQ(7u, stats.suppressed);
+  EXPECT_EQ(4u, stats.written);
+
+  // The next interval starts with the limit reset.
+  sink_.messages.clear();
+  for (int i = 0; i < 3; i++)
+    logger_.write(LOG_WARN, LOG_DECODE, "again %d", i);
+  logger_.flush();
+  EXPECT_EQ(3u, sink_.count("again "));
+  EXPECT_EQ(0u, sink_.count("Suppressed"));
+}
+
+//! Each class has its own limit and zero removes the limit.
+TEST_F(LoggerTest, ClassesLimitedSeparately) {
+  logger_.setRateLimit(LOG_DECODE, 1);
+  logger_.setRateLimit(LOG_GENERAL, 0);
+  for (int i = 0; i < 100; i++)
+  {
+    logger_.info("general %d", i);
+    logger_.write(LOG_ERROR, LOG_DECODE, "decode %d", i);
+  }
+  logger_.flush();
+  EXPECT_EQ(100u, sink_.count("general "));
+  EXPECT_EQ(1u, sink_.count("decode "));
+  EXPECT_EQ(1u, sink_.count("Suppressed 99 decode messages"));
+  EXPECT_EQ(0u, sink_.count("Suppressed 0"));
+}
+
+//! Aggregated classes are reported once per interval with the total, and not at all without occurrences.
+TEST_F(LoggerTest, AggregatesCounts) {
+  logger_.count(LOG_DROPPED_BYTES, 5);
+  logger_.count(LOG_DROPPED_BYTES, 7);
+  logger_.count(LOG_DROPPED_BYTES, 3);
+  EXPECT_EQ(0u, sink_.messages.size());
+  logger_.flush();
+  ASSERT_EQ(1u, sink_.messages.size());
+  EXPECT_EQ(LOG_ERROR, sink_.messages[0].first);
+  EXPECT_EQ(1u, sink_.count("Read error, dropped 15 bytes in "));
+  EXPECT_EQ(15u, logger_.stats().aggregated);
+
+  logger_.flush();
+  EXPECT_EQ(1u, sink_.messages.size());
+  logger_.count(LOG_DROPPED_BYTES, 1);
+  logger_.flush();
+  EXPECT_EQ(1u, sink_.count("Read error, dropped 1 bytes in "));
+  EXPECT_EQ(16u, logger_.stats().aggregated);
+}
+
+TEST_F(LoggerTest, LongMessagesTruncated) {
+  std::string text(500, 'x');
+  logger_.info("%s", text.c_str());
+  logger_.flush();
+  ASSERT_EQ(1u, sink_.messages.size());
+  EXPECT_EQ(std::string(Logger::max_message_length - 1, 'x'), sink_.messages[0].second);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,154 @@
+/** Compares the region of interest counter with brute force sums over the spectrum it counted.
+ \file      test_roi_counter.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/roi_counter.h>
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <vector>
+
+using namespace ursa;
+
+class RoiCounterTest : public testing::Test
+{
+protected:
+  RoiCounter counter_;
+  std::vector<uint64_t> bins_; //!< The spectrum of the events given to the counter.
+  uint64_t state_; //!< The pseudo random sequence, fixed so failures repeat.
+
+  void SetUp() {
+    bins_.assign(spectrum_bins, 0);
+    state_ = 2468;
+  }
+
+  uint32_t random(uint32_t limit) {
+    state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t(state_ >> 33) % limit);
+  }
+
+  //! Counts events into both the counter and the spectrum.
+  void addEvents(size_t events) {
+    for (size_t i = 0; i < events; i++)
+    {
+      uint16_t channel = uint16_t(random(spectrum_bins));
+      uint32_t counts = 1 + random(15);
+      counter_.add(channel, counts);
+      bins_[channel] += counts;
+    }
+  }
+
+  //! Checks every region and the gross counts against sums over the spectrum.
+  void expectCounts(const std::vector<ChannelRange> &rois) {
+    RoiCounts counts;
+    counter_.read(&counts);
+    ASSERT_EQ(rois.size(), counts.size);
+    uint64_t gross = 0;
+    for (size_t c = 0; c < spectrum_bins; c++)
+      gross += bins_[c];
+    EXPECT_EQ(gross, counts.gross);
+    for (size_t r = 0; r < rois.size(); r++)
+    {
+      uint64_t sum = 0;
+      for (size_t c = rois[r].low; c <= rois[r].high && c < spectrum_bins; c++)
+        sum += bins_[c];
+      EXPECT_EQ(sum, counts.counts[r]) << "region " << r << " " << rois[r].low << "-" << rois[r].high;
+    }
+  }
+};
+
+TEST_F(RoiCounterTest, OverlappingRegions) {
+  std::vector<ChannelRange> rois;
+  const ChannelRange fixed[] = { { 0, 4095 }, { 100, 200 }, { 150, 250 }, { 150, 150 }, { 200, 200 },
+                                 { 120, 180 }, { 0, 0 }, { 4095, 4095 }, { 100, 200 } };
+  rois.assign(fixed, fixed + sizeof(fixed) / sizeof(fixed[0]));
+  ASSERT_TRUE(counter_.configure(rois));
+  addEvents(200000);
+  expectCounts(rois);
+}
+
+TEST_F(RoiCounterTest, RegionsPastSpectrum) {
+  std::vector<ChannelRange> rois;
+  const ChannelRange fixed[] = { { 4000, 5000 }, { 4095, 65535 }, { 4096, 4200 }, { 60000, 65535 },
+                                 { 0, 65535 } };
+  rois.assign(fixed, fixed + sizeof(fixed) / sizeof(fixed[0]));
+  ASSERT_TRUE(counter_.configure(rois));
+  addEvents(100000);
+  expectCounts(rois);
+}
+
+//! 64 regions with no shared boundaries give the most segments a channel can be resolved to.
+TEST_F(RoiCounterTest, MostRegions) {
+  std::vector<ChannelRange> rois;
+  for (size_t r = 0; r < max_rois; r++)
+  {
+    ChannelRange roi = { uint16_t(1 + 31 * r), uint16_t(2100 + 29 * r) };
+    rois.push_back(roi);
+  }
+  ASSERT_TRUE(counter_.configure(rois));
+  addEvents(300000);
+  expectCounts(rois);
+
+  for (size_t round = 0; round < 5; round++)
+  {
+    for (size_t r = 0; r < max_rois; r++)
+    {
+      rois[r].low = uint16_t(random(spectrum_bins + 200));
+      rois[r].high = uint16_t(rois[r].low + random(2000));
+    }
+    ASSERT_TRUE(counter_.configure(rois));
+    bins_.assign(spectrum_bins, 0);
+    addEvents(100000);
+    expectCounts(rois);
+  }
+}
+
+//! A rejected configuration keeps the regions and counts.
+TEST_F(RoiCounterTest, RejectsInvalid) {
+  std::vector<ChannelRange> rois(1);
+  rois[0].low = 10;
+  rois[0].high = 20;
+  ASSERT_TRUE(counter_.configure(rois));
+  addEvents(10000);
+
+  std::vector<ChannelRange> too_many(max_rois + 1, rois[0]);
+  EXPECT_FALSE(counter_.configure(too_many));
+  std::vector<ChannelRange> reversed(1);
+  reversed[0].low = 20;
+  reversed[0].high = 10;
+  EXPECT_FALSE(counter_.configure(reversed));
+  expectCounts(rois);
+
+  // A new configuration clears the counts.
+  ASSERT_TRUE(counter_.configure(rois));
+  bins_.assign(spectrum_bins, 0);
+  expectCounts(rois);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
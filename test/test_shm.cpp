@@ -0,0 +1,236 @@
+/** Stress tests the shared memory ring with one writer and two readers on their own threads.
+ \file      test_shm.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/shm_ring.h>
+#include <gtest/gtest.h>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace ursa;
+
+const uint64_t stress_events = 2000000; //!< The events the writer publishes.
+const uint64_t stress_snapshot_period = 1000; //!< The events between snapshots.
+
+//! Event n carries n in every field, so a torn event shows as fields that disagree.
+bool eventConsistent(const ShmEvent &event) {
+  return (event.channel == uint16_t(event.time_ns & 0xfff)
+      && event.counts == uint8_t(event.time_ns % 251));
+}
+
+//! Snapshot k has bin i set to k * shm_spectrum_bins + i, and k as its time and epoch.
+bool spectrumConsistent(uint64_t number, uint64_t time_ns, uint32_t epoch,
+                        const uint64_t *bins) {
+  if (time_ns != number || epoch != uint32_t(number))
+    return (false);
+  for (size_t i = 0; i < shm_spectrum_bins; i++)
+    if (bins[i] != number * shm_spectrum_bins + i)
+      return (false);
+  return (true);
+}
+
+//! What a reader thread saw.
+struct ReaderResult
+{
+  uint64_t events; //!< The events read.
+  uint64_t dropped; //!< The events reported lost.
+  uint64_t torn; //!< Events with fields that disagree that the reader accepted.
+  uint64_t disordered; //!< Events accepted out of order.
+  uint64_t snapshots; //!< The snapshots read.
+  uint64_t torn_snapshots; //!< Snapshots accepted with bins that disagree.
+
+  ReaderResult() :
+      events(0), dropped(0), torn(0), disordered(0), snapshots(0), torn_snapshots(0) {
+  }
+};
+
+//! Publishes stress_events events with a snapshot every stress_snapshot_period, yielding after each, then clears running.
+void writeRing(ShmWriter *writer, boost::atomic<bool> *running) {
+  uint64_t snapshot = 0;
+  for (uint64_t n = 0; n < stress_events; n++)
+  {
+    writer->addEvent(n, uint16_t(n & 0xfff), uint8_t(n % 251));
+    if (n % stress_snapshot_period == 0)
+    {
+      snapshot++;
+      uint64_t *bins = writer->beginSpectrum();
+      for (size_t i = 0; i < shm_spectrum_bins; i++)
+        bins[i] = snapshot * shm_spectrum_bins + i;
+      writer->commitSpectrum(snapshot, uint32_t(snapshot));
+      boost::this_thread::yield();
+    }
+  }
+  running->store(false);
+}
+
+//! Copies events and snapshots out until the writer is done and the ring is drained.
+void copyRing(ShmReader *reader, boost::atomic<bool> *running, ReaderResult *result) {
+  std::vector<ShmEvent> events(256);
+  std::vector<uint64_t> bins(shm_spectrum_bins);
+  uint64_t next = 0;
+  for (;;)
+  {
+    bool more = running->load();
+    size_t count = reader->readEvents(&events[0], events.size(), &result->dropped);
+    for (size_t i = 0; i < count; i++)
+    {
+      if (!eventConsistent(events[i]))
+        result->torn++;
+      if (events[i].time_ns < next)
+        result->disordered++;
+      next = events[i].time_ns + 1;
+    }
+    result->events += count;
+
+    uint64_t time_ns;
+    uint32_t epoch;
+    uint64_t number = reader->readSpectrum(&time_ns, &epoch, &bins[0]);
+    if (number != 0)
+    {
+      result->snapshots++;
+      if (!spectrumConsistent(number, time_ns, epoch, &bins[0]))
+        result->torn_snapshots++;
+    }
+    if (!more && count == 0)
+      break;
+  }
+}
+
+/** Reads events and snapshots in place until the writer is done and the ring is drained.
+ *
+ * The reader yields while it holds a run or a slot, so the writer overtakes it often even on one core.
+ * Every event read or dropped moves the cursor by one, so an accepted event must be number
+ * events + dropped.
+ */
+void peekRing(ShmReader *reader, boost::atomic<bool> *running, ReaderResult *result) {
+  for (;;)
+  {
+    bool more = running->load();
+    const ShmEvent *first;
+    size_t count = reader->peekEvents(&first, &result->dropped);
+    boost::this_thread::yield();
+    uint64_t expected = result->events + result->dropped;
+    uint64_t torn = 0;
+    uint64_t disordered = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      if (!eventConsistent(first[i]))
+        torn++;
+      if (first[i].time_ns != expected + i)
+        disordered++;
+    }
+    if (reader->consumeEvents(count))
+    {
+      result->events += count;
+      result->torn += torn;
+      result->disordered += disordered;
+    }
+    else
+      result->dropped += count;
+
+    uint64_t sequence;
+    const ShmSpectrumSlot *slot = reader->latestSpectrum(&sequence);
+    boost::this_thread::yield();
+    if (slot)
+    {
+      bool consistent = spectrumConsistent(sequence / 2, slot->time_ns, slot->epoch,
+                                           slot->bins);
+      if (reader->spectrumValid(slot, sequence))
+      {
+        result->snapshots++;
+        if (!consistent)
+          result->torn_snapshots++;
+      }
+    }
+    if (!more && count == 0)
+      break;
+  }
+}
+
+class ShmRingTest : public testing::Test
+{
+protected:
+  std::string name_;
+  ShmWriter writer_;
+
+  void SetUp() {
+    char name[64];
+    snprintf(name, sizeof(name), "/ursa_test_shm_%d", int(getpid()));
+    name_ = name;
+  }
+};
+
+//! A small ring makes both readers fall behind, so the overwrite checks are exercised as well.
+TEST_F(ShmRingTest, TwoReadersSeeNoTornData) {
+  ASSERT_TRUE(writer_.open(name_, 64));
+  ShmReader copier;
+  ShmReader peeker;
+  ASSERT_TRUE(copier.open(name_));
+  ASSERT_TRUE(peeker.open(name_));
+
+  boost::atomic<bool> running(true);
+  ReaderResult copied;
+  ReaderResult peeked;
+  boost::thread copy_thread(boost::bind(&copyRing, &copier, &running, &copied));
+  boost::thread peek_thread(boost::bind(&peekRing, &peeker, &running, &peeked));
+  writeRing(&writer_, &running);
+  copy_thread.join();
+  peek_thread.join();
+
+  EXPECT_EQ(stress_events, copied.events + copied.dropped);
+  EXPECT_EQ(stress_events, peeked.events + peeked.dropped);
+  EXPECT_GT(copied.events, 0u);
+  EXPECT_GT(peeked.events, 0u);
+  EXPECT_EQ(0u, copied.torn);
+  EXPECT_EQ(0u, peeked.torn);
+  EXPECT_EQ(0u, copied.disordered);
+  EXPECT_EQ(0u, peeked.disordered);
+  EXPECT_EQ(0u, copied.torn_snapshots);
+  EXPECT_EQ(0u, peeked.torn_snapshots);
+  writer_.close();
+}
+
+//! A reader opened on a closed ring fails and one opened before close sees the writer go.
+TEST_F(ShmRingTest, ReaderSeesWriterClose) {
+  ShmReader reader;
+  EXPECT_FALSE(reader.open(name_));
+  ASSERT_TRUE(writer_.open(name_, 16));
+  ASSERT_TRUE(reader.open(name_));
+  EXPECT_TRUE(reader.writerActive());
+  writer_.close();
+  EXPECT_TRUE(reader.writerActive() == false);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,285 @@
+/** Compares the spectrum kernels with plain loops, with every instruction set the CPU supports.
+ \file      test_spectrum_ops.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include <ursa_driver/spectrum_ops.h>
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+
+using namespace ursa;
+
+//! The levels each kernel is compared at.  Levels above what the CPU supports run the best it has.
+const char *const simd_levels[] = { "avx2", "sse2", "scalar" };
+const size_t simd_level_count = sizeof(simd_levels) / sizeof(simd_levels[0]);
+
+//! A fixed pseudo random sequence so failures repeat.
+class Random
+{
+private:
+  uint64_t state_;
+
+public:
+  explicit Random(uint64_t seed) :
+      state_(seed) {
+  }
+  uint32_t next() {
+    state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t(state_ >> 32));
+  }
+  //! Returns a value below limit.
+  uint32_t below(uint32_t limit) {
+    return (next() % limit);
+  }
+};
+
+//! Plain loop integration of channels low to high, stopping at n.
+uint64_t rangeSum(const std::vector<uint32_t> &spectrum, size_t n,
+                  const ChannelRange &range) {
+  uint64_t sum = 0;
+  for (size_t c = range.low; c <= range.high && c < n; c++)
+    sum += spectrum[c];
+  return (sum);
+}
+
+class SpectrumOpsTest : public testing::Test
+{
+protected:
+  std::vector<uint32_t> gross_;
+  std::vector<uint32_t> background_;
+  std::vector<ChannelRange> ranges_;
+
+  /** A tenth of the bins hold counts of 2^31 and above, so the sums pass 2^32 and the signed conversions
+   * would show.  The ranges include single bins, reversed ranges, ranges past the spectrum and more than
+   * max_fused_ranges of them.
+   */
+  void SetUp() {
+    Random random(12345);
+    gross_.resize(spectrum_bins);
+    background_.resize(spectrum_bins);
+    for (size_t i = 0; i < spectrum_bins; i++)
+    {
+      gross_[i] = random.below(10) == 0 ? 0x80000000u + random.below(0x7fffffff) : random.below(1000);
+      background_[i] = random.below(10) == 0 ? 0xffffffffu - random.below(100) : random.below(1000);
+    }
+
+    for (size_t r = 0; r < 3 * max_fused_ranges + 17; r++)
+    {
+      ChannelRange range;
+      range.low = uint16_t(random.below(spectrum_bins + 100));
+      range.high = uint16_t(range.low + random.below(300));
+      if (r % 7 == 0)
+        range.high = range.low;
+      if (r % 11 == 0)
+        range.high = uint16_t(range.low - random.below(20) - 1);
+      ranges_.push_back(range);
+    }
+    ChannelRange all = { 0, 0xffff };
+    ranges_.push_back(all);
+    ChannelRange last = { spectrum_bins - 1, spectrum_bins - 1 };
+    ranges_.push_back(last);
+  }
+
+  void TearDown() {
+    limitSimd("avx2");
+  }
+};
+
+TEST_F(SpectrumOpsTest, LimitSimd) {
+  EXPECT_TRUE(limitSimd("scalar"));
+  EXPECT_STREQ("scalar", simdLevel());
+  EXPECT_FALSE(limitSimd("avx512"));
+  EXPECT_STREQ("scalar", simdLevel());
+}
+
+TEST_F(SpectrumOpsTest, RoiSums) {
+  const size_t lengths[] = { spectrum_bins, spectrum_bins - 3, 1003, 17, 5, 0 };
+  for (size_t l = 0; l < simd_level_count; l++)
+  {
+    ASSERT_TRUE(limitSimd(simd_levels[l]));
+    for (size_t k = 0; k < sizeof(lengths) / sizeof(lengths[0]); k++)
+    {
+      SCOPED_TRACE(testing::Message() << simdLevel() << " n=" << lengths[k]);
+      std::vector<uint64_t> sums(ranges_.size());
+      roiSums(&gross_[0], lengths[k], &ranges_[0], ranges_.size(), &sums[0]);
+      for (size_t r = 0; r < ranges_.size(); r++)
+        ASSERT_EQ(rangeSum(gross_, lengths[k], ranges_[r]), sums[r])
+            << "range " << ranges_[r].low << "-" << ranges_[r].high;
+    }
+  }
+}
+
+TEST_F(SpectrumOpsTest, NetRoiSums) {
+  const double scale = 0.37;
+  for (size_t l = 0; l < simd_level_count; l++)
+  {
+    ASSERT_TRUE(limitSimd(simd_levels[l]));
+    SCOPED_TRACE(simdLevel());
+    std::vector<double> net(ranges_.size());
+    std::vector<double> variance(ranges_.size());
+    netRoiSums(&gross_[0], &background_[0], scale, spectrum_bins - 5, &ranges_[0],
+               ranges_.size(), &net[0], &variance[0]);
+    for (size_t r = 0; r < ranges_.size(); r++)
+    {
+      uint64_t gross = rangeSum(gross_, spectrum_bins - 5, ranges_[r]);
+      uint64_t background = rangeSum(background_, spectrum_bins - 5, ranges_[r]);
+      ASSERT_DOUBLE_EQ(gross - scale * background, net[r]) << "range " << r;
+      ASSERT_DOUBLE_EQ(gross + scale * scale * background, variance[r]) << "range " << r;
+    }
+
+    // Without variances only the net counts are written.
+    std::vector<double> net_only(ranges_.size());
+    netRoiSums(&gross_[0], &background_[0], scale, spectrum_bins - 5, &ranges_[0],
+               ranges_.size(), &net_only[0], NULL);
+    EXPECT_TRUE(net == net_only);
+  }
+}
+
+TEST_F(SpectrumOpsTest, SubtractBackground) {
+  const double scale = 1.7;
+  const size_t n = spectrum_bins - 3;
+  for (size_t l = 0; l < simd_level_count; l++)
+  {
+    ASSERT_TRUE(limitSimd(simd_levels[l]));
+    SCOPED_TRACE(simdLevel());
+    std::vector<double> net(n);
+    std::vector<double> variance(n);
+    subtractBackground(&net[0], &variance[0], &gross_[0], &background_[0], scale, n);
+    for (size_t i = 0; i < n; i++)
+    {
+      ASSERT_DOUBLE_EQ(double(gross_[i]) - scale * double(background_[i]), net[i]) << "bin " << i;
+      ASSERT_DOUBLE_EQ(double(gross_[i]) + scale * scale * double(background_[i]), variance[i])
+          << "bin " << i;
+    }
+  }
+}
+
+TEST_F(SpectrumOpsTest, SumSpectra) {
+  const size_t n = spectrum_bins - 5;
+  const uint32_t *sources[] = { &gross_[0], &background_[0], &gross_[0], &background_[0],
+                                &background_[0] };
+  const size_t count = sizeof(sources) / sizeof(sources[0]);
+  for (size_t l = 0; l < simd_level_count; l++)
+  {
+    ASSERT_TRUE(limitSimd(simd_levels[l]));
+    SCOPED_TRACE(simdLevel());
+    std::vector<uint64_t> sum(n, 1);
+    sumSpectra(&sum[0], sources, count, n);
+    for (size_t i = 0; i < n; i++)
+    {
+      uint64_t expected = 0;
+      for (size_t k = 0; k < count; k++)
+        expected += sources[k][i];
+      ASSERT_EQ(expected, sum[i]) << "bin " << i;
+    }
+  }
+}
+
+TEST_F(SpectrumOpsTest, WidenAccumulate) {
+  const size_t n = spectrum_bins - 3;
+  for (size_t l = 0; l < simd_level_count; l++)
+  {
+    ASSERT_TRUE(limitSimd(simd_levels[l]));
+    SCOPED_TRACE(simdLevel());
+    std::vector<uint64_t> totals(n, 0xfffffffffULL);
+    widenAccumulate(&totals[0], &gross_[0], n);
+    widenAccumulate(&totals[0], &background_[0], n);
+    for (size_t i = 0; i < n; i++)
+      ASSERT_EQ(0xfffffffffULL + gross_[i] + background_[i], totals[i]) << "bin " << i;
+  }
+}
+
+TEST_F(SpectrumOpsTest, AccumulateRows) {
+  const size_t stride = 21;
+  const size_t rows = 50;
+  Random random(678);
+  std::vector<float> matrix(rows * stride);
+  for (size_t i = 0; i < matrix.size(); i++)
+    matrix[i] = random.below(100000) / 1000.0f;
+  std::vector<uint32_t> picked;
+  std::vector<double> scale;
+  for (size_t i = 0; i < 30; i++)
+  {
+    picked.push_back(random.below(rows));
+    scale.push_back(random.below(5000) / 100.0);
+  }
+
+  for (size_t l = 0; l < simd_level_count; l++)
+  {
+    ASSERT_TRUE(limitSimd(simd_levels[l]));
+    SCOPED_TRACE(simdLevel());
+    std::vector<double> acc(stride, 0.5);
+    accumulateRows(&acc[0], &matrix[0], stride, &picked[0], &scale[0], picked.size());
+    for (size_t t = 0; t < stride; t++)
+    {
+      double expected = 0.5;
+      for (size_t i = 0; i < picked.size(); i++)
+        expected += scale[i] * matrix[picked[i] * stride + t];
+      ASSERT_DOUBLE_EQ(expected, acc[t]) << "column " << t;
+    }
+  }
+}
+
+TEST(SpectrumOps, RangeRatios) {
+  const double values[] = { 100, 25, 0, -4 };
+  const double variances[] = { 120, 30, 1, 2 };
+  const RangeRatio ratios[] = { { 0, 1 }, { 1, 0 }, { 0, 2 }, { 3, 1 }, { 0, 3 } };
+  const size_t count = sizeof(ratios) / sizeof(ratios[0]);
+
+  double results[count];
+  double sigmas[count];
+  rangeRatios(values, variances, ratios, count, results, sigmas);
+  double poisson_sigmas[count];
+  rangeRatios(values, NULL, ratios, count, results, poisson_sigmas);
+  for (size_t r = 0; r < count; r++)
+  {
+    SCOPED_TRACE(r);
+    double top = values[ratios[r].numerator];
+    double bottom = values[ratios[r].denominator];
+    if (bottom <= 0)
+    {
+      EXPECT_EQ(0, results[r]);
+      EXPECT_EQ(0, sigmas[r]);
+      EXPECT_EQ(0, poisson_sigmas[r]);
+      continue;
+    }
+    double ratio = top / bottom;
+    EXPECT_DOUBLE_EQ(ratio, results[r]);
+    double top_var = variances[ratios[r].numerator];
+    double bottom_var = variances[ratios[r].denominator];
+    EXPECT_DOUBLE_EQ(std::sqrt(top_var + ratio * ratio * bottom_var) / bottom, sigmas[r]);
+    // Treated as Poisson, a negative count has no variance.
+    double poisson_top = top > 0 ? top : 0;
+    EXPECT_DOUBLE_EQ(std::sqrt(poisson_top + ratio * ratio * bottom) / bottom, poisson_sigmas[r]);
+  }
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
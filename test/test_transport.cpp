@@ -0,0 +1,269 @@
+/** Tests of the transports against a loopback stand-in for the Ursa and a replayed capture.
+ \file      test_transport.cpp
+ \authors   Mike Hosmar <mikehosmar@gmail.com>
+ \copyright Copyright (c) 2015, Michael Hosmar, All rights reserved.
+
+ The MIT License (MIT)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <ursa_driver/ursa_driver.h>
+#include <gtest/gtest.h>
+
+#include <boost/thread/thread.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace ursa;
+
+//! Returns the three byte frame for one event.
+std::vector<uint8_t> frame(uint16_t channel, uint8_t counts) {
+  std::vector<uint8_t> bytes(3);
+  bytes[0] = 0xff;
+  bytes[1] = uint8_t((counts << 4) | (channel >> 8));
+  bytes[2] = uint8_t(channel & 0xff);
+  return (bytes);
+}
+
+//! A capture of events cycling through the first 1024 channels with a count of 1.
+std::vector<uint8_t> capture(size_t events) {
+  std::vector<uint8_t> bytes;
+  for (size_t i = 0; i < events; i++)
+  {
+    std::vector<uint8_t> event = frame(i % 1024, 1);
+    bytes.insert(bytes.end(), event.begin(), event.end());
+  }
+  return (bytes);
+}
+
+/** A serial to Ethernet converter with an Ursa behind it, on a loopback port.
+ *
+ * Answers CheckComms and sends the capture after StartAcquire.  One connection is served.
+ */
+class LoopbackUrsa
+{
+private:
+  int listen_fd_;
+  std::vector<uint8_t> capture_;
+  boost::thread thread_;
+
+  void serve() {
+    int fd = accept(listen_fd_, NULL, NULL);
+    if (fd < 0)
+      return;
+    uint8_t command;
+    while (::read(fd, &command, 1) == 1)
+    {
+      if (command == 'U')
+        ::write(fd, "URSA2", 5);
+      else if (command == 'G')
+        ::write(fd, &capture_[0], capture_.size());
+      else if (command == 'v')
+        break;
+    }
+    ::close(fd);
+  }
+
+public:
+  uint16_t port;
+
+  explicit LoopbackUrsa(const std::vector<uint8_t> &data) :
+      capture_(data), port(0) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd_, (sockaddr *) &address, sizeof(address));
+    socklen_t length = sizeof(address);
+    getsockname(listen_fd_, (sockaddr *) &address, &length);
+    port = ntohs(address.sin_port);
+    listen(listen_fd_, 1);
+    thread_ = boost::thread(&LoopbackUrsa::serve, this);
+  }
+  ~LoopbackUrsa() {
+    shutdown(listen_fd_, SHUT_RDWR);
+    ::close(listen_fd_);
+    thread_.join();
+  }
+  std::string address() const {
+    char text[32];
+    snprintf(text, sizeof(text), "127.0.0.1:%d", (int) port);
+    return (text);
+  }
+};
+
+//! Reads until the spectrum holds the expected total or two seconds pass.
+uint64_t acquire(Interface *ursa, uint64_t expected) {
+  boost::array<uint32_t, 4096> spectrum;
+  uint64_t total = 0;
+  for (int i = 0; i < 200 && total < expected; i++)
+  {
+    usleep(10000);
+    ursa->read();
+    ursa->getSpectra(&spectrum);
+    total = 0;
+    for (size_t bin = 0; bin < spectrum.size(); bin++)
+      total += spectrum[bin];
+  }
+  return (total);
+}
+
+TEST(Transport, CreateFromUri) {
+  std::string port;
+  Transport *transport = createTransport("tcp://10.0.0.5:4001", &port);
+  EXPECT_TRUE(dynamic_cast<TcpTransport *>(transport) != NULL);
+  EXPECT_EQ("10.0.0.5:4001", port);
+  delete transport;
+
+  transport = createTransport("file:///tmp/capture.bin?speed=2&loop=1", &port);
+  EXPECT_TRUE(dynamic_cast<ReplayTransport *>(transport) != NULL);
+  EXPECT_EQ("/tmp/capture.bin", port);
+  delete transport;
+
+  transport = createTransport("tty:///dev/ttyUSB1", &port);
+  EXPECT_TRUE(dynamic_cast<TtyTransport *>(transport) != NULL);
+  EXPECT_EQ("/dev/ttyUSB1", port);
+  delete transport;
+
+  transport = createTransport("/dev/ttyUSB0", &port);
+  EXPECT_TRUE(dynamic_cast<SerialTransport *>(transport) != NULL);
+  EXPECT_EQ("/dev/ttyUSB0", port);
+  delete transport;
+
+  EXPECT_TRUE(createTransport("udp://10.0.0.5:4001", &port) == NULL);
+}
+
+TEST(Transport, TcpAcquire) {
+  const size_t events = 5000;
+  LoopbackUrsa server(capture(events));
+  Interface ursa(server.address().c_str(), 115200, new TcpTransport());
+  ursa.connect();
+  ASSERT_TRUE(ursa.connected());
+
+  ursa.startAcquire();
+  EXPECT_EQ(events, acquire(&ursa, events));
+  boost::array<uint32_t, 4096> spectrum;
+  ursa.getSpectra(&spectrum);
+  EXPECT_EQ(5u, spectrum[0]);
+  EXPECT_EQ(4u, spectrum[1023]);
+  EXPECT_EQ(0u, spectrum[1024]);
+}
+
+TEST(Transport, TcpRefused) {
+  uint16_t port;
+  {
+    std::vector<uint8_t> nothing;
+    LoopbackUrsa server(nothing);
+    port = server.port;
+    TcpTransport client;
+    client.setTimeout(200);
+    ASSERT_TRUE(client.open(server.address(), 115200));
+  }
+  char address[32];
+  snprintf(address, sizeof(address), "127.0.0.1:%d", (int) port);
+  TcpTransport transport;
+  transport.setTimeout(200);
+  EXPECT_FALSE(transport.open(address, 115200));
+  EXPECT_FALSE(transport.open("no port", 115200));
+}
+
+TEST(Transport, TcpClosedByPeer) {
+  std::vector<uint8_t> nothing;
+  LoopbackUrsa *server = new LoopbackUrsa(nothing);
+  TcpTransport transport;
+  transport.setTimeout(200);
+  ASSERT_TRUE(transport.open(server->address(), 115200));
+  uint8_t stop = 'v';
+  EXPECT_EQ(1u, transport.write(&stop, 1));
+  usleep(50000);
+  delete server;
+
+  uint8_t buffer[16];
+  EXPECT_EQ(0u, transport.read(buffer, sizeof(buffer)));
+  EXPECT_FALSE(transport.isOpen());
+
+  // Writing to a dropped connection closes the transport rather than killing the process with SIGPIPE.
+  // The first write can still be buffered before the peer's reset arrives.
+  server = new LoopbackUrsa(nothing);
+  ASSERT_TRUE(transport.open(server->address(), 115200));
+  EXPECT_EQ(1u, transport.write(&stop, 1));
+  usleep(50000);
+  delete server;
+  size_t written = 1;
+  for (int i = 0; i < 10 && written; i++)
+  {
+    written = transport.write(&stop, 1);
+    usleep(10000);
+  }
+  EXPECT_EQ(0u, written);
+  EXPECT_FALSE(transport.isOpen());
+}
+
+TEST(Transport, ReplayAcquire) {
+  const size_t events = 3000;
+  std::vector<uint8_t> data = capture(events);
+  char path[] = "/tmp/ursa_replay_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ((ssize_t) data.size(), ::write(fd, &data[0], data.size()));
+  ::close(fd);
+
+  Interface ursa(path, 115200, new ReplayTransport(0));
+  ursa.connect();
+  ASSERT_TRUE(ursa.connected());
+  ursa.startAcquire();
+  EXPECT_EQ(events, acquire(&ursa, events));
+  unlink(path);
+}
+
+TEST(Transport, ReplayPaced) {
+  std::vector<uint8_t> data = capture(1000);
+  char path[] = "/tmp/ursa_replay_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ((ssize_t) data.size(), ::write(fd, &data[0], data.size()));
+  ::close(fd);
+
+  // 11520 bytes per second: nothing before StartAcquire, then roughly 1152 bytes in 100 ms.
+  ReplayTransport replay(1.0);
+  ASSERT_TRUE(replay.open(path, 115200));
+  usleep(50000);
+  EXPECT_EQ(0u, replay.available());
+  uint8_t start = 'G';
+  replay.write(&start, 1);
+  usleep(100000);
+  size_t waiting = replay.available();
+  EXPECT_GT(waiting, 900u);
+  EXPECT_LT(waiting, 1600u);
+  unlink(path);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}